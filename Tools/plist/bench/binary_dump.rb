@@ -0,0 +1,29 @@
+#!/usr/bin/env ruby
+# Writes every XML property list under Bundles/ back out as XML and as
+# binary, and reports the total size of each.
+#
+#   ruby bench/binary_dump.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'benchmark'
+
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+PATTERN = "#{BUNDLES}/**/*.{plist,tmCommand,tmDragCommand,tmLanguage,tmMacro,tmPreferences,tmSnippet,tmTemplate,tmTheme}"
+
+iterations = (ARGV[0] || 5).to_i
+objects = Dir[PATTERN].select { |f| File.file?(f) }.map { |f| OSX::PropertyList.load_file(f) rescue nil }.compact
+puts "#{objects.size} property lists, #{iterations} iterations"
+
+[:xml1, :binary1].each do |format|
+  bytes = objects.inject(0) { |sum, obj| sum + obj.to_plist(format).size }
+  puts "#{format}: #{bytes / 1024} KB"
+end
+
+Benchmark.bm(16) do |bm|
+  [:xml1, :binary1].each do |format|
+    bm.report(format.to_s) do
+      iterations.times { objects.each { |obj| obj.to_plist(format) } }
+    end
+  end
+end
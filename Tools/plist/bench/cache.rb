@@ -0,0 +1,39 @@
+#!/usr/bin/env ruby
+# Loads every property list under Bundles/ with load_file, without the
+# cache, into a cold cache and from a warm one.
+#
+#   ruby bench/cache.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'benchmark'
+require 'tmpdir'
+require 'fileutils'
+
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+PATTERN = "#{BUNDLES}/**/*.{plist,tmCommand,tmDragCommand,tmLanguage,tmMacro,tmPreferences,tmSnippet,tmTemplate,tmTheme}"
+
+iterations = (ARGV[0] || 5).to_i
+paths = Dir[PATTERN].select { |f| File.file?(f) }
+dir = File.join(Dir.tmpdir, "plist-bench-cache-#{$$}")
+puts "#{paths.size} files, #{iterations} iterations"
+
+begin
+  Benchmark.bm(16) do |bm|
+    bm.report('uncached') do
+      iterations.times { paths.each { |f| OSX::PropertyList.load_file(f) rescue nil } }
+    end
+    OSX::PropertyList.cache_dir = dir
+    OSX::PropertyList.cache_limit = 1 << 30
+    bm.report('cold cache') do
+      paths.each { |f| OSX::PropertyList.load_file(f) rescue nil }
+    end
+    bm.report('warm cache') do
+      iterations.times { paths.each { |f| OSX::PropertyList.load_file(f) rescue nil } }
+    end
+  end
+  p OSX::PropertyList.cache_stats
+ensure
+  OSX::PropertyList.cache_dir = nil
+  FileUtils.rm_rf(dir)
+end
@@ -0,0 +1,32 @@
+#!/usr/bin/env ruby
+# Hashes every plist under Bundles/, already loaded, with digest and by
+# running canonical to_plist output through MD5 and SHA-256, and reports
+# the time and objects allocated.
+#
+#   ruby bench/digest.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'digest'
+require 'benchmark'
+
+iterations = (ARGV[0] || 5).to_i
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+paths = Dir["#{BUNDLES}/**/*.{tmLanguage,tmCommand,tmSnippet,tmPreferences,tmMacro,plist}"].select { |f| File.file?(f) }
+objects = paths.map { |f| OSX::PropertyList.load_file(f) }
+total = objects.inject(0) { |sum, o| sum + o.to_plist(:canonical => true).size }
+puts "#{objects.size} plists, #{total / 1024} KB as canonical XML; #{iterations} iterations"
+
+def measure(name, bytes, iterations)
+  GC.start
+  before = GC.stat(:total_allocated_objects)
+  time = (1..3).map { GC.start; Benchmark.realtime { iterations.times { yield } } }.min
+  allocated = (GC.stat(:total_allocated_objects) - before) / 3 / iterations
+  printf("%-32s %7.1f ms  %6.1f MB/s  %8d objects\n", name, time * 1000 / iterations,
+    bytes * iterations / time / 1048576, allocated)
+end
+
+measure('to_plist canonical + MD5', total, iterations) { objects.each { |o| Digest::MD5.hexdigest(o.to_plist(:canonical => true)) } }
+measure('to_plist canonical + SHA-256', total, iterations) { objects.each { |o| Digest::SHA256.hexdigest(o.to_plist(:canonical => true)) } }
+measure('binary canonical + MD5', total, iterations) { objects.each { |o| Digest::MD5.hexdigest(o.to_plist(:binary1, :canonical => true)) } }
+measure('digest', total, iterations) { objects.each { |o| OSX::PropertyList.digest(o) } }
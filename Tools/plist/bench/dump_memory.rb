@@ -0,0 +1,42 @@
+#!/usr/bin/env ruby
+# Peak memory of writing a large property list to a file with to_plist
+# and IO#write, against PropertyList.dump streaming it. Each case runs in
+# a child process; peak RSS is read from /proc, so this needs Linux.
+#
+#   ruby bench/dump_memory.rb [entries]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'tmpdir'
+
+entries = (ARGV[0] || 200_000).to_i
+path = File.join(Dir.tmpdir, "plist-bench-dump-#{$$}")
+abort "needs /proc/self/status" unless File.exist?('/proc/self/status')
+
+def peak_mb
+  File.read('/proc/self/status')[/VmHWM:\s+(\d+)/, 1].to_i / 1024.0
+end
+
+# Something shaped like a completion cache
+obj = (0...entries).map { |i| { 'word' => "completion_#{i}", 'display' => "completion #{i} & more", 'rank' => i } }
+puts "#{entries} entries"
+[:xml1, :binary1].each do |format|
+  [:to_plist, :dump].each do |method|
+    pid = fork do
+      GC.start
+      before = peak_mb
+      started = Time.now
+      File.open(path, 'wb') do |f|
+        if method == :dump then OSX::PropertyList.dump(f, obj, format)
+        else f.write(obj.to_plist(format))
+        end
+      end
+      printf("%-8s %-9s %6.1f MB output  %6.1f MB extra peak  %.2fs\n", format, method,
+        File.size(path) / 1048576.0, peak_mb - before, Time.now - started)
+      $stdout.flush
+      exit!(0)
+    end
+    Process.wait(pid)
+  end
+end
+File.delete(path) if File.exist?(path)
@@ -0,0 +1,25 @@
+#!/usr/bin/env ruby
+# Reads name and uuid from every info.plist under Bundles/, once with a
+# full load and once with extract.
+#
+#   ruby bench/extract.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'benchmark'
+
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+
+iterations = (ARGV[0] || 20).to_i
+sources = Dir["#{BUNDLES}/*/info.plist"].map { |f| File.open(f, 'rb') { |io| io.read } }
+sources = sources.select { |s| (OSX::PropertyList.load(s) rescue nil).is_a?(Hash) }
+puts "#{sources.size} info.plist files, #{iterations} iterations"
+
+Benchmark.bm(16) do |bm|
+  bm.report('load') do
+    iterations.times { sources.each { |s| plist = OSX::PropertyList.load(s); [plist['name'], plist['uuid']] } }
+  end
+  bm.report('extract') do
+    iterations.times { sources.each { |s| OSX::PropertyList.extract(s, 'name', 'uuid') } }
+  end
+end
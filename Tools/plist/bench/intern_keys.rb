@@ -0,0 +1,41 @@
+#!/usr/bin/env ruby
+# Loads every grammar under Bundles/ with each :intern_keys mode and
+# reports the objects allocated, the heap left after a full GC while the
+# grammars are still referenced, and the time taken. Each mode runs in a
+# child process so one can't warm the heap for the next.
+#
+#   ruby bench/intern_keys.rb
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'objspace'
+
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+paths = Dir["#{BUNDLES}/**/*.{tmLanguage,plist}"].select { |f| f =~ /Syntaxes/ && File.file?(f) }
+sources = paths.map { |f| File.open(f, 'rb') { |io| io.read } }
+puts "#{sources.size} grammars, #{sources.inject(0) { |sum, s| sum + s.size } / 1024} KB"
+
+[nil, true, :load, :symbols].each do |mode|
+  pid = fork do
+    opts = mode ? { :intern_keys => mode } : {}
+    GC.start
+    before = GC.stat(:total_allocated_objects)
+    started = Time.now
+    avoided = 0
+    grammars = sources.map do |s|
+      grammar = OSX::PropertyList.load(s, false, opts)
+      avoided += OSX::PropertyList.intern_stats[:avoided] if mode
+      grammar
+    end
+    elapsed = Time.now - started
+    allocated = GC.stat(:total_allocated_objects) - before
+    GC.start
+    printf("%-9s %7d objects allocated  %7d live slots  %5.1f MB of Strings  %6d key Strings avoided  %5.1f ms\n",
+      mode ? mode.inspect : 'off', allocated, GC.stat(:heap_live_slots),
+      ObjectSpace.memsize_of_all(String) / 1048576.0, avoided, elapsed * 1000)
+    $stdout.flush
+    grammars.size
+    exit!(0)
+  end
+  Process.wait(pid)
+end
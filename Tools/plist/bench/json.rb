@@ -0,0 +1,48 @@
+#!/usr/bin/env ruby
+# Converts every plist under Bundles/ to JSON and back, natively with
+# to_json and from_json and through Ruby objects with load, JSON.generate,
+# JSON.parse and to_plist, and reports the time and objects allocated.
+#
+#   ruby bench/json.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'json'
+require 'benchmark'
+
+iterations = (ARGV[0] || 3).to_i
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+paths = Dir["#{BUNDLES}/**/*.{tmLanguage,tmCommand,tmSnippet,tmPreferences,tmMacro,plist}"].select { |f| File.file?(f) }
+sources = paths.map { |f| File.open(f, 'rb') { |io| io.read } }
+jsons = sources.map { |s| OSX::PropertyList.to_json(s) }
+puts "#{sources.size} plists, #{sources.inject(0) { |sum, s| sum + s.size } / 1024} KB; " \
+  "#{jsons.inject(0) { |sum, s| sum + s.size } / 1024} KB as JSON; #{iterations} iterations"
+
+# Dates and data as to_json writes them, so both sides produce the same JSON
+def plain(obj)
+  case obj
+  when Hash then obj.each_with_object({}) { |(k, v), h| h[k] = plain(v) }
+  when Array then obj.map { |v| plain(v) }
+  when Time then { '$date' => obj.utc.strftime('%Y-%m-%dT%H:%M:%SZ') }
+  when String then obj.blob? ? { '$data' => [obj].pack('m0') } : obj
+  else obj
+  end
+end
+
+def measure(name, bytes, iterations)
+  GC.start
+  before = GC.stat(:total_allocated_objects)
+  time = (1..3).map { GC.start; Benchmark.realtime { iterations.times { yield } } }.min
+  allocated = (GC.stat(:total_allocated_objects) - before) / 3 / iterations
+  printf("%-32s %7.1f ms  %6.1f MB/s  %8d objects\n", name, time * 1000 / iterations,
+    bytes * iterations / time / 1048576, allocated)
+end
+
+total = sources.inject(0) { |sum, s| sum + s.size }
+measure('load + JSON.generate', total, iterations) { sources.each { |s| JSON.generate(plain(OSX::PropertyList.load(s))) } }
+measure('to_json', total, iterations) { sources.each { |s| OSX::PropertyList.to_json(s) } }
+total = jsons.inject(0) { |sum, s| sum + s.size }
+# JSON.parse leaves the $date and $data objects as Hashes, which flatters it
+measure('JSON.parse + to_plist', total, iterations) { jsons.each { |s| JSON.parse(s).to_plist } }
+measure('from_json', total, iterations) { jsons.each { |s| OSX::PropertyList.from_json(s) } }
+measure('from_json :binary1', total, iterations) { jsons.each { |s| OSX::PropertyList.from_json(s, :binary1) } }
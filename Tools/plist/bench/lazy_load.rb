@@ -0,0 +1,36 @@
+#!/usr/bin/env ruby
+# Reads a few top level keys from every .tmLanguage under Bundles/, once
+# with load and once with load_lazy, and reports how many nodes the lazy
+# views had to convert.
+#
+#   ruby bench/lazy_load.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'benchmark'
+
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+KEYS = %w[name scopeName uuid]
+
+iterations = (ARGV[0] || 5).to_i
+sources = Dir["#{BUNDLES}/**/*.tmLanguage"].map { |f| File.open(f, 'rb') { |io| io.read } }
+sources = sources.select { |s| (OSX::PropertyList.load_lazy(s) rescue nil).is_a?(OSX::PropertyList::LazyHash) }
+puts "#{sources.size} grammars, #{iterations} iterations"
+
+nodes = materialized = 0
+sources.each do |s|
+  plist = OSX::PropertyList.load_lazy(s)
+  KEYS.each { |key| plist[key] }
+  nodes += plist.nodes
+  materialized += plist.materialized
+end
+puts "load_lazy converted #{materialized} of #{nodes} nodes"
+
+Benchmark.bm(16) do |bm|
+  bm.report('load') do
+    iterations.times { sources.each { |s| plist = OSX::PropertyList.load(s); KEYS.each { |key| plist[key] } } }
+  end
+  bm.report('load_lazy') do
+    iterations.times { sources.each { |s| plist = OSX::PropertyList.load_lazy(s); KEYS.each { |key| plist[key] } } }
+  end
+end
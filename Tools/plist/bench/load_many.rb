@@ -0,0 +1,37 @@
+#!/usr/bin/env ruby
+# Loads every property list under Bundles/ with load_file in a loop and
+# with load_many on 1, 2, 4 and 8 threads, eagerly and lazily.
+#
+#   ruby bench/load_many.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+# Scaling stops at the number of CPUs, which is printed first. Eager
+# loads also spend a good part of their time creating Ruby objects,
+# which happens on one thread.
+require './plist'
+require 'benchmark'
+require 'etc' rescue nil
+
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+PATTERN = "#{BUNDLES}/**/*.{plist,tmCommand,tmDragCommand,tmLanguage,tmMacro,tmPreferences,tmSnippet,tmTemplate,tmTheme}"
+
+iterations = (ARGV[0] || 5).to_i
+paths = Dir[PATTERN].select { |f| File.file?(f) }
+cpus = defined?(Etc.nprocessors) ? Etc.nprocessors : '?'
+puts "#{paths.size} files, #{iterations} iterations, #{cpus} CPUs"
+
+Benchmark.bm(16) do |bm|
+  bm.report('load_file') do
+    iterations.times { paths.each { |f| OSX::PropertyList.load_file(f) rescue nil } }
+  end
+  [1, 2, 4, 8].each do |threads|
+    bm.report("load_many(#{threads})") do
+      iterations.times { OSX::PropertyList.load_many(paths, :threads => threads) }
+    end
+  end
+  [1, 2, 4, 8].each do |threads|
+    bm.report("lazy(#{threads})") do
+      iterations.times { OSX::PropertyList.load_many(paths, :threads => threads, :lazy => true) }
+    end
+  end
+end
@@ -0,0 +1,62 @@
+#!/usr/bin/env ruby
+# Merges a small customization into each of the largest grammars under
+# Bundles/ and diffs the two back, natively with merge and diff and in
+# Ruby by loading both sides and walking them, and reports the time and
+# objects allocated per grammar.
+#
+#   ruby bench/merge.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'benchmark'
+
+iterations = (ARGV[0] || 10).to_i
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+paths = Dir["#{BUNDLES}/**/*.tmLanguage"].select { |f| File.file?(f) }.sort_by { |f| -File.size(f) }.first(10)
+grammars = paths.map { |f| File.open(f, 'rb') { |io| io.read } }
+
+# What a user override usually touches: a rule or two, a new pattern
+overlays = grammars.map do |source|
+  grammar = OSX::PropertyList.load(source)
+  repository = grammar['repository'] || {}
+  key = repository.keys.first
+  { 'patterns' => [{ 'include' => '#custom' }],
+    'repository' => { 'custom' => { 'match' => '\\bTODO\\b', 'name' => 'keyword.todo' } }.merge(key ? { key => { 'name' => 'custom.scope' } } : {}) }
+end
+overlay_plists = overlays.map { |o| o.to_plist }
+puts "#{grammars.size} grammars, #{grammars.inject(0) { |sum, s| sum + s.size } / 1024} KB; #{iterations} iterations"
+
+def deep_merge(a, b)
+  return b unless a.is_a?(Hash) && b.is_a?(Hash)
+  a.merge(b) { |key, x, y| deep_merge(x, y) }
+end
+
+def diff(a, b, path = [], ops = [])
+  if a.is_a?(Hash) && b.is_a?(Hash)
+    a.each { |k, v| b.key?(k) ? (diff(v, b[k], path + [k], ops) unless v == b[k]) : ops << [:delete, path + [k]] }
+    b.each { |k, v| ops << [:set, path + [k], v] unless a.key?(k) }
+  elsif a != b
+    ops << [:set, path, b]
+  end
+  ops
+end
+
+def measure(name, count, iterations)
+  GC.start
+  before = GC.stat(:total_allocated_objects)
+  time = (1..3).map { GC.start; Benchmark.realtime { iterations.times { yield } } }.min
+  allocated = (GC.stat(:total_allocated_objects) - before) / 3 / iterations / count
+  printf("%-32s %7.2f ms per grammar  %8d objects\n", name, time * 1000 / iterations / count, allocated)
+end
+
+pairs = grammars.zip(overlay_plists)
+merged = pairs.map { |g, o| OSX::PropertyList.merge(g, o) }
+measure('load + deep merge + to_plist', pairs.size, iterations) do
+  pairs.each { |g, o| deep_merge(OSX::PropertyList.load(g), OSX::PropertyList.load(o)).to_plist }
+end
+measure('merge', pairs.size, iterations) { pairs.each { |g, o| OSX::PropertyList.merge(g, o) } }
+measure('merge :binary1', pairs.size, iterations) { pairs.each { |g, o| OSX::PropertyList.merge(g, o, :format => :binary1) } }
+measure('merge :lazy', pairs.size, iterations) { pairs.each { |g, o| OSX::PropertyList.merge(g, o, :format => :lazy) } }
+triples = grammars.zip(merged)
+measure('load + Ruby diff', triples.size, iterations) { triples.each { |a, b| diff(OSX::PropertyList.load(a), OSX::PropertyList.load(b)) } }
+measure('diff', triples.size, iterations) { triples.each { |a, b| OSX::PropertyList.diff(a, b) } }
@@ -0,0 +1,43 @@
+#!/usr/bin/env ruby
+# Loads the OpenStep property lists in the repository (the Xcode projects
+# under Tools/ and a few bundle files) with each available backend, and
+# the same data as XML for comparison.
+#
+#   ruby bench/openstep_load.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'benchmark'
+
+ROOT = File.expand_path('../../../..', __FILE__)
+FILES = Dir["#{ROOT}/Tools/**/*.pbxproj"] + [
+  "#{ROOT}/Tools/Bundle Manager/tags.plist",
+  "#{ROOT}/Bundles/PHP.tmbundle/Support/functions.plist",
+]
+
+iterations = (ARGV[0] || 20).to_i
+sources = FILES.select { |f| File.file?(f) }.map { |f| File.open(f, 'rb') { |io| io.read } }
+xml = sources.map { |s| OSX::PropertyList.load(s).to_plist }
+bytes = sources.inject(0) { |sum, s| sum + s.size }
+puts "#{sources.size} OpenStep property lists, #{bytes / 1024} KB, #{iterations} iterations"
+
+backends = [:native]
+begin
+  OSX::PropertyList.backend = :corefoundation
+  backends << :corefoundation
+rescue ArgumentError
+  puts "CoreFoundation backend not available, skipping it"
+end
+
+Benchmark.bm(16) do |bm|
+  backends.each do |backend|
+    OSX::PropertyList.backend = backend
+    bm.report(backend.to_s) do
+      iterations.times { sources.each { |s| OSX::PropertyList.load(s) } }
+    end
+  end
+  OSX::PropertyList.backend = :native
+  bm.report('native, as XML') do
+    iterations.times { xml.each { |s| OSX::PropertyList.load(s) } }
+  end
+end
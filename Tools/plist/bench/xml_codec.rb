@@ -0,0 +1,51 @@
+#!/usr/bin/env ruby
+# XML load and dump of the two kinds of content the escape and base64
+# kernels handle: large <data> payloads, and the longest command scripts
+# in the .tmCommand files under Bundles/. Each run of the extension is
+# repeated with TM_PLIST_SIMD capping it to SSE2 and to the scalar code.
+#
+#   ruby bench/xml_codec.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require 'benchmark'
+
+LEVELS = %w[avx2 sse2 scalar]
+iterations = (ARGV[0] || 5).to_i
+
+unless ENV['TM_PLIST_SIMD']
+  LEVELS.each { |level| system({ 'TM_PLIST_SIMD' => level }, RbConfig.ruby, __FILE__, iterations.to_s) }
+  exit
+end
+
+require './plist'
+
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+scripts = Dir["#{BUNDLES}/**/*.tmCommand"].map do |f|
+  OSX::PropertyList.load(File.open(f, 'rb') { |io| io.read })['command'] rescue nil
+end
+scripts = scripts.compact.sort_by { |s| -s.size }.first(200)
+
+srand(1)
+payload = (0...16).map { |i| s = Random.bytes(1 << 20); s.blob = true; s }
+workloads = {
+  'data 16x1MB' => { 'files' => payload },
+  'commands'    => scripts.map { |s| { 'name' => 'Command', 'command' => s, 'input' => 'selection' } },
+}
+
+if ENV['TM_PLIST_SIMD'] == LEVELS.first
+  puts "data: 16 blobs of 1 MB; commands: the #{scripts.size} longest .tmCommand scripts, " \
+    "#{scripts.inject(0) { |sum, s| sum + s.size } / 1024} KB; #{iterations} iterations"
+end
+# Best of three, each after a full GC, since the command scripts are
+# small enough for collection pauses to swamp the differences
+def best
+  (1..3).map { GC.start; Benchmark.realtime { yield } }.min
+end
+
+workloads.each do |name, obj|
+  xml = obj.to_plist
+  dump = best { iterations.times { obj.to_plist } }
+  load = best { iterations.times { OSX::PropertyList.load(xml) } }
+  mb = xml.size * iterations / 1048576.0
+  printf("%-7s %-12s dump %7.1f MB/s   load %7.1f MB/s\n", ENV['TM_PLIST_SIMD'], name, mb / dump, mb / load)
+end
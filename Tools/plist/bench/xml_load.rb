@@ -0,0 +1,35 @@
+#!/usr/bin/env ruby
+# Loads every XML property list under Bundles/ with each available backend.
+#
+#   ruby bench/xml_load.rb [iterations]
+#
+# Run it from the directory the extension was built in, like test.rb.
+require './plist'
+require 'benchmark'
+
+BUNDLES = File.expand_path('../../../../Bundles', __FILE__)
+PATTERN = "#{BUNDLES}/**/*.{plist,tmCommand,tmDragCommand,tmLanguage,tmMacro,tmPreferences,tmSnippet,tmTemplate,tmTheme}"
+
+iterations = (ARGV[0] || 5).to_i
+sources = Dir[PATTERN].select { |f| File.file?(f) }.map { |f| File.open(f, 'rb') { |io| io.read } }
+sources = sources.select { |s| s =~ /\A(\xEF\xBB\xBF)?\s*</n }
+bytes = sources.inject(0) { |sum, s| sum + s.size }
+puts "#{sources.size} XML property lists, #{bytes / 1024} KB, #{iterations} iterations"
+
+backends = [:native]
+begin
+  OSX::PropertyList.backend = :corefoundation
+  backends << :corefoundation
+rescue ArgumentError
+  puts "CoreFoundation backend not available, skipping it"
+end
+
+Benchmark.bm(16) do |bm|
+  backends.each do |backend|
+    OSX::PropertyList.backend = backend
+    bm.report(backend.to_s) do
+      iterations.times { sources.each { |s| OSX::PropertyList.load(s) } }
+    end
+  end
+end
+OSX::PropertyList.backend = :native
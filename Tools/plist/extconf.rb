@@ -1,7 +1,18 @@
 #!/usr/bin/ruby
 require 'mkmf'
-newFlags = " -arch ppc -arch i386 -isysroot /Developer/SDKs/MacOSX10.4u.sdk"
-$CFLAGS += newFlags
-$LDFLAGS += ' -framework CoreFoundation' + newFlags + ' -undefined suppress -flat_namespace'
-$LIBRUBYARG_SHARED=""
+if RUBY_PLATFORM =~ /darwin/
+  newFlags = " -arch ppc -arch i386 -isysroot /Developer/SDKs/MacOSX10.4u.sdk"
+  $CFLAGS += newFlags
+  $LDFLAGS += ' -framework CoreFoundation' + newFlags + ' -undefined suppress -flat_namespace'
+  $LIBRUBYARG_SHARED=""
+  $defs << "-DHAVE_COREFOUNDATION"
+end
+have_header("ruby/st.h")
+have_func("rb_utf8_str_new")
+have_func("rb_enc_interned_str", "ruby/encoding.h")
+have_func("rb_str_new_static")
+have_library("pthread", "pthread_create")
+have_struct_member("struct stat", "st_mtim", "sys/stat.h")
+have_struct_member("struct stat", "st_mtimespec", "sys/stat.h")
+have_header("ruby/thread.h") && have_func("rb_thread_call_without_gvl", "ruby/thread.h")
 create_makefile("osx/plist")
@@ -3,7 +3,8 @@
  * Kevin Ballard
  *
  * This is a Ruby extension to read/write Cocoa property lists
- * Not surprisingly, it only works on OS X
+ * All three formats are read natively, XML and binary are written
+ * natively too; writing OpenStep needs CoreFoundation (and therefore OS X)
  *
  * Copyright © 2005, Kevin Ballard
  *
@@ -20,6 +21,9 @@
  *     the format of the plist, which can be one of
  *     :xml1, :binary1, or :openstep
  *
+ * PropertyList::load_file(path, format = false)
+ *     Like load, but maps the file at path instead of reading it
+ *
  * PropertyList::dump(io, obj, type = :xml1)
  *     Takes an IO stream (open for writing) and an object
  *     Writes the object to the IO stream as a property list
@@ -41,6 +45,9 @@
  *
  * A blob string is turned into a CFData when dumped
  *
+ * PropertyList::backend = :native | :corefoundation
+ *     Selects the implementation behind load and dump
+ *
  */
 
 /*
@@ -56,39 +63,150 @@
  * See also: String#blob?, String#blob=, and Object#to_plist
  */
 
-#include <ruby.h>
-#if HAVE_RUBY_ST_H
-#include <ruby/st.h>
-#else
-#include <st.h>
-#endif
+#include "plist.h"
+#include "plist_xml.h"
+#include "plist_ruby.h"
+#include "plist_binary.h"
+#include "plist_file.h"
+#include "plist_lazy.h"
+#include "plist_extract.h"
+#include "plist_batch.h"
+#include "plist_cache.h"
+#include "plist_simd.h"
+#include "plist_intern.h"
+#include "plist_json.h"
+#include "plist_stats.h"
+#include "plist_digest.h"
+#include "plist_merge.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_COREFOUNDATION
 #include <CoreFoundation/CoreFoundation.h>
-
-// Here's some convenience macros
-#ifndef StringValue
-#define StringValue(x) do {								\
-		if (TYPE(x) != T_STRING) x = rb_str_to_str(x);	\
-	} while (0)
 #endif
 
-static VALUE mOSX;
-static VALUE mPlist;
+VALUE mOSX;
+VALUE mPlist;
 static VALUE mPlistDeprecated;
-static VALUE timeEpoch;
-static VALUE ePropertyListError;
+VALUE timeEpoch;
+VALUE ePropertyListError;
 
 static VALUE id_gm;
-static VALUE id_plus;
-static VALUE id_minus;
-static VALUE id_read;
-static VALUE id_write;
+VALUE id_plus;
+VALUE id_minus;
+VALUE id_read;
+VALUE id_write;
+
+VALUE id_xml;
+VALUE id_binary;
+VALUE id_openstep;
+
+VALUE id_blob;
+VALUE id_mapping;
+
+static VALUE id_native;
+static VALUE id_corefoundation;
+static VALUE id_threads;
+static VALUE id_lazy;
+static VALUE id_buffer_size, id_canonical;
+static VALUE id_intern_keys;
+static VALUE id_map_data;
+
+// Set when OSX::PropertyList.backend = :corefoundation
+static int useCoreFoundation = 0;
+
+void plist_buf_init(plist_buf_t *buf) {
+	buf->ptr = NULL;
+	buf->len = 0;
+	buf->capa = 0;
+}
+
+// Makes room for +extra+ more bytes, returns -1 when out of memory
+int plist_buf_reserve(plist_buf_t *buf, long extra) {
+	if (buf->len + extra <= buf->capa) return 0;
+	long capa = buf->capa ? buf->capa : 256;
+	while (capa < buf->len + extra) capa *= 2;
+	char *ptr = realloc(buf->ptr, capa);
+	if (!ptr) return -1;
+	buf->ptr = ptr;
+	buf->capa = capa;
+	return 0;
+}
+
+int plist_buf_append(plist_buf_t *buf, const char *bytes, long len) {
+	if (len == 0) return 0;
+	if (plist_buf_reserve(buf, len) < 0) return -1;
+	memcpy(buf->ptr + buf->len, bytes, len);
+	buf->len += len;
+	return 0;
+}
 
-static VALUE id_xml;
-static VALUE id_binary;
-static VALUE id_openstep;
+// Appends the UTF-8 encoding of a code point
+int plist_buf_append_utf8(plist_buf_t *buf, unsigned long cp) {
+	char out[4];
+	int n;
+	if (cp < 0x80) {
+		out[0] = (char)cp; n = 1;
+	} else if (cp < 0x800) {
+		out[0] = (char)(0xC0 | (cp >> 6));
+		out[1] = (char)(0x80 | (cp & 0x3F)); n = 2;
+	} else if (cp < 0x10000) {
+		out[0] = (char)(0xE0 | (cp >> 12));
+		out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+		out[2] = (char)(0x80 | (cp & 0x3F)); n = 3;
+	} else {
+		out[0] = (char)(0xF0 | (cp >> 18));
+		out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+		out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+		out[3] = (char)(0x80 | (cp & 0x3F)); n = 4;
+	}
+	return plist_buf_append(buf, out, n);
+}
 
-static VALUE id_blob;
+void plist_buf_free(plist_buf_t *buf) {
+	free(buf->ptr);
+	plist_buf_init(buf);
+}
 
+// Where a failed parse of +bytes+ stopped: the byte offset for binary
+// input, the line number otherwise. Doesn't touch Ruby.
+long plist_error_position(const char *bytes, long len, plist_error_t *error, int *binary) {
+	long line = 1, i;
+	long offset = error->offset < len ? error->offset : len;
+	*binary = plist_binary_detect(bytes, len);
+	if (*binary) return offset;
+	for (i = 0; i < offset; i++) {
+		if (bytes[i] == '\n') line++;
+	}
+	return line;
+}
+
+// Creates the PropertyListError for a failed native parse
+VALUE plist_error_new(const char *message, long position, int binary) {
+	char text[256];
+	if (binary) snprintf(text, sizeof(text), "Malformed binary property list: %s at offset %ld", message, position);
+	else snprintf(text, sizeof(text), "Malformed property list: %s at line %ld", message, position);
+	return rb_exc_new2(ePropertyListError, text);
+}
+
+// Raises a PropertyListError for a failed native parse of +bytes+
+void plist_raise_error(const char *bytes, long len, plist_error_t *error) {
+	int binary;
+	long position = plist_error_position(bytes, len, error, &binary);
+	rb_exc_raise(plist_error_new(error->message, position, binary));
+}
+
+// Creates a String from plist text, tagged as UTF-8 where Ruby knows encodings
+VALUE plist_str_new(const char *bytes, long len) {
+#ifdef HAVE_RB_UTF8_STR_NEW
+	return rb_utf8_str_new(bytes, len);
+#else
+	return rb_str_new(bytes, len);
+#endif
+}
+
+#ifdef HAVE_COREFOUNDATION
 VALUE convertPropertyListRef(CFPropertyListRef plist);
 VALUE convertStringRef(CFStringRef plist);
 VALUE convertDictionaryRef(CFDictionaryRef plist);
@@ -97,8 +215,6 @@ VALUE convertNumberRef(CFNumberRef plist);
 VALUE convertBooleanRef(CFBooleanRef plist);
 VALUE convertDataRef(CFDataRef plist);
 VALUE convertDateRef(CFDateRef plist);
-VALUE str_blob(VALUE self);
-VALUE str_setBlob(VALUE self, VALUE b);
 
 // Raises a Ruby exception with the given string
 void raiseError(CFStringRef error) {
@@ -117,45 +233,8 @@ void raiseError(CFStringRef error) {
 		if (freeBuffer) free(errBuffer);
 }
 
-/* call-seq:
- *    PropertyList.method_missing(symbol, [args]) -> result
- *
- * Forwards all method calls to the OSX::PropertyList class after
- * outputting a warning.
- */
-VALUE plist_deprecated_method_missing(int argc, VALUE *argv, VALUE self) {
-	static bool shownWarning = false;
-	if (!shownWarning) {
-		fprintf(stderr, "Warning: PropertyList is deprecated. Use OSX::PropertyList instead.\n");
-		shownWarning = true;
-	}
-	VALUE symbol = *argv++; argc--;
-	Check_Type(symbol, T_SYMBOL);
-	return rb_funcall3(mPlist, SYM2ID(symbol), argc, argv);
-}
-
-/* call-seq:
- *    PropertyList.load(obj)         -> object
- *    PropertyList.load(obj, format) -> [object, format]
- *
- * Loads a property list from an IO stream or a String and creates
- * an equivalent Object from it.
- *
- * If +format+ is provided, it returns one of
- * <tt>:xml1</tt>, <tt>:binary1</tt>, or <tt>:openstep</tt>.
- */
-VALUE plist_load(int argc, VALUE *argv, VALUE self) {
-	VALUE io, retFormat;
-	int count = rb_scan_args(argc, argv, "11", &io, &retFormat);
-	if (count < 2) retFormat = Qfalse;
-	VALUE buffer;
-	if (RTEST(rb_respond_to(io, id_read))) {
-		// Read from IO
-		buffer = rb_funcall(io, id_read, 0);
-	} else {
-		StringValue(io);
-		buffer = io;
-	}
+// Loads +buffer+ through CoreFoundation, storing the detected format in +formatOut+
+static VALUE cfLoad(VALUE buffer, VALUE retFormat, VALUE *formatOut) {
 	// For some reason, the CFReadStream version doesn't work with input < 6 characters
 	// but the CFDataRef version doesn't return format
 	// So lets use the CFDataRef version unless format is requested
@@ -197,22 +276,17 @@ VALUE plist_load(int argc, VALUE *argv, VALUE self) {
 	VALUE obj = convertPropertyListRef(plist);
 	CFRelease(plist);
 	if (RTEST(retFormat)) {
-		VALUE ary = rb_ary_new();
-		rb_ary_push(ary, obj);
 		if (format == kCFPropertyListOpenStepFormat) {
-			retFormat = id_openstep;
+			*formatOut = id_openstep;
 		} else if (format == kCFPropertyListXMLFormat_v1_0) {
-			retFormat = id_xml;
+			*formatOut = id_xml;
 		} else if (format == kCFPropertyListBinaryFormat_v1_0) {
-			retFormat = id_binary;
+			*formatOut = id_binary;
 		} else {
-			retFormat = rb_intern("unknown");
+			*formatOut = rb_intern("unknown");
 		}
-		rb_ary_push(ary, ID2SYM(retFormat));
-		return ary;
-	} else {
-		return obj;
 	}
+	return obj;
 }
 
 // Maps the property list object to a ruby object
@@ -348,84 +422,19 @@ VALUE convertPlistToString(CFPropertyListRef plist, CFPropertyListFormat format)
 	return plistData;
 }
 
-/* call-seq:
- *    PropertyList.dump(io, obj)         -> Integer
- *    PropertyList.dump(io, obj, format) -> Integer
- *
- * Writes the property list representation of +obj+
- * to the IO stream (must be open for writing).
- *
- * +format+ can be one of <tt>:xml1</tt> or <tt>:binary1</tt>.
- *
- * Returns the number of bytes written, or +nil+ if
- * the object could not be represented as a property list
- */
-VALUE plist_dump(int argc, VALUE *argv, VALUE self) {
-	VALUE io, obj, type;
-	int count = rb_scan_args(argc, argv, "21", &io, &obj, &type);
-	if (count < 3) {
-		type = id_xml;
-	} else {
-		type = rb_to_id(type);
-	}
-	if (!RTEST(rb_respond_to(io, id_write))) {
-		rb_raise(rb_eArgError, "Argument 1 must be an IO object");
-		return Qnil;
-	}
+// Serializes +obj+ through CoreFoundation in the format named by +type+
+static VALUE cfDump(VALUE obj, VALUE type) {
 	CFPropertyListFormat format;
 	if (type == id_xml) {
 		format = kCFPropertyListXMLFormat_v1_0;
 	} else if (type == id_binary) {
 		format = kCFPropertyListBinaryFormat_v1_0;
-	} else if (type == id_openstep) {
-		format = kCFPropertyListOpenStepFormat;
 	} else {
-		rb_raise(rb_eArgError, "Argument 3 must be one of :xml1, :binary1, or :openstep");
-		return Qnil;
-	}
-	CFPropertyListRef plist = convertObject(obj);
-	VALUE data = convertPlistToString(plist, format);
-	if (NIL_P(data)) {
-		return Qnil;
-	} else {
-		return rb_funcall(io, id_write, 1, data);
-	}
-}
-
-/* call-seq:
- *    object.to_plist         -> String
- *    object.to_plist(format) -> String
- *
- * Converts the object to a property list representation
- * and returns it as a string.
- *
- * +format+ can be one of <tt>:xml1</tt> or <tt>:binary1</tt>.
- */
-VALUE obj_to_plist(int argc, VALUE *argv, VALUE self) {
-	VALUE type;
-	int count = rb_scan_args(argc, argv, "01", &type);
-	if (count < 1) {
-		type = id_xml;
-	} else {
-		type = rb_to_id(type);
-	}
-	CFPropertyListFormat format;
-	if (type == id_xml) {
-		format = kCFPropertyListXMLFormat_v1_0;
-	} else if (type == id_binary) {
-		format = kCFPropertyListBinaryFormat_v1_0;
-	} else if (type == id_openstep) {
 		format = kCFPropertyListOpenStepFormat;
-	} else {
-		rb_raise(rb_eArgError, "Argument 2 must be one of :xml1, :binary1, or :openstep");
-		return Qnil;
 	}
-	CFPropertyListRef plist = convertObject(self);
+	CFPropertyListRef plist = convertObject(obj);
 	VALUE data = convertPlistToString(plist, format);
 	CFRelease(plist);
-	if (type == id_xml || type == id_binary) {
-		str_setBlob(data, Qfalse);
-	}
 	return data;
 }
 
@@ -497,11 +506,11 @@ CFDictionaryRef convertHash(VALUE obj) {
 
 // Converts an Array to a CFArrayRef
 CFArrayRef convertArray(VALUE obj) {
-	CFIndex count = (CFIndex)RARRAY(obj)->len;
+	CFIndex count = (CFIndex)RARRAY_LEN(obj);
 	CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, count, &kCFTypeArrayCallBacks);
 	int i;
 	for (i = 0; i < count; i++) {
-		CFPropertyListRef aVal = convertObject(RARRAY(obj)->ptr[i]);
+		CFPropertyListRef aVal = convertObject(RARRAY_PTR(obj)[i]);
 		CFArrayAppendValue(array, aVal);
 		CFRelease(aVal);
 	}
@@ -551,6 +560,459 @@ CFDateRef convertTime(VALUE obj) {
 	return date;
 }
 
+#endif
+
+/* call-seq:
+ *    PropertyList.method_missing(symbol, [args]) -> result
+ *
+ * Forwards all method calls to the OSX::PropertyList class after
+ * outputting a warning.
+ */
+VALUE plist_deprecated_method_missing(int argc, VALUE *argv, VALUE self) {
+	static bool shownWarning = false;
+	if (!shownWarning) {
+		fprintf(stderr, "Warning: PropertyList is deprecated. Use OSX::PropertyList instead.\n");
+		shownWarning = true;
+	}
+	VALUE symbol = *argv++; argc--;
+	Check_Type(symbol, T_SYMBOL);
+	return rb_funcall3(mPlist, SYM2ID(symbol), argc, argv);
+}
+
+// Picks a reader for +bytes+; +buffer+ is the String holding them, if any
+static VALUE loadBytes(const char *bytes, long len, VALUE buffer, VALUE retFormat, VALUE *format, plist_intern_t *intern) {
+#ifdef HAVE_COREFOUNDATION
+	if (useCoreFoundation) {
+		if (NIL_P(buffer)) buffer = rb_str_new(bytes, len);
+		return cfLoad(buffer, retFormat, format);
+	}
+#endif
+	plist_parse_fn parse = plist_reader_for(bytes, len);
+	*format = plist_reader_format(parse);
+	plist_stats_load(*format, len);
+	VALUE obj = parse == plist_binary_parse ? plist_binary_load(bytes, len, intern, Qnil, NULL) : plist_build(parse, bytes, len, intern);
+	plist_stats_phase(*format, PLIST_PARSE);
+	return obj;
+}
+
+// Splits an options Hash passed in place of the optional format flag
+// off into *opts, leaving the flag false
+static void formatOrOptions(int count, VALUE *retFormat, VALUE *opts) {
+	if (count < 2) *retFormat = Qfalse;
+	if (count == 2 && TYPE(*retFormat) == T_HASH) {
+		*opts = *retFormat;
+		*retFormat = Qfalse;
+	}
+	if (!NIL_P(*opts)) *opts = rb_convert_type(*opts, T_HASH, "Hash", "to_hash");
+}
+
+// Sets up the key table the :intern_keys option in +opts+ asks for
+static VALUE internOption(VALUE opts, plist_intern_t **intern) {
+	return plist_intern_new(NIL_P(opts) ? Qnil : rb_hash_aref(opts, ID2SYM(id_intern_keys)), intern);
+}
+
+// Pairs +obj+ with its format symbol when the caller asked for it
+static VALUE withFormat(VALUE obj, VALUE retFormat, VALUE format) {
+	if (RTEST(retFormat)) {
+		VALUE ary = rb_ary_new();
+		rb_ary_push(ary, obj);
+		rb_ary_push(ary, ID2SYM(format));
+		return ary;
+	} else {
+		return obj;
+	}
+}
+
+/* call-seq:
+ *    PropertyList.load(obj)                  -> object
+ *    PropertyList.load(obj, format)          -> [object, format]
+ *    PropertyList.load(obj, format, options) -> object or [object, format]
+ *
+ * Loads a property list from an IO stream or a String and creates
+ * an equivalent Object from it.
+ *
+ * If +format+ is provided, it returns one of
+ * <tt>:xml1</tt>, <tt>:binary1</tt>, or <tt>:openstep</tt>.
+ *
+ * With <tt>:intern_keys => true</tt> (or <tt>:process</tt>) every
+ * dictionary key is a frozen String from Ruby's table of frozen
+ * strings, made once per distinct key rather than for each repeat.
+ * <tt>:load</tt> shares keys only within this property list, and
+ * <tt>:symbols</tt> gives Symbol keys. intern_stats tells how many key
+ * Strings were saved. Only the native backend interns.
+ */
+VALUE plist_load(int argc, VALUE *argv, VALUE self) {
+	VALUE io, retFormat, opts;
+	int count = rb_scan_args(argc, argv, "12", &io, &retFormat, &opts);
+	formatOrOptions(count, &retFormat, &opts);
+	plist_intern_t *intern;
+	VALUE table = internOption(opts, &intern);
+	VALUE buffer;
+	if (RTEST(rb_respond_to(io, id_read))) {
+		// Read from IO
+		buffer = rb_funcall(io, id_read, 0);
+	} else {
+		StringValue(io);
+		buffer = io;
+	}
+	VALUE format = id_xml;
+	VALUE obj = loadBytes(RSTRING_PTR(buffer), RSTRING_LEN(buffer), buffer, retFormat, &format, intern);
+	plist_intern_finish(intern);
+	RB_GC_GUARD(buffer);
+	RB_GC_GUARD(table);
+	return withFormat(obj, retFormat, format);
+}
+
+/* call-seq:
+ *    PropertyList.load_lazy(obj)         -> object
+ *    PropertyList.load_lazy(obj, format) -> [object, format]
+ *
+ * Like load, but dictionaries and arrays come back as LazyHash and
+ * LazyArray views that only convert the members that are asked for.
+ * Use #materialized on a view to see how many nodes were converted.
+ */
+VALUE plist_load_lazy(int argc, VALUE *argv, VALUE self) {
+	VALUE io, retFormat;
+	int count = rb_scan_args(argc, argv, "11", &io, &retFormat);
+	if (count < 2) retFormat = Qfalse;
+	VALUE buffer;
+	if (RTEST(rb_respond_to(io, id_read))) {
+		buffer = rb_funcall(io, id_read, 0);
+	} else {
+		StringValue(io);
+		buffer = io;
+	}
+	VALUE format = plist_reader_format(plist_reader_for(RSTRING_PTR(buffer), RSTRING_LEN(buffer)));
+	plist_stats_load(format, RSTRING_LEN(buffer));
+	VALUE obj = plist_lazy_load(RSTRING_PTR(buffer), RSTRING_LEN(buffer));
+	plist_stats_phase(format, PLIST_PARSE);
+	RB_GC_GUARD(buffer);
+	return withFormat(obj, retFormat, format);
+}
+
+/* call-seq:
+ *    PropertyList.extract(obj, *keypaths) -> Array
+ *
+ * Reads only the values at +keypaths+ from a property list given as an
+ * IO stream or a String. Each key path is an Array of dictionary keys
+ * and array indexes, e.g. <tt>["patterns", 0, "name"]</tt>; a single
+ * key can be given on its own. Returns the values in the same order,
+ * with +nil+ for paths that don't exist.
+ *
+ * Everything the key paths don't lead into is skipped without creating
+ * Ruby objects, and reading stops as soon as every path is resolved, so
+ * problems later in the input go unnoticed.
+ */
+VALUE plist_extract(int argc, VALUE *argv, VALUE self) {
+	if (argc < 1) rb_raise(rb_eArgError, "wrong number of arguments (0 for 1)");
+	VALUE io = argv[0];
+	VALUE paths = plist_keypaths(argc - 1, argv + 1);
+	VALUE buffer;
+	if (RTEST(rb_respond_to(io, id_read))) {
+		buffer = rb_funcall(io, id_read, 0);
+	} else {
+		StringValue(io);
+		buffer = io;
+	}
+	VALUE format = plist_reader_format(plist_reader_for(RSTRING_PTR(buffer), RSTRING_LEN(buffer)));
+	plist_stats_load(format, RSTRING_LEN(buffer));
+	VALUE results = plist_extract_native(RSTRING_PTR(buffer), RSTRING_LEN(buffer), paths);
+	plist_stats_phase(format, PLIST_PARSE);
+	RB_GC_GUARD(buffer);
+	return results;
+}
+
+struct load_file_args {
+	plist_map_t map;
+	VALUE retFormat;
+	VALUE format;
+	plist_intern_t *intern;
+	VALUE owner;                    // takes over map for :map_data, or Qnil
+};
+
+static void mappingFree(void *ptr) {
+	plist_map_close(ptr);
+	xfree(ptr);
+}
+
+// Loads a binary file leaving its large data objects where they are.
+// The owner takes the file over and releases it once no String points
+// into it any more, or right away if none ended up doing so.
+static VALUE loadMapped(struct load_file_args *args) {
+	plist_map_t *owned;
+	long shared;
+	Data_Get_Struct(args->owner, plist_map_t, owned);
+	*owned = args->map;
+	args->map.bytes = NULL;
+	args->map.len = 0;
+	args->map.mapped = 0;
+	args->format = id_binary;
+	plist_stats_load(id_binary, owned->len);
+	VALUE obj = plist_binary_load(owned->bytes, owned->len, args->intern, args->owner, &shared);
+	if (shared == 0) plist_map_close(owned);
+	plist_stats_phase(id_binary, PLIST_PARSE);
+	return obj;
+}
+
+static VALUE loadFileBody(VALUE arg) {
+	struct load_file_args *args = (struct load_file_args *)arg;
+	if (!NIL_P(args->owner) && !useCoreFoundation && plist_reader_for(args->map.bytes, args->map.len) == plist_binary_parse) return loadMapped(args);
+	return loadBytes(args->map.bytes, args->map.len, Qnil, args->retFormat, &args->format, args->intern);
+}
+
+static VALUE loadFileCleanup(VALUE arg) {
+	struct load_file_args *args = (struct load_file_args *)arg;
+	plist_map_close(&args->map);
+	return Qnil;
+}
+
+/* call-seq:
+ *    PropertyList.load_file(path)                  -> object
+ *    PropertyList.load_file(path, format)          -> [object, format]
+ *    PropertyList.load_file(path, format, options) -> object or [object, format]
+ *
+ * Like load, but reads the property list at +path+ directly. The file
+ * is mapped into memory rather than read, so a binary property list
+ * only has the objects that are actually reached decoded.
+ *
+ * When cache_dir is set, the parsed form of the file is kept there
+ * and reused until the file changes.
+ *
+ * With <tt>:map_data => true</tt> the <data> objects of 4 KB or more
+ * in a binary file come back as Strings pointing into the mapped file
+ * instead of copies of it, which stays mapped while any of them is
+ * alive. Changing one of those Strings copies it first. The cache is
+ * not used for such loads.
+ */
+VALUE plist_load_file(int argc, VALUE *argv, VALUE self) {
+	VALUE path, retFormat, opts;
+	int count = rb_scan_args(argc, argv, "12", &path, &retFormat, &opts);
+	formatOrOptions(count, &retFormat, &opts);
+	struct load_file_args args;
+	FilePathValue(path);
+	plist_stats_path(path);
+	VALUE table = internOption(opts, &args.intern);
+	args.format = id_xml;
+	args.owner = Qnil;
+	if (!NIL_P(opts) && RTEST(rb_hash_aref(opts, ID2SYM(id_map_data)))) {
+		plist_map_t *owned;
+		args.owner = Data_Make_Struct(rb_cObject, plist_map_t, NULL, mappingFree, owned);
+	}
+	VALUE obj = NIL_P(args.owner) ? plist_cache_load(path, &args.format, args.intern) : Qundef;
+	if (obj == Qundef) {
+		if (plist_map_open(&args.map, StringValueCStr(path)) < 0) rb_sys_fail(StringValueCStr(path));
+		args.retFormat = retFormat;
+		obj = rb_ensure(loadFileBody, (VALUE)&args, loadFileCleanup, (VALUE)&args);
+	}
+	plist_intern_finish(args.intern);
+	RB_GC_GUARD(table);
+	RB_GC_GUARD(args.owner);
+	return withFormat(obj, retFormat, args.format);
+}
+
+/* call-seq:
+ *    PropertyList.load_many(paths)                   -> Array
+ *    PropertyList.load_many(paths, :threads => count) -> Array
+ *    PropertyList.load_many(paths, :lazy => true)     -> Array
+ *    PropertyList.load_many(paths, :intern_keys => mode) -> Array
+ *
+ * Loads the property list files at +paths+, parsing them on up to
+ * +count+ native threads (one per CPU by default) while other Ruby
+ * threads keep running. The results are in the same order as +paths+;
+ * a file that can't be read or parsed gives the exception that
+ * load_file would have raised instead of aborting the whole batch.
+ *
+ * Creating the Ruby objects can't be spread over threads. With
+ * <tt>:lazy => true</tt> dictionaries and arrays are returned as
+ * load_lazy views instead, which leaves almost nothing to do serially.
+ * <tt>:intern_keys</tt> works as for load, with one table shared by
+ * the whole batch.
+ */
+VALUE plist_load_many(int argc, VALUE *argv, VALUE self) {
+	VALUE paths, opts;
+	int count = rb_scan_args(argc, argv, "11", &paths, &opts);
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int lazy = 0;
+	if (count > 1 && !NIL_P(opts)) {
+		opts = rb_convert_type(opts, T_HASH, "Hash", "to_hash");
+		VALUE value = rb_hash_aref(opts, ID2SYM(id_threads));
+		if (!NIL_P(value)) threads = NUM2LONG(value);
+		if (threads < 1) rb_raise(rb_eArgError, "threads must be at least 1");
+		lazy = RTEST(rb_hash_aref(opts, ID2SYM(id_lazy)));
+	}
+	plist_intern_t *intern;
+	VALUE table = internOption(count > 1 ? opts : Qnil, &intern);
+	VALUE results = plist_load_batch(paths, threads > 64 ? 64 : (int)threads, lazy, intern);
+	plist_intern_finish(intern);
+	RB_GC_GUARD(table);
+	return results;
+}
+
+// Returns PLIST_EMIT_SORTED if +opts+ asks for :canonical output
+static int dumpFlags(VALUE opts) {
+	return !NIL_P(opts) && RTEST(rb_hash_aref(opts, ID2SYM(id_canonical))) ? PLIST_EMIT_SORTED : 0;
+}
+
+// Returns the property list representation of +obj+ as a String.
+// Canonical output always comes from the native writers, since
+// CoreFoundation doesn't promise any particular key order.
+static VALUE dumpToString(VALUE obj, VALUE type, int flags, const char *argName) {
+	if (type != id_xml && type != id_binary && type != id_openstep) {
+		rb_raise(rb_eArgError, "%s must be one of :xml1, :binary1, or :openstep", argName);
+	}
+	int native = !useCoreFoundation || flags != 0;
+	if (type == id_xml && native) {
+		VALUE out = rb_str_buf_new(4096);
+		plist_xml_dump(obj, out, PLIST_DUMP_CHUNK, flags);
+		return out;
+	}
+	if (type == id_binary && native) {
+		VALUE out = rb_str_buf_new(4096);
+		plist_binary_dump(obj, out, PLIST_DUMP_CHUNK, flags);
+		return out;
+	}
+#ifdef HAVE_COREFOUNDATION
+	return cfDump(obj, type);
+#else
+	rb_raise(ePropertyListError, "Only XML property lists can be written without CoreFoundation");
+	return Qnil;
+#endif
+}
+
+/* call-seq:
+ *    PropertyList.dump(io, obj)                                 -> Integer
+ *    PropertyList.dump(io, obj, format)                         -> Integer
+ *    PropertyList.dump(io, obj, format, :buffer_size => bytes) -> Integer
+ *    PropertyList.dump(io, obj, format, :canonical => true)    -> Integer
+ *
+ * Writes the property list representation of +obj+
+ * to the IO stream (must be open for writing).
+ *
+ * +format+ can be one of <tt>:xml1</tt> or <tt>:binary1</tt>.
+ *
+ * Output is passed to <tt>io.write</tt> in pieces of +bytes+ (64 KB
+ * by default) as it is produced, so XML never needs more than one
+ * piece in memory. Binary output can only start once the whole
+ * object table is known, but is written out the same way. If +obj+
+ * turns out not to be convertible part way through, whatever was
+ * already written stays written.
+ *
+ * With <tt>:canonical => true</tt> dictionary keys are written in
+ * byte order, so equal objects always produce identical output.
+ *
+ * Returns the number of bytes written, or +nil+ if
+ * the object could not be represented as a property list
+ */
+VALUE plist_dump(int argc, VALUE *argv, VALUE self) {
+	VALUE io, obj, type, opts;
+	long chunk = PLIST_DUMP_CHUNK;
+	int flags = 0;
+	int count = rb_scan_args(argc, argv, "22", &io, &obj, &type, &opts);
+	if (count == 3 && TYPE(type) == T_HASH) {
+		opts = type;
+		count = 2;
+	}
+	if (count < 3 || NIL_P(type)) {
+		type = id_xml;
+	} else {
+		type = rb_to_id(type);
+	}
+	if (!NIL_P(opts)) {
+		opts = rb_convert_type(opts, T_HASH, "Hash", "to_hash");
+		VALUE value = rb_hash_aref(opts, ID2SYM(id_buffer_size));
+		if (!NIL_P(value)) chunk = NUM2LONG(value);
+		if (chunk < 1) rb_raise(rb_eArgError, "buffer_size must be at least 1");
+		flags = dumpFlags(opts);
+	}
+	if (!RTEST(rb_respond_to(io, id_write))) {
+		rb_raise(rb_eArgError, "Argument 1 must be an IO object");
+		return Qnil;
+	}
+	if ((!useCoreFoundation || flags) && (type == id_xml || type == id_binary)) {
+		long written = type == id_xml ? plist_xml_dump(obj, io, chunk, flags) : plist_binary_dump(obj, io, chunk, flags);
+		plist_stats_dump(type, written);
+		plist_stats_phase(type, PLIST_WRITE);
+		return LONG2NUM(written);
+	}
+	VALUE data = dumpToString(obj, type, flags, "Argument 3");
+	if (NIL_P(data)) {
+		return Qnil;
+	} else {
+		plist_stats_dump(type, RSTRING_LEN(data));
+		VALUE written = rb_funcall(io, id_write, 1, data);
+		plist_stats_phase(type, PLIST_WRITE);
+		return written;
+	}
+}
+
+/* call-seq:
+ *    object.to_plist                                  -> String
+ *    object.to_plist(format)                          -> String
+ *    object.to_plist(format, :canonical => true)      -> String
+ *
+ * Converts the object to a property list representation
+ * and returns it as a string.
+ *
+ * +format+ can be one of <tt>:xml1</tt> or <tt>:binary1</tt>.
+ *
+ * With <tt>:canonical => true</tt> dictionary keys are written in
+ * byte order, so equal objects always produce identical output.
+ */
+VALUE obj_to_plist(int argc, VALUE *argv, VALUE self) {
+	VALUE type, opts;
+	int count = rb_scan_args(argc, argv, "02", &type, &opts);
+	if (count == 1 && TYPE(type) == T_HASH) {
+		opts = type;
+		count = 0;
+	}
+	if (count < 1 || NIL_P(type)) {
+		type = id_xml;
+	} else {
+		type = rb_to_id(type);
+	}
+	if (!NIL_P(opts)) opts = rb_convert_type(opts, T_HASH, "Hash", "to_hash");
+	VALUE data = dumpToString(self, type, dumpFlags(opts), "Argument 2");
+	if (type == id_xml || type == id_binary) {
+		str_setBlob(data, Qfalse);
+	}
+	if (!NIL_P(data)) {
+		plist_stats_dump(type, RSTRING_LEN(data));
+		plist_stats_phase(type, PLIST_WRITE);
+	}
+	return data;
+}
+
+/* call-seq:
+ *    PropertyList.backend -> Symbol
+ *
+ * Returns the implementation used by load and dump, either
+ * <tt>:native</tt> or <tt>:corefoundation</tt>.
+ */
+VALUE plist_backend(VALUE self) {
+	return ID2SYM(useCoreFoundation ? id_corefoundation : id_native);
+}
+
+/* call-seq:
+ *    PropertyList.backend = backend -> backend
+ *
+ * Selects the implementation used by load and dump. The native
+ * backend reads and writes XML itself and is always available,
+ * <tt>:corefoundation</tt> requires CoreFoundation.
+ */
+VALUE plist_setBackend(VALUE self, VALUE backend) {
+	ID name = rb_to_id(backend);
+	if (name == id_native) {
+		useCoreFoundation = 0;
+#ifdef HAVE_COREFOUNDATION
+	} else if (name == id_corefoundation) {
+		useCoreFoundation = 1;
+#endif
+	} else {
+		rb_raise(rb_eArgError, "Unsupported property list backend");
+	}
+	return backend;
+}
+
 /* call-seq:
  *    str.blob? -> Boolean
  *
@@ -579,17 +1041,33 @@ VALUE str_setBlob(VALUE self, VALUE b) {
 	}
 }
 
-/* Bridge to CoreFoundation for reading/writing Property Lists.
- * Only works when CoreFoundation is available.
+// Every entry point keeps a call record for stats and TM_PLIST_TRACE
+PLIST_TRACED("load", plist_load)
+PLIST_TRACED("load_file", plist_load_file)
+PLIST_TRACED("load_lazy", plist_load_lazy)
+PLIST_TRACED("extract", plist_extract)
+PLIST_TRACED("load_many", plist_load_many)
+PLIST_TRACED("dump", plist_dump)
+PLIST_TRACED("to_plist", obj_to_plist)
+
+/* Reading/writing Property Lists. Everything is read natively, and
+ * XML and binary are written natively; writing OpenStep goes through
+ * CoreFoundation when it is available.
  */
 void Init_plist() {
 	mPlistDeprecated = rb_define_module("PropertyList");
 	rb_define_module_function(mPlistDeprecated,"method_missing", plist_deprecated_method_missing, -1);
 	mOSX = rb_define_module("OSX");
 	mPlist = rb_define_module_under(mOSX, "PropertyList");
-	rb_define_module_function(mPlist, "load", plist_load, -1);
-	rb_define_module_function(mPlist, "dump", plist_dump, -1);
-	rb_define_method(rb_cObject, "to_plist", obj_to_plist, -1);
+	rb_define_module_function(mPlist, "load", plist_loadTraced, -1);
+	rb_define_module_function(mPlist, "load_file", plist_load_fileTraced, -1);
+	rb_define_module_function(mPlist, "load_lazy", plist_load_lazyTraced, -1);
+	rb_define_module_function(mPlist, "extract", plist_extractTraced, -1);
+	rb_define_module_function(mPlist, "load_many", plist_load_manyTraced, -1);
+	rb_define_module_function(mPlist, "dump", plist_dumpTraced, -1);
+	rb_define_module_function(mPlist, "backend", plist_backend, 0);
+	rb_define_module_function(mPlist, "backend=", plist_setBackend, 1);
+	rb_define_method(rb_cObject, "to_plist", obj_to_plistTraced, -1);
 	rb_define_method(rb_cString, "blob?", str_blob, 0);
 	rb_define_method(rb_cString, "blob=", str_setBlob, 1);
 	ePropertyListError = rb_define_class_under(mOSX, "PropertyListError", rb_eStandardError);
@@ -604,4 +1082,21 @@ void Init_plist() {
 	id_binary = rb_intern("binary1");
 	id_openstep = rb_intern("openstep");
 	id_blob = rb_intern("@blob");
+	id_mapping = rb_intern("mapping");
+	id_native = rb_intern("native");
+	id_corefoundation = rb_intern("corefoundation");
+	id_threads = rb_intern("threads");
+	id_lazy = rb_intern("lazy");
+	id_buffer_size = rb_intern("buffer_size");
+	id_canonical = rb_intern("canonical");
+	id_intern_keys = rb_intern("intern_keys");
+	id_map_data = rb_intern("map_data");
+	Init_plist_simd();
+	Init_plist_lazy();
+	Init_plist_cache();
+	Init_plist_intern();
+	Init_plist_json();
+	Init_plist_stats();
+	Init_plist_digest();
+	Init_plist_merge();
 }
@@ -0,0 +1,116 @@
+#ifndef _PLIST_H_
+#define _PLIST_H_
+
+#include <ruby.h>
+#if HAVE_RUBY_ST_H
+#include <ruby/st.h>
+#else
+#include <st.h>
+#endif
+
+// Here's some convenience macros
+#ifndef StringValue
+#define StringValue(x) do {								\
+		if (TYPE(x) != T_STRING) x = rb_str_to_str(x);	\
+	} while (0)
+#endif
+#ifndef RARRAY_LEN
+#define RARRAY_LEN(x) (RARRAY(x)->len)
+#endif
+#ifndef RARRAY_PTR
+#define RARRAY_PTR(x) (RARRAY(x)->ptr)
+#endif
+#ifndef RSTRING_LEN
+#define RSTRING_LEN(x) (RSTRING(x)->len)
+#endif
+#ifndef RSTRING_PTR
+#define RSTRING_PTR(x) (RSTRING(x)->ptr)
+#endif
+#ifndef RB_GC_GUARD
+#define RB_GC_GUARD(v) (*(volatile VALUE *)&(v))
+#endif
+
+// Deepest dict/array nesting any reader or writer will follow
+#define PLIST_MAX_DEPTH 512
+
+// Default size of the pieces dump hands to an IO
+#define PLIST_DUMP_CHUNK 65536
+
+// Seconds between the Unix epoch and the plist epoch (2001-01-01 UTC)
+#define PLIST_EPOCH_OFFSET 978307200.0
+
+extern VALUE mOSX;
+extern VALUE mPlist;
+extern VALUE timeEpoch;
+extern VALUE ePropertyListError;
+
+extern VALUE id_plus;
+extern VALUE id_minus;
+extern VALUE id_read;
+extern VALUE id_write;
+
+extern VALUE id_xml;
+extern VALUE id_binary;
+extern VALUE id_openstep;
+
+extern VALUE id_blob;
+extern VALUE id_mapping;
+
+VALUE str_blob(VALUE self);
+VALUE str_setBlob(VALUE self, VALUE b);
+
+/*
+ * Readers report what they find through a plist_handler_t, one call per
+ * token, and never build a tree of their own. Every callback returns one
+ * of the PLIST_* codes below; PLIST_SKIP is only meaningful from
+ * begin_dict/begin_array and makes the reader step over that container
+ * without decoding anything inside it.
+ *
+ * Byte ranges passed to key/string/data are only valid for the duration
+ * of the call.
+ */
+enum {
+	PLIST_CONTINUE = 0,
+	PLIST_SKIP = 1,
+	PLIST_STOP = 2
+};
+
+typedef struct {
+	int (*begin_dict)(void *ctx);
+	int (*end_dict)(void *ctx);
+	int (*begin_array)(void *ctx);
+	int (*end_array)(void *ctx);
+	int (*key)(void *ctx, const char *bytes, long len);
+	int (*string)(void *ctx, const char *bytes, long len);
+	int (*data)(void *ctx, const char *bytes, long len);
+	int (*integer)(void *ctx, long long value);
+	int (*real)(void *ctx, double value);
+	int (*boolean)(void *ctx, int value);
+	int (*date)(void *ctx, double seconds); // relative to 2001-01-01 UTC
+	int (*unsigned_integer)(void *ctx, unsigned long long value); // above LLONG_MAX
+} plist_handler_t;
+
+typedef struct {
+	const char *message;
+	long offset;
+} plist_error_t;
+
+// Growable byte buffer that never calls into Ruby
+typedef struct {
+	char *ptr;
+	long len;
+	long capa;
+} plist_buf_t;
+
+void plist_buf_init(plist_buf_t *buf);
+int plist_buf_reserve(plist_buf_t *buf, long extra);
+int plist_buf_append(plist_buf_t *buf, const char *bytes, long len);
+int plist_buf_append_utf8(plist_buf_t *buf, unsigned long cp);
+void plist_buf_free(plist_buf_t *buf);
+
+long plist_error_position(const char *bytes, long len, plist_error_t *error, int *binary);
+VALUE plist_error_new(const char *message, long position, int binary);
+NORETURN(void plist_raise_error(const char *bytes, long len, plist_error_t *error));
+VALUE plist_str_new(const char *bytes, long len);
+
+#endif /* _PLIST_H_ */
@@ -0,0 +1,227 @@
+/*
+ * OSX::PropertyList.load_many support.
+ *
+ * Worker threads map and parse the files into plist_doc_t node arrays;
+ * none of that touches Ruby, so it runs with the GVL released. Turning
+ * the documents into Ruby objects (or lazy views of them) happens
+ * afterwards, back on the calling thread.
+ */
+
+#include "plist_batch.h"
+#include "plist_doc.h"
+#include "plist_file.h"
+#include "plist_ruby.h"
+#include "plist_lazy.h"
+#include "plist_stats.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+
+enum {
+	JOB_PENDING,                    // no worker has taken it yet
+	JOB_PARSED,
+	JOB_SYS_ERROR,                  // err_no is set
+	JOB_PARSE_ERROR,                // message and position are set
+	JOB_NO_MEMORY
+};
+
+typedef struct {
+	char *path;
+	int status;
+	int err_no;
+	const char *message;
+	long position;
+	int binary;
+	VALUE format;                   // what the file turned out to be, unless it couldn't be read
+	long len;
+	double seconds;                 // spent parsing it
+	plist_doc_t doc;
+} job_t;
+
+typedef struct {
+	job_t *jobs;
+	long count;
+	long next;
+	int cancelled;
+	pthread_mutex_t lock;
+} pool_t;
+
+static void run_job(job_t *job, plist_buf_t *scratch) {
+	plist_map_t map;
+	plist_error_t error;
+	plist_parse_fn parse;
+	if (plist_map_open(&map, job->path) < 0) {
+		job->status = JOB_SYS_ERROR;
+		job->err_no = errno;
+		return;
+	}
+	double start = plist_stats_now();
+	parse = plist_reader_for(map.bytes, map.len);
+	job->format = plist_reader_format(parse);
+	job->len = map.len;
+	if (parse(map.bytes, map.len, &plist_doc_handler, &job->doc, scratch, &error) < 0) {
+		job->status = JOB_PARSE_ERROR;
+		job->message = error.message;
+		job->position = plist_error_position(map.bytes, map.len, &error, &job->binary);
+	} else if (job->doc.failed) {
+		job->status = JOB_NO_MEMORY;
+	} else {
+		job->status = JOB_PARSED;
+	}
+	// The node array only needs its open-container stack while it is built
+	plist_buf_free(&job->doc.open);
+	plist_map_close(&map);
+	job->seconds = plist_stats_now() - start;
+}
+
+static void *worker(void *arg) {
+	pool_t *pool = arg;
+	plist_buf_t scratch;
+	plist_buf_init(&scratch);
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		long i = pool->cancelled ? pool->count : pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (i >= pool->count) break;
+		run_job(&pool->jobs[i], &scratch);
+	}
+	plist_buf_free(&scratch);
+	return NULL;
+}
+
+struct run_args {
+	pool_t *pool;
+	int threads;
+};
+
+// Runs the workers to completion; the calling thread is one of them
+static void *run_pool(void *arg) {
+	struct run_args *args = arg;
+	pthread_t *ids = malloc(sizeof(pthread_t) * args->threads);
+	int i, started = 0;
+	for (i = 1; ids && i < args->threads; i++) {
+		if (pthread_create(&ids[started], NULL, worker, args->pool) == 0) started++;
+	}
+	worker(args->pool);
+	for (i = 0; i < started; i++) pthread_join(ids[i], NULL);
+	free(ids);
+	return NULL;
+}
+
+// Interrupts (Thread#raise, ^C, a trapped signal) stop the workers from
+// taking new files
+static void cancel_pool(void *arg) {
+	pool_t *pool = arg;
+	pthread_mutex_lock(&pool->lock);
+	pool->cancelled = 1;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static VALUE convert(job_t *job, VALUE path, int lazy, plist_intern_t *intern) {
+	switch (job->status) {
+		case JOB_PARSED:
+			if (lazy) return plist_lazy_adopt(&job->doc);
+			return plist_doc_count(&job->doc) ? plist_doc_to_ruby(&job->doc, 0, intern) : Qnil;
+		case JOB_SYS_ERROR:
+			return rb_funcall(rb_eSystemCallError, rb_intern("new"), 2, path, INT2NUM(job->err_no));
+		case JOB_PARSE_ERROR:
+			return plist_error_new(job->message, job->position, job->binary);
+		default:
+			return rb_exc_new2(rb_eNoMemError, "failed to allocate memory");
+	}
+}
+
+struct batch_args {
+	VALUE paths;
+	int threads;
+	int lazy;
+	plist_intern_t *intern;
+	pool_t pool;
+};
+
+static VALUE batch_body(VALUE arg) {
+	struct batch_args *args = (struct batch_args *)arg;
+	pool_t *pool = &args->pool;
+	struct run_args run;
+	long i;
+	for (i = 0; i < pool->count; i++) {
+		pool->jobs[i].path = strdup(StringValueCStr(RARRAY_PTR(args->paths)[i]));
+		if (!pool->jobs[i].path) rb_memerror();
+	}
+	run.pool = pool;
+	run.threads = args->threads;
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+	// An interrupt that doesn't raise, like a signal with a trap that
+	// returns, lets the workers go on with the files left
+	for (;;) {
+		rb_thread_call_without_gvl(run_pool, &run, cancel_pool, pool);
+		if (!pool->cancelled) break;
+		rb_thread_check_ints();
+		if (pool->next >= pool->count) break;
+		pool->cancelled = 0;
+		run.threads = args->threads < pool->count - pool->next ? args->threads : (int)(pool->count - pool->next);
+	}
+#else
+	run_pool(&run);
+#endif
+	// Parsing is charged per file, at its own format, rather than the
+	// time the pool as a whole took
+	for (i = 0; i < pool->count; i++) {
+		job_t *job = &pool->jobs[i];
+		if (job->status == JOB_SYS_ERROR) continue;
+		plist_stats_load(job->format, job->len);
+		plist_stats_time(job->format, PLIST_PARSE, job->seconds);
+	}
+	plist_stats_phase(Qnil, PLIST_PARSE);
+	VALUE results = rb_ary_new2(pool->count);
+	for (i = 0; i < pool->count; i++) {
+		rb_ary_push(results, convert(&pool->jobs[i], RARRAY_PTR(args->paths)[i], args->lazy, args->intern));
+		plist_stats_phase(pool->jobs[i].status == JOB_PARSED ? pool->jobs[i].format : Qnil, PLIST_CONVERT);
+		// Free each document as soon as it has been converted
+		plist_doc_free(&pool->jobs[i].doc);
+	}
+	return results;
+}
+
+static VALUE batch_cleanup(VALUE arg) {
+	struct batch_args *args = (struct batch_args *)arg;
+	long i;
+	for (i = 0; i < args->pool.count; i++) {
+		free(args->pool.jobs[i].path);
+		plist_doc_free(&args->pool.jobs[i].doc);
+	}
+	free(args->pool.jobs);
+	pthread_mutex_destroy(&args->pool.lock);
+	return Qnil;
+}
+
+// Loads every file in +paths+ using up to +threads+ threads. Results are
+// in input order; files that fail give the exception instead of a value.
+// With +lazy+ set the parsed documents are returned as load_lazy views,
+// otherwise all of them take their keys from +intern+ unless it is NULL.
+VALUE plist_load_batch(VALUE paths, int threads, int lazy, plist_intern_t *intern) {
+	struct batch_args args;
+	long i;
+	paths = rb_ary_dup(rb_convert_type(paths, T_ARRAY, "Array", "to_ary"));
+	for (i = 0; i < RARRAY_LEN(paths); i++) {
+		VALUE path = RARRAY_PTR(paths)[i];
+		FilePathValue(path);
+		rb_ary_store(paths, i, path);
+	}
+	args.paths = paths;
+	args.lazy = lazy;
+	args.intern = intern;
+	args.threads = threads < 1 ? 1 : (threads > RARRAY_LEN(paths) ? (int)RARRAY_LEN(paths) : threads);
+	args.pool.count = RARRAY_LEN(paths);
+	args.pool.next = 0;
+	args.pool.cancelled = 0;
+	args.pool.jobs = calloc(args.pool.count ? args.pool.count : 1, sizeof(job_t));
+	if (!args.pool.jobs) rb_memerror();
+	for (i = 0; i < args.pool.count; i++) plist_doc_init(&args.pool.jobs[i].doc);
+	pthread_mutex_init(&args.pool.lock, NULL);
+	return rb_ensure(batch_body, (VALUE)&args, batch_cleanup, (VALUE)&args);
+}
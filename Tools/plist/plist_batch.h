@@ -0,0 +1,9 @@
+#ifndef _PLIST_BATCH_H_
+#define _PLIST_BATCH_H_
+
+#include "plist.h"
+#include "plist_intern.h"
+
+VALUE plist_load_batch(VALUE paths, int threads, int lazy, plist_intern_t *intern);
+
+#endif /* _PLIST_BATCH_H_ */
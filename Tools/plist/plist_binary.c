@@ -0,0 +1,954 @@
+/*
+ * Native reader and writer for binary (bplist00) property lists.
+ *
+ * Opening a bplist only validates the trailer and the bounds of the
+ * offset table; individual objects are located and checked when they
+ * are first reached. Strings referenced from several places come back
+ * as one shared, frozen String, the same way the writer deduplicated
+ * them.
+ */
+
+#include "plist_binary.h"
+#include "plist_ruby.h"
+#include "plist_stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long long read_be(const unsigned char *p, int n) {
+	unsigned long long value = 0;
+	int i;
+	for (i = 0; i < n; i++) value = (value << 8) | p[i];
+	return value;
+}
+
+static double read_double(const unsigned char *p, int n) {
+	if (n == 4) {
+		unsigned int bits = (unsigned int)read_be(p, 4);
+		float f;
+		memcpy(&f, &bits, 4);
+		return f;
+	} else {
+		unsigned long long bits = read_be(p, 8);
+		double d;
+		memcpy(&d, &bits, 8);
+		return d;
+	}
+}
+
+static int fail(plist_error_t *error, const char *message, long offset) {
+	error->message = message;
+	error->offset = offset;
+	return -1;
+}
+
+int plist_binary_detect(const char *bytes, long len) {
+	return len >= 8 && memcmp(bytes, "bplist00", 8) == 0;
+}
+
+// Validates the header, trailer and offset table bounds of a bplist00
+int plist_bplist_open(plist_bplist_t *bp, const char *bytes, long len, plist_error_t *error) {
+	const unsigned char *b = (const unsigned char *)bytes;
+	if (len < 8 + 1 + 1 + 32 || !plist_binary_detect(bytes, len)) return fail(error, "not a bplist00 file", 0);
+	const unsigned char *trailer = b + len - 32;
+	bp->bytes = b;
+	bp->len = len;
+	bp->offset_size = trailer[6];
+	bp->ref_size = trailer[7];
+	bp->num_objects = read_be(trailer + 8, 8);
+	bp->top_object = read_be(trailer + 16, 8);
+	unsigned long long table = read_be(trailer + 24, 8);
+	if (bp->offset_size < 1 || bp->offset_size > 8 || bp->ref_size < 1 || bp->ref_size > 8)
+		return fail(error, "invalid integer sizes in trailer", len - 32);
+	if (bp->num_objects == 0 || bp->top_object >= bp->num_objects)
+		return fail(error, "invalid object count in trailer", len - 32);
+	if (table < 9 || table > (unsigned long long)(len - 32))
+		return fail(error, "offset table out of range", len - 32);
+	if (bp->num_objects > ((unsigned long long)(len - 32) - table) / bp->offset_size)
+		return fail(error, "offset table out of range", len - 32);
+	if (bp->ref_size < 8 && bp->num_objects > (1ULL << (8 * bp->ref_size)))
+		return fail(error, "object references too narrow", len - 32);
+	bp->offset_table = b + table;
+	return 0;
+}
+
+// Returns the +i+th object reference of an array or dict body
+unsigned long long plist_bplist_ref(const plist_bplist_t *bp, const unsigned char *refs, unsigned long long i) {
+	return read_be(refs + i * bp->ref_size, bp->ref_size);
+}
+
+// Reads an extended count (marker 0x?F followed by an integer object)
+static int read_count(const plist_bplist_t *bp, const unsigned char **p, const unsigned char *limit, unsigned info, unsigned long long *count, plist_error_t *error) {
+	if (info != 0xF) {
+		*count = info;
+		return 0;
+	}
+	if (*p >= limit || (**p & 0xF0) != 0x10) return fail(error, "malformed object length", *p - bp->bytes);
+	int n = 1 << (**p & 0xF);
+	if (n > 8 || limit - (*p + 1) < n) return fail(error, "malformed object length", *p - bp->bytes);
+	*count = read_be(*p + 1, n);
+	*p += 1 + n;
+	return 0;
+}
+
+// Locates object +ref+ and decodes its header, checking it lies inside the file
+int plist_bplist_object(const plist_bplist_t *bp, unsigned long long ref, plist_bobject_t *obj, plist_error_t *error) {
+	if (ref >= bp->num_objects) return fail(error, "object reference out of range", 0);
+	unsigned long long offset = read_be(bp->offset_table + ref * bp->offset_size, bp->offset_size);
+	const unsigned char *limit = bp->offset_table;
+	if (offset < 8 || offset >= (unsigned long long)(limit - bp->bytes)) return fail(error, "object offset out of range", 0);
+	const unsigned char *p = bp->bytes + offset;
+	unsigned marker = *p++;
+	unsigned info = marker & 0xF;
+	unsigned long long unit = 1;
+	obj->count = 0;
+	obj->integer = 0;
+	obj->real = 0;
+	switch (marker >> 4) {
+		case 0x0:
+			if (marker == 0x00) {
+				obj->kind = PLIST_B_NULL;
+			} else if (marker == 0x08 || marker == 0x09) {
+				obj->kind = PLIST_B_BOOL;
+				obj->integer = marker == 0x09;
+			} else {
+				return fail(error, "unknown object type", (long)offset);
+			}
+			obj->body = p;
+			return 0;
+		case 0x1: {
+			int n = 1 << info;
+			if (n > 16 || limit - p < n) return fail(error, "malformed integer", (long)offset);
+			if (n == 16) {
+				// 128 bit integers only ever hold unsigned 64 bit values
+				if (read_be(p, 8) != 0) return fail(error, "integer out of range", (long)offset);
+				p += 8;
+				n = 8;
+				obj->kind = PLIST_B_UINT;
+			} else {
+				obj->kind = PLIST_B_INT;
+			}
+			obj->integer = (long long)read_be(p, n);
+			if (obj->kind == PLIST_B_UINT && obj->integer >= 0) obj->kind = PLIST_B_INT;
+			obj->body = p;
+			return 0;
+		}
+		case 0x2:
+		case 0x3: {
+			int n = 1 << info;
+			if ((n != 4 && n != 8) || (marker >> 4 == 0x3 && n != 8) || limit - p < n)
+				return fail(error, "malformed real", (long)offset);
+			obj->kind = (marker >> 4 == 0x2) ? PLIST_B_REAL : PLIST_B_DATE;
+			obj->real = read_double(p, n);
+			obj->body = p;
+			return 0;
+		}
+		case 0x4: obj->kind = PLIST_B_DATA; break;
+		case 0x5: obj->kind = PLIST_B_ASCII; break;
+		case 0x6: obj->kind = PLIST_B_UTF16; unit = 2; break;
+		case 0x7: obj->kind = PLIST_B_UTF8; break;
+		case 0x8: {
+			int n = info + 1;
+			if (n > 8 || limit - p < n) return fail(error, "malformed uid", (long)offset);
+			obj->kind = PLIST_B_UID;
+			obj->integer = (long long)read_be(p, n);
+			obj->body = p;
+			return 0;
+		}
+		case 0xA:
+		case 0xC: obj->kind = PLIST_B_ARRAY; unit = bp->ref_size; break;
+		case 0xD: obj->kind = PLIST_B_DICT; unit = 2 * bp->ref_size; break;
+		default:
+			return fail(error, "unknown object type", (long)offset);
+	}
+	if (read_count(bp, &p, limit, info, &obj->count, error) < 0) return -1;
+	if (obj->count > (unsigned long long)(limit - p) / unit) return fail(error, "object extends past the object table", (long)offset);
+	obj->body = p;
+	return 0;
+}
+
+// Appends UTF-16BE text as UTF-8, replacing unpaired surrogates with U+FFFD
+int plist_utf16_to_utf8(const unsigned char *units, unsigned long long count, plist_buf_t *out) {
+	unsigned long long i;
+	if (plist_buf_reserve(out, (long)(count * 3)) < 0) return -1;
+	for (i = 0; i < count; i++) {
+		unsigned long cp = ((unsigned long)units[2 * i] << 8) | units[2 * i + 1];
+		if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < count) {
+			unsigned long lo = ((unsigned long)units[2 * i + 2] << 8) | units[2 * i + 3];
+			if (lo >= 0xDC00 && lo <= 0xDFFF) {
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+				i++;
+			} else {
+				cp = 0xFFFD;
+			}
+		} else if (cp >= 0xD800 && cp <= 0xDFFF) {
+			cp = 0xFFFD;
+		}
+		char *d = out->ptr + out->len;
+		if (cp < 0x80) {
+			d[0] = (char)cp;
+			out->len += 1;
+		} else if (cp < 0x800) {
+			d[0] = (char)(0xC0 | (cp >> 6));
+			d[1] = (char)(0x80 | (cp & 0x3F));
+			out->len += 2;
+		} else if (cp < 0x10000) {
+			d[0] = (char)(0xE0 | (cp >> 12));
+			d[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+			d[2] = (char)(0x80 | (cp & 0x3F));
+			out->len += 3;
+		} else {
+			// a surrogate pair is two units, so it still fits in 6 reserved bytes
+			d[0] = (char)(0xF0 | (cp >> 18));
+			d[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+			d[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+			d[3] = (char)(0x80 | (cp & 0x3F));
+			out->len += 4;
+		}
+	}
+	return 0;
+}
+
+// Replaying a bplist as reader events
+
+typedef struct {
+	plist_bplist_t bp;
+	const plist_handler_t *handler;
+	void *ctx;
+	plist_buf_t *scratch;
+	plist_error_t *error;
+	int stopped;
+	unsigned long long path[PLIST_MAX_DEPTH + 1];
+} binary_parser_t;
+
+#define EMIT(ps, call) do {								\
+		if ((call) == PLIST_STOP) {						\
+			(ps)->stopped = 1;							\
+			return -1;									\
+		}												\
+	} while (0)
+
+static int walk(binary_parser_t *ps, unsigned long long ref, int depth, int is_key) {
+	const plist_handler_t *h = ps->handler;
+	plist_bobject_t obj;
+	unsigned long long i;
+	int d, rc;
+	if (depth > PLIST_MAX_DEPTH) return fail(ps->error, "nesting too deep", 0);
+	if (plist_bplist_object(&ps->bp, ref, &obj, ps->error) < 0) return -1;
+	long offset = (long)(obj.body - ps->bp.bytes);
+	if (is_key && obj.kind != PLIST_B_ASCII && obj.kind != PLIST_B_UTF16 && obj.kind != PLIST_B_UTF8)
+		return fail(ps->error, "dictionary key is not a string", offset);
+	switch (obj.kind) {
+		case PLIST_B_NULL: return fail(ps->error, "unsupported null object", offset);
+		case PLIST_B_BOOL: EMIT(ps, h->boolean(ps->ctx, (int)obj.integer)); return 0;
+		case PLIST_B_INT:
+		case PLIST_B_UID: EMIT(ps, h->integer(ps->ctx, obj.integer)); return 0;
+		case PLIST_B_UINT: EMIT(ps, h->unsigned_integer(ps->ctx, (unsigned long long)obj.integer)); return 0;
+		case PLIST_B_REAL: EMIT(ps, h->real(ps->ctx, obj.real)); return 0;
+		case PLIST_B_DATE: EMIT(ps, h->date(ps->ctx, obj.real)); return 0;
+		case PLIST_B_DATA: EMIT(ps, h->data(ps->ctx, (const char *)obj.body, (long)obj.count)); return 0;
+		case PLIST_B_ASCII:
+		case PLIST_B_UTF16:
+		case PLIST_B_UTF8: {
+			const char *bytes = (const char *)obj.body;
+			long len = (long)obj.count;
+			if (obj.kind == PLIST_B_UTF16) {
+				ps->scratch->len = 0;
+				if (plist_utf16_to_utf8(obj.body, obj.count, ps->scratch) < 0) return fail(ps->error, "out of memory", offset);
+				bytes = ps->scratch->ptr;
+				len = ps->scratch->len;
+			}
+			EMIT(ps, is_key ? h->key(ps->ctx, bytes, len) : h->string(ps->ctx, bytes, len));
+			return 0;
+		}
+		default:
+			break;
+	}
+	for (d = 0; d < depth; d++) {
+		if (ps->path[d] == ref) return fail(ps->error, "reference cycle", offset);
+	}
+	ps->path[depth] = ref;
+	int is_dict = obj.kind == PLIST_B_DICT;
+	rc = is_dict ? h->begin_dict(ps->ctx) : h->begin_array(ps->ctx);
+	if (rc == PLIST_STOP) {
+		ps->stopped = 1;
+		return -1;
+	}
+	if (rc == PLIST_SKIP) return 0;
+	for (i = 0; i < obj.count; i++) {
+		if (is_dict && walk(ps, plist_bplist_ref(&ps->bp, obj.body, i), depth + 1, 1) < 0) return -1;
+		if (walk(ps, plist_bplist_ref(&ps->bp, obj.body, is_dict ? obj.count + i : i), depth + 1, 0) < 0) return -1;
+	}
+	EMIT(ps, is_dict ? h->end_dict(ps->ctx) : h->end_array(ps->ctx));
+	return 0;
+}
+
+// Reports the objects reachable from the top of a bplist00 to +handler+.
+// Null objects have no event and are rejected, as they are by load.
+int plist_binary_parse(const char *bytes, long len, const plist_handler_t *handler, void *ctx, plist_buf_t *scratch, plist_error_t *error) {
+	binary_parser_t ps;
+	if (plist_bplist_open(&ps.bp, bytes, len, error) < 0) return -1;
+	ps.handler = handler;
+	ps.ctx = ctx;
+	ps.scratch = scratch;
+	ps.error = error;
+	ps.stopped = 0;
+	if (walk(&ps, ps.bp.top_object, 0, 0) < 0) return ps.stopped ? 0 : -1;
+	return 0;
+}
+
+// Loading into Ruby objects
+
+typedef struct {
+	plist_bplist_t bp;
+	VALUE strings;
+	plist_intern_t *intern;
+	VALUE owner;                    // of the mapping data Strings may share, or Qnil
+	long shared;                    // data Strings sharing it
+	plist_buf_t scratch;
+	unsigned long long path[PLIST_MAX_DEPTH + 1];
+} binary_loader_t;
+
+static void raise_binary_error(plist_error_t *error) {
+	rb_raise(ePropertyListError, "Malformed binary property list: %s at offset %ld", error->message, error->offset);
+}
+
+static VALUE decode(binary_loader_t *l, unsigned long long ref, int depth, int is_key);
+
+// Records +ref+ as the container being decoded at +depth+, rejecting cycles
+static void enter_container(binary_loader_t *l, unsigned long long ref, int depth) {
+	int i;
+	for (i = 0; i < depth; i++) {
+		if (l->path[i] == ref) rb_raise(ePropertyListError, "Malformed binary property list: reference cycle");
+	}
+	l->path[depth] = ref;
+}
+
+// Strings are remembered by object reference so repeats share one frozen String
+static VALUE decode_string(binary_loader_t *l, unsigned long long ref, plist_bobject_t *obj, int is_key) {
+	VALUE memo_key = ULL2NUM(ref);
+	VALUE str;
+	if (is_key && l->intern) {
+		if (obj->kind != PLIST_B_UTF16) return plist_intern_key(l->intern, (const char *)obj->body, (long)obj->count);
+		l->scratch.len = 0;
+		if (plist_utf16_to_utf8(obj->body, obj->count, &l->scratch) < 0) rb_raise(rb_eNoMemError, "failed to allocate memory");
+		return plist_intern_key(l->intern, l->scratch.ptr, l->scratch.len);
+	}
+	if (NIL_P(l->strings)) {
+		l->strings = rb_hash_new();
+	} else {
+		str = rb_hash_lookup(l->strings, memo_key);
+		if (!NIL_P(str)) {
+			if (!OBJ_FROZEN(str)) rb_obj_freeze(str);
+			return str;
+		}
+	}
+	if (obj->kind == PLIST_B_UTF16) {
+		l->scratch.len = 0;
+		if (plist_utf16_to_utf8(obj->body, obj->count, &l->scratch) < 0) rb_raise(rb_eNoMemError, "failed to allocate memory");
+		str = plist_str_new(l->scratch.ptr, l->scratch.len);
+	} else {
+		str = plist_str_new((const char *)obj->body, (long)obj->count);
+	}
+	// Hash#[]= would freeze a copy of a key anyway, so freeze it right away
+	if (is_key) rb_obj_freeze(str);
+	rb_hash_aset(l->strings, memo_key, str);
+	return str;
+}
+
+static VALUE decode(binary_loader_t *l, unsigned long long ref, int depth, int is_key) {
+	plist_bobject_t obj;
+	plist_error_t error;
+	unsigned long long i;
+	if (depth > PLIST_MAX_DEPTH) rb_raise(ePropertyListError, "Malformed binary property list: nesting too deep");
+	if (plist_bplist_object(&l->bp, ref, &obj, &error) < 0) raise_binary_error(&error);
+	if (is_key && obj.kind != PLIST_B_ASCII && obj.kind != PLIST_B_UTF16 && obj.kind != PLIST_B_UTF8)
+		rb_raise(ePropertyListError, "Malformed binary property list: dictionary key is not a string");
+	switch (obj.kind) {
+		case PLIST_B_NULL: rb_raise(ePropertyListError, "Malformed binary property list: unsupported null object");
+		case PLIST_B_BOOL:
+			PLIST_COUNT(PLIST_OBJ_BOOLEAN);
+			return obj.integer ? Qtrue : Qfalse;
+		case PLIST_B_INT:
+		case PLIST_B_UID:
+			PLIST_COUNT(PLIST_OBJ_INTEGER);
+			return LL2NUM(obj.integer);
+		case PLIST_B_UINT:
+			PLIST_COUNT(PLIST_OBJ_INTEGER);
+			return ULL2NUM((unsigned long long)obj.integer);
+		case PLIST_B_REAL:
+			PLIST_COUNT(PLIST_OBJ_REAL);
+			return rb_float_new(obj.real);
+		case PLIST_B_DATE:
+			PLIST_COUNT(PLIST_OBJ_DATE);
+			return rb_funcall(timeEpoch, id_plus, 1, rb_float_new(obj.real));
+		case PLIST_B_DATA: {
+			VALUE str;
+			PLIST_COUNT(PLIST_OBJ_DATA);
+#ifdef HAVE_RB_STR_NEW_STATIC
+			if (!NIL_P(l->owner) && obj.count >= PLIST_SHARE_MIN) {
+				// Ruby copies a static String before modifying it, so the
+				// read-only pages are never written; the hidden ivar keeps
+				// them mapped for as long as the String points at them
+				str = rb_str_new_static((const char *)obj.body, (long)obj.count);
+				rb_ivar_set(str, id_mapping, l->owner);
+				l->shared++;
+			} else
+#endif
+			str = rb_str_new((const char *)obj.body, (long)obj.count);
+			str_setBlob(str, Qtrue);
+			return str;
+		}
+		case PLIST_B_ASCII:
+		case PLIST_B_UTF16:
+		case PLIST_B_UTF8:
+			PLIST_COUNT(is_key ? PLIST_OBJ_KEY : PLIST_OBJ_STRING);
+			return decode_string(l, ref, &obj, is_key);
+		case PLIST_B_ARRAY: {
+			VALUE array = rb_ary_new2((long)obj.count);
+			PLIST_COUNT(PLIST_OBJ_ARRAY);
+			enter_container(l, ref, depth);
+			for (i = 0; i < obj.count; i++) {
+				rb_ary_push(array, decode(l, plist_bplist_ref(&l->bp, obj.body, i), depth + 1, 0));
+			}
+			return array;
+		}
+		default: {
+			VALUE hash = rb_hash_new();
+			PLIST_COUNT(PLIST_OBJ_DICT);
+			enter_container(l, ref, depth);
+			for (i = 0; i < obj.count; i++) {
+				VALUE key = decode(l, plist_bplist_ref(&l->bp, obj.body, i), depth + 1, 1);
+				VALUE value = decode(l, plist_bplist_ref(&l->bp, obj.body, obj.count + i), depth + 1, 0);
+				rb_hash_aset(hash, key, value);
+			}
+			return hash;
+		}
+	}
+}
+
+static VALUE load_body(VALUE arg) {
+	binary_loader_t *l = (binary_loader_t *)arg;
+	return decode(l, l->bp.top_object, 0, 0);
+}
+
+static VALUE load_cleanup(VALUE arg) {
+	binary_loader_t *l = (binary_loader_t *)arg;
+	plist_buf_free(&l->scratch);
+	return Qnil;
+}
+
+// Decodes a bplist00 document, visiting only objects reachable from the
+// top; keys come from +intern+ unless it is NULL. Large data objects
+// point into +bytes+ rather than being copied when +owner+ is an object
+// keeping them alive, and *shared counts them; pass Qnil and NULL to
+// copy everything.
+VALUE plist_binary_load(const char *bytes, long len, plist_intern_t *intern, VALUE owner, long *shared) {
+	binary_loader_t l;
+	plist_error_t error;
+	if (plist_bplist_open(&l.bp, bytes, len, &error) < 0) raise_binary_error(&error);
+	l.strings = Qnil;
+	l.intern = intern;
+	l.owner = owner;
+	l.shared = 0;
+	plist_buf_init(&l.scratch);
+	VALUE obj = rb_ensure(load_body, (VALUE)&l, load_cleanup, (VALUE)&l);
+	if (shared) *shared = l.shared;
+	return obj;
+}
+
+/*
+ * Writer. The handler builds the object table in memory: scalars are
+ * encoded as soon as they arrive and deduplicated on their encoded bytes,
+ * containers keep the object numbers of their members. Reference and
+ * offset widths are only known once the whole table exists, so the
+ * containers are encoded while the table is written out.
+ */
+
+typedef struct {
+	unsigned char marker;           // 0xA0/0xD0 for containers, 0 for scalars
+	long start;                     // offset into encoded, or index into refs
+	long count;                     // encoded length, or number of members
+} bw_object_t;
+
+typedef struct {
+	long object;
+	long pending;
+} bw_frame_t;
+
+#define BW_OBJECTS(w) ((bw_object_t *)(w)->objects.ptr)
+#define BW_COUNT(buf, type) ((buf).len / (long)sizeof(type))
+
+static int bw_fail(plist_binary_writer_t *w, const char *message) {
+	if (!w->error) w->error = message;
+	return PLIST_STOP;
+}
+
+static unsigned long bw_hash(const unsigned char *bytes, long len) {
+	unsigned long long h = 14695981039346656037ULL;
+	long i;
+	for (i = 0; i < len; i++) h = (h ^ bytes[i]) * 1099511628211ULL;
+	return (unsigned long)(h ^ (h >> 32));
+}
+
+static int bw_grow_table(plist_binary_writer_t *w) {
+	long capa = w->table_capa ? w->table_capa * 2 : 256, i;
+	long *table = calloc(capa, sizeof(long));
+	if (!table) return -1;
+	for (i = 0; i < w->table_capa; i++) {
+		if (!w->table[i]) continue;
+		bw_object_t *obj = &BW_OBJECTS(w)[w->table[i] - 1];
+		unsigned long slot = bw_hash((unsigned char *)w->encoded.ptr + obj->start, obj->count) & (capa - 1);
+		while (table[slot]) slot = (slot + 1) & (capa - 1);
+		table[slot] = w->table[i];
+	}
+	free(w->table);
+	w->table = table;
+	w->table_capa = capa;
+	return 0;
+}
+
+static int bw_push(plist_binary_writer_t *w, long object) {
+	if (plist_buf_append(&w->pending, (const char *)&object, sizeof(long)) < 0) return bw_fail(w, "out of memory");
+	return PLIST_CONTINUE;
+}
+
+static long bw_new_object(plist_binary_writer_t *w, unsigned char marker, long start, long count) {
+	bw_object_t obj;
+	obj.marker = marker;
+	obj.start = start;
+	obj.count = count;
+	if (plist_buf_append(&w->objects, (const char *)&obj, sizeof(obj)) < 0) return -1;
+	return BW_COUNT(w->objects, bw_object_t) - 1;
+}
+
+// Adds the scalar encoded in w->scratch, reusing an identical earlier one
+static int bw_scalar(plist_binary_writer_t *w) {
+	const unsigned char *bytes = (const unsigned char *)w->scratch.ptr;
+	long len = w->scratch.len;
+	if (w->error) return PLIST_STOP;
+	if ((w->table_used + 1) * 2 > w->table_capa && bw_grow_table(w) < 0) return bw_fail(w, "out of memory");
+	unsigned long slot = bw_hash(bytes, len) & (w->table_capa - 1);
+	while (w->table[slot]) {
+		bw_object_t *obj = &BW_OBJECTS(w)[w->table[slot] - 1];
+		if (obj->count == len && memcmp(w->encoded.ptr + obj->start, bytes, len) == 0) return bw_push(w, w->table[slot] - 1);
+		slot = (slot + 1) & (w->table_capa - 1);
+	}
+	long object = bw_new_object(w, 0, w->encoded.len, len);
+	if (object < 0 || plist_buf_append(&w->encoded, (const char *)bytes, len) < 0) return bw_fail(w, "out of memory");
+	w->table[slot] = object + 1;
+	w->table_used++;
+	return bw_push(w, object);
+}
+
+// Encodes an integer object, returns its length
+static int bw_encode_int(unsigned char *p, long long value) {
+	int n, i;
+	if (value < 0 || value > 0xFFFFFFFFLL) {
+		p[0] = 0x13;
+		n = 8;
+	} else if (value > 0xFFFF) {
+		p[0] = 0x12;
+		n = 4;
+	} else if (value > 0xFF) {
+		p[0] = 0x11;
+		n = 2;
+	} else {
+		p[0] = 0x10;
+		n = 1;
+	}
+	for (i = 0; i < n; i++) p[n - i] = (unsigned char)((unsigned long long)value >> (8 * i));
+	return n + 1;
+}
+
+// Encodes an object marker with its count, returns its length
+static int bw_encode_header(unsigned char *p, unsigned char marker, long count) {
+	if (count < 15) {
+		p[0] = marker | (unsigned char)count;
+		return 1;
+	}
+	p[0] = marker | 0xF;
+	return 1 + bw_encode_int(p + 1, count);
+}
+
+static int bw_header(plist_binary_writer_t *w, unsigned char marker, long count, long payload) {
+	w->scratch.len = 0;
+	if (plist_buf_reserve(&w->scratch, 10 + payload) < 0) return -1;
+	w->scratch.len = bw_encode_header((unsigned char *)w->scratch.ptr, marker, count);
+	return 0;
+}
+
+static int bw_begin(plist_binary_writer_t *w, unsigned char marker) {
+	bw_frame_t frame;
+	if (w->error) return PLIST_STOP;
+	frame.object = bw_new_object(w, marker, 0, 0);
+	if (frame.object < 0) return bw_fail(w, "out of memory");
+	if (w->frames.len && bw_push(w, frame.object) == PLIST_STOP) return PLIST_STOP;
+	frame.pending = BW_COUNT(w->pending, long);
+	if (plist_buf_append(&w->frames, (const char *)&frame, sizeof(frame)) < 0) return bw_fail(w, "out of memory");
+	return PLIST_CONTINUE;
+}
+
+static int bw_end(void *ctx) {
+	plist_binary_writer_t *w = ctx;
+	if (w->error) return PLIST_STOP;
+	bw_frame_t frame = ((bw_frame_t *)w->frames.ptr)[BW_COUNT(w->frames, bw_frame_t) - 1];
+	long *members = (long *)w->pending.ptr + frame.pending;
+	long n = BW_COUNT(w->pending, long) - frame.pending, i;
+	bw_object_t *obj = &BW_OBJECTS(w)[frame.object];
+	w->frames.len -= sizeof(bw_frame_t);
+	obj->start = BW_COUNT(w->refs, long);
+	if (obj->marker == 0xD0) {
+		// Pending holds key, value, key, value; the table wants keys first
+		if (n % 2) return bw_fail(w, "dictionary key without a value");
+		obj->count = n / 2;
+		if (plist_buf_reserve(&w->refs, n * sizeof(long)) < 0) return bw_fail(w, "out of memory");
+		long *refs = (long *)(w->refs.ptr + w->refs.len);
+		for (i = 0; i < n / 2; i++) {
+			refs[i] = members[2 * i];
+			refs[n / 2 + i] = members[2 * i + 1];
+		}
+		w->refs.len += n * sizeof(long);
+	} else {
+		obj->count = n;
+		if (plist_buf_append(&w->refs, (const char *)members, n * sizeof(long)) < 0) return bw_fail(w, "out of memory");
+	}
+	w->pending.len = frame.pending * sizeof(long);
+	return PLIST_CONTINUE;
+}
+
+static int bw_begin_dict(void *ctx) {
+	return bw_begin(ctx, 0xD0);
+}
+
+static int bw_begin_array(void *ctx) {
+	return bw_begin(ctx, 0xA0);
+}
+
+// Strings are stored as ASCII when possible and as UTF-16BE otherwise
+static int bw_string(void *ctx, const char *bytes, long len) {
+	plist_binary_writer_t *w = ctx;
+	const unsigned char *s = (const unsigned char *)bytes;
+	long i, units = 0;
+	if (w->error) return PLIST_STOP;
+	for (i = 0; i < len && s[i] < 0x80; i++);
+	if (i == len) {
+		if (bw_header(w, 0x50, len, len) < 0) return bw_fail(w, "out of memory");
+		memcpy(w->scratch.ptr + w->scratch.len, bytes, len);
+		w->scratch.len += len;
+		return bw_scalar(w);
+	}
+	// Every input byte yields at most one UTF-16 unit (two bytes)
+	plist_buf_t *out = &w->scratch;
+	out->len = 0;
+	if (plist_buf_reserve(out, 10 + 2 * len) < 0) return bw_fail(w, "out of memory");
+	unsigned char *u = (unsigned char *)out->ptr + 10;
+	for (i = 0; i < len;) {
+		unsigned long cp = s[i];
+		int n;
+		if (cp < 0x80) n = 1;
+		else if ((cp & 0xE0) == 0xC0) { n = 2; cp &= 0x1F; }
+		else if ((cp & 0xF0) == 0xE0) { n = 3; cp &= 0x0F; }
+		else if ((cp & 0xF8) == 0xF0) { n = 4; cp &= 0x07; }
+		else return bw_fail(w, "string is not valid UTF-8");
+		if (i + n > len) return bw_fail(w, "string is not valid UTF-8");
+		int k;
+		for (k = 1; k < n; k++) {
+			if ((s[i + k] & 0xC0) != 0x80) return bw_fail(w, "string is not valid UTF-8");
+			cp = (cp << 6) | (s[i + k] & 0x3F);
+		}
+		if ((n == 2 && cp < 0x80) || (n == 3 && cp < 0x800) || (n == 4 && cp < 0x10000) ||
+			cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+			return bw_fail(w, "string is not valid UTF-8");
+		if (cp >= 0x10000) {
+			cp -= 0x10000;
+			unsigned long hi = 0xD800 | (cp >> 10), lo = 0xDC00 | (cp & 0x3FF);
+			u[2 * units] = (unsigned char)(hi >> 8); u[2 * units + 1] = (unsigned char)hi;
+			u[2 * units + 2] = (unsigned char)(lo >> 8); u[2 * units + 3] = (unsigned char)lo;
+			units += 2;
+		} else {
+			u[2 * units] = (unsigned char)(cp >> 8); u[2 * units + 1] = (unsigned char)cp;
+			units++;
+		}
+		i += n;
+	}
+	// Slide the header in front of the units now that their number is known
+	unsigned char header[10];
+	int h = bw_encode_header(header, 0x60, units);
+	memmove(out->ptr + h, u, 2 * units);
+	memcpy(out->ptr, header, h);
+	out->len = h + 2 * units;
+	return bw_scalar(w);
+}
+
+static int bw_data(void *ctx, const char *bytes, long len) {
+	plist_binary_writer_t *w = ctx;
+	if (w->error) return PLIST_STOP;
+	if (bw_header(w, 0x40, len, len) < 0) return bw_fail(w, "out of memory");
+	memcpy(w->scratch.ptr + w->scratch.len, bytes, len);
+	w->scratch.len += len;
+	return bw_scalar(w);
+}
+
+static int bw_integer(void *ctx, long long value) {
+	plist_binary_writer_t *w = ctx;
+	if (w->error) return PLIST_STOP;
+	w->scratch.len = 0;
+	if (plist_buf_reserve(&w->scratch, 9) < 0) return bw_fail(w, "out of memory");
+	w->scratch.len = bw_encode_int((unsigned char *)w->scratch.ptr, value);
+	return bw_scalar(w);
+}
+
+// Integers above LLONG_MAX take a 128-bit object, as CoreFoundation writes them
+static int bw_unsigned_integer(void *ctx, unsigned long long value) {
+	plist_binary_writer_t *w = ctx;
+	int i;
+	if (w->error) return PLIST_STOP;
+	w->scratch.len = 0;
+	if (plist_buf_reserve(&w->scratch, 17) < 0) return bw_fail(w, "out of memory");
+	memset(w->scratch.ptr, 0, 17);
+	w->scratch.ptr[0] = (char)0x14;
+	for (i = 0; i < 8; i++) w->scratch.ptr[16 - i] = (char)(value >> (8 * i));
+	w->scratch.len = 17;
+	return bw_scalar(w);
+}
+
+static int bw_double(plist_binary_writer_t *w, unsigned char marker, double value) {
+	unsigned long long bits;
+	int i;
+	if (w->error) return PLIST_STOP;
+	w->scratch.len = 0;
+	if (plist_buf_reserve(&w->scratch, 9) < 0) return bw_fail(w, "out of memory");
+	memcpy(&bits, &value, 8);
+	w->scratch.ptr[0] = (char)marker;
+	for (i = 0; i < 8; i++) w->scratch.ptr[8 - i] = (char)(bits >> (8 * i));
+	w->scratch.len = 9;
+	return bw_scalar(w);
+}
+
+static int bw_real(void *ctx, double value) {
+	return bw_double(ctx, 0x23, value);
+}
+
+static int bw_date(void *ctx, double seconds) {
+	return bw_double(ctx, 0x33, seconds);
+}
+
+static int bw_boolean(void *ctx, int value) {
+	plist_binary_writer_t *w = ctx;
+	if (w->error) return PLIST_STOP;
+	w->scratch.len = 0;
+	if (plist_buf_reserve(&w->scratch, 1) < 0) return bw_fail(w, "out of memory");
+	w->scratch.ptr[0] = value ? 0x09 : 0x08;
+	w->scratch.len = 1;
+	return bw_scalar(w);
+}
+
+const plist_handler_t plist_binary_writer_handler = {
+	bw_begin_dict, bw_end, bw_begin_array, bw_end,
+	bw_string, bw_string, bw_data, bw_integer, bw_real, bw_boolean, bw_date, bw_unsigned_integer
+};
+
+void plist_binary_writer_init(plist_binary_writer_t *writer) {
+	plist_buf_init(&writer->objects);
+	plist_buf_init(&writer->encoded);
+	plist_buf_init(&writer->refs);
+	plist_buf_init(&writer->pending);
+	plist_buf_init(&writer->frames);
+	plist_buf_init(&writer->scratch);
+	writer->table = NULL;
+	writer->table_capa = 0;
+	writer->table_used = 0;
+	writer->offsets = NULL;
+	writer->chunk = NULL;
+	writer->error = NULL;
+}
+
+void plist_binary_writer_free(plist_binary_writer_t *writer) {
+	plist_buf_free(&writer->objects);
+	plist_buf_free(&writer->encoded);
+	plist_buf_free(&writer->refs);
+	plist_buf_free(&writer->pending);
+	plist_buf_free(&writer->frames);
+	plist_buf_free(&writer->scratch);
+	free(writer->table);
+	writer->table = NULL;
+	writer->table_capa = 0;
+	writer->table_used = 0;
+	free(writer->offsets);
+	writer->offsets = NULL;
+	free(writer->chunk);
+	writer->chunk = NULL;
+}
+
+typedef struct {
+	char *chunk;
+	long len;
+	long capa;
+	long total;
+	plist_flush_fn flush;
+	void *ctx;
+} bw_out_t;
+
+static int bw_flush(bw_out_t *out) {
+	if (out->len && out->flush(out->ctx, out->chunk, out->len) < 0) return -1;
+	out->total += out->len;
+	out->len = 0;
+	return 0;
+}
+
+static int bw_write(bw_out_t *out, const void *bytes, long len) {
+	const char *p = bytes;
+	while (len > 0) {
+		long n = out->capa - out->len;
+		if (n > len) n = len;
+		memcpy(out->chunk + out->len, p, n);
+		out->len += n;
+		p += n;
+		len -= n;
+		if (out->len == out->capa && bw_flush(out) < 0) return -1;
+	}
+	return 0;
+}
+
+static int bw_write_be(bw_out_t *out, unsigned long long value, int n) {
+	unsigned char bytes[8];
+	int i;
+	for (i = 0; i < n; i++) bytes[n - 1 - i] = (unsigned char)(value >> (8 * i));
+	return bw_write(out, bytes, n);
+}
+
+// The smallest of 1, 2, 4 or 8 bytes that can hold +value+
+static int bw_width(unsigned long long value) {
+	if (value <= 0xFF) return 1;
+	if (value <= 0xFFFF) return 2;
+	if (value <= 0xFFFFFFFFULL) return 4;
+	return 8;
+}
+
+static int bw_write_table(plist_binary_writer_t *w, bw_out_t *out, unsigned long long *offsets) {
+	bw_object_t *objects = BW_OBJECTS(w);
+	long *refs = (long *)w->refs.ptr;
+	long n = BW_COUNT(w->objects, bw_object_t), i, j;
+	int ref_size = bw_width(n);
+	if (bw_write(out, "bplist00", 8) < 0) return -1;
+	for (i = 0; i < n; i++) {
+		bw_object_t *obj = &objects[i];
+		offsets[i] = out->total + out->len;
+		if (!obj->marker) {
+			if (bw_write(out, w->encoded.ptr + obj->start, obj->count) < 0) return -1;
+			continue;
+		}
+		unsigned char header[10];
+		long members = obj->marker == 0xD0 ? 2 * obj->count : obj->count;
+		if (bw_write(out, header, bw_encode_header(header, obj->marker, obj->count)) < 0) return -1;
+		for (j = 0; j < members; j++) {
+			if (bw_write_be(out, refs[obj->start + j], ref_size) < 0) return -1;
+		}
+	}
+	unsigned long long table = out->total + out->len;
+	int offset_size = bw_width(table);
+	for (i = 0; i < n; i++) {
+		if (bw_write_be(out, offsets[i], offset_size) < 0) return -1;
+	}
+	unsigned char trailer[8] = {0, 0, 0, 0, 0, 0, (unsigned char)offset_size, (unsigned char)ref_size};
+	if (bw_write(out, trailer, 8) < 0 || bw_write_be(out, n, 8) < 0 ||
+		bw_write_be(out, 0, 8) < 0 || bw_write_be(out, table, 8) < 0) return -1;
+	return bw_flush(out);
+}
+
+// Writes the collected object table, handing it to +flush+ in pieces of
+// at most +chunk+ bytes. Returns -1 with writer->error set on failure.
+// +flush+ may raise: the buffers are freed with the writer.
+int plist_binary_writer_finish(plist_binary_writer_t *writer, long chunk, plist_flush_fn flush, void *ctx, long *written) {
+	bw_out_t out;
+	if (writer->error) return -1;
+	if (writer->frames.len || !writer->objects.len) {
+		writer->error = "incomplete property list";
+		return -1;
+	}
+	writer->offsets = malloc(BW_COUNT(writer->objects, bw_object_t) * sizeof(unsigned long long));
+	writer->chunk = malloc(chunk);
+	out.chunk = writer->chunk;
+	out.len = 0;
+	out.capa = chunk;
+	out.total = 0;
+	out.flush = flush;
+	out.ctx = ctx;
+	int rc = -1;
+	if (!writer->offsets || !writer->chunk) writer->error = "out of memory";
+	else if ((rc = bw_write_table(writer, &out, writer->offsets)) < 0) writer->error = "write failed";
+	*written = out.total;
+	return rc;
+}
+
+struct dump_args {
+	plist_source_fn source;
+	void *src;
+	VALUE out;
+	long chunk;
+	plist_binary_writer_t writer;
+	long written;
+};
+
+static int flush_to_ruby(void *ctx, const char *bytes, long len) {
+	struct dump_args *args = ctx;
+	if (TYPE(args->out) == T_STRING) {
+		rb_str_buf_cat(args->out, bytes, len);
+		return 0;
+	}
+	// A String of its own, as the IO may keep it
+	rb_funcall(args->out, id_write, 1, rb_str_new(bytes, len));
+	return 0;
+}
+
+static VALUE dump_body(VALUE arg) {
+	struct dump_args *args = (struct dump_args *)arg;
+	args->source(args->src, &plist_binary_writer_handler, &args->writer);
+	if (plist_binary_writer_finish(&args->writer, args->chunk, flush_to_ruby, args, &args->written) < 0) {
+		if (strcmp(args->writer.error, "out of memory") == 0) rb_memerror();
+		rb_raise(rb_eArgError, "Could not write binary property list: %s", args->writer.error);
+	}
+	return Qnil;
+}
+
+static VALUE dump_cleanup(VALUE arg) {
+	struct dump_args *args = (struct dump_args *)arg;
+	plist_binary_writer_free(&args->writer);
+	return Qnil;
+}
+
+// Writes the value +source+ reports as a bplist00 to +out+, a String or
+// anything with #write, in pieces of +chunk+ bytes. Returns the number
+// of bytes written.
+long plist_binary_write(plist_source_fn source, void *src, VALUE out, long chunk) {
+	struct dump_args args;
+	args.source = source;
+	args.src = src;
+	args.out = out;
+	args.chunk = chunk;
+	args.written = 0;
+	plist_binary_writer_init(&args.writer);
+	rb_ensure(dump_body, (VALUE)&args, dump_cleanup, (VALUE)&args);
+	return args.written;
+}
+
+struct emit_args {
+	VALUE obj;
+	int flags;
+};
+
+static void emit_object(void *src, const plist_handler_t *handler, void *ctx) {
+	struct emit_args *args = src;
+	plist_emit_object(args->obj, handler, ctx, args->flags);
+}
+
+// Writes +obj+ as a bplist00 to +out+, a String or anything with #write,
+// in pieces of +chunk+ bytes. Returns the number of bytes written.
+long plist_binary_dump(VALUE obj, VALUE out, long chunk, int flags) {
+	struct emit_args args;
+	args.obj = obj;
+	args.flags = flags;
+	long written = plist_binary_write(emit_object, &args, out, chunk);
+	RB_GC_GUARD(obj);
+	return written;
+}
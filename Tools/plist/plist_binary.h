@@ -0,0 +1,85 @@
+#ifndef _PLIST_BINARY_H_
+#define _PLIST_BINARY_H_
+
+#include "plist.h"
+#include "plist_intern.h"
+
+// Kinds of objects found in a bplist00 object table
+enum {
+	PLIST_B_NULL,
+	PLIST_B_BOOL,
+	PLIST_B_INT,
+	PLIST_B_UINT,
+	PLIST_B_REAL,
+	PLIST_B_DATE,
+	PLIST_B_DATA,
+	PLIST_B_ASCII,
+	PLIST_B_UTF16,
+	PLIST_B_UTF8,
+	PLIST_B_UID,
+	PLIST_B_ARRAY,
+	PLIST_B_DICT
+};
+
+typedef struct {
+	const unsigned char *bytes;
+	long len;
+	const unsigned char *offset_table;
+	int offset_size;
+	int ref_size;
+	unsigned long long num_objects;
+	unsigned long long top_object;
+} plist_bplist_t;
+
+typedef struct {
+	int kind;
+	unsigned long long count;       // bytes, UTF-16 units or elements
+	const unsigned char *body;      // payload or the first object reference
+	long long integer;              // PLIST_B_BOOL/INT/UINT/UID
+	double real;                    // PLIST_B_REAL/DATE
+} plist_bobject_t;
+
+int plist_binary_detect(const char *bytes, long len);
+int plist_bplist_open(plist_bplist_t *bp, const char *bytes, long len, plist_error_t *error);
+int plist_bplist_object(const plist_bplist_t *bp, unsigned long long ref, plist_bobject_t *obj, plist_error_t *error);
+unsigned long long plist_bplist_ref(const plist_bplist_t *bp, const unsigned char *refs, unsigned long long i);
+int plist_utf16_to_utf8(const unsigned char *units, unsigned long long count, plist_buf_t *out);
+
+int plist_binary_parse(const char *bytes, long len, const plist_handler_t *handler, void *ctx, plist_buf_t *scratch, plist_error_t *error);
+// Data objects smaller than this are copied even when they could be shared
+#define PLIST_SHARE_MIN 4096
+
+VALUE plist_binary_load(const char *bytes, long len, plist_intern_t *intern, VALUE owner, long *shared);
+
+typedef int (*plist_flush_fn)(void *ctx, const char *bytes, long len);
+
+typedef struct {
+	plist_buf_t objects;            // one record per object table entry
+	plist_buf_t encoded;            // scalar objects, already encoded
+	plist_buf_t refs;               // members of finished containers
+	plist_buf_t pending;            // members of containers still open
+	plist_buf_t frames;             // containers still open
+	plist_buf_t scratch;
+	long *table;                    // object number + 1 of each unique scalar
+	long table_capa;
+	long table_used;
+	// Used by plist_binary_writer_finish; held here so that a flush that
+	// raises leaves them for plist_binary_writer_free
+	unsigned long long *offsets;
+	char *chunk;
+	const char *error;
+} plist_binary_writer_t;
+
+extern const plist_handler_t plist_binary_writer_handler;
+
+void plist_binary_writer_init(plist_binary_writer_t *writer);
+int plist_binary_writer_finish(plist_binary_writer_t *writer, long chunk, plist_flush_fn flush, void *ctx, long *written);
+void plist_binary_writer_free(plist_binary_writer_t *writer);
+
+// Feeds one value to +handler+, raising if it can't
+typedef void (*plist_source_fn)(void *src, const plist_handler_t *handler, void *ctx);
+
+long plist_binary_write(plist_source_fn source, void *src, VALUE out, long chunk);
+long plist_binary_dump(VALUE obj, VALUE out, long chunk, int flags);
+
+#endif /* _PLIST_BINARY_H_ */
@@ -0,0 +1,404 @@
+/*
+ * Persistent cache of parsed property lists for load_file.
+ *
+ * When a cache directory is set, every file load_file parses is also
+ * saved there as its plist_doc_t node array. Later loads of the same
+ * path map that instead of parsing again, as long as the file's size,
+ * mtime and content hash still match what was recorded.
+ * Files under 4 KB are left out; parsing them is quicker than a lookup.
+ *
+ * Entries are written to a temporary file and renamed into place, so
+ * readers never see a partial one. Every hit touches its entry, and
+ * after each write the least recently used entries are deleted until
+ * the directory fits under the size limit.
+ */
+
+#include "plist_cache.h"
+#include "plist_doc.h"
+#include "plist_file.h"
+#include "plist_ruby.h"
+#include "plist_xml.h"
+#include "plist_binary.h"
+#include "plist_stats.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+
+#define CACHE_MAGIC "PLCACHE1"
+#define CACHE_SUFFIX ".plc"
+#define CACHE_DEFAULT_LIMIT (32L * 1024 * 1024)
+// Below this the native readers beat a cache lookup, so files this
+// small are parsed directly and never stored
+#define CACHE_MIN_SIZE 4096
+
+typedef struct {
+	char magic[8];
+	unsigned int byte_order;        // 0x01020304 as written by this machine
+	unsigned int node_size;         // sizeof(plist_node_t) of the writer
+	unsigned long long format;      // 0 for XML input, 1 for binary, 2 for OpenStep
+	unsigned long long size;        // of the source file
+	long long mtime_sec;
+	long long mtime_nsec;
+	unsigned long long hash;        // of the source file's bytes
+	unsigned long long path_len;
+	unsigned long long nodes;
+	unsigned long long text_len;
+	unsigned long long entry_hash;  // of the nodes and text
+} cache_header_t;
+
+static VALUE cacheDir = Qnil;
+static long cacheLimit = CACHE_DEFAULT_LIMIT;
+static long cacheHits, cacheMisses, cacheWrites, cacheEvictions;
+// Bytes in the cache directory as of the last scan plus what was written
+// since; -1 until the first scan
+static long cacheSize = -1;
+
+static VALUE id_hits, id_misses, id_writes, id_evictions;
+
+#define PAD8(n) (((n) + 7) & ~7ULL)
+
+// A quick 64 bit hash, only used to notice edits that kept size and mtime
+static unsigned long long content_hash(const char *bytes, long len) {
+	unsigned long long h = 0x9E3779B97F4A7C15ULL ^ (unsigned long long)len, w;
+	long i;
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, bytes + i, 8);
+		h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 32;
+	}
+	for (; i < len; i++) h = (h ^ (unsigned char)bytes[i]) * 0x100000001B3ULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	return h ^ (h >> 33);
+}
+
+static void stat_mtime(const struct stat *st, long long *sec, long long *nsec) {
+	*sec = (long long)st->st_mtime;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+	*nsec = (long long)st->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+	*nsec = (long long)st->st_mtimespec.tv_nsec;
+#else
+	*nsec = 0;
+#endif
+}
+
+// Covers the nodes and text of an entry; the path is compared as is
+static unsigned long long entry_hash(const plist_doc_t *doc) {
+	return content_hash(doc->nodes.ptr, doc->nodes.len) * 31 + content_hash(doc->text.ptr, doc->text.len);
+}
+
+typedef struct {
+	VALUE path;                     // source path, expanded once it's worth caching
+	VALUE entry;                    // its cache file
+	plist_map_t source;
+	plist_map_t cached;
+	plist_doc_t doc;
+	int borrowed;                   // doc points into the cached mapping
+	plist_buf_t scratch;
+	cache_header_t header;
+	plist_intern_t *intern;         // for the keys, or NULL
+} cache_load_t;
+
+// Entries are named after a hash of the source path; the path itself is
+// stored inside to catch collisions
+static VALUE entry_path(VALUE path) {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx" CACHE_SUFFIX, content_hash(RSTRING_PTR(path), RSTRING_LEN(path)));
+	VALUE entry = rb_str_dup(cacheDir);
+	rb_str_cat2(entry, name);
+	return entry;
+}
+
+// Sets up c->doc to read straight from a mapped entry, if it matches the source
+static int read_entry(cache_load_t *c, const struct stat *st) {
+	const cache_header_t *h;
+	long long sec, nsec;
+	if (plist_map_open(&c->cached, StringValueCStr(c->entry)) < 0) return 0;
+	if (c->cached.len < (long)sizeof(cache_header_t)) return 0;
+	h = (const cache_header_t *)c->cached.bytes;
+	stat_mtime(st, &sec, &nsec);
+	if (memcmp(h->magic, CACHE_MAGIC, 8) != 0 || h->byte_order != 0x01020304 || h->node_size != sizeof(plist_node_t)) return 0;
+	if (h->size != (unsigned long long)st->st_size || h->mtime_sec != sec || h->mtime_nsec != nsec) return 0;
+	if (h->path_len != (unsigned long long)RSTRING_LEN(c->path)) return 0;
+	unsigned long long room = (unsigned long long)c->cached.len - sizeof(cache_header_t);
+	if (PAD8(h->path_len) > room || h->nodes > (room - PAD8(h->path_len)) / sizeof(plist_node_t)) return 0;
+	room -= PAD8(h->path_len) + h->nodes * sizeof(plist_node_t);
+	if (h->text_len > room) return 0;
+	const char *p = c->cached.bytes + sizeof(cache_header_t);
+	if (memcmp(p, RSTRING_PTR(c->path), h->path_len) != 0) return 0;
+	if (h->hash != content_hash(c->source.bytes, c->source.len)) return 0;
+	p += PAD8(h->path_len);
+	// The doc borrows the mapping, so it must not be freed as a doc
+	c->borrowed = 1;
+	c->doc.nodes.ptr = (char *)p;
+	c->doc.nodes.len = c->doc.nodes.capa = (long)(h->nodes * sizeof(plist_node_t));
+	c->doc.text.ptr = (char *)p + c->doc.nodes.len;
+	c->doc.text.len = c->doc.text.capa = (long)h->text_len;
+	if (h->entry_hash != entry_hash(&c->doc) || !plist_doc_valid(&c->doc)) {
+		plist_doc_init(&c->doc);
+		c->borrowed = 0;
+		return 0;
+	}
+	c->header = *h;
+	return 1;
+}
+
+static int write_all(int fd, const void *bytes, size_t len) {
+	const char *p = bytes;
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+// Writes the entry for c->doc under a temporary name and renames it into place
+static int write_entry(cache_load_t *c) {
+	static const char zeros[8] = {0};
+	char temp[4096];
+	int fd;
+	if (snprintf(temp, sizeof(temp), "%s.%ld.tmp", StringValueCStr(c->entry), (long)getpid()) >= (int)sizeof(temp)) return -1;
+	fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	int ok = write_all(fd, &c->header, sizeof(c->header)) == 0 &&
+		write_all(fd, RSTRING_PTR(c->path), RSTRING_LEN(c->path)) == 0 &&
+		write_all(fd, zeros, PAD8(c->header.path_len) - c->header.path_len) == 0 &&
+		write_all(fd, c->doc.nodes.ptr, c->doc.nodes.len) == 0 &&
+		write_all(fd, c->doc.text.ptr, c->doc.text.len) == 0;
+	if (close(fd) < 0) ok = 0;
+	if (!ok || rename(temp, StringValueCStr(c->entry)) < 0) {
+		unlink(temp);
+		return -1;
+	}
+	return 0;
+}
+
+typedef struct {
+	char *name;
+	time_t used;
+	long size;
+} entry_info_t;
+
+static int by_use(const void *a, const void *b) {
+	time_t x = ((const entry_info_t *)a)->used, y = ((const entry_info_t *)b)->used;
+	return x < y ? -1 : x > y;
+}
+
+// Totals the cache directory, deleting the least recently used entries
+// until it fits the limit. Rewriting an entry isn't subtracted from
+// cacheSize, so this also runs now and then to correct the estimate.
+static void evict(void) {
+	const char *dir = StringValueCStr(cacheDir);
+	DIR *d = opendir(dir);
+	struct dirent *e;
+	plist_buf_t entries, path;
+	long total = 0, i, count;
+	if (!d) return;
+	plist_buf_init(&entries);
+	plist_buf_init(&path);
+	while ((e = readdir(d))) {
+		size_t len = strlen(e->d_name);
+		struct stat st;
+		entry_info_t info;
+		if (len <= strlen(CACHE_SUFFIX) || strcmp(e->d_name + len - strlen(CACHE_SUFFIX), CACHE_SUFFIX) != 0) continue;
+		path.len = 0;
+		if (plist_buf_append(&path, dir, strlen(dir)) < 0 || plist_buf_append(&path, "/", 1) < 0 ||
+			plist_buf_append(&path, e->d_name, len + 1) < 0) break;
+		if (stat(path.ptr, &st) < 0) continue;
+		info.name = strdup(path.ptr);
+		info.used = st.st_mtime;
+		info.size = (long)st.st_size;
+		if (!info.name || plist_buf_append(&entries, (const char *)&info, sizeof(info)) < 0) {
+			free(info.name);
+			break;
+		}
+		total += info.size;
+	}
+	closedir(d);
+	count = entries.len / (long)sizeof(entry_info_t);
+	entry_info_t *list = (entry_info_t *)entries.ptr;
+	if (total > cacheLimit) qsort(list, count, sizeof(entry_info_t), by_use);
+	for (i = 0; i < count; i++) {
+		if (total > cacheLimit && unlink(list[i].name) == 0) {
+			total -= list[i].size;
+			cacheEvictions++;
+		}
+		free(list[i].name);
+	}
+	cacheSize = total;
+	plist_buf_free(&entries);
+	plist_buf_free(&path);
+}
+
+// The Ruby objects for the document in +c+, read as +format+
+static VALUE converted(cache_load_t *c, VALUE format) {
+	VALUE obj = plist_doc_to_ruby(&c->doc, 0, c->intern);
+	plist_stats_phase(format, PLIST_CONVERT);
+	return obj;
+}
+
+static VALUE cache_load_body(VALUE arg) {
+	cache_load_t *c = (cache_load_t *)arg;
+	plist_error_t error;
+	plist_parse_fn parse;
+	if (plist_map_open(&c->source, StringValueCStr(c->path)) < 0 || !S_ISREG(c->source.st.st_mode)) return Qundef;
+	const struct stat *st = &c->source.st;
+	parse = plist_reader_for(c->source.bytes, c->source.len);
+	unsigned long long format = parse == plist_xml_parse ? 0 : parse == plist_binary_parse ? 1 : 2;
+	VALUE name = plist_reader_format(parse);
+	c->header.format = format;
+	plist_stats_load(name, c->source.len);
+	if (c->source.len < CACHE_MIN_SIZE) {
+		VALUE obj = parse == plist_binary_parse ? plist_binary_load(c->source.bytes, c->source.len, c->intern, Qnil, NULL) : plist_build(parse, c->source.bytes, c->source.len, c->intern);
+		plist_stats_phase(name, PLIST_PARSE);
+		return obj;
+	}
+	c->path = rb_file_expand_path(c->path, Qnil);
+	c->entry = entry_path(c->path);
+	if (read_entry(c, st)) {
+		cacheHits++;
+		// The entry's mtime is its last use, for eviction; a minute is close enough
+		if (c->cached.st.st_mtime < time(NULL) - 60) utimes(StringValueCStr(c->entry), NULL);
+		plist_stats_phase(name, PLIST_PARSE);
+		return converted(c, name);
+	}
+	cacheMisses++;
+	if (parse(c->source.bytes, c->source.len, &plist_doc_handler, &c->doc, &c->scratch, &error) < 0) {
+		plist_raise_error(c->source.bytes, c->source.len, &error);
+	}
+	if (c->doc.failed) rb_memerror();
+	memset(&c->header, 0, sizeof(c->header));
+	memcpy(c->header.magic, CACHE_MAGIC, 8);
+	c->header.byte_order = 0x01020304;
+	c->header.node_size = sizeof(plist_node_t);
+	c->header.format = format;
+	c->header.size = (unsigned long long)st->st_size;
+	stat_mtime(st, &c->header.mtime_sec, &c->header.mtime_nsec);
+	c->header.hash = content_hash(c->source.bytes, c->source.len);
+	c->header.path_len = (unsigned long long)RSTRING_LEN(c->path);
+	c->header.nodes = (unsigned long long)plist_doc_count(&c->doc);
+	c->header.text_len = (unsigned long long)c->doc.text.len;
+	c->header.entry_hash = entry_hash(&c->doc);
+	// A cache that can't be written to just stays cold
+	if (write_entry(c) == 0) {
+		cacheWrites++;
+		long size = (long)(sizeof(cache_header_t) + PAD8(c->header.path_len)) + c->doc.nodes.len + c->doc.text.len;
+		if (cacheSize < 0) evict();
+		else if ((cacheSize += size) > cacheLimit) evict();
+	}
+	plist_stats_phase(name, PLIST_PARSE);
+	return converted(c, name);
+}
+
+static VALUE cache_load_cleanup(VALUE arg) {
+	cache_load_t *c = (cache_load_t *)arg;
+	if (!c->borrowed) plist_doc_free(&c->doc);
+	plist_buf_free(&c->scratch);
+	if (c->source.bytes) plist_map_close(&c->source);
+	if (c->cached.bytes) plist_map_close(&c->cached);
+	return Qnil;
+}
+
+// Loads +path+ through the cache. Returns Qundef when the cache is off
+// or can't handle the file, leaving load_file to do its usual thing.
+VALUE plist_cache_load(VALUE path, VALUE *format, plist_intern_t *intern) {
+	cache_load_t c;
+	if (NIL_P(cacheDir)) return Qundef;
+	memset(&c, 0, sizeof(c));
+	c.path = path;
+	c.intern = intern;
+	VALUE obj = rb_ensure(cache_load_body, (VALUE)&c, cache_load_cleanup, (VALUE)&c);
+	if (obj != Qundef) *format = c.header.format == 1 ? id_binary : c.header.format == 2 ? id_openstep : id_xml;
+	return obj;
+}
+
+/* call-seq:
+ *    PropertyList.cache_dir -> String or nil
+ *
+ * Returns the directory load_file caches parsed property lists in,
+ * or +nil+ when caching is off (the default). The TM_PLIST_CACHE
+ * environment variable sets it when the extension is loaded.
+ */
+static VALUE plist_cacheDir(VALUE self) {
+	return cacheDir;
+}
+
+/* call-seq:
+ *    PropertyList.cache_dir = dir -> dir
+ *
+ * Turns the cache on, keeping it in +dir+ (created if missing), or
+ * off when +dir+ is +nil+.
+ */
+static VALUE plist_setCacheDir(VALUE self, VALUE dir) {
+	if (NIL_P(dir)) {
+		cacheDir = Qnil;
+		return dir;
+	}
+	VALUE path = rb_file_expand_path(dir, Qnil);
+	if (mkdir(StringValueCStr(path), 0755) < 0 && errno != EEXIST) rb_sys_fail(StringValueCStr(path));
+	cacheDir = rb_obj_freeze(path);
+	cacheSize = -1;
+	return dir;
+}
+
+/* call-seq:
+ *    PropertyList.cache_limit -> Integer
+ *
+ * Returns the most bytes the cache directory is allowed to hold,
+ * 32 MB by default.
+ */
+static VALUE plist_cacheLimit(VALUE self) {
+	return LONG2NUM(cacheLimit);
+}
+
+/* call-seq:
+ *    PropertyList.cache_limit = bytes -> bytes
+ */
+static VALUE plist_setCacheLimit(VALUE self, VALUE limit) {
+	long bytes = NUM2LONG(limit);
+	if (bytes < 0) rb_raise(rb_eArgError, "cache_limit can't be negative");
+	cacheLimit = bytes;
+	return limit;
+}
+
+/* call-seq:
+ *    PropertyList.cache_stats -> Hash
+ *
+ * Returns counters for this process: <tt>:hits</tt>, <tt>:misses</tt>,
+ * <tt>:writes</tt> and <tt>:evictions</tt>.
+ */
+static VALUE plist_cacheStats(VALUE self) {
+	VALUE stats = rb_hash_new();
+	rb_hash_aset(stats, ID2SYM(id_hits), LONG2NUM(cacheHits));
+	rb_hash_aset(stats, ID2SYM(id_misses), LONG2NUM(cacheMisses));
+	rb_hash_aset(stats, ID2SYM(id_writes), LONG2NUM(cacheWrites));
+	rb_hash_aset(stats, ID2SYM(id_evictions), LONG2NUM(cacheEvictions));
+	return stats;
+}
+
+void Init_plist_cache(void) {
+	rb_global_variable(&cacheDir);
+	rb_define_module_function(mPlist, "cache_dir", plist_cacheDir, 0);
+	rb_define_module_function(mPlist, "cache_dir=", plist_setCacheDir, 1);
+	rb_define_module_function(mPlist, "cache_limit", plist_cacheLimit, 0);
+	rb_define_module_function(mPlist, "cache_limit=", plist_setCacheLimit, 1);
+	rb_define_module_function(mPlist, "cache_stats", plist_cacheStats, 0);
+	id_hits = rb_intern("hits");
+	id_misses = rb_intern("misses");
+	id_writes = rb_intern("writes");
+	id_evictions = rb_intern("evictions");
+	const char *dir = getenv("TM_PLIST_CACHE");
+	if (dir && *dir) plist_setCacheDir(mPlist, rb_str_new2(dir));
+}
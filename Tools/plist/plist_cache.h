@@ -0,0 +1,10 @@
+#ifndef _PLIST_CACHE_H_
+#define _PLIST_CACHE_H_
+
+#include "plist.h"
+#include "plist_intern.h"
+
+VALUE plist_cache_load(VALUE path, VALUE *format, plist_intern_t *intern);
+void Init_plist_cache(void);
+
+#endif /* _PLIST_CACHE_H_ */
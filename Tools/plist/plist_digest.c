@@ -0,0 +1,186 @@
+/*
+ * A 128-bit hash of the structure and values of a property list.
+ *
+ * digest walks the object with plist_emit_object in canonical key order
+ * and feeds each event straight into SipHash-2-4-128, so nothing is
+ * serialized and nothing is allocated beyond the key sort. Every event
+ * starts with a tag byte and variable length values carry their length,
+ * so no two different trees feed the same bytes:
+ *
+ *   d e       begin and end a dictionary
+ *   a ]       begin and end an array
+ *   k s b     key, string, data: 8 byte length, then the bytes
+ *   i u       integer, one above 2**63 - 1: 8 bytes
+ *   r D       real, date: the 8 bytes of the double
+ *   t f       true, false
+ *
+ * Numbers are little endian. Reals and dates are hashed exactly, with
+ * -0.0 taken as 0.0 and every NaN as the same one. The key is fixed, so
+ * digests can be stored and compared between processes; they are meant
+ * for spotting changes, not for resisting someone crafting collisions.
+ */
+
+#include "plist_digest.h"
+#include "plist_ruby.h"
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v)											\
+	do {													\
+		v[0] += v[1]; v[1] = ROTL(v[1], 13); v[1] ^= v[0];	\
+		v[0] = ROTL(v[0], 32);								\
+		v[2] += v[3]; v[3] = ROTL(v[3], 16); v[3] ^= v[2];	\
+		v[0] += v[3]; v[3] = ROTL(v[3], 21); v[3] ^= v[0];	\
+		v[2] += v[1]; v[1] = ROTL(v[1], 17); v[1] ^= v[2];	\
+		v[2] = ROTL(v[2], 32);								\
+	} while (0)
+
+typedef struct {
+	uint64_t v[4];
+	unsigned char tail[8];          // bytes not yet making up a word
+	int used;
+	uint64_t len;
+} siphash_t;
+
+static const unsigned char digestKey[16] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
+static uint64_t load64(const unsigned char *p) {
+	uint64_t word = 0;
+	int i;
+	for (i = 7; i >= 0; i--) word = (word << 8) | p[i];
+	return word;
+}
+
+static void siphash_init(siphash_t *s, const unsigned char key[16]) {
+	uint64_t k0 = load64(key), k1 = load64(key + 8);
+	s->v[0] = k0 ^ 0x736f6d6570736575ULL;
+	s->v[1] = k1 ^ 0x646f72616e646f6dULL ^ 0xee;
+	s->v[2] = k0 ^ 0x6c7967656e657261ULL;
+	s->v[3] = k1 ^ 0x7465646279746573ULL;
+	s->used = 0;
+	s->len = 0;
+}
+
+static inline void siphash_word(siphash_t *s, uint64_t m) {
+	s->v[3] ^= m;
+	SIPROUND(s->v);
+	SIPROUND(s->v);
+	s->v[0] ^= m;
+}
+
+static void siphash_update(siphash_t *s, const void *data, size_t len) {
+	const unsigned char *p = data;
+	s->len += len;
+	if (s->used) {
+		while (len && s->used < 8) {
+			s->tail[s->used++] = *p++;
+			len--;
+		}
+		if (s->used < 8) return;
+		siphash_word(s, load64(s->tail));
+		s->used = 0;
+	}
+	for (; len >= 8; p += 8, len -= 8) siphash_word(s, load64(p));
+	memcpy(s->tail, p, len);
+	s->used = (int)len;
+}
+
+static void siphash_final(siphash_t *s, unsigned char out[16]) {
+	uint64_t b = s->len << 56;
+	int i;
+	for (i = 0; i < s->used; i++) b |= (uint64_t)s->tail[i] << (8 * i);
+	siphash_word(s, b);
+	s->v[2] ^= 0xee;
+	for (i = 0; i < 4; i++) SIPROUND(s->v);
+	uint64_t h0 = s->v[0] ^ s->v[1] ^ s->v[2] ^ s->v[3];
+	s->v[1] ^= 0xdd;
+	for (i = 0; i < 4; i++) SIPROUND(s->v);
+	uint64_t h1 = s->v[0] ^ s->v[1] ^ s->v[2] ^ s->v[3];
+	for (i = 0; i < 8; i++) {
+		out[i] = (unsigned char)(h0 >> (8 * i));
+		out[i + 8] = (unsigned char)(h1 >> (8 * i));
+	}
+}
+
+// Handler
+
+static void put_tag(siphash_t *s, char tag) {
+	siphash_update(s, &tag, 1);
+}
+
+static void put_u64(siphash_t *s, char tag, uint64_t value) {
+	unsigned char bytes[9];
+	int i;
+	bytes[0] = (unsigned char)tag;
+	for (i = 0; i < 8; i++) bytes[i + 1] = (unsigned char)(value >> (8 * i));
+	siphash_update(s, bytes, sizeof(bytes));
+}
+
+static void put_bytes(siphash_t *s, char tag, const char *bytes, long len) {
+	put_u64(s, tag, (uint64_t)len);
+	siphash_update(s, bytes, (size_t)len);
+}
+
+static void put_double(siphash_t *s, char tag, double value) {
+	uint64_t bits;
+	if (isnan(value)) value = NAN;
+	else if (value == 0) value = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	put_u64(s, tag, bits);
+}
+
+static int digest_beginDict(void *ctx) { put_tag(ctx, 'd'); return PLIST_CONTINUE; }
+static int digest_endDict(void *ctx) { put_tag(ctx, 'e'); return PLIST_CONTINUE; }
+static int digest_beginArray(void *ctx) { put_tag(ctx, 'a'); return PLIST_CONTINUE; }
+static int digest_endArray(void *ctx) { put_tag(ctx, ']'); return PLIST_CONTINUE; }
+static int digest_key(void *ctx, const char *bytes, long len) { put_bytes(ctx, 'k', bytes, len); return PLIST_CONTINUE; }
+static int digest_string(void *ctx, const char *bytes, long len) { put_bytes(ctx, 's', bytes, len); return PLIST_CONTINUE; }
+static int digest_data(void *ctx, const char *bytes, long len) { put_bytes(ctx, 'b', bytes, len); return PLIST_CONTINUE; }
+static int digest_integer(void *ctx, long long value) { put_u64(ctx, 'i', (uint64_t)value); return PLIST_CONTINUE; }
+static int digest_unsigned_integer(void *ctx, unsigned long long value) { put_u64(ctx, 'u', (uint64_t)value); return PLIST_CONTINUE; }
+static int digest_real(void *ctx, double value) { put_double(ctx, 'r', value); return PLIST_CONTINUE; }
+static int digest_boolean(void *ctx, int value) { put_tag(ctx, value ? 't' : 'f'); return PLIST_CONTINUE; }
+static int digest_date(void *ctx, double seconds) { put_double(ctx, 'D', seconds); return PLIST_CONTINUE; }
+
+static const plist_handler_t digest_handler = {
+	digest_beginDict, digest_endDict, digest_beginArray, digest_endArray,
+	digest_key, digest_string, digest_data, digest_integer, digest_real, digest_boolean, digest_date,
+	digest_unsigned_integer
+};
+
+/* call-seq:
+ *    PropertyList.digest(obj) -> String
+ *
+ * Returns a 128-bit hash of +obj+ as 32 lowercase hex digits. Two
+ * objects get the same digest when they would write the same property
+ * list: key order doesn't matter, but a String and the same bytes as
+ * data do, as do <tt>1</tt> and <tt>1.0</tt>. Nothing is serialized, so
+ * this is much quicker than hashing the output of to_plist.
+ *
+ * Raises ArgumentError if +obj+ can't be represented as a property list.
+ */
+static VALUE plist_digest(VALUE self, VALUE obj) {
+	static const char hex[] = "0123456789abcdef";
+	siphash_t state;
+	unsigned char hash[16];
+	char text[32];
+	int i;
+	siphash_init(&state, digestKey);
+	plist_emit_object(obj, &digest_handler, &state, PLIST_EMIT_SORTED);
+	siphash_final(&state, hash);
+	for (i = 0; i < 16; i++) {
+		text[2 * i] = hex[hash[i] >> 4];
+		text[2 * i + 1] = hex[hash[i] & 15];
+	}
+	return rb_usascii_str_new(text, sizeof(text));
+}
+
+void Init_plist_digest(void) {
+	rb_define_module_function(mPlist, "digest", plist_digest, 1);
+}
@@ -0,0 +1,8 @@
+#ifndef _PLIST_DIGEST_H_
+#define _PLIST_DIGEST_H_
+
+#include "plist.h"
+
+void Init_plist_digest(void);
+
+#endif /* _PLIST_DIGEST_H_ */
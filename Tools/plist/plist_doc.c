@@ -0,0 +1,232 @@
+/*
+ * An in-memory property list that doesn't involve Ruby objects.
+ *
+ * plist_doc_handler stores reader events as a flat array of nodes, with
+ * all key, string and data bytes in one text buffer. Containers record
+ * where their subtree ends, so siblings can be stepped over without
+ * looking inside them, and plist_doc_emit replays any subtree to another
+ * handler.
+ */
+
+#include "plist_doc.h"
+#include <string.h>
+
+#define OPEN_COUNT(doc) ((doc)->open.len / (long)sizeof(long))
+
+static int doc_fail(plist_doc_t *doc) {
+	doc->failed = 1;
+	return PLIST_STOP;
+}
+
+// Appends a node, counting it as a member of the innermost open container
+static plist_node_t *add_node(plist_doc_t *doc, int kind, int counts) {
+	plist_node_t node;
+	if (counts && OPEN_COUNT(doc)) {
+		plist_node_t *parent = plist_doc_node(doc, ((long *)doc->open.ptr)[OPEN_COUNT(doc) - 1]);
+		parent->len++;
+	}
+	memset(&node, 0, sizeof(node));
+	node.kind = kind;
+	if (plist_buf_append(&doc->nodes, (const char *)&node, sizeof(node)) < 0) return NULL;
+	return plist_doc_node(doc, plist_doc_count(doc) - 1);
+}
+
+static int d_begin(plist_doc_t *doc, int kind) {
+	long index = plist_doc_count(doc);
+	int counts = !OPEN_COUNT(doc) || plist_doc_node(doc, ((long *)doc->open.ptr)[OPEN_COUNT(doc) - 1])->kind == PLIST_NODE_ARRAY;
+	if (!add_node(doc, kind, counts)) return doc_fail(doc);
+	if (plist_buf_append(&doc->open, (const char *)&index, sizeof(long)) < 0) return doc_fail(doc);
+	return PLIST_CONTINUE;
+}
+
+static int d_begin_dict(void *ctx) {
+	return d_begin(ctx, PLIST_NODE_DICT);
+}
+
+static int d_begin_array(void *ctx) {
+	return d_begin(ctx, PLIST_NODE_ARRAY);
+}
+
+static int d_end(void *ctx) {
+	plist_doc_t *doc = ctx;
+	doc->open.len -= sizeof(long);
+	plist_doc_node(doc, ((long *)doc->open.ptr)[OPEN_COUNT(doc)])->v.end = plist_doc_count(doc);
+	return PLIST_CONTINUE;
+}
+
+// Only keys and array elements count as members, so dicts end up with pairs
+static int d_scalar(plist_doc_t *doc, int kind, plist_node_t **node) {
+	int counts = 1;
+	if (kind != PLIST_NODE_KEY && OPEN_COUNT(doc)) {
+		counts = plist_doc_node(doc, ((long *)doc->open.ptr)[OPEN_COUNT(doc) - 1])->kind == PLIST_NODE_ARRAY;
+	}
+	*node = add_node(doc, kind, counts);
+	return *node ? PLIST_CONTINUE : doc_fail(doc);
+}
+
+static int d_text(plist_doc_t *doc, int kind, const char *bytes, long len) {
+	plist_node_t *node;
+	if (d_scalar(doc, kind, &node) == PLIST_STOP) return PLIST_STOP;
+	node->len = len;
+	node->v.start = doc->text.len;
+	if (plist_buf_append(&doc->text, bytes, len) < 0) return doc_fail(doc);
+	return PLIST_CONTINUE;
+}
+
+static int d_key(void *ctx, const char *bytes, long len) {
+	return d_text(ctx, PLIST_NODE_KEY, bytes, len);
+}
+
+static int d_string(void *ctx, const char *bytes, long len) {
+	return d_text(ctx, PLIST_NODE_STRING, bytes, len);
+}
+
+static int d_data(void *ctx, const char *bytes, long len) {
+	return d_text(ctx, PLIST_NODE_DATA, bytes, len);
+}
+
+static int d_integer(void *ctx, long long value) {
+	plist_node_t *node;
+	if (d_scalar(ctx, PLIST_NODE_INTEGER, &node) == PLIST_STOP) return PLIST_STOP;
+	node->v.integer = value;
+	return PLIST_CONTINUE;
+}
+
+static int d_unsigned_integer(void *ctx, unsigned long long value) {
+	plist_node_t *node;
+	if (d_scalar(ctx, PLIST_NODE_INTEGER, &node) == PLIST_STOP) return PLIST_STOP;
+	node->len = 1;
+	node->v.integer = (long long)value;
+	return PLIST_CONTINUE;
+}
+
+static int d_boolean(void *ctx, int value) {
+	plist_node_t *node;
+	if (d_scalar(ctx, PLIST_NODE_BOOLEAN, &node) == PLIST_STOP) return PLIST_STOP;
+	node->v.integer = value;
+	return PLIST_CONTINUE;
+}
+
+static int d_real(void *ctx, double value) {
+	plist_node_t *node;
+	if (d_scalar(ctx, PLIST_NODE_REAL, &node) == PLIST_STOP) return PLIST_STOP;
+	node->v.real = value;
+	return PLIST_CONTINUE;
+}
+
+static int d_date(void *ctx, double seconds) {
+	plist_node_t *node;
+	if (d_scalar(ctx, PLIST_NODE_DATE, &node) == PLIST_STOP) return PLIST_STOP;
+	node->v.real = seconds;
+	return PLIST_CONTINUE;
+}
+
+const plist_handler_t plist_doc_handler = {
+	d_begin_dict, d_end, d_begin_array, d_end,
+	d_key, d_string, d_data, d_integer, d_real, d_boolean, d_date, d_unsigned_integer
+};
+
+void plist_doc_init(plist_doc_t *doc) {
+	plist_buf_init(&doc->nodes);
+	plist_buf_init(&doc->text);
+	plist_buf_init(&doc->open);
+	doc->failed = 0;
+}
+
+void plist_doc_free(plist_doc_t *doc) {
+	plist_buf_free(&doc->nodes);
+	plist_buf_free(&doc->text);
+	plist_buf_free(&doc->open);
+}
+
+// Index of the node following the subtree at +i+
+long plist_doc_next(const plist_doc_t *doc, long i) {
+	const plist_node_t *node = plist_doc_node(doc, i);
+	if (node->kind == PLIST_NODE_DICT || node->kind == PLIST_NODE_ARRAY) return node->v.end;
+	return i + 1;
+}
+
+// Index of the value stored under +key+ in the dict at +i+, or -1
+long plist_doc_lookup(const plist_doc_t *doc, long i, const char *key, long len) {
+	const plist_node_t *dict = plist_doc_node(doc, i);
+	long child = i + 1;
+	while (child < dict->v.end) {
+		const plist_node_t *node = plist_doc_node(doc, child);
+		if (node->len == len && memcmp(plist_doc_text(doc, node), key, len) == 0) return child + 1;
+		child = plist_doc_next(doc, child + 1);
+	}
+	return -1;
+}
+
+static int valid_subtree(const plist_doc_t *doc, long i, long limit, int depth) {
+	const plist_node_t *node = plist_doc_node(doc, i);
+	long child, members = 0;
+	switch (node->kind) {
+		case PLIST_NODE_KEY:
+		case PLIST_NODE_STRING:
+		case PLIST_NODE_DATA:
+			return node->len >= 0 && node->v.start >= 0 && node->v.start <= doc->text.len - node->len;
+		case PLIST_NODE_INTEGER:
+		case PLIST_NODE_REAL:
+		case PLIST_NODE_BOOLEAN:
+		case PLIST_NODE_DATE:
+			return 1;
+		case PLIST_NODE_DICT:
+		case PLIST_NODE_ARRAY:
+			break;
+		default:
+			return 0;
+	}
+	if (depth > PLIST_MAX_DEPTH || node->v.end <= i || node->v.end > limit) return 0;
+	for (child = i + 1; child < node->v.end; members++) {
+		if (node->kind == PLIST_NODE_DICT) {
+			if (plist_doc_node(doc, child)->kind != PLIST_NODE_KEY || !valid_subtree(doc, child, node->v.end, depth + 1)) return 0;
+			if (++child >= node->v.end) return 0;
+		}
+		if (plist_doc_node(doc, child)->kind == PLIST_NODE_KEY || !valid_subtree(doc, child, node->v.end, depth + 1)) return 0;
+		child = plist_doc_next(doc, child);
+	}
+	return child == node->v.end && members == node->len;
+}
+
+// Checks that nodes and text read back from somewhere untrusted form a
+// single well-formed tree, so walking it can't leave the buffers
+int plist_doc_valid(const plist_doc_t *doc) {
+	long count = plist_doc_count(doc);
+	if (count < 1 || plist_doc_node(doc, 0)->kind == PLIST_NODE_KEY || !valid_subtree(doc, 0, count, 0)) return 0;
+	return plist_doc_next(doc, 0) == count;
+}
+
+#define EMIT(call) do {									\
+		if ((call) == PLIST_STOP) return -1;			\
+	} while (0)
+
+// Replays the subtree at +i+, returns -1 if the handler stopped early
+int plist_doc_emit(const plist_doc_t *doc, long i, const plist_handler_t *handler, void *ctx) {
+	const plist_node_t *node = plist_doc_node(doc, i);
+	switch (node->kind) {
+		case PLIST_NODE_DICT:
+		case PLIST_NODE_ARRAY: {
+			int is_dict = node->kind == PLIST_NODE_DICT;
+			int rc = is_dict ? handler->begin_dict(ctx) : handler->begin_array(ctx);
+			if (rc == PLIST_STOP) return -1;
+			if (rc == PLIST_SKIP) return 0;
+			long child = i + 1;
+			while (child < node->v.end) {
+				if (plist_doc_emit(doc, child, handler, ctx) < 0) return -1;
+				child = plist_doc_next(doc, child);
+			}
+			EMIT(is_dict ? handler->end_dict(ctx) : handler->end_array(ctx));
+			return 0;
+		}
+		case PLIST_NODE_KEY: EMIT(handler->key(ctx, plist_doc_text(doc, node), node->len)); return 0;
+		case PLIST_NODE_STRING: EMIT(handler->string(ctx, plist_doc_text(doc, node), node->len)); return 0;
+		case PLIST_NODE_DATA: EMIT(handler->data(ctx, plist_doc_text(doc, node), node->len)); return 0;
+		case PLIST_NODE_INTEGER:
+			EMIT(node->len ? handler->unsigned_integer(ctx, (unsigned long long)node->v.integer) : handler->integer(ctx, node->v.integer));
+			return 0;
+		case PLIST_NODE_REAL: EMIT(handler->real(ctx, node->v.real)); return 0;
+		case PLIST_NODE_BOOLEAN: EMIT(handler->boolean(ctx, (int)node->v.integer)); return 0;
+		default: EMIT(handler->date(ctx, node->v.real)); return 0;
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef _PLIST_DOC_H_
+#define _PLIST_DOC_H_
+
+#include "plist.h"
+
+// Kinds of node in a plist_doc_t
+enum {
+	PLIST_NODE_DICT,
+	PLIST_NODE_ARRAY,
+	PLIST_NODE_KEY,
+	PLIST_NODE_STRING,
+	PLIST_NODE_DATA,
+	PLIST_NODE_INTEGER,
+	PLIST_NODE_REAL,
+	PLIST_NODE_BOOLEAN,
+	PLIST_NODE_DATE
+};
+
+typedef struct {
+	int kind;
+	long len;                       // members of a container (pairs for a dict), bytes of text,
+	                                // 1 for an integer above LLONG_MAX
+	union {
+		long end;                   // containers: index just past the subtree
+		long start;                 // keys, strings and data: offset into text
+		long long integer;          // integers and booleans; unsigned if len is 1
+		double real;                // reals and dates
+	} v;
+} plist_node_t;
+
+// A parsed property list as a flat array of nodes in document order
+typedef struct {
+	plist_buf_t nodes;
+	plist_buf_t text;
+	plist_buf_t open;               // indexes of the containers being built
+	int failed;
+} plist_doc_t;
+
+#define plist_doc_node(doc, i) (&((plist_node_t *)(doc)->nodes.ptr)[i])
+#define plist_doc_text(doc, node) ((doc)->text.ptr + (node)->v.start)
+#define plist_doc_count(doc) ((doc)->nodes.len / (long)sizeof(plist_node_t))
+
+extern const plist_handler_t plist_doc_handler;
+
+void plist_doc_init(plist_doc_t *doc);
+void plist_doc_free(plist_doc_t *doc);
+int plist_doc_valid(const plist_doc_t *doc);
+long plist_doc_next(const plist_doc_t *doc, long i);
+long plist_doc_lookup(const plist_doc_t *doc, long i, const char *key, long len);
+int plist_doc_emit(const plist_doc_t *doc, long i, const plist_handler_t *handler, void *ctx);
+
+#endif /* _PLIST_DOC_H_ */
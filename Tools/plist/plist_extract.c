@@ -0,0 +1,333 @@
+/*
+ * OSX::PropertyList.extract support.
+ *
+ * The extractor is a reader handler that knows which key paths are still
+ * possible at the current position. Any container none of them lead
+ * into is answered with PLIST_SKIP, so the reader steps over it without
+ * reporting anything, and once every path has been found the read is
+ * stopped. Only matched values are turned into Ruby objects.
+ */
+
+#include "plist_extract.h"
+#include "plist_ruby.h"
+#include <string.h>
+
+typedef struct {
+	const char *key;                // NULL for array indexes
+	long len;                       // key length, or the index
+} path_part_t;
+
+typedef struct {
+	long first;                     // offset of the first part in parts
+	long len;
+} path_t;
+
+typedef struct {
+	int is_dict;
+	long index;                     // next array index
+	long candidates;                // offset of this level's candidates
+	long count;
+} frame_t;
+
+typedef struct {
+	VALUE paths;
+	VALUE results;
+	plist_buf_t parts;              // path_part_t
+	plist_buf_t defs;               // path_t
+	plist_buf_t found;              // one char per path
+	plist_buf_t candidates;         // path numbers, one run per open frame
+	plist_buf_t frames;             // frame_t
+	plist_buf_t selected;           // paths matching the member being read
+	long remaining;
+	int capturing;                  // depth inside a captured container
+	long capture_at;                // offset of the captured paths in selected
+	long capture_count;
+	plist_builder_t builder;
+	int oom;
+} extractor_t;
+
+#define PATH(x, i) (((path_t *)(x)->defs.ptr)[i])
+#define PART(x, i) (((path_part_t *)(x)->parts.ptr)[i])
+#define LONGS(buf) ((long *)(buf).ptr)
+#define NLONGS(buf) ((buf).len / (long)sizeof(long))
+#define NFRAMES(x) ((x)->frames.len / (long)sizeof(frame_t))
+#define TOP_FRAME(x) (&((frame_t *)(x)->frames.ptr)[NFRAMES(x) - 1])
+
+static int x_fail(extractor_t *x) {
+	x->oom = 1;
+	return PLIST_STOP;
+}
+
+// Turns extract's arguments into an Array of key paths, each an Array
+// of Strings and non-negative Integers
+VALUE plist_keypaths(int argc, VALUE *argv) {
+	VALUE paths = rb_ary_new2(argc);
+	int i;
+	long j;
+	for (i = 0; i < argc; i++) {
+		VALUE arg = argv[i], path = rb_ary_new();
+		if (TYPE(arg) != T_ARRAY) arg = rb_ary_new3(1, arg);
+		for (j = 0; j < RARRAY_LEN(arg); j++) {
+			VALUE part = RARRAY_PTR(arg)[j];
+			if (TYPE(part) == T_SYMBOL) part = rb_str_new2(rb_id2name(SYM2ID(part)));
+			if (TYPE(part) == T_STRING) {
+				rb_ary_push(path, rb_str_new(RSTRING_PTR(part), RSTRING_LEN(part)));
+			} else if (FIXNUM_P(part) && FIX2LONG(part) >= 0) {
+				rb_ary_push(path, part);
+			} else {
+				rb_raise(rb_eArgError, "Key paths must contain strings and non-negative integers");
+			}
+		}
+		rb_ary_push(paths, path);
+	}
+	return paths;
+}
+
+// Follows +path+ from its +from+th part through already converted objects
+static VALUE plist_dig(VALUE obj, VALUE path, long from) {
+	long i;
+	for (i = from; i < RARRAY_LEN(path) && !NIL_P(obj); i++) {
+		VALUE part = RARRAY_PTR(path)[i];
+		if (TYPE(obj) == T_HASH && TYPE(part) == T_STRING) obj = rb_hash_lookup(obj, part);
+		else if (TYPE(obj) == T_ARRAY && FIXNUM_P(part)) obj = rb_ary_entry(obj, FIX2LONG(part));
+		else obj = Qnil;
+	}
+	return obj;
+}
+
+// A path that ran into a scalar or a closed container can't match anywhere else
+static void give_up(extractor_t *x, long path) {
+	if (x->found.ptr[path]) return;
+	x->found.ptr[path] = 1;
+	x->remaining--;
+}
+
+static void found(extractor_t *x, long path, VALUE value, long depth) {
+	if (x->found.ptr[path]) return;
+	x->found.ptr[path] = 1;
+	x->remaining--;
+	rb_ary_store(x->results, path, plist_dig(value, RARRAY_PTR(x->paths)[path], depth));
+}
+
+// Stores a converted value for every selected path, longer ones are dug out of it
+static int deliver(extractor_t *x, long at, long count, VALUE value) {
+	long i, depth = NFRAMES(x);
+	for (i = 0; i < count; i++) found(x, LONGS(x->selected)[at + i], value, depth);
+	x->selected.len = at * sizeof(long);
+	return x->remaining ? PLIST_CONTINUE : PLIST_STOP;
+}
+
+// Narrows the innermost frame's candidates to those whose next part is
+// this member's key or index, leaving them at the end of selected
+static int select_member(extractor_t *x, const char *key, long len, long *at, long *count) {
+	*at = NLONGS(x->selected);
+	*count = 0;
+	long depth = NFRAMES(x), i, first = 0, n;
+	if (depth == 0) {
+		n = RARRAY_LEN(x->paths);
+	} else {
+		frame_t *frame = TOP_FRAME(x);
+		first = frame->candidates;
+		n = frame->count;
+	}
+	for (i = 0; i < n; i++) {
+		long path = depth == 0 ? i : LONGS(x->candidates)[first + i];
+		if (x->found.ptr[path]) continue;
+		if (depth > 0) {
+			path_part_t *part = &PART(x, PATH(x, path).first + depth - 1);
+			if (key ? !part->key || part->len != len || memcmp(part->key, key, len) != 0 : part->key || part->len != len) continue;
+		}
+		if (plist_buf_append(&x->selected, (const char *)&path, sizeof(long)) < 0) return -1;
+		(*count)++;
+	}
+	return 0;
+}
+
+// Works out which paths the value about to be reported belongs to
+static int current(extractor_t *x, long *at, long *count) {
+	if (NFRAMES(x) == 0) return select_member(x, NULL, 0, at, count);
+	frame_t *frame = TOP_FRAME(x);
+	if (frame->is_dict) {
+		// the key callback already selected them
+		*count = frame->index;
+		*at = NLONGS(x->selected) - *count;
+		frame->index = 0;
+		return 0;
+	}
+	return select_member(x, NULL, frame->index++, at, count);
+}
+
+static int x_begin(extractor_t *x, int is_dict) {
+	long at, count, i, depth = NFRAMES(x);
+	if (x->capturing) {
+		x->capturing++;
+		return is_dict ? plist_builder_handler.begin_dict(&x->builder) : plist_builder_handler.begin_array(&x->builder);
+	}
+	if (current(x, &at, &count) < 0) return x_fail(x);
+	int exact = 0, deeper = 0;
+	for (i = 0; i < count; i++) {
+		if (PATH(x, LONGS(x->selected)[at + i]).len == depth) exact = 1;
+		else deeper = 1;
+	}
+	if (exact) {
+		// Longer paths through this container are dug out of the result
+		x->capturing = 1;
+		x->capture_at = at;
+		x->capture_count = count;
+		plist_builder_init(&x->builder);
+		return is_dict ? plist_builder_handler.begin_dict(&x->builder) : plist_builder_handler.begin_array(&x->builder);
+	}
+	if (!deeper) {
+		x->selected.len = at * sizeof(long);
+		return PLIST_SKIP;
+	}
+	frame_t frame;
+	frame.is_dict = is_dict;
+	frame.index = 0;
+	frame.candidates = NLONGS(x->candidates);
+	frame.count = count;
+	if (plist_buf_append(&x->candidates, x->selected.ptr + at * sizeof(long), count * sizeof(long)) < 0) return x_fail(x);
+	x->selected.len = at * sizeof(long);
+	if (plist_buf_append(&x->frames, (const char *)&frame, sizeof(frame)) < 0) return x_fail(x);
+	return PLIST_CONTINUE;
+}
+
+static int x_end(extractor_t *x, int is_dict) {
+	if (x->capturing) {
+		if (is_dict) plist_builder_handler.end_dict(&x->builder);
+		else plist_builder_handler.end_array(&x->builder);
+		if (--x->capturing) return PLIST_CONTINUE;
+		return deliver(x, x->capture_at, x->capture_count, x->builder.result);
+	}
+	frame_t *frame = TOP_FRAME(x);
+	long i;
+	for (i = 0; i < frame->count; i++) give_up(x, LONGS(x->candidates)[frame->candidates + i]);
+	x->candidates.len = frame->candidates * sizeof(long);
+	x->frames.len -= sizeof(frame_t);
+	return x->remaining ? PLIST_CONTINUE : PLIST_STOP;
+}
+
+static int x_begin_dict(void *ctx) {
+	return x_begin(ctx, 1);
+}
+
+static int x_end_dict(void *ctx) {
+	return x_end(ctx, 1);
+}
+
+static int x_begin_array(void *ctx) {
+	return x_begin(ctx, 0);
+}
+
+static int x_end_array(void *ctx) {
+	return x_end(ctx, 0);
+}
+
+static int x_key(void *ctx, const char *bytes, long len) {
+	extractor_t *x = ctx;
+	long at, count;
+	if (x->capturing) return plist_builder_handler.key(&x->builder, bytes, len);
+	// Drop whatever the previous key selected before picking for this one
+	frame_t *frame = TOP_FRAME(x);
+	x->selected.len -= frame->index * sizeof(long);
+	if (select_member(x, bytes, len, &at, &count) < 0) return x_fail(x);
+	TOP_FRAME(x)->index = count;
+	return PLIST_CONTINUE;
+}
+
+// Scalars only become Ruby objects when a path ends on them
+#define SCALAR(name, type, call)											\
+	static int x_##name type {												\
+		extractor_t *x = ctx;												\
+		long at, count, i, depth = NFRAMES(x);								\
+		if (x->capturing) return plist_builder_handler.call;				\
+		if (current(x, &at, &count) < 0) return x_fail(x);					\
+		for (i = 0; i < count; i++) {										\
+			if (PATH(x, LONGS(x->selected)[at + i]).len == depth) {			\
+				plist_builder_init(&x->builder);							\
+				plist_builder_handler.call;									\
+				return deliver(x, at, count, x->builder.result);			\
+			}																\
+		}																	\
+		for (i = 0; i < count; i++) give_up(x, LONGS(x->selected)[at + i]);	\
+		x->selected.len = at * sizeof(long);								\
+		return x->remaining ? PLIST_CONTINUE : PLIST_STOP;					\
+	}
+
+SCALAR(string, (void *ctx, const char *bytes, long len), string(&x->builder, bytes, len))
+SCALAR(data, (void *ctx, const char *bytes, long len), data(&x->builder, bytes, len))
+SCALAR(integer, (void *ctx, long long value), integer(&x->builder, value))
+SCALAR(unsigned_integer, (void *ctx, unsigned long long value), unsigned_integer(&x->builder, value))
+SCALAR(real, (void *ctx, double value), real(&x->builder, value))
+SCALAR(boolean, (void *ctx, int value), boolean(&x->builder, value))
+SCALAR(date, (void *ctx, double seconds), date(&x->builder, seconds))
+
+static const plist_handler_t extractor_handler = {
+	x_begin_dict, x_end_dict, x_begin_array, x_end_array,
+	x_key, x_string, x_data, x_integer, x_real, x_boolean, x_date, x_unsigned_integer
+};
+
+struct extract_args {
+	extractor_t x;
+	plist_parse_fn parse;
+	const char *bytes;
+	long len;
+	plist_buf_t scratch;
+};
+
+static VALUE extract_body(VALUE arg) {
+	struct extract_args *args = (struct extract_args *)arg;
+	extractor_t *x = &args->x;
+	plist_error_t error;
+	long i, j, n = RARRAY_LEN(x->paths);
+	for (i = 0; i < n; i++) {
+		VALUE path = RARRAY_PTR(x->paths)[i];
+		path_t def;
+		def.first = x->parts.len / (long)sizeof(path_part_t);
+		def.len = RARRAY_LEN(path);
+		for (j = 0; j < def.len; j++) {
+			VALUE value = RARRAY_PTR(path)[j];
+			path_part_t part;
+			part.key = TYPE(value) == T_STRING ? RSTRING_PTR(value) : NULL;
+			part.len = part.key ? RSTRING_LEN(value) : FIX2LONG(value);
+			if (plist_buf_append(&x->parts, (const char *)&part, sizeof(part)) < 0) rb_memerror();
+		}
+		if (plist_buf_append(&x->defs, (const char *)&def, sizeof(def)) < 0) rb_memerror();
+		if (plist_buf_append(&x->found, "", 1) < 0) rb_memerror();
+	}
+	if (n == 0) return x->results;
+	if (args->parse(args->bytes, args->len, &extractor_handler, x, &args->scratch, &error) < 0) {
+		plist_raise_error(args->bytes, args->len, &error);
+	}
+	if (x->oom) rb_memerror();
+	return x->results;
+}
+
+static VALUE extract_cleanup(VALUE arg) {
+	struct extract_args *args = (struct extract_args *)arg;
+	plist_buf_free(&args->x.parts);
+	plist_buf_free(&args->x.defs);
+	plist_buf_free(&args->x.found);
+	plist_buf_free(&args->x.candidates);
+	plist_buf_free(&args->x.frames);
+	plist_buf_free(&args->x.selected);
+	plist_buf_free(&args->scratch);
+	return Qnil;
+}
+
+// Returns the values at +paths+ (from plist_keypaths), nil where a path
+// doesn't exist.
+VALUE plist_extract_native(const char *bytes, long len, VALUE paths) {
+	struct extract_args args;
+	args.parse = plist_reader_for(bytes, len);
+	args.bytes = bytes;
+	args.len = len;
+	plist_buf_init(&args.scratch);
+	memset(&args.x, 0, sizeof(args.x));
+	args.x.paths = paths;
+	args.x.results = rb_ary_new2(RARRAY_LEN(paths));
+	args.x.remaining = RARRAY_LEN(paths);
+	if (RARRAY_LEN(paths)) rb_ary_store(args.x.results, RARRAY_LEN(paths) - 1, Qnil);
+	plist_builder_init(&args.x.builder);
+	return rb_ensure(extract_body, (VALUE)&args, extract_cleanup, (VALUE)&args);
+}
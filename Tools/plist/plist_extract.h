@@ -0,0 +1,9 @@
+#ifndef _PLIST_EXTRACT_H_
+#define _PLIST_EXTRACT_H_
+
+#include "plist.h"
+
+VALUE plist_keypaths(int argc, VALUE *argv);
+VALUE plist_extract_native(const char *bytes, long len, VALUE paths);
+
+#endif /* _PLIST_EXTRACT_H_ */
@@ -0,0 +1,79 @@
+/*
+ * Read-only views of whole files. Large regular files are mmapped so
+ * that the readers only touch the pages they actually decode; small
+ * ones and anything that can't be mapped (pipes, empty files) are read
+ * into memory instead.
+ */
+
+#include "plist_file.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static int read_all(plist_map_t *map, int fd, long capa) {
+	map->bytes = malloc(capa);
+	map->len = 0;
+	map->mapped = 0;
+	if (!map->bytes) return -1;
+	for (;;) {
+		if (map->len == capa) {
+			char *bytes = realloc(map->bytes, capa * 2);
+			if (!bytes) return -1;
+			map->bytes = bytes;
+			capa *= 2;
+		}
+		ssize_t n = read(fd, map->bytes + map->len, capa - map->len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -1;
+		if (n == 0) return 0;
+		map->len += n;
+	}
+}
+
+// Maps +path+ into memory, returns -1 with errno set on failure.
+// map->st holds the file's stat information afterwards.
+int plist_map_open(plist_map_t *map, const char *path) {
+	struct stat *st = &map->st;
+	int fd = open(path, O_RDONLY);
+	long capa = 65536;
+	map->bytes = NULL;
+	map->len = 0;
+	map->mapped = 0;
+	memset(st, 0, sizeof(*st));
+	if (fd < 0) return -1;
+	if (fstat(fd, st) < 0) memset(st, 0, sizeof(*st));
+	if (S_ISREG(st->st_mode) && st->st_size > 0 && st->st_size < PLIST_MAP_MIN) {
+		// One spare byte so the buffer never grows before EOF shows up
+		capa = (long)st->st_size + 1;
+	} else if (S_ISREG(st->st_mode) && st->st_size > 0) {
+		void *bytes = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (bytes != MAP_FAILED) {
+			map->bytes = bytes;
+			map->len = (long)st->st_size;
+			map->mapped = 1;
+			close(fd);
+			return 0;
+		}
+	}
+	int rc = read_all(map, fd, capa);
+	int saved = errno;
+	close(fd);
+	if (rc < 0) {
+		plist_map_close(map);
+		errno = saved;
+	}
+	return rc;
+}
+
+void plist_map_close(plist_map_t *map) {
+	if (map->mapped) munmap(map->bytes, (size_t)map->len);
+	else free(map->bytes);
+	map->bytes = NULL;
+	map->len = 0;
+	map->mapped = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef _PLIST_FILE_H_
+#define _PLIST_FILE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Files smaller than this are read, since mapping them costs more
+#define PLIST_MAP_MIN 65536
+
+typedef struct {
+	char *bytes;
+	long len;
+	int mapped;
+	struct stat st;
+} plist_map_t;
+
+int plist_map_open(plist_map_t *map, const char *path);
+void plist_map_close(plist_map_t *map);
+
+#endif /* _PLIST_FILE_H_ */
@@ -0,0 +1,176 @@
+/*
+ * Dictionary keys for loads with :intern_keys.
+ *
+ * Bundle plists repeat a handful of keys (name, match, patterns, ...)
+ * thousands of times. With interning each load keeps a table from key
+ * bytes to the object made for them, so every repeat of a key shares
+ * one frozen String, or Symbol, and costs a lookup instead of an
+ * allocation. By default the Strings come from Ruby's own table of
+ * frozen strings, which shares them across loads and with literals;
+ * :load keeps them to the one load.
+ *
+ * Ruby 2.6 and later already swap a plain String key for its frozen
+ * shared copy in Hash#[]=, so there the saving is the String made for
+ * every key only to be thrown away, not live heap.
+ */
+
+#include "plist_intern.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_RB_ENC_INTERNED_STR
+#include <ruby/encoding.h>
+#endif
+
+enum {
+	INTERN_LOAD,
+	INTERN_PROCESS,
+	INTERN_SYMBOLS
+};
+
+typedef struct {
+	st_index_t hash;
+	long offset;                    // of the key bytes in text
+	long len;
+	VALUE value;                    // 0 for an empty slot
+} intern_entry_t;
+
+struct plist_intern {
+	int mode;
+	intern_entry_t *slots;
+	long capacity;                  // a power of two
+	long count;
+	plist_buf_t text;
+	long keys;                      // lookups, one per key in the input
+};
+
+static VALUE id_load, id_process, id_symbols, id_keys, id_created, id_avoided;
+#ifndef HAVE_RB_ENC_INTERNED_STR
+static VALUE id_uminus;
+#endif
+static long lastKeys, lastCreated;
+
+static void intern_mark(void *ptr) {
+	plist_intern_t *intern = ptr;
+	long i;
+	for (i = 0; i < intern->capacity; i++) {
+		if (intern->slots[i].value) rb_gc_mark(intern->slots[i].value);
+	}
+}
+
+static void intern_free(void *ptr) {
+	plist_intern_t *intern = ptr;
+	free(intern->slots);
+	plist_buf_free(&intern->text);
+	xfree(intern);
+}
+
+// Returns a wrapper owning a new table for the :intern_keys option
+// +mode+ and sets *intern to it, or returns Qnil with *intern NULL when
+// +mode+ turns interning off. The wrapper keeps the table's objects
+// alive, so keep it on the stack until the load is done.
+VALUE plist_intern_new(VALUE mode, plist_intern_t **intern) {
+	int kind;
+	*intern = NULL;
+	if (!RTEST(mode)) return Qnil;
+	if (mode == ID2SYM(id_load)) kind = INTERN_LOAD;
+	else if (mode == Qtrue || mode == ID2SYM(id_process)) kind = INTERN_PROCESS;
+	else if (mode == ID2SYM(id_symbols)) kind = INTERN_SYMBOLS;
+	else rb_raise(rb_eArgError, "intern_keys must be true, :load, :process or :symbols");
+	plist_intern_t *in;
+	VALUE self = Data_Make_Struct(rb_cObject, plist_intern_t, intern_mark, intern_free, in);
+	in->mode = kind;
+	plist_buf_init(&in->text);
+	in->slots = calloc(64, sizeof(intern_entry_t));
+	if (!in->slots) rb_memerror();
+	in->capacity = 64;
+	*intern = in;
+	return self;
+}
+
+static VALUE create(plist_intern_t *intern, const char *bytes, long len) {
+	switch (intern->mode) {
+		case INTERN_SYMBOLS:
+			return rb_str_intern(plist_str_new(bytes, len));
+		case INTERN_PROCESS:
+#ifdef HAVE_RB_ENC_INTERNED_STR
+			return rb_enc_interned_str(bytes, len, rb_utf8_encoding());
+#else
+			return rb_funcall(plist_str_new(bytes, len), id_uminus, 0);
+#endif
+		default:
+			return rb_obj_freeze(plist_str_new(bytes, len));
+	}
+}
+
+static void grow(plist_intern_t *intern) {
+	long capacity = intern->capacity * 2, i;
+	intern_entry_t *slots = calloc(capacity, sizeof(intern_entry_t));
+	if (!slots) rb_memerror();
+	for (i = 0; i < intern->capacity; i++) {
+		intern_entry_t *e = &intern->slots[i];
+		if (!e->value) continue;
+		long j = (long)(e->hash & (capacity - 1));
+		while (slots[j].value) j = (j + 1) & (capacity - 1);
+		slots[j] = *e;
+	}
+	free(intern->slots);
+	intern->slots = slots;
+	intern->capacity = capacity;
+}
+
+// The object for the dictionary key +bytes+, made on its first use in this load
+VALUE plist_intern_key(plist_intern_t *intern, const char *bytes, long len) {
+	st_index_t hash = rb_memhash(bytes, len);
+	long i = (long)(hash & (intern->capacity - 1));
+	intern->keys++;
+	for (;; i = (i + 1) & (intern->capacity - 1)) {
+		intern_entry_t *e = &intern->slots[i];
+		if (!e->value) break;
+		if (e->hash == hash && e->len == len && memcmp(intern->text.ptr + e->offset, bytes, len) == 0) return e->value;
+	}
+	VALUE value = create(intern, bytes, len);
+	long offset = intern->text.len;
+	if (plist_buf_append(&intern->text, bytes, len) < 0) rb_memerror();
+	intern_entry_t *e = &intern->slots[i];
+	e->hash = hash;
+	e->offset = offset;
+	e->len = len;
+	e->value = value;
+	if (++intern->count * 2 > intern->capacity) grow(intern);
+	return value;
+}
+
+// Records the table's counts for intern_stats once a load is done
+void plist_intern_finish(plist_intern_t *intern) {
+	if (!intern) return;
+	lastKeys = intern->keys;
+	lastCreated = intern->count;
+}
+
+/* call-seq:
+ *    PropertyList.intern_stats -> Hash
+ *
+ * Returns counts for the last load done with <tt>:intern_keys</tt>:
+ * <tt>:keys</tt> read, the Strings or Symbols <tt>:created</tt> for
+ * them, and so the key Strings <tt>:avoided</tt>.
+ */
+static VALUE plist_internStats(VALUE self) {
+	VALUE stats = rb_hash_new();
+	rb_hash_aset(stats, ID2SYM(id_keys), LONG2NUM(lastKeys));
+	rb_hash_aset(stats, ID2SYM(id_created), LONG2NUM(lastCreated));
+	rb_hash_aset(stats, ID2SYM(id_avoided), LONG2NUM(lastKeys - lastCreated));
+	return stats;
+}
+
+void Init_plist_intern(void) {
+	rb_define_module_function(mPlist, "intern_stats", plist_internStats, 0);
+	id_load = rb_intern("load");
+	id_process = rb_intern("process");
+	id_symbols = rb_intern("symbols");
+	id_keys = rb_intern("keys");
+	id_created = rb_intern("created");
+	id_avoided = rb_intern("avoided");
+#ifndef HAVE_RB_ENC_INTERNED_STR
+	id_uminus = rb_intern("-@");
+#endif
+}
@@ -0,0 +1,13 @@
+#ifndef _PLIST_INTERN_H_
+#define _PLIST_INTERN_H_
+
+#include "plist.h"
+
+typedef struct plist_intern plist_intern_t;
+
+VALUE plist_intern_new(VALUE mode, plist_intern_t **intern);
+VALUE plist_intern_key(plist_intern_t *intern, const char *bytes, long len);
+void plist_intern_finish(plist_intern_t *intern);
+void Init_plist_intern(void);
+
+#endif /* _PLIST_INTERN_H_ */
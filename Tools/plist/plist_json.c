@@ -0,0 +1,733 @@
+/*
+ * Conversion between property lists and JSON without Ruby objects.
+ *
+ * to_json runs one of the native readers straight into a JSON writer,
+ * and from_json runs a JSON reader straight into the XML or binary
+ * writer, so neither builds the Ruby object graph load and dump would.
+ *
+ * JSON has no dates or raw bytes, so they are written as one-member
+ * objects that from_json turns back into what they were:
+ *
+ *   <date>   {"$date": "2001-01-01T00:00:00Z"}  (UTC, to the second, as in XML)
+ *   <data>   {"$data": "base64..."}
+ *
+ * Reals are always written with a fraction or exponent so they read
+ * back as reals. NaN and infinite reals have no JSON form and JSON's
+ * null has no property list one; both are errors.
+ */
+
+#include "plist_json.h"
+#include "plist_ruby.h"
+#include "plist_xml.h"
+#include "plist_binary.h"
+#include "plist_simd.h"
+#include "plist_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// Reader
+
+typedef struct {
+	const char *start;
+	const char *p;
+	const char *end;
+	const plist_handler_t *handler;
+	void *ctx;
+	plist_buf_t *scratch;
+	plist_error_t *error;
+	int depth;
+	int stopped;
+} json_parser_t;
+
+static int parse_value(json_parser_t *ps, int skip);
+
+// Records an error at the current position and unwinds the parse
+static int fail(json_parser_t *ps, const char *message) {
+	ps->error->message = message;
+	ps->error->offset = ps->p - ps->start;
+	return -1;
+}
+
+// Checks a handler return code, stopping the parse if requested
+#define EMIT(ps, call) do {								\
+		if ((call) == PLIST_STOP) {						\
+			(ps)->stopped = 1;							\
+			return -1;									\
+		}												\
+	} while (0)
+
+static void skip_space(json_parser_t *ps) {
+	while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\n' || *ps->p == '\r' || *ps->p == '\t')) ps->p++;
+}
+
+static int hex4(const char *p, unsigned long *out) {
+	int i;
+	*out = 0;
+	for (i = 0; i < 4; i++) {
+		char c = p[i];
+		int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+		if (digit < 0) return -1;
+		*out = *out << 4 | digit;
+	}
+	return 0;
+}
+
+/*
+ * Reads the string starting at the opening quote. The result points into
+ * the input when there were no escapes, otherwise into the scratch buffer.
+ */
+static int read_string(json_parser_t *ps, const char **text, long *text_len) {
+	const char *p = ps->p + 1;
+	long run = plist_json_scan(p, ps->end - p);
+	if (p + run < ps->end && p[run] == '"') {
+		*text = p;
+		*text_len = run;
+		ps->p = p + run + 1;
+		return 0;
+	}
+	ps->scratch->len = 0;
+	for (;;) {
+		if (plist_buf_append(ps->scratch, p, run) < 0) return fail(ps, "out of memory");
+		p += run;
+		ps->p = p;
+		if (p >= ps->end) return fail(ps, "unterminated string");
+		if (*p == '"') break;
+		if (*p != '\\') return fail(ps, "control character in string");
+		if (p + 1 >= ps->end) return fail(ps, "unterminated string");
+		char c = 0;
+		switch (p[1]) {
+			case '"': c = '"'; break;
+			case '\\': c = '\\'; break;
+			case '/': c = '/'; break;
+			case 'b': c = '\b'; break;
+			case 'f': c = '\f'; break;
+			case 'n': c = '\n'; break;
+			case 'r': c = '\r'; break;
+			case 't': c = '\t'; break;
+			case 'u': {
+				unsigned long cp, low;
+				if (ps->end - p < 6 || hex4(p + 2, &cp) < 0) return fail(ps, "malformed \\u escape");
+				p += 6;
+				if (cp >= 0xD800 && cp < 0xDC00 && ps->end - p >= 6 && p[0] == '\\' && p[1] == 'u' && hex4(p + 2, &low) == 0 && low >= 0xDC00 && low < 0xE000) {
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+					p += 6;
+				} else if (cp >= 0xD800 && cp < 0xE000) {
+					cp = 0xFFFD;
+				}
+				if (plist_buf_append_utf8(ps->scratch, cp) < 0) return fail(ps, "out of memory");
+				break;
+			}
+			default: return fail(ps, "unknown escape in string");
+		}
+		if (c) {
+			if (plist_buf_append(ps->scratch, &c, 1) < 0) return fail(ps, "out of memory");
+			p += 2;
+		}
+		run = plist_json_scan(p, ps->end - p);
+	}
+	ps->p++;
+	*text = ps->scratch->ptr;
+	*text_len = ps->scratch->len;
+	return 0;
+}
+
+static int parse_number(json_parser_t *ps, int skip) {
+	const char *start = ps->p, *p = ps->p, *end = ps->end;
+	int is_real = 0;
+	if (p < end && *p == '-') p++;
+	if (p < end && *p == '0') {
+		p++;
+	} else if (p < end && *p >= '1' && *p <= '9') {
+		while (p < end && *p >= '0' && *p <= '9') p++;
+	} else {
+		return fail(ps, "unexpected character");
+	}
+	if (p < end && *p == '.') {
+		is_real = 1;
+		p++;
+		if (p >= end || *p < '0' || *p > '9') return fail(ps, "malformed number");
+		while (p < end && *p >= '0' && *p <= '9') p++;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		is_real = 1;
+		p++;
+		if (p < end && (*p == '+' || *p == '-')) p++;
+		if (p >= end || *p < '0' || *p > '9') return fail(ps, "malformed number");
+		while (p < end && *p >= '0' && *p <= '9') p++;
+	}
+	char text[64];
+	if (p - start >= (long)sizeof(text)) return fail(ps, "number too long");
+	memcpy(text, start, p - start);
+	text[p - start] = '\0';
+	ps->p = p;
+	if (skip) return 0;
+	errno = 0;
+	if (is_real) {
+		EMIT(ps, ps->handler->real(ps->ctx, strtod(text, NULL)));
+	} else {
+		long long value = strtoll(text, NULL, 10);
+		if (errno == ERANGE && *text != '-') {
+			// Up to 2**64 - 1, as a bplist can hold
+			errno = 0;
+			unsigned long long big = strtoull(text, NULL, 10);
+			if (errno != ERANGE) {
+				EMIT(ps, ps->handler->unsigned_integer(ps->ctx, big));
+				return 0;
+			}
+		}
+		if (errno == ERANGE) {
+			ps->p = start;
+			return fail(ps, "integer out of range");
+		}
+		EMIT(ps, ps->handler->integer(ps->ctx, value));
+	}
+	return 0;
+}
+
+static int parse_literal(json_parser_t *ps, const char *word, long len) {
+	if (ps->end - ps->p < len || memcmp(ps->p, word, len) != 0) return fail(ps, "unexpected character");
+	ps->p += len;
+	return 0;
+}
+
+// Reads {"$date": "..."} or {"$data": "..."} if that is what the object
+// at ps->p is, setting *found; anything else is left for parse_object
+static int parse_tagged(json_parser_t *ps, int skip, int *found) {
+	const char *start = ps->p, *text;
+	long len;
+	int is_data;
+	*found = 0;
+	ps->p++;
+	skip_space(ps);
+	if (ps->p >= ps->end || *ps->p != '"') goto other;
+	if (read_string(ps, &text, &len) < 0) return -1;
+	if (len != 5 || (memcmp(text, "$date", 5) != 0 && memcmp(text, "$data", 5) != 0)) goto other;
+	is_data = text[4] == 'a';
+	skip_space(ps);
+	if (ps->p >= ps->end || *ps->p != ':') goto other;
+	ps->p++;
+	skip_space(ps);
+	if (ps->p >= ps->end || *ps->p != '"') goto other;
+	const char *value = ps->p;
+	if (read_string(ps, &text, &len) < 0) return -1;
+	skip_space(ps);
+	if (ps->p >= ps->end || *ps->p != '}') goto other;
+	ps->p++;
+	*found = 1;
+	if (skip) return 0;
+	if (is_data) {
+		// Decoding in place is safe since the output never overtakes the input
+		char *out;
+		if (text == ps->scratch->ptr) {
+			out = ps->scratch->ptr;
+		} else {
+			ps->scratch->len = 0;
+			if (plist_buf_reserve(ps->scratch, len / 4 * 3 + PLIST_BASE64_SLACK) < 0) return fail(ps, "out of memory");
+			out = ps->scratch->ptr;
+		}
+		long n = plist_base64_decode(text, len, out);
+		if (n < 0) {
+			ps->p = value;
+			return fail(ps, "invalid base64 data");
+		}
+		EMIT(ps, ps->handler->data(ps->ctx, out, n));
+	} else {
+		double seconds;
+		if (plist_date_parse(text, len, &seconds) < 0) {
+			ps->p = value;
+			return fail(ps, "malformed date");
+		}
+		EMIT(ps, ps->handler->date(ps->ctx, seconds));
+	}
+	return 0;
+other:
+	ps->p = start;
+	return 0;
+}
+
+static int parse_object(json_parser_t *ps, int skip) {
+	const plist_handler_t *h = ps->handler;
+	int found, report = !skip;
+	if (parse_tagged(ps, skip, &found) < 0) return -1;
+	if (found) return 0;
+	if (++ps->depth > PLIST_MAX_DEPTH) return fail(ps, "nesting too deep");
+	if (report) {
+		int rc = h->begin_dict(ps->ctx);
+		if (rc == PLIST_STOP) {
+			ps->stopped = 1;
+			return -1;
+		}
+		if (rc == PLIST_SKIP) report = 0;
+	}
+	ps->p++;
+	skip_space(ps);
+	if (ps->p < ps->end && *ps->p == '}') {
+		ps->p++;
+	} else {
+		for (;;) {
+			const char *key;
+			long key_len;
+			skip_space(ps);
+			if (ps->p >= ps->end || *ps->p != '"') return fail(ps, "expected a string key");
+			if (read_string(ps, &key, &key_len) < 0) return -1;
+			if (report) EMIT(ps, h->key(ps->ctx, key, key_len));
+			skip_space(ps);
+			if (ps->p >= ps->end || *ps->p != ':') return fail(ps, "expected ':'");
+			ps->p++;
+			if (parse_value(ps, !report) < 0) return -1;
+			skip_space(ps);
+			if (ps->p < ps->end && *ps->p == ',') {
+				ps->p++;
+			} else if (ps->p < ps->end && *ps->p == '}') {
+				ps->p++;
+				break;
+			} else {
+				return fail(ps, "expected ',' or '}'");
+			}
+		}
+	}
+	ps->depth--;
+	if (report) EMIT(ps, h->end_dict(ps->ctx));
+	return 0;
+}
+
+static int parse_array(json_parser_t *ps, int skip) {
+	const plist_handler_t *h = ps->handler;
+	int report = !skip;
+	if (++ps->depth > PLIST_MAX_DEPTH) return fail(ps, "nesting too deep");
+	if (report) {
+		int rc = h->begin_array(ps->ctx);
+		if (rc == PLIST_STOP) {
+			ps->stopped = 1;
+			return -1;
+		}
+		if (rc == PLIST_SKIP) report = 0;
+	}
+	ps->p++;
+	skip_space(ps);
+	if (ps->p < ps->end && *ps->p == ']') {
+		ps->p++;
+	} else {
+		for (;;) {
+			if (parse_value(ps, !report) < 0) return -1;
+			skip_space(ps);
+			if (ps->p < ps->end && *ps->p == ',') {
+				ps->p++;
+			} else if (ps->p < ps->end && *ps->p == ']') {
+				ps->p++;
+				break;
+			} else {
+				return fail(ps, "expected ',' or ']'");
+			}
+		}
+	}
+	ps->depth--;
+	if (report) EMIT(ps, h->end_array(ps->ctx));
+	return 0;
+}
+
+static int parse_value(json_parser_t *ps, int skip) {
+	const char *text;
+	long len;
+	skip_space(ps);
+	if (ps->p >= ps->end) return fail(ps, "unexpected end of input");
+	switch (*ps->p) {
+		case '{': return parse_object(ps, skip);
+		case '[': return parse_array(ps, skip);
+		case '"':
+			if (read_string(ps, &text, &len) < 0) return -1;
+			if (!skip) EMIT(ps, ps->handler->string(ps->ctx, text, len));
+			return 0;
+		case 't':
+			if (parse_literal(ps, "true", 4) < 0) return -1;
+			if (!skip) EMIT(ps, ps->handler->boolean(ps->ctx, 1));
+			return 0;
+		case 'f':
+			if (parse_literal(ps, "false", 5) < 0) return -1;
+			if (!skip) EMIT(ps, ps->handler->boolean(ps->ctx, 0));
+			return 0;
+		case 'n':
+			return fail(ps, "null has no property list equivalent");
+		default:
+			return parse_number(ps, skip);
+	}
+}
+
+// Reports the JSON value in +bytes+ to +handler+ the way the property
+// list readers do. Returns 0 on success or when the handler stopped
+// the parse, -1 with +error+ set otherwise.
+int plist_json_parse(const char *bytes, long len, const plist_handler_t *handler, void *ctx, plist_buf_t *scratch, plist_error_t *error) {
+	json_parser_t ps;
+	ps.start = bytes;
+	ps.p = bytes;
+	ps.end = bytes + len;
+	ps.handler = handler;
+	ps.ctx = ctx;
+	ps.scratch = scratch;
+	ps.error = error;
+	ps.depth = 0;
+	ps.stopped = 0;
+	if (len >= 3 && memcmp(bytes, "\xEF\xBB\xBF", 3) == 0) ps.p += 3;
+	if (parse_value(&ps, 0) < 0) return ps.stopped ? 0 : -1;
+	skip_space(&ps);
+	if (ps.p != ps.end) return fail(&ps, "trailing characters");
+	return 0;
+}
+
+// Writer
+
+typedef struct {
+	VALUE out;                      // the String being written
+	VALUE io;                       // takes out every +chunk+ bytes, or Qnil
+	long chunk;
+	long written;                   // bytes handed to io
+	int depth;
+	int after_key;                  // the next value belongs to a key
+	char first[PLIST_MAX_DEPTH + 1]; // nothing written yet in the container at each depth
+	const char *error;
+} json_writer_t;
+
+// Hands the buffered output to the IO as a String of its own, which the
+// IO may keep; the next chunk goes into a new one.
+static void flush_chunk(json_writer_t *w) {
+	long len = RSTRING_LEN(w->out);
+	if (len == 0) return;
+	rb_funcall(w->io, id_write, 1, w->out);
+	w->written += len;
+	w->out = rb_str_buf_new(w->chunk);
+}
+
+static void put(json_writer_t *w, const char *bytes, long len) {
+	if (NIL_P(w->io)) {
+		rb_str_buf_cat(w->out, bytes, len);
+		return;
+	}
+	while (len > 0) {
+		long n = w->chunk - RSTRING_LEN(w->out);
+		if (n > len) n = len;
+		rb_str_buf_cat(w->out, bytes, n);
+		bytes += n;
+		len -= n;
+		if (RSTRING_LEN(w->out) >= w->chunk) flush_chunk(w);
+	}
+}
+
+// Writes the comma a value or key needs after the one before it
+static void separate(json_writer_t *w) {
+	if (w->after_key) {
+		w->after_key = 0;
+	} else if (w->depth > 0) {
+		if (!w->first[w->depth]) put(w, ",", 1);
+		w->first[w->depth] = 0;
+	}
+}
+
+static void put_string(json_writer_t *w, const char *p, long len) {
+	const char *end = p + len;
+	put(w, "\"", 1);
+	for (;;) {
+		long run = plist_json_scan(p, end - p);
+		put(w, p, run);
+		p += run;
+		if (p == end) break;
+		unsigned char c = (unsigned char)*p++;
+		switch (c) {
+			case '"': put(w, "\\\"", 2); break;
+			case '\\': put(w, "\\\\", 2); break;
+			case '\n': put(w, "\\n", 2); break;
+			case '\r': put(w, "\\r", 2); break;
+			case '\t': put(w, "\\t", 2); break;
+			case '\b': put(w, "\\b", 2); break;
+			case '\f': put(w, "\\f", 2); break;
+			default: {
+				char escape[8];
+				snprintf(escape, sizeof(escape), "\\u%04x", c);
+				put(w, escape, 6);
+			}
+		}
+	}
+	put(w, "\"", 1);
+}
+
+static int begin(json_writer_t *w, const char *open) {
+	separate(w);
+	if (w->depth >= PLIST_MAX_DEPTH) {
+		w->error = "nesting too deep";
+		return PLIST_STOP;
+	}
+	put(w, open, 1);
+	w->first[++w->depth] = 1;
+	return PLIST_CONTINUE;
+}
+
+static int j_begin_dict(void *ctx) {
+	return begin(ctx, "{");
+}
+
+static int j_begin_array(void *ctx) {
+	return begin(ctx, "[");
+}
+
+static int j_end_dict(void *ctx) {
+	json_writer_t *w = ctx;
+	w->depth--;
+	put(w, "}", 1);
+	return PLIST_CONTINUE;
+}
+
+static int j_end_array(void *ctx) {
+	json_writer_t *w = ctx;
+	w->depth--;
+	put(w, "]", 1);
+	return PLIST_CONTINUE;
+}
+
+static int j_key(void *ctx, const char *bytes, long len) {
+	json_writer_t *w = ctx;
+	separate(w);
+	put_string(w, bytes, len);
+	put(w, ":", 1);
+	w->after_key = 1;
+	return PLIST_CONTINUE;
+}
+
+static int j_string(void *ctx, const char *bytes, long len) {
+	separate(ctx);
+	put_string(ctx, bytes, len);
+	return PLIST_CONTINUE;
+}
+
+// A multiple of 3 bytes, so only the last block can need padding
+#define DATA_BLOCK 3072
+
+static int j_data(void *ctx, const char *bytes, long len) {
+	json_writer_t *w = ctx;
+	char text[DATA_BLOCK / 3 * 4];
+	separate(w);
+	put(w, "{\"$data\":\"", 10);
+	while (len > 0) {
+		long n = len < DATA_BLOCK ? len : DATA_BLOCK;
+		plist_base64_encode((const unsigned char *)bytes, n, text);
+		put(w, text, (n + 2) / 3 * 4);
+		bytes += n;
+		len -= n;
+	}
+	put(w, "\"}", 2);
+	return PLIST_CONTINUE;
+}
+
+static int j_integer(void *ctx, long long value) {
+	char text[32];
+	separate(ctx);
+	snprintf(text, sizeof(text), "%lld", value);
+	put(ctx, text, (long)strlen(text));
+	return PLIST_CONTINUE;
+}
+
+static int j_unsigned_integer(void *ctx, unsigned long long value) {
+	char text[32];
+	separate(ctx);
+	snprintf(text, sizeof(text), "%llu", value);
+	put(ctx, text, (long)strlen(text));
+	return PLIST_CONTINUE;
+}
+
+static int j_real(void *ctx, double value) {
+	json_writer_t *w = ctx;
+	char text[32];
+	plist_real_format(value, text);
+	if (strpbrk(text, "ni")) {
+		w->error = "NaN and infinite reals have no JSON equivalent";
+		return PLIST_STOP;
+	}
+	separate(w);
+	put(w, text, (long)strlen(text));
+	if (!strpbrk(text, ".e")) put(w, ".0", 2);
+	return PLIST_CONTINUE;
+}
+
+static int j_boolean(void *ctx, int value) {
+	separate(ctx);
+	if (value) put(ctx, "true", 4);
+	else put(ctx, "false", 5);
+	return PLIST_CONTINUE;
+}
+
+static int j_date(void *ctx, double seconds) {
+	char text[21];
+	separate(ctx);
+	plist_date_format(seconds, text);
+	put(ctx, "{\"$date\":\"", 10);
+	put(ctx, text, (long)strlen(text));
+	put(ctx, "\"}", 2);
+	return PLIST_CONTINUE;
+}
+
+static const plist_handler_t json_writer_handler = {
+	j_begin_dict, j_end_dict, j_begin_array, j_end_array,
+	j_key, j_string, j_data, j_integer, j_real, j_boolean, j_date, j_unsigned_integer
+};
+
+// Ruby interface
+
+// The bytes of +input+, an IO or a String
+static VALUE read_input(VALUE input) {
+	if (RTEST(rb_respond_to(input, id_read))) return rb_funcall(input, id_read, 0);
+	StringValue(input);
+	return input;
+}
+
+// A String for the output, empty and tagged as UTF-8 for JSON
+static VALUE new_output(int json) {
+	return json ? plist_str_new("", 0) : rb_str_buf_new(0);
+}
+
+static void raise_json_error(const char *bytes, long len, plist_error_t *error) {
+	long line = 1, i;
+	for (i = 0; i < error->offset && i < len; i++) {
+		if (bytes[i] == '\n') line++;
+	}
+	rb_raise(ePropertyListError, "Malformed JSON: %s at line %ld", error->message, line);
+}
+
+struct convert_args {
+	VALUE buffer;                   // the input
+	VALUE out;
+	VALUE format;
+	plist_buf_t scratch;
+	json_writer_t *writer;
+	long written;
+};
+
+static VALUE to_json_body(VALUE arg) {
+	struct convert_args *args = (struct convert_args *)arg;
+	const char *bytes = RSTRING_PTR(args->buffer);
+	long len = RSTRING_LEN(args->buffer);
+	json_writer_t *w = args->writer;
+	plist_error_t error;
+	plist_parse_fn parse = plist_reader_for(bytes, len);
+	plist_stats_load(plist_reader_format(parse), len);
+	if (parse(bytes, len, &json_writer_handler, w, &args->scratch, &error) < 0) plist_raise_error(bytes, len, &error);
+	if (w->error) rb_raise(rb_eArgError, "Could not write JSON: %s", w->error);
+	if (NIL_P(w->io)) {
+		args->written = RSTRING_LEN(w->out);
+	} else {
+		flush_chunk(w);
+		args->written = w->written;
+	}
+	plist_stats_dump(id_json, args->written);
+	plist_stats_phase(id_json, PLIST_WRITE);
+	return Qnil;
+}
+
+static VALUE convert_cleanup(VALUE arg) {
+	struct convert_args *args = (struct convert_args *)arg;
+	plist_buf_free(&args->scratch);
+	return Qnil;
+}
+
+/* call-seq:
+ *    PropertyList.to_json(input)         -> String
+ *    PropertyList.to_json(input, output) -> Integer
+ *
+ * Converts the property list in +input+, an IO or a String in any of
+ * the formats load reads, to JSON without creating Ruby objects for its
+ * contents. The JSON is returned, or written to +output+ in pieces as
+ * it is produced, in which case the number of bytes is returned.
+ *
+ * Dates become <tt>{"$date": "2001-01-01T00:00:00Z"}</tt> and data
+ * <tt>{"$data": "base64..."}</tt>, which from_json reads back. Reals
+ * that are NaN or infinite can't be written.
+ */
+static VALUE plist_toJSON(int argc, VALUE *argv, VALUE self) {
+	VALUE input, output;
+	struct convert_args args;
+	// On the stack, where the GC sees the String it's writing to
+	json_writer_t writer;
+	rb_scan_args(argc, argv, "11", &input, &output);
+	args.buffer = read_input(input);
+	plist_buf_init(&args.scratch);
+	memset(&writer, 0, sizeof(writer));
+	if (NIL_P(output)) {
+		writer.out = new_output(1);
+		writer.io = Qnil;
+	} else {
+		writer.out = rb_str_buf_new(PLIST_DUMP_CHUNK);
+		writer.io = output;
+	}
+	writer.chunk = PLIST_DUMP_CHUNK;
+	args.writer = &writer;
+	args.out = writer.out;
+	rb_ensure(to_json_body, (VALUE)&args, convert_cleanup, (VALUE)&args);
+	RB_GC_GUARD(args.buffer);
+	RB_GC_GUARD(args.out);
+	return NIL_P(output) ? args.out : LONG2NUM(args.written);
+}
+
+// Feeds the JSON input to a writer, for plist_binary_write
+static void json_source(void *arg, const plist_handler_t *handler, void *ctx) {
+	struct convert_args *args = arg;
+	const char *bytes = RSTRING_PTR(args->buffer);
+	long len = RSTRING_LEN(args->buffer);
+	plist_error_t error;
+	if (plist_json_parse(bytes, len, handler, ctx, &args->scratch, &error) < 0) raise_json_error(bytes, len, &error);
+}
+
+static VALUE from_json_body(VALUE arg) {
+	struct convert_args *args = (struct convert_args *)arg;
+	plist_stats_load(id_json, RSTRING_LEN(args->buffer));
+	if (args->format == id_binary) {
+		args->written = plist_binary_write(json_source, args, args->out, PLIST_DUMP_CHUNK);
+	} else {
+		plist_xml_writer_t writer;
+		plist_xml_writer_init(&writer, args->out, PLIST_DUMP_CHUNK);
+		json_source(args, &plist_xml_writer_handler, &writer);
+		args->written = plist_xml_writer_finish(&writer);
+	}
+	plist_stats_dump(args->format, args->written);
+	plist_stats_phase(args->format, PLIST_WRITE);
+	return Qnil;
+}
+
+/* call-seq:
+ *    PropertyList.from_json(input, format = :xml1)         -> String
+ *    PropertyList.from_json(input, output, format = :xml1) -> Integer
+ *
+ * Converts the JSON in +input+, an IO or a String, to a property list
+ * in +format+, <tt>:xml1</tt> or <tt>:binary1</tt>, without creating
+ * Ruby objects for its contents. The property list is returned, or
+ * written to +output+ in pieces, in which case the number of bytes is
+ * returned. XML output starts before all the input has been checked,
+ * so +output+ may have been written to when an error is raised.
+ *
+ * The <tt>$date</tt> and <tt>$data</tt> objects to_json writes become
+ * dates and data again. JSON null can't be converted.
+ */
+static VALUE plist_fromJSON(int argc, VALUE *argv, VALUE self) {
+	VALUE input, output, format;
+	struct convert_args args;
+	int count = rb_scan_args(argc, argv, "12", &input, &output, &format);
+	if (count == 2 && SYMBOL_P(output)) {
+		format = output;
+		output = Qnil;
+	}
+	args.format = NIL_P(format) ? id_xml : rb_to_id(format);
+	if (args.format != id_xml && args.format != id_binary) rb_raise(rb_eArgError, "format must be :xml1 or :binary1");
+	args.buffer = read_input(input);
+	args.out = NIL_P(output) ? new_output(0) : output;
+	args.writer = NULL;
+	plist_buf_init(&args.scratch);
+	rb_ensure(from_json_body, (VALUE)&args, convert_cleanup, (VALUE)&args);
+	RB_GC_GUARD(args.buffer);
+	return NIL_P(output) ? args.out : LONG2NUM(args.written);
+}
+
+PLIST_TRACED("to_json", plist_toJSON)
+PLIST_TRACED("from_json", plist_fromJSON)
+
+void Init_plist_json(void) {
+	rb_define_module_function(mPlist, "to_json", plist_toJSONTraced, -1);
+	rb_define_module_function(mPlist, "from_json", plist_fromJSONTraced, -1);
+}
@@ -0,0 +1,9 @@
+#ifndef _PLIST_JSON_H_
+#define _PLIST_JSON_H_
+
+#include "plist.h"
+
+int plist_json_parse(const char *bytes, long len, const plist_handler_t *handler, void *ctx, plist_buf_t *scratch, plist_error_t *error);
+void Init_plist_json(void);
+
+#endif /* _PLIST_JSON_H_ */
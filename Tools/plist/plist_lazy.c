@@ -0,0 +1,339 @@
+/*
+ * OSX::PropertyList.load_lazy support.
+ *
+ * The property list is parsed into a plist_doc_t and handed out as
+ * LazyHash/LazyArray views onto it. A member is converted to a Ruby
+ * object the first time it is asked for; nested containers come back as
+ * further views, so only the parts of the document that are actually
+ * visited ever become Ruby objects. to_h/to_a convert a whole subtree.
+ */
+
+#include "plist_lazy.h"
+#include "plist_doc.h"
+#include "plist_ruby.h"
+
+static VALUE cLazyDoc, cLazyHash, cLazyArray;
+
+typedef struct {
+	plist_doc_t doc;
+	long materialized;
+	unsigned char *seen;            // a bit per node counted in +materialized+
+} lazy_doc_t;
+
+typedef struct {
+	VALUE owner;                    // the LazyDoc holding the nodes
+	long node;
+	VALUE members;                  // node index => converted member
+	long *children;                 // node of each array element, once indexed
+} lazy_view_t;
+
+static void lazy_doc_free(void *ptr) {
+	lazy_doc_t *ld = ptr;
+	plist_doc_free(&ld->doc);
+	xfree(ld->seen);
+	xfree(ld);
+}
+
+static void lazy_view_free(void *ptr) {
+	lazy_view_t *view = ptr;
+	xfree(view->children);
+	xfree(view);
+}
+
+static void lazy_view_mark(void *ptr) {
+	lazy_view_t *view = ptr;
+	rb_gc_mark(view->owner);
+	rb_gc_mark(view->members);
+}
+
+static lazy_doc_t *get_doc(VALUE owner) {
+	lazy_doc_t *ld;
+	Data_Get_Struct(owner, lazy_doc_t, ld);
+	return ld;
+}
+
+static lazy_view_t *get_view(VALUE self) {
+	lazy_view_t *view;
+	Data_Get_Struct(self, lazy_view_t, view);
+	return view;
+}
+
+static VALUE new_view(VALUE owner, long node) {
+	lazy_view_t *view;
+	int kind = plist_doc_node(&get_doc(owner)->doc, node)->kind;
+	VALUE self = Data_Make_Struct(kind == PLIST_NODE_DICT ? cLazyHash : cLazyArray, lazy_view_t, lazy_view_mark, lazy_view_free, view);
+	view->owner = owner;
+	view->node = node;
+	view->members = rb_hash_new();
+	view->children = NULL;
+	return self;
+}
+
+// Counts the nodes from +from+ up to +to+ that weren't converted before,
+// so converting a subtree again doesn't count it twice
+static void count_materialized(lazy_doc_t *ld, long from, long to) {
+	long i;
+	if (!ld->seen) ld->seen = ZALLOC_N(unsigned char, (plist_doc_count(&ld->doc) + 7) / 8);
+	for (i = from; i < to; i++) {
+		if (ld->seen[i / 8] & (1 << (i % 8))) continue;
+		ld->seen[i / 8] |= 1 << (i % 8);
+		ld->materialized++;
+	}
+}
+
+// Converts the whole subtree at +node+ into Ruby objects
+static VALUE materialize(VALUE owner, long node) {
+	lazy_doc_t *ld = get_doc(owner);
+	plist_node_t *key = plist_doc_node(&ld->doc, node);
+	plist_builder_t builder;
+	if (key->kind == PLIST_NODE_KEY) {
+		// Keys have no event of their own outside a dict, and Hash keys are frozen
+		count_materialized(ld, node, node + 1);
+		return rb_obj_freeze(plist_str_new(plist_doc_text(&ld->doc, key), key->len));
+	}
+	plist_builder_init(&builder);
+	plist_doc_emit(&ld->doc, node, &plist_builder_handler, &builder);
+	count_materialized(ld, node, plist_doc_next(&ld->doc, node));
+	return builder.result;
+}
+
+// The member at +node+: a view for containers, a Ruby object otherwise
+static VALUE member(VALUE self, long node) {
+	lazy_view_t *view = get_view(self);
+	VALUE key = LONG2FIX(node);
+	VALUE value = rb_hash_lookup(view->members, key);
+	if (NIL_P(value)) {
+		int kind = plist_doc_node(&get_doc(view->owner)->doc, node)->kind;
+		if (kind == PLIST_NODE_DICT || kind == PLIST_NODE_ARRAY) value = new_view(view->owner, node);
+		else value = materialize(view->owner, node);
+		rb_hash_aset(view->members, key, value);
+	}
+	return value;
+}
+
+/* call-seq:
+ *    view.size -> Integer
+ *
+ * Returns the number of members without converting any of them.
+ */
+static VALUE lazy_size(VALUE self) {
+	lazy_view_t *view = get_view(self);
+	return LONG2NUM(plist_doc_node(&get_doc(view->owner)->doc, view->node)->len);
+}
+
+/* call-seq:
+ *    view.materialized -> Integer
+ *
+ * Returns how many nodes of the whole document have been converted
+ * to Ruby objects so far. Every key, value and container counts as
+ * one node.
+ */
+static VALUE lazy_materialized(VALUE self) {
+	return LONG2NUM(get_doc(get_view(self)->owner)->materialized);
+}
+
+/* call-seq:
+ *    view.nodes -> Integer
+ *
+ * Returns the number of nodes in the whole document.
+ */
+static VALUE lazy_nodes(VALUE self) {
+	return LONG2NUM(plist_doc_count(&get_doc(get_view(self)->owner)->doc));
+}
+
+/* call-seq:
+ *    lazy_hash[key] -> object
+ *
+ * Returns the value stored under +key+, or +nil+. Only that value is
+ * converted; if it is a dictionary or an array, a further view.
+ */
+static VALUE lazy_hash_aref(VALUE self, VALUE key) {
+	lazy_view_t *view = get_view(self);
+	if (TYPE(key) == T_SYMBOL) key = rb_str_new2(rb_id2name(SYM2ID(key)));
+	if (TYPE(key) != T_STRING) return Qnil;
+	long node = plist_doc_lookup(&get_doc(view->owner)->doc, view->node, RSTRING_PTR(key), RSTRING_LEN(key));
+	return node < 0 ? Qnil : member(self, node);
+}
+
+/* call-seq:
+ *    lazy_hash.key?(key) -> true or false
+ */
+static VALUE lazy_hash_has_key(VALUE self, VALUE key) {
+	lazy_view_t *view = get_view(self);
+	if (TYPE(key) == T_SYMBOL) key = rb_str_new2(rb_id2name(SYM2ID(key)));
+	if (TYPE(key) != T_STRING) return Qfalse;
+	long node = plist_doc_lookup(&get_doc(view->owner)->doc, view->node, RSTRING_PTR(key), RSTRING_LEN(key));
+	return node < 0 ? Qfalse : Qtrue;
+}
+
+/* call-seq:
+ *    lazy_hash.keys -> Array
+ */
+static VALUE lazy_hash_keys(VALUE self) {
+	lazy_view_t *view = get_view(self);
+	plist_doc_t *doc = &get_doc(view->owner)->doc;
+	long child = view->node + 1, end = plist_doc_node(doc, view->node)->v.end;
+	VALUE keys = rb_ary_new();
+	while (child < end) {
+		rb_ary_push(keys, member(self, child));
+		child = plist_doc_next(doc, child + 1);
+	}
+	return keys;
+}
+
+/* call-seq:
+ *    lazy_hash.each { |key, value| block } -> lazy_hash
+ *
+ * Yields every pair, converting members the same way #[] does.
+ */
+static VALUE lazy_hash_each(VALUE self) {
+	RETURN_ENUMERATOR(self, 0, 0);
+	lazy_view_t *view = get_view(self);
+	plist_doc_t *doc = &get_doc(view->owner)->doc;
+	long child = view->node + 1, end = plist_doc_node(doc, view->node)->v.end;
+	while (child < end) {
+		rb_yield(rb_assoc_new(member(self, child), member(self, child + 1)));
+		child = plist_doc_next(doc, child + 1);
+	}
+	return self;
+}
+
+/* call-seq:
+ *    lazy_array[index] -> object
+ *
+ * Returns the element at +index+, or +nil+. Negative indexes count
+ * from the end. The first call finds where every element starts, so
+ * later ones go straight to theirs.
+ */
+static VALUE lazy_array_aref(VALUE self, VALUE index) {
+	lazy_view_t *view = get_view(self);
+	plist_doc_t *doc = &get_doc(view->owner)->doc;
+	long i = NUM2LONG(index), len = plist_doc_node(doc, view->node)->len, child = view->node + 1;
+	if (i < 0) i += len;
+	if (i < 0 || i >= len) return Qnil;
+	if (!view->children) {
+		long n, *children = ALLOC_N(long, len);
+		for (n = 0; n < len; n++) {
+			children[n] = child;
+			child = plist_doc_next(doc, child);
+		}
+		view->children = children;
+	}
+	return member(self, view->children[i]);
+}
+
+/* call-seq:
+ *    lazy_array.each { |value| block } -> lazy_array
+ */
+static VALUE lazy_array_each(VALUE self) {
+	RETURN_ENUMERATOR(self, 0, 0);
+	lazy_view_t *view = get_view(self);
+	plist_doc_t *doc = &get_doc(view->owner)->doc;
+	long child = view->node + 1, end = plist_doc_node(doc, view->node)->v.end;
+	while (child < end) {
+		rb_yield(member(self, child));
+		child = plist_doc_next(doc, child);
+	}
+	return self;
+}
+
+/* call-seq:
+ *    view.to_h -> Hash
+ *    view.to_a -> Array
+ *
+ * Converts the whole subtree into ordinary Ruby objects.
+ */
+static VALUE lazy_convert(VALUE self) {
+	lazy_view_t *view = get_view(self);
+	return materialize(view->owner, view->node);
+}
+
+/* call-seq:
+ *    view == obj -> true or false
+ */
+static VALUE lazy_equal(VALUE self, VALUE other) {
+	if (rb_obj_is_kind_of(other, cLazyHash) || rb_obj_is_kind_of(other, cLazyArray)) other = lazy_convert(other);
+	return rb_equal(lazy_convert(self), other);
+}
+
+// Takes over +doc+ and returns a view of its top object; a document
+// holding a single scalar just gives that value.
+VALUE plist_lazy_adopt(plist_doc_t *doc) {
+	lazy_doc_t *ld;
+	VALUE owner = Data_Make_Struct(cLazyDoc, lazy_doc_t, 0, lazy_doc_free, ld);
+	ld->doc = *doc;
+	plist_doc_init(doc);
+	// Nothing else gets added, so drop the stack used while building
+	plist_buf_free(&ld->doc.open);
+	if (plist_doc_count(&ld->doc) == 0) return Qnil;
+	int kind = plist_doc_node(&ld->doc, 0)->kind;
+	if (kind == PLIST_NODE_DICT || kind == PLIST_NODE_ARRAY) return new_view(owner, 0);
+	return materialize(owner, 0);
+}
+
+struct lazy_load_args {
+	plist_parse_fn parse;
+	const char *bytes;
+	long len;
+	plist_doc_t doc;
+	plist_buf_t scratch;
+};
+
+static VALUE lazy_load_body(VALUE arg) {
+	struct lazy_load_args *args = (struct lazy_load_args *)arg;
+	plist_error_t error;
+	int rc = args->parse(args->bytes, args->len, &plist_doc_handler, &args->doc, &args->scratch, &error);
+	if (args->doc.failed) rb_memerror();
+	if (rc < 0) plist_raise_error(args->bytes, args->len, &error);
+	return plist_lazy_adopt(&args->doc);
+}
+
+static VALUE lazy_load_cleanup(VALUE arg) {
+	struct lazy_load_args *args = (struct lazy_load_args *)arg;
+	plist_doc_free(&args->doc);
+	plist_buf_free(&args->scratch);
+	return Qnil;
+}
+
+// Parses +bytes+ into a document and returns a view of its top object
+VALUE plist_lazy_load(const char *bytes, long len) {
+	struct lazy_load_args args;
+	args.parse = plist_reader_for(bytes, len);
+	args.bytes = bytes;
+	args.len = len;
+	plist_doc_init(&args.doc);
+	plist_buf_init(&args.scratch);
+	return rb_ensure(lazy_load_body, (VALUE)&args, lazy_load_cleanup, (VALUE)&args);
+}
+
+void Init_plist_lazy(void) {
+	cLazyDoc = rb_define_class_under(mPlist, "LazyDocument", rb_cObject);
+	rb_undef_alloc_func(cLazyDoc);
+	cLazyHash = rb_define_class_under(mPlist, "LazyHash", rb_cObject);
+	rb_undef_alloc_func(cLazyHash);
+	rb_include_module(cLazyHash, rb_mEnumerable);
+	rb_define_method(cLazyHash, "[]", lazy_hash_aref, 1);
+	rb_define_method(cLazyHash, "key?", lazy_hash_has_key, 1);
+	rb_define_method(cLazyHash, "has_key?", lazy_hash_has_key, 1);
+	rb_define_method(cLazyHash, "include?", lazy_hash_has_key, 1);
+	rb_define_method(cLazyHash, "keys", lazy_hash_keys, 0);
+	rb_define_method(cLazyHash, "each", lazy_hash_each, 0);
+	rb_define_method(cLazyHash, "each_pair", lazy_hash_each, 0);
+	rb_define_method(cLazyHash, "size", lazy_size, 0);
+	rb_define_method(cLazyHash, "length", lazy_size, 0);
+	rb_define_method(cLazyHash, "to_h", lazy_convert, 0);
+	rb_define_method(cLazyHash, "==", lazy_equal, 1);
+	rb_define_method(cLazyHash, "materialized", lazy_materialized, 0);
+	rb_define_method(cLazyHash, "nodes", lazy_nodes, 0);
+	cLazyArray = rb_define_class_under(mPlist, "LazyArray", rb_cObject);
+	rb_undef_alloc_func(cLazyArray);
+	rb_include_module(cLazyArray, rb_mEnumerable);
+	rb_define_method(cLazyArray, "[]", lazy_array_aref, 1);
+	rb_define_method(cLazyArray, "each", lazy_array_each, 0);
+	rb_define_method(cLazyArray, "size", lazy_size, 0);
+	rb_define_method(cLazyArray, "length", lazy_size, 0);
+	rb_define_method(cLazyArray, "to_a", lazy_convert, 0);
+	rb_define_method(cLazyArray, "==", lazy_equal, 1);
+	rb_define_method(cLazyArray, "materialized", lazy_materialized, 0);
+	rb_define_method(cLazyArray, "nodes", lazy_nodes, 0);
+}
@@ -0,0 +1,11 @@
+#ifndef _PLIST_LAZY_H_
+#define _PLIST_LAZY_H_
+
+#include "plist.h"
+#include "plist_doc.h"
+
+VALUE plist_lazy_load(const char *bytes, long len);
+VALUE plist_lazy_adopt(plist_doc_t *doc);
+void Init_plist_lazy(void);
+
+#endif /* _PLIST_LAZY_H_ */
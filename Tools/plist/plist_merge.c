@@ -0,0 +1,392 @@
+/*
+ * OSX::PropertyList.diff and merge.
+ *
+ * Both sides are parsed into plist_doc_t documents, or for Ruby objects
+ * emitted into them, and compared node by node. diff only turns the
+ * values it reports into Ruby objects. merge writes its result by
+ * replaying subtrees of the two documents to the XML or binary writer,
+ * or into a new document for a lazy view, so nothing it copies over
+ * unchanged ever becomes a Ruby object.
+ *
+ * Dictionaries are matched by key whatever their order. Keys are looked
+ * for at the position following the previous match before searching,
+ * so documents that keep their keys in the same order are compared in
+ * linear time. Arrays are matched index by index.
+ */
+
+#include "plist_merge.h"
+#include "plist_doc.h"
+#include "plist_ruby.h"
+#include "plist_lazy.h"
+#include "plist_xml.h"
+#include "plist_binary.h"
+#include "plist_stats.h"
+#include <string.h>
+
+enum {
+	MERGE_DEEP,                     // dictionaries merged at every level
+	MERGE_SHALLOW,                  // only the top level keys
+	MERGE_APPEND                    // deep, and arrays concatenated
+};
+
+static VALUE id_set, id_delete, id_strategy, id_format, id_deep, id_shallow, id_append, id_lazy;
+
+struct compare_args {
+	VALUE inputs[2];
+	VALUE buffers[2];               // the bytes read from each input, or Qnil
+	VALUE formats[2];               // format read, or Qnil for Ruby objects
+	plist_doc_t docs[2];
+	plist_doc_t result;             // for :lazy
+	plist_buf_t scratch;
+	VALUE path;                     // diff: keys and indexes down to here
+	VALUE ops;
+	int strategy;
+	VALUE format;                   // merge: output format
+	VALUE out;
+};
+
+#define BASE(args) (&(args)->docs[0])
+#define OVERLAY(args) (&(args)->docs[1])
+
+// Loads side +n+: property list input is parsed, anything else is
+// taken as the Ruby object it is
+static void load_side(struct compare_args *args, int n) {
+	VALUE input = args->inputs[n];
+	plist_doc_t *doc = &args->docs[n];
+	if (TYPE(input) == T_STRING || RTEST(rb_respond_to(input, id_read))) {
+		VALUE buffer = TYPE(input) == T_STRING ? input : rb_funcall(input, id_read, 0);
+		StringValue(buffer);
+		args->buffers[n] = buffer;
+		const char *bytes = RSTRING_PTR(buffer);
+		long len = RSTRING_LEN(buffer);
+		plist_error_t error;
+		plist_parse_fn parse = plist_reader_for(bytes, len);
+		args->formats[n] = plist_reader_format(parse);
+		plist_stats_load(args->formats[n], len);
+		int rc = parse(bytes, len, &plist_doc_handler, doc, &args->scratch, &error);
+		if (doc->failed) rb_memerror();
+		if (rc < 0) plist_raise_error(bytes, len, &error);
+		plist_stats_phase(args->formats[n], PLIST_PARSE);
+	} else {
+		plist_emit_object(input, &plist_doc_handler, doc, 0);
+		if (doc->failed) rb_memerror();
+	}
+	if (plist_doc_count(doc) == 0) rb_raise(ePropertyListError, "Empty property list");
+}
+
+// Index of the value under the key at +key+ of +from+ in the dict at
+// +dict+ of +doc+, or -1. *hint is the key node to try first and is
+// moved past any match.
+static long find_key(const plist_doc_t *doc, long dict, long *hint, const plist_doc_t *from, long key) {
+	const plist_node_t *node = plist_doc_node(from, key);
+	const char *text = plist_doc_text(from, node);
+	long value;
+	if (*hint < plist_doc_node(doc, dict)->v.end) {
+		const plist_node_t *candidate = plist_doc_node(doc, *hint);
+		if (candidate->len == node->len && memcmp(plist_doc_text(doc, candidate), text, node->len) == 0) {
+			value = *hint + 1;
+			*hint = plist_doc_next(doc, value);
+			return value;
+		}
+	}
+	value = plist_doc_lookup(doc, dict, text, node->len);
+	if (value >= 0) *hint = plist_doc_next(doc, value);
+	return value;
+}
+
+static int same_tree(const plist_doc_t *a, long i, const plist_doc_t *b, long j) {
+	const plist_node_t *x = plist_doc_node(a, i), *y = plist_doc_node(b, j);
+	long child, hint;
+	if (x->kind != y->kind) return 0;
+	switch (x->kind) {
+		case PLIST_NODE_KEY:
+		case PLIST_NODE_STRING:
+		case PLIST_NODE_DATA:
+			return x->len == y->len && memcmp(plist_doc_text(a, x), plist_doc_text(b, y), x->len) == 0;
+		case PLIST_NODE_INTEGER:
+		case PLIST_NODE_BOOLEAN:
+			return x->v.integer == y->v.integer && x->len == y->len;
+		case PLIST_NODE_REAL:
+		case PLIST_NODE_DATE:
+			return x->v.real == y->v.real || (x->v.real != x->v.real && y->v.real != y->v.real);
+		case PLIST_NODE_ARRAY:
+			if (x->len != y->len) return 0;
+			for (child = i + 1, j++; child < x->v.end; child = plist_doc_next(a, child), j = plist_doc_next(b, j)) {
+				if (!same_tree(a, child, b, j)) return 0;
+			}
+			return 1;
+		default:
+			if (x->len != y->len) return 0;
+			for (child = i + 1, hint = j + 1; child < x->v.end; child = plist_doc_next(a, child + 1)) {
+				long value = find_key(b, j, &hint, a, child);
+				if (value < 0 || !same_tree(a, child + 1, b, value)) return 0;
+			}
+			return 1;
+	}
+}
+
+// Diff
+
+static void add_op(struct compare_args *args, VALUE op, VALUE last, long value) {
+	VALUE path = rb_ary_dup(args->path);
+	if (!NIL_P(last)) rb_ary_push(path, last);
+	if (value < 0) rb_ary_push(args->ops, rb_ary_new3(2, ID2SYM(op), path));
+	else rb_ary_push(args->ops, rb_ary_new3(3, ID2SYM(op), path, plist_doc_to_ruby(OVERLAY(args), value, NULL)));
+}
+
+static VALUE key_at(const plist_doc_t *doc, long key) {
+	const plist_node_t *node = plist_doc_node(doc, key);
+	return plist_str_new(plist_doc_text(doc, node), node->len);
+}
+
+static void diff_tree(struct compare_args *args, long i, long j) {
+	const plist_doc_t *a = BASE(args), *b = OVERLAY(args);
+	const plist_node_t *x = plist_doc_node(a, i), *y = plist_doc_node(b, j);
+	long child, hint, index;
+	if (x->kind == PLIST_NODE_DICT && y->kind == PLIST_NODE_DICT) {
+		for (child = i + 1, hint = j + 1; child < x->v.end; child = plist_doc_next(a, child + 1)) {
+			long value = find_key(b, j, &hint, a, child);
+			if (value < 0) {
+				add_op(args, id_delete, key_at(a, child), -1);
+			} else if (!same_tree(a, child + 1, b, value)) {
+				rb_ary_push(args->path, key_at(a, child));
+				diff_tree(args, child + 1, value);
+				rb_ary_pop(args->path);
+			}
+		}
+		for (child = j + 1, hint = i + 1; child < y->v.end; child = plist_doc_next(b, child + 1)) {
+			if (find_key(a, i, &hint, b, child) < 0) add_op(args, id_set, key_at(b, child), child + 1);
+		}
+	} else if (x->kind == PLIST_NODE_ARRAY && y->kind == PLIST_NODE_ARRAY) {
+		long ai = i + 1, bj = j + 1;
+		for (index = 0; index < x->len && index < y->len; index++) {
+			if (!same_tree(a, ai, b, bj)) {
+				rb_ary_push(args->path, LONG2NUM(index));
+				diff_tree(args, ai, bj);
+				rb_ary_pop(args->path);
+			}
+			ai = plist_doc_next(a, ai);
+			bj = plist_doc_next(b, bj);
+		}
+		for (; index < y->len; index++, bj = plist_doc_next(b, bj)) add_op(args, id_set, LONG2NUM(index), bj);
+		// Last first, so the operations can be applied in order
+		for (index = x->len - 1; index >= y->len; index--) add_op(args, id_delete, LONG2NUM(index), -1);
+	} else if (!same_tree(a, i, b, j)) {
+		add_op(args, id_set, Qnil, j);
+	}
+}
+
+static VALUE diff_body(VALUE arg) {
+	struct compare_args *args = (struct compare_args *)arg;
+	load_side(args, 0);
+	load_side(args, 1);
+	diff_tree(args, 0, 0);
+	plist_stats_phase(NIL_P(args->formats[1]) ? args->formats[0] : args->formats[1], PLIST_CONVERT);
+	return args->ops;
+}
+
+static VALUE compare_cleanup(VALUE arg) {
+	struct compare_args *args = (struct compare_args *)arg;
+	plist_doc_free(&args->docs[0]);
+	plist_doc_free(&args->docs[1]);
+	plist_doc_free(&args->result);
+	plist_buf_free(&args->scratch);
+	return Qnil;
+}
+
+static void compare_init(struct compare_args *args, VALUE base, VALUE overlay) {
+	memset(args, 0, sizeof(*args));
+	args->inputs[0] = base;
+	args->inputs[1] = overlay;
+	args->buffers[0] = args->buffers[1] = Qnil;
+	args->formats[0] = args->formats[1] = Qnil;
+	plist_doc_init(&args->docs[0]);
+	plist_doc_init(&args->docs[1]);
+	plist_doc_init(&args->result);
+	plist_buf_init(&args->scratch);
+	args->path = Qnil;
+	args->ops = Qnil;
+	args->format = Qnil;
+	args->out = Qnil;
+}
+
+/* call-seq:
+ *    PropertyList.diff(a, b) -> Array
+ *
+ * Compares two property lists and returns the operations that turn +a+
+ * into +b+, each one of
+ *
+ *   [:set, keypath, value]
+ *   [:delete, keypath]
+ *
+ * where +keypath+ is an Array of dictionary keys and array indexes as
+ * for extract. Dictionaries are compared key by key, in any order;
+ * arrays index by index, so elements past the end of +a+ are set and
+ * those past the end of +b+ deleted, last first. An empty Array means
+ * there is no difference. A change at the top level has an empty path.
+ *
+ * +a+ and +b+ are each an IO or String holding a property list, as for
+ * load, or an object to_plist could write. Only the values in the
+ * result are turned into Ruby objects.
+ */
+static VALUE plist_diff(int argc, VALUE *argv, VALUE self) {
+	VALUE a, b;
+	struct compare_args args;
+	rb_scan_args(argc, argv, "2", &a, &b);
+	compare_init(&args, a, b);
+	args.path = rb_ary_new();
+	args.ops = rb_ary_new();
+	VALUE ops = rb_ensure(diff_body, (VALUE)&args, compare_cleanup, (VALUE)&args);
+	RB_GC_GUARD(args.buffers[0]);
+	RB_GC_GUARD(args.buffers[1]);
+	RB_GC_GUARD(args.path);
+	return ops;
+}
+
+// Merge
+
+#define EMIT(call) do {									\
+		if ((call) == PLIST_STOP) return -1;			\
+	} while (0)
+
+static int emit_members(const plist_doc_t *doc, long i, const plist_handler_t *handler, void *ctx) {
+	long child;
+	for (child = i + 1; child < plist_doc_node(doc, i)->v.end; child = plist_doc_next(doc, child)) {
+		if (plist_doc_emit(doc, child, handler, ctx) < 0) return -1;
+	}
+	return 0;
+}
+
+// Replays the merge of the base value at +i+ and the overlay value at
+// +j+, returning -1 if the handler stopped early
+static int merge_tree(struct compare_args *args, long i, long j, const plist_handler_t *handler, void *ctx, int depth) {
+	const plist_doc_t *a = BASE(args), *b = OVERLAY(args);
+	const plist_node_t *x = plist_doc_node(a, i), *y = plist_doc_node(b, j);
+	long child, hint;
+	if (x->kind == PLIST_NODE_DICT && y->kind == PLIST_NODE_DICT && (args->strategy != MERGE_SHALLOW || depth == 0)) {
+		EMIT(handler->begin_dict(ctx));
+		for (child = i + 1, hint = j + 1; child < x->v.end; child = plist_doc_next(a, child + 1)) {
+			long value = find_key(b, j, &hint, a, child);
+			if (plist_doc_emit(a, child, handler, ctx) < 0) return -1;
+			if (value < 0) {
+				if (plist_doc_emit(a, child + 1, handler, ctx) < 0) return -1;
+			} else if (merge_tree(args, child + 1, value, handler, ctx, depth + 1) < 0) {
+				return -1;
+			}
+		}
+		for (child = j + 1, hint = i + 1; child < y->v.end; child = plist_doc_next(b, child + 1)) {
+			if (find_key(a, i, &hint, b, child) >= 0) continue;
+			if (plist_doc_emit(b, child, handler, ctx) < 0 || plist_doc_emit(b, child + 1, handler, ctx) < 0) return -1;
+		}
+		EMIT(handler->end_dict(ctx));
+		return 0;
+	}
+	if (x->kind == PLIST_NODE_ARRAY && y->kind == PLIST_NODE_ARRAY && args->strategy == MERGE_APPEND) {
+		EMIT(handler->begin_array(ctx));
+		if (emit_members(a, i, handler, ctx) < 0 || emit_members(b, j, handler, ctx) < 0) return -1;
+		EMIT(handler->end_array(ctx));
+		return 0;
+	}
+	return plist_doc_emit(b, j, handler, ctx);
+}
+
+// Feeds the merged result to a writer, for plist_binary_write
+static void merge_source(void *arg, const plist_handler_t *handler, void *ctx) {
+	merge_tree(arg, 0, 0, handler, ctx, 0);
+}
+
+static VALUE merge_body(VALUE arg) {
+	struct compare_args *args = (struct compare_args *)arg;
+	load_side(args, 0);
+	load_side(args, 1);
+	if (NIL_P(args->format)) args->format = args->formats[0] == id_binary ? id_binary : id_xml;
+	if (args->format == id_lazy) {
+		merge_source(args, &plist_doc_handler, &args->result);
+		if (args->result.failed) rb_memerror();
+		return plist_lazy_adopt(&args->result);
+	}
+	long written;
+	args->out = rb_str_buf_new(4096);
+	if (args->format == id_binary) {
+		written = plist_binary_write(merge_source, args, args->out, PLIST_DUMP_CHUNK);
+	} else {
+		plist_xml_writer_t writer;
+		plist_xml_writer_init(&writer, args->out, PLIST_DUMP_CHUNK);
+		merge_source(args, &plist_xml_writer_handler, &writer);
+		written = plist_xml_writer_finish(&writer);
+	}
+	str_setBlob(args->out, Qfalse);
+	plist_stats_dump(args->format, written);
+	plist_stats_phase(args->format, PLIST_WRITE);
+	return args->out;
+}
+
+/* call-seq:
+ *    PropertyList.merge(base, overlay)          -> String
+ *    PropertyList.merge(base, overlay, options) -> String or view
+ *
+ * Returns +base+ with +overlay+ merged into it. Both are given as for
+ * diff. Options are:
+ *
+ * <tt>:strategy</tt>:: <tt>:deep</tt> (the default) merges dictionaries
+ *                      key by key at every level, with anything else
+ *                      in +overlay+ replacing what +base+ has.
+ *                      <tt>:shallow</tt> only merges the top level
+ *                      keys, and <tt>:append</tt> is like
+ *                      <tt>:deep</tt> but adds the elements of an array
+ *                      in +overlay+ to the end of the one in +base+.
+ * <tt>:format</tt>::   <tt>:xml1</tt> or <tt>:binary1</tt> returns the
+ *                      result as a property list, by default in the
+ *                      format of +base+ (XML if that is OpenStep or an
+ *                      object). <tt>:lazy</tt> returns a view as
+ *                      load_lazy does.
+ *
+ * Keys keep the order they have in +base+, followed by the ones only
+ * +overlay+ has. The merged property list is written straight from the
+ * parsed inputs, so none of it is converted to Ruby objects.
+ */
+static VALUE plist_merge(int argc, VALUE *argv, VALUE self) {
+	VALUE base, overlay, opts;
+	struct compare_args args;
+	rb_scan_args(argc, argv, "21", &base, &overlay, &opts);
+	compare_init(&args, base, overlay);
+	args.strategy = MERGE_DEEP;
+	if (!NIL_P(opts)) {
+		opts = rb_convert_type(opts, T_HASH, "Hash", "to_hash");
+		VALUE strategy = rb_hash_aref(opts, ID2SYM(id_strategy));
+		if (!NIL_P(strategy)) {
+			ID id = rb_to_id(strategy);
+			if (id == id_deep) args.strategy = MERGE_DEEP;
+			else if (id == id_shallow) args.strategy = MERGE_SHALLOW;
+			else if (id == id_append) args.strategy = MERGE_APPEND;
+			else rb_raise(rb_eArgError, "strategy must be one of :deep, :shallow, or :append");
+		}
+		VALUE format = rb_hash_aref(opts, ID2SYM(id_format));
+		if (!NIL_P(format)) {
+			args.format = rb_to_id(format);
+			if (args.format != id_xml && args.format != id_binary && args.format != id_lazy) {
+				rb_raise(rb_eArgError, "format must be one of :xml1, :binary1, or :lazy");
+			}
+		}
+	}
+	VALUE result = rb_ensure(merge_body, (VALUE)&args, compare_cleanup, (VALUE)&args);
+	RB_GC_GUARD(args.buffers[0]);
+	RB_GC_GUARD(args.buffers[1]);
+	return result;
+}
+
+PLIST_TRACED("diff", plist_diff)
+PLIST_TRACED("merge", plist_merge)
+
+void Init_plist_merge(void) {
+	rb_define_module_function(mPlist, "diff", plist_diffTraced, -1);
+	rb_define_module_function(mPlist, "merge", plist_mergeTraced, -1);
+	id_set = rb_intern("set");
+	id_delete = rb_intern("delete");
+	id_strategy = rb_intern("strategy");
+	id_format = rb_intern("format");
+	id_deep = rb_intern("deep");
+	id_shallow = rb_intern("shallow");
+	id_append = rb_intern("append");
+	id_lazy = rb_intern("lazy");
+}
@@ -0,0 +1,8 @@
+#ifndef _PLIST_MERGE_H_
+#define _PLIST_MERGE_H_
+
+#include "plist.h"
+
+void Init_plist_merge(void);
+
+#endif /* _PLIST_MERGE_H_ */
@@ -0,0 +1,423 @@
+/*
+ * Native reader for OpenStep (ASCII) property lists.
+ *
+ * Reads what CoreFoundation reads in this format: dictionaries
+ * ({ key = value; }), arrays (( a, b )), quoted and unquoted strings,
+ * <hex> data, // and C comments, and a top level of bare key = value;
+ * pairs as found in .strings files. Like the XML reader it reports
+ * every value to a plist_handler_t as it goes, and strings without
+ * escapes are handed out as pointers into the input.
+ *
+ * Runs of whitespace, unquoted strings and the text of quoted strings
+ * are scanned 16 bytes at a time where SSE2 is available. Those scans
+ * are most of the work in a .pbxproj file, with its deep indentation,
+ * 24 digit object IDs and long quoted paths.
+ */
+
+#include "plist_openstep.h"
+#include <string.h>
+#if defined(__SSE2__) && defined(__GNUC__)
+#define OPENSTEP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+typedef struct {
+	const char *start;
+	const char *p;
+	const char *end;
+	const plist_handler_t *handler;
+	void *ctx;
+	plist_buf_t *scratch;
+	plist_error_t *error;
+	int depth;
+	int stopped;
+} openstep_parser_t;
+
+// \ooo escapes above 0177 are NeXTSTEP characters; this maps them from 0200 up
+static const unsigned short nextstep_chars[128] = {
+	0x00A0, 0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C7,
+	0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+	0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D9,
+	0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00B5, 0x00D7, 0x00F7,
+	0x00A9, 0x00A1, 0x00A2, 0x00A3, 0x2044, 0x00A5, 0x0192, 0x00A7,
+	0x00A4, 0x2019, 0x201C, 0x00AB, 0x2039, 0x203A, 0xFB01, 0xFB02,
+	0x00AE, 0x2013, 0x2020, 0x2021, 0x00B7, 0x00A6, 0x00B6, 0x2022,
+	0x201A, 0x201E, 0x201D, 0x00BB, 0x2026, 0x2030, 0x00AC, 0x00BF,
+	0x00B9, 0x02CB, 0x00B4, 0x02C6, 0x02DC, 0x00AF, 0x02D8, 0x02D9,
+	0x00A8, 0x00B2, 0x02DA, 0x00B8, 0x00B3, 0x02DD, 0x02DB, 0x02C7,
+	0x2014, 0x00B1, 0x00BC, 0x00BD, 0x00BE, 0x00E0, 0x00E1, 0x00E2,
+	0x00E3, 0x00E4, 0x00E5, 0x00E7, 0x00E8, 0x00E9, 0x00EA, 0x00EB,
+	0x00EC, 0x00C6, 0x00ED, 0x00AA, 0x00EE, 0x00EF, 0x00F0, 0x00F1,
+	0x0141, 0x00D8, 0x0152, 0x00BA, 0x00F2, 0x00F3, 0x00F4, 0x00F5,
+	0x00F6, 0x00E6, 0x00F9, 0x00FA, 0x00FB, 0x0131, 0x00FC, 0x00FD,
+	0x0142, 0x00F8, 0x0153, 0x00DF, 0x00FE, 0x00FF, 0xFFFD, 0xFFFD
+};
+
+static int parse_value(openstep_parser_t *ps, int skip);
+
+// Records an error at the current position and unwinds the parse
+static int fail(openstep_parser_t *ps, const char *message) {
+	ps->error->message = message;
+	ps->error->offset = ps->p - ps->start;
+	return -1;
+}
+
+// Checks a handler return code, stopping the parse if requested
+#define EMIT(ps, call) do {								\
+		if ((call) == PLIST_STOP) {						\
+			(ps)->stopped = 1;							\
+			return -1;									\
+		}												\
+	} while (0)
+
+static int is_space(unsigned char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// The characters CoreFoundation allows in an unquoted string
+static int is_bare(unsigned char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '-' && c <= ':') || c == '_' || c == '$';
+}
+
+static int hex_value(unsigned char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+#ifdef OPENSTEP_SSE2
+// Marks the lanes of +v+ holding lo..lo+span (compared unsigned)
+static __m128i in_range(__m128i v, char lo, char span) {
+	__m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+	return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(span)), d);
+}
+#endif
+
+// Returns the first byte at or after +p+ that isn't whitespace
+static const char *scan_space(const char *p, const char *end) {
+#ifdef OPENSTEP_SSE2
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range(v, '\t', 4)));
+		if (mask != 0xFFFF) return p + __builtin_ctz(~mask);
+		p += 16;
+	}
+#endif
+	while (p < end && is_space(*p)) p++;
+	return p;
+}
+
+// Returns the first byte at or after +p+ that can't be in an unquoted string
+static const char *scan_bare(const char *p, const char *end) {
+#ifdef OPENSTEP_SSE2
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i ok = _mm_or_si128(in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 25), in_range(v, '-', 13));
+		ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')), _mm_cmpeq_epi8(v, _mm_set1_epi8('$'))));
+		int mask = _mm_movemask_epi8(ok);
+		if (mask != 0xFFFF) return p + __builtin_ctz(~mask);
+		p += 16;
+	}
+#endif
+	while (p < end && is_bare(*p)) p++;
+	return p;
+}
+
+// Returns the first +quote+ or backslash at or after +p+, or +end+
+static const char *scan_quoted(const char *p, const char *end, char quote) {
+#ifdef OPENSTEP_SSE2
+	__m128i q = _mm_set1_epi8(quote), backslash = _mm_set1_epi8('\\');
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, q), _mm_cmpeq_epi8(v, backslash)));
+		if (mask) return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	while (p < end && *p != quote && *p != '\\') p++;
+	return p;
+}
+
+// Skips whitespace and comments
+static int skip_space(openstep_parser_t *ps) {
+	for (;;) {
+		ps->p = scan_space(ps->p, ps->end);
+		if (ps->end - ps->p < 2 || ps->p[0] != '/') return 0;
+		if (ps->p[1] == '/') {
+			const char *eol = memchr(ps->p, '\n', ps->end - ps->p);
+			ps->p = eol ? eol + 1 : ps->end;
+		} else if (ps->p[1] == '*') {
+			const char *star = ps->p + 2;
+			for (;;) {
+				star = memchr(star, '*', ps->end - star);
+				if (!star || star + 1 >= ps->end) return fail(ps, "unterminated comment");
+				if (star[1] == '/') break;
+				star++;
+			}
+			ps->p = star + 2;
+		} else {
+			return 0;
+		}
+	}
+}
+
+// Decodes the escape after a backslash onto the end of the scratch buffer
+static int append_escape(openstep_parser_t *ps) {
+	unsigned long cp;
+	char c;
+	if (ps->p >= ps->end) return fail(ps, "unterminated quoted string");
+	c = *ps->p++;
+	switch (c) {
+		case 'a': c = '\a'; break;
+		case 'b': c = '\b'; break;
+		case 'f': c = '\f'; break;
+		case 'n': c = '\n'; break;
+		case 'r': c = '\r'; break;
+		case 't': c = '\t'; break;
+		case 'v': c = '\v'; break;
+		case 'U': {
+			int digits;
+			for (cp = 0, digits = 0; digits < 4 && ps->p < ps->end && hex_value(*ps->p) >= 0; digits++) {
+				cp = (cp << 4) | hex_value(*ps->p++);
+			}
+			if (digits == 0) return fail(ps, "malformed \\U escape");
+			// Characters outside the BMP are written as a pair of \U escapes
+			if (cp >= 0xD800 && cp < 0xDC00 && ps->end - ps->p >= 6 && ps->p[0] == '\\' && ps->p[1] == 'U') {
+				unsigned long low = 0;
+				for (digits = 0; digits < 4 && hex_value(ps->p[2 + digits]) >= 0; digits++) {
+					low = (low << 4) | hex_value(ps->p[2 + digits]);
+				}
+				if (digits == 4 && low >= 0xDC00 && low < 0xE000) {
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+					ps->p += 6;
+				}
+			}
+			if (cp >= 0xD800 && cp < 0xE000) cp = 0xFFFD;
+			return plist_buf_append_utf8(ps->scratch, cp) < 0 ? fail(ps, "out of memory") : 0;
+		}
+		case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': {
+			int digits;
+			cp = c - '0';
+			for (digits = 1; digits < 3 && ps->p < ps->end && *ps->p >= '0' && *ps->p <= '7'; digits++) {
+				cp = (cp << 3) | (*ps->p++ - '0');
+			}
+			cp &= 0xFF;
+			if (cp >= 0x80) cp = nextstep_chars[cp - 0x80];
+			return plist_buf_append_utf8(ps->scratch, cp) < 0 ? fail(ps, "out of memory") : 0;
+		}
+		default: break;             // anything else stands for itself
+	}
+	return plist_buf_append(ps->scratch, &c, 1) < 0 ? fail(ps, "out of memory") : 0;
+}
+
+/*
+ * Reads the quoted string at ps->p. Escapes are decoded into the scratch
+ * buffer when +decode+ is set and only stepped over otherwise; without
+ * escapes the result points into the input.
+ */
+static int read_quoted(openstep_parser_t *ps, int decode, const char **text, long *len) {
+	char quote = *ps->p++;
+	const char *run = ps->p;
+	int copied = 0;
+	for (;;) {
+		const char *hit = scan_quoted(ps->p, ps->end, quote);
+		if (hit >= ps->end) return fail(ps, "unterminated quoted string");
+		if (*hit == quote) {
+			if (copied) {
+				if (plist_buf_append(ps->scratch, run, hit - run) < 0) return fail(ps, "out of memory");
+				*text = ps->scratch->ptr;
+				*len = ps->scratch->len;
+			} else {
+				*text = run;
+				*len = hit - run;
+			}
+			ps->p = hit + 1;
+			return 0;
+		}
+		ps->p = hit + 1;
+		if (!decode) {
+			if (ps->p >= ps->end) return fail(ps, "unterminated quoted string");
+			ps->p++;
+			continue;
+		}
+		if (!copied) {
+			ps->scratch->len = 0;
+			copied = 1;
+		}
+		if (plist_buf_append(ps->scratch, run, hit - run) < 0) return fail(ps, "out of memory");
+		if (append_escape(ps) < 0) return -1;
+		run = ps->p;
+	}
+}
+
+// Reads a quoted or unquoted string
+static int read_string(openstep_parser_t *ps, int decode, const char **text, long *len) {
+	const char *start = ps->p;
+	if (ps->p >= ps->end) return fail(ps, "unexpected end of input");
+	if (*ps->p == '"' || *ps->p == '\'') return read_quoted(ps, decode, text, len);
+	ps->p = scan_bare(ps->p, ps->end);
+	if (ps->p == start) return fail(ps, "unexpected character");
+	*text = start;
+	*len = ps->p - start;
+	return 0;
+}
+
+// Reads <hex digits> data, which may be broken up by whitespace
+static int read_data(openstep_parser_t *ps, int decode, const char **bytes, long *len) {
+	plist_buf_t *out = ps->scratch;
+	int high = -1;
+	ps->p++;
+	out->len = 0;
+	for (;;) {
+		int value;
+		ps->p = scan_space(ps->p, ps->end);
+		if (ps->p >= ps->end) return fail(ps, "unterminated data");
+		if (*ps->p == '>') break;
+		if ((value = hex_value(*ps->p)) < 0) return fail(ps, "malformed data");
+		ps->p++;
+		if (high < 0) {
+			high = value;
+		} else {
+			char byte = (char)(high << 4 | value);
+			if (decode && plist_buf_append(out, &byte, 1) < 0) return fail(ps, "out of memory");
+			high = -1;
+		}
+	}
+	if (high >= 0) return fail(ps, "odd number of hex digits in data");
+	ps->p++;
+	*bytes = out->ptr ? out->ptr : "";
+	*len = out->len;
+	return 0;
+}
+
+/*
+ * Reads key = value; pairs up to the closing brace, or to the end of the
+ * input when +braced+ is false (a .strings file). As in .strings files,
+ * a key followed directly by ';' is its own value.
+ */
+static int parse_pairs(openstep_parser_t *ps, int braced, int skip) {
+	const plist_handler_t *h = ps->handler;
+	for (;;) {
+		const char *key;
+		long key_len;
+		if (skip_space(ps) < 0) return -1;
+		if (ps->p >= ps->end) return braced ? fail(ps, "unterminated dictionary") : 0;
+		if (braced && *ps->p == '}') {
+			ps->p++;
+			return 0;
+		}
+		if (*ps->p != '"' && *ps->p != '\'' && !is_bare(*ps->p)) return fail(ps, "expected a string key in dictionary");
+		if (read_string(ps, !skip, &key, &key_len) < 0) return -1;
+		if (!skip) EMIT(ps, h->key(ps->ctx, key, key_len));
+		if (skip_space(ps) < 0) return -1;
+		if (ps->p < ps->end && *ps->p == ';') {
+			if (!skip) EMIT(ps, h->string(ps->ctx, key, key_len));
+		} else {
+			if (ps->p >= ps->end || *ps->p != '=') return fail(ps, "expected '=' after dictionary key");
+			ps->p++;
+			if (parse_value(ps, skip) < 0) return -1;
+			if (skip_space(ps) < 0) return -1;
+			if (ps->p >= ps->end || *ps->p != ';') return fail(ps, "expected ';' after dictionary value");
+		}
+		ps->p++;
+	}
+}
+
+// Reads array members up to the closing parenthesis; a trailing comma is fine
+static int parse_items(openstep_parser_t *ps, int skip) {
+	for (;;) {
+		if (skip_space(ps) < 0) return -1;
+		if (ps->p < ps->end && *ps->p == ')') {
+			ps->p++;
+			return 0;
+		}
+		if (parse_value(ps, skip) < 0) return -1;
+		if (skip_space(ps) < 0) return -1;
+		if (ps->p >= ps->end) return fail(ps, "unterminated array");
+		if (*ps->p == ',') ps->p++;
+		else if (*ps->p != ')') return fail(ps, "expected ',' or ')' in array");
+	}
+}
+
+static int parse_container(openstep_parser_t *ps, int is_dict, int skip) {
+	const plist_handler_t *h = ps->handler;
+	int report = !skip;
+	if (report) {
+		int rc = is_dict ? h->begin_dict(ps->ctx) : h->begin_array(ps->ctx);
+		if (rc == PLIST_STOP) {
+			ps->stopped = 1;
+			return -1;
+		}
+		if (rc == PLIST_SKIP) skip = 1;
+	}
+	if (++ps->depth > PLIST_MAX_DEPTH) return fail(ps, "nesting too deep");
+	ps->p++;
+	if ((is_dict ? parse_pairs(ps, 1, skip) : parse_items(ps, skip)) < 0) return -1;
+	ps->depth--;
+	if (report && !skip) EMIT(ps, is_dict ? h->end_dict(ps->ctx) : h->end_array(ps->ctx));
+	return 0;
+}
+
+static int parse_value(openstep_parser_t *ps, int skip) {
+	const plist_handler_t *h = ps->handler;
+	const char *text;
+	long len;
+	if (skip_space(ps) < 0) return -1;
+	if (ps->p >= ps->end) return fail(ps, "unexpected end of input");
+	switch (*ps->p) {
+		case '{': return parse_container(ps, 1, skip);
+		case '(': return parse_container(ps, 0, skip);
+		case '<':
+			if (read_data(ps, !skip, &text, &len) < 0) return -1;
+			if (!skip) EMIT(ps, h->data(ps->ctx, text, len));
+			return 0;
+		default:
+			if (read_string(ps, !skip, &text, &len) < 0) return -1;
+			if (!skip) EMIT(ps, h->string(ps->ctx, text, len));
+			return 0;
+	}
+}
+
+// Parses an OpenStep property list, reporting every value to +handler+
+int plist_openstep_parse(const char *bytes, long len, const plist_handler_t *handler, void *ctx, plist_buf_t *scratch, plist_error_t *error) {
+	openstep_parser_t ps;
+	ps.start = ps.p = bytes;
+	ps.end = bytes + len;
+	ps.handler = handler;
+	ps.ctx = ctx;
+	ps.scratch = scratch;
+	ps.error = error;
+	ps.depth = 0;
+	ps.stopped = 0;
+	if (len >= 3 && memcmp(ps.p, "\xEF\xBB\xBF", 3) == 0) ps.p += 3;
+	if (len >= 2 && (memcmp(bytes, "\xFF\xFE", 2) == 0 || memcmp(bytes, "\xFE\xFF", 2) == 0)) {
+		return fail(&ps, "UTF-16 input is not supported");
+	}
+
+	if (skip_space(&ps) < 0) return -1;
+	if (ps.p >= ps.end) return fail(&ps, "unexpected end of input");
+	if (*ps.p != '{' && *ps.p != '(' && *ps.p != '<') {
+		// Either a lone string or the first key of a .strings file
+		const char *first = ps.p, *text;
+		long text_len;
+		int rc;
+		if (read_string(&ps, 1, &text, &text_len) < 0) return -1;
+		if (skip_space(&ps) < 0) return -1;
+		if (ps.p >= ps.end) {
+			handler->string(ctx, text, text_len);
+			return 0;
+		}
+		if (*ps.p != '=' && *ps.p != ';') return fail(&ps, "unexpected text after the property list");
+		ps.p = first;
+		rc = handler->begin_dict(ctx);
+		if (rc == PLIST_STOP) return 0;
+		if (parse_pairs(&ps, 0, rc == PLIST_SKIP) < 0) return ps.stopped ? 0 : -1;
+		if (rc != PLIST_SKIP) handler->end_dict(ctx);
+		return 0;
+	}
+	if (parse_value(&ps, 0) < 0) return ps.stopped ? 0 : -1;
+	if (skip_space(&ps) < 0) return -1;
+	if (ps.p < ps.end) return fail(&ps, "unexpected text after the property list");
+	return 0;
+}
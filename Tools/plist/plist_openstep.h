@@ -0,0 +1,8 @@
+#ifndef _PLIST_OPENSTEP_H_
+#define _PLIST_OPENSTEP_H_
+
+#include "plist.h"
+
+int plist_openstep_parse(const char *bytes, long len, const plist_handler_t *handler, void *ctx, plist_buf_t *scratch, plist_error_t *error);
+
+#endif /* _PLIST_OPENSTEP_H_ */
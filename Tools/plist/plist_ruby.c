@@ -0,0 +1,354 @@
+/*
+ * Glue between the native readers/writers and Ruby objects.
+ *
+ * plist_builder_handler turns reader events straight into Hash, Array,
+ * String, etc. and plist_emit_object walks a Ruby object graph the other
+ * way, feeding a writer.
+ */
+
+#include "plist_ruby.h"
+#include "plist_xml.h"
+#include "plist_binary.h"
+#include "plist_openstep.h"
+#include "plist_stats.h"
+#include <limits.h>
+#include <ruby/encoding.h>
+
+// Picks the native reader for +bytes+. Like CoreFoundation, anything
+// that is neither binary nor XML is taken to be OpenStep. Doesn't touch Ruby.
+plist_parse_fn plist_reader_for(const char *bytes, long len) {
+	if (plist_binary_detect(bytes, len)) return plist_binary_parse;
+	if (plist_xml_detect(bytes, len)) return plist_xml_parse;
+	return plist_openstep_parse;
+}
+
+// The format symbol load reports for input read by +parse+
+VALUE plist_reader_format(plist_parse_fn parse) {
+	if (parse == plist_binary_parse) return id_binary;
+	if (parse == plist_xml_parse) return id_xml;
+	return id_openstep;
+}
+
+// Attaches a freshly created value to the innermost open container
+static void add_value(plist_builder_t *b, VALUE value) {
+	long depth = RARRAY_LEN(b->stack);
+	if (depth == 0) {
+		b->result = value;
+		return;
+	}
+	VALUE top = RARRAY_PTR(b->stack)[depth - 1];
+	if (TYPE(top) == T_HASH) {
+		rb_hash_aset(top, RARRAY_PTR(b->keys)[depth - 1], value);
+	} else {
+		rb_ary_push(top, value);
+	}
+}
+
+static int b_begin_dict(void *ctx) {
+	plist_builder_t *b = ctx;
+	VALUE hash = rb_hash_new();
+	PLIST_COUNT(PLIST_OBJ_DICT);
+	add_value(b, hash);
+	rb_ary_push(b->stack, hash);
+	rb_ary_push(b->keys, Qnil);
+	return PLIST_CONTINUE;
+}
+
+static int b_begin_array(void *ctx) {
+	plist_builder_t *b = ctx;
+	VALUE array = rb_ary_new();
+	PLIST_COUNT(PLIST_OBJ_ARRAY);
+	add_value(b, array);
+	rb_ary_push(b->stack, array);
+	rb_ary_push(b->keys, Qnil);
+	return PLIST_CONTINUE;
+}
+
+static int b_end(void *ctx) {
+	plist_builder_t *b = ctx;
+	rb_ary_pop(b->stack);
+	rb_ary_pop(b->keys);
+	return PLIST_CONTINUE;
+}
+
+static int b_key(void *ctx, const char *bytes, long len) {
+	plist_builder_t *b = ctx;
+	PLIST_COUNT(PLIST_OBJ_KEY);
+	rb_ary_store(b->keys, -1, b->intern ? plist_intern_key(b->intern, bytes, len) : plist_str_new(bytes, len));
+	return PLIST_CONTINUE;
+}
+
+static int b_string(void *ctx, const char *bytes, long len) {
+	PLIST_COUNT(PLIST_OBJ_STRING);
+	add_value(ctx, plist_str_new(bytes, len));
+	return PLIST_CONTINUE;
+}
+
+static int b_data(void *ctx, const char *bytes, long len) {
+	VALUE str = rb_str_new(bytes, len);
+	str_setBlob(str, Qtrue);
+	PLIST_COUNT(PLIST_OBJ_DATA);
+	add_value(ctx, str);
+	return PLIST_CONTINUE;
+}
+
+static int b_integer(void *ctx, long long value) {
+	PLIST_COUNT(PLIST_OBJ_INTEGER);
+	add_value(ctx, LL2NUM(value));
+	return PLIST_CONTINUE;
+}
+
+static int b_unsigned_integer(void *ctx, unsigned long long value) {
+	PLIST_COUNT(PLIST_OBJ_INTEGER);
+	add_value(ctx, ULL2NUM(value));
+	return PLIST_CONTINUE;
+}
+
+static int b_real(void *ctx, double value) {
+	PLIST_COUNT(PLIST_OBJ_REAL);
+	add_value(ctx, rb_float_new(value));
+	return PLIST_CONTINUE;
+}
+
+static int b_boolean(void *ctx, int value) {
+	PLIST_COUNT(PLIST_OBJ_BOOLEAN);
+	add_value(ctx, value ? Qtrue : Qfalse);
+	return PLIST_CONTINUE;
+}
+
+static int b_date(void *ctx, double seconds) {
+	PLIST_COUNT(PLIST_OBJ_DATE);
+	add_value(ctx, rb_funcall(timeEpoch, id_plus, 1, rb_float_new(seconds)));
+	return PLIST_CONTINUE;
+}
+
+const plist_handler_t plist_builder_handler = {
+	b_begin_dict, b_end, b_begin_array, b_end,
+	b_key, b_string, b_data, b_integer, b_real, b_boolean, b_date, b_unsigned_integer
+};
+
+// The containers live in Ruby arrays so the GC can see them mid-parse
+void plist_builder_init(plist_builder_t *builder) {
+	builder->stack = rb_ary_new();
+	builder->keys = rb_ary_new();
+	builder->result = Qnil;
+	builder->intern = NULL;
+}
+
+struct build_args {
+	plist_parse_fn parse;
+	const char *bytes;
+	long len;
+	plist_builder_t builder;
+	plist_buf_t scratch;
+};
+
+static VALUE build_body(VALUE arg) {
+	struct build_args *args = (struct build_args *)arg;
+	plist_error_t error;
+	if (args->parse(args->bytes, args->len, &plist_builder_handler, &args->builder, &args->scratch, &error) < 0) {
+		plist_raise_error(args->bytes, args->len, &error);
+	}
+	return args->builder.result;
+}
+
+static VALUE build_cleanup(VALUE arg) {
+	struct build_args *args = (struct build_args *)arg;
+	plist_buf_free(&args->scratch);
+	return Qnil;
+}
+
+// Parses +bytes+ with the given reader and returns the resulting object;
+// keys come from +intern+ unless it is NULL
+VALUE plist_build(plist_parse_fn parse, const char *bytes, long len, plist_intern_t *intern) {
+	struct build_args args;
+	args.parse = parse;
+	args.bytes = bytes;
+	args.len = len;
+	plist_builder_init(&args.builder);
+	args.builder.intern = intern;
+	plist_buf_init(&args.scratch);
+	return rb_ensure(build_body, (VALUE)&args, build_cleanup, (VALUE)&args);
+}
+
+struct emit_state {
+	const plist_handler_t *handler;
+	void *ctx;
+	int depth;
+	int sorted;                     // dictionary keys in byte order
+};
+
+typedef struct {
+	VALUE key;                      // as a String
+	VALUE value;
+} emit_pair_t;
+
+static void emit(VALUE obj, struct emit_state *state);
+
+// Property lists hold UTF-8, so Strings in another encoding are converted
+// once here for every writer, raising for characters UTF-8 lacks. Binary
+// Strings are left for the writers to take as they are.
+static VALUE utf8_string(VALUE str) {
+	int index = ENCODING_GET(str);
+	if (index == rb_utf8_encindex() || index == rb_ascii8bit_encindex() || index == rb_usascii_encindex()) return str;
+	if (rb_enc_str_asciionly_p(str)) return str;
+	return rb_str_encode(str, rb_enc_from_encoding(rb_utf8_encoding()), 0, Qnil);
+}
+
+static VALUE key_string(VALUE key) {
+	if (TYPE(key) == T_SYMBOL) key = rb_str_new2(rb_id2name(SYM2ID(key)));
+	if (TYPE(key) != T_STRING) rb_raise(rb_eArgError, "Dictionary keys must be strings");
+	return utf8_string(key);
+}
+
+static int emit_pair(VALUE key, VALUE value, VALUE arg) {
+	struct emit_state *state = (struct emit_state *)arg;
+	key = key_string(key);
+	state->handler->key(state->ctx, RSTRING_PTR(key), RSTRING_LEN(key));
+	emit(value, state);
+	return ST_CONTINUE;
+}
+
+static int collect_pair(VALUE key, VALUE value, VALUE arg) {
+	emit_pair_t **next = (emit_pair_t **)arg;
+	(*next)->key = key_string(key);
+	(*next)->value = value;
+	(*next)++;
+	return ST_CONTINUE;
+}
+
+static int compare_pairs(const void *a, const void *b) {
+	VALUE x = ((const emit_pair_t *)a)->key, y = ((const emit_pair_t *)b)->key;
+	long xlen = RSTRING_LEN(x), ylen = RSTRING_LEN(y);
+	int c = memcmp(RSTRING_PTR(x), RSTRING_PTR(y), xlen < ylen ? xlen : ylen);
+	return c ? c : (xlen > ylen) - (xlen < ylen);
+}
+
+// Emits the members of +hash+ ordered by the bytes of their keys. The
+// pairs are kept in an ALLOCV buffer, which the GC scans, so the
+// Strings made for Symbol keys stay alive.
+static void emit_sorted(VALUE hash, struct emit_state *state) {
+	long count = RHASH_SIZE(hash), i;
+	VALUE buffer;
+	emit_pair_t *pairs = ALLOCV_N(emit_pair_t, buffer, count), *next = pairs;
+	rb_hash_foreach(hash, collect_pair, (VALUE)&next);
+	count = next - pairs;
+	qsort(pairs, count, sizeof(emit_pair_t), compare_pairs);
+	for (i = 0; i < count; i++) {
+		state->handler->key(state->ctx, RSTRING_PTR(pairs[i].key), RSTRING_LEN(pairs[i].key));
+		emit(pairs[i].value, state);
+	}
+	ALLOCV_END(buffer);
+}
+
+static void emit(VALUE obj, struct emit_state *state) {
+	const plist_handler_t *h = state->handler;
+	switch (TYPE(obj)) {
+		case T_STRING:
+			if (RTEST(str_blob(obj))) {
+				h->data(state->ctx, RSTRING_PTR(obj), RSTRING_LEN(obj));
+			} else {
+				obj = utf8_string(obj);
+				h->string(state->ctx, RSTRING_PTR(obj), RSTRING_LEN(obj));
+				RB_GC_GUARD(obj);
+			}
+			return;
+		case T_HASH:
+			if (++state->depth > PLIST_MAX_DEPTH) rb_raise(rb_eArgError, "The argument tree is nested too deeply");
+			h->begin_dict(state->ctx);
+			if (state->sorted) emit_sorted(obj, state);
+			else rb_hash_foreach(obj, emit_pair, (VALUE)state);
+			h->end_dict(state->ctx);
+			state->depth--;
+			return;
+		case T_ARRAY: {
+			long i;
+			if (++state->depth > PLIST_MAX_DEPTH) rb_raise(rb_eArgError, "The argument tree is nested too deeply");
+			h->begin_array(state->ctx);
+			for (i = 0; i < RARRAY_LEN(obj); i++) emit(RARRAY_PTR(obj)[i], state);
+			h->end_array(state->ctx);
+			state->depth--;
+			return;
+		}
+		case T_FLOAT: h->real(state->ctx, NUM2DBL(obj)); return;
+		case T_FIXNUM:
+		case T_BIGNUM:
+			// What a bplist's 128-bit integers hold, read back from one
+			if (RTEST(rb_funcall(obj, '>', 1, LL2NUM(LLONG_MAX)))) h->unsigned_integer(state->ctx, NUM2ULL(obj));
+			else h->integer(state->ctx, NUM2LL(obj));
+			return;
+		case T_TRUE: h->boolean(state->ctx, 1); return;
+		case T_FALSE: h->boolean(state->ctx, 0); return;
+		default:
+			if (rb_obj_is_kind_of(obj, rb_cTime)) {
+				h->date(state->ctx, NUM2DBL(rb_funcall(obj, id_minus, 1, timeEpoch)));
+				return;
+			}
+	}
+	rb_raise(rb_eArgError, "An object in the argument tree could not be converted");
+}
+
+// Feeds +obj+ and everything below it to +handler+; with
+// PLIST_EMIT_SORTED in +flags+ dictionaries give their keys in byte
+// order rather than the Hash's
+void plist_emit_object(VALUE obj, const plist_handler_t *handler, void *ctx, int flags) {
+	struct emit_state state;
+	state.handler = handler;
+	state.ctx = ctx;
+	state.depth = 0;
+	state.sorted = (flags & PLIST_EMIT_SORTED) != 0;
+	emit(obj, &state);
+}
+
+static const int node_types[] = {
+	[PLIST_NODE_DICT] = PLIST_OBJ_DICT,
+	[PLIST_NODE_ARRAY] = PLIST_OBJ_ARRAY,
+	[PLIST_NODE_KEY] = PLIST_OBJ_KEY,
+	[PLIST_NODE_STRING] = PLIST_OBJ_STRING,
+	[PLIST_NODE_DATA] = PLIST_OBJ_DATA,
+	[PLIST_NODE_INTEGER] = PLIST_OBJ_INTEGER,
+	[PLIST_NODE_REAL] = PLIST_OBJ_REAL,
+	[PLIST_NODE_BOOLEAN] = PLIST_OBJ_BOOLEAN,
+	[PLIST_NODE_DATE] = PLIST_OBJ_DATE
+};
+
+// Converts the subtree at +i+ of a parsed document straight into Ruby
+// objects, with keys from +intern+ unless it is NULL. Quicker than
+// replaying it to the builder, which has to keep its open containers
+// in Ruby arrays.
+VALUE plist_doc_to_ruby(const plist_doc_t *doc, long i, plist_intern_t *intern) {
+	const plist_node_t *node = plist_doc_node(doc, i);
+	long child;
+	PLIST_COUNT(node_types[node->kind]);
+	switch (node->kind) {
+		case PLIST_NODE_DICT: {
+			VALUE hash = rb_hash_new();
+			for (child = i + 1; child < node->v.end; child = plist_doc_next(doc, child + 1)) {
+				const plist_node_t *key = plist_doc_node(doc, child);
+				const char *text = plist_doc_text(doc, key);
+				VALUE k = intern ? plist_intern_key(intern, text, key->len) : plist_str_new(text, key->len);
+				PLIST_COUNT(PLIST_OBJ_KEY);
+				rb_hash_aset(hash, k, plist_doc_to_ruby(doc, child + 1, intern));
+			}
+			return hash;
+		}
+		case PLIST_NODE_ARRAY: {
+			VALUE array = rb_ary_new2(node->len);
+			for (child = i + 1; child < node->v.end; child = plist_doc_next(doc, child)) {
+				rb_ary_push(array, plist_doc_to_ruby(doc, child, intern));
+			}
+			return array;
+		}
+		case PLIST_NODE_KEY:
+		case PLIST_NODE_STRING: return plist_str_new(plist_doc_text(doc, node), node->len);
+		case PLIST_NODE_DATA: {
+			VALUE str = rb_str_new(plist_doc_text(doc, node), node->len);
+			str_setBlob(str, Qtrue);
+			return str;
+		}
+		case PLIST_NODE_INTEGER: return node->len ? ULL2NUM((unsigned long long)node->v.integer) : LL2NUM(node->v.integer);
+		case PLIST_NODE_REAL: return rb_float_new(node->v.real);
+		case PLIST_NODE_BOOLEAN: return node->v.integer ? Qtrue : Qfalse;
+		default: return rb_funcall(timeEpoch, id_plus, 1, rb_float_new(node->v.real));
+	}
+}
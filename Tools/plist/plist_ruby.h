@@ -0,0 +1,30 @@
+#ifndef _PLIST_RUBY_H_
+#define _PLIST_RUBY_H_
+
+#include "plist.h"
+#include "plist_doc.h"
+#include "plist_intern.h"
+
+typedef int (*plist_parse_fn)(const char *bytes, long len, const plist_handler_t *handler, void *ctx, plist_buf_t *scratch, plist_error_t *error);
+
+typedef struct {
+	VALUE stack;
+	VALUE keys;
+	VALUE result;
+	plist_intern_t *intern;          // for the keys, or NULL
+} plist_builder_t;
+
+extern const plist_handler_t plist_builder_handler;
+
+plist_parse_fn plist_reader_for(const char *bytes, long len);
+VALUE plist_reader_format(plist_parse_fn parse);
+
+void plist_builder_init(plist_builder_t *builder);
+VALUE plist_build(plist_parse_fn parse, const char *bytes, long len, plist_intern_t *intern);
+VALUE plist_doc_to_ruby(const plist_doc_t *doc, long i, plist_intern_t *intern);
+// For plist_emit_object and the dump functions: the canonical key order
+#define PLIST_EMIT_SORTED 1
+
+void plist_emit_object(VALUE obj, const plist_handler_t *handler, void *ctx, int flags);
+
+#endif /* _PLIST_RUBY_H_ */
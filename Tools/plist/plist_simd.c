@@ -0,0 +1,358 @@
+/*
+ * Vector kernels for the XML and JSON readers and writers.
+ *
+ * Finding the characters to escape in a string, finding the end of a
+ * run of text, and the base64 coding of <data> values are byte loops
+ * that dominate loading and dumping plists with long command scripts
+ * or large embedded data. Each has a scalar version and one using
+ * SSE2 or AVX2; AVX2 is picked at run time, so a build for generic
+ * x86-64 still uses it. Setting TM_PLIST_SIMD to "sse2" or "scalar"
+ * before the extension loads caps the level, for comparing them.
+ *
+ * The base64 kernels follow Muła and Lemire, "Faster Base64 Encoding
+ * and Decoding Using AVX2 Instructions" (ACM TOCS 2018). SSE2 lacks
+ * the byte shuffle they rely on, so without AVX2 base64 is scalar.
+ */
+
+#include "plist_simd.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__) && defined(__GNUC__)
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#define SIMD_AVX2 1
+#include <immintrin.h>
+#define AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+int plist_simd_level = PLIST_SIMD_SCALAR;
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 6-bit values of the base64 alphabet; 64 for XML whitespace, 65 for '=', 66 otherwise
+#define B64_SPACE 64
+#define B64_PAD 65
+#define B64_BAD 66
+static const unsigned char base64_values[256] = {
+	66, 66, 66, 66, 66, 66, 66, 66, 66, 64, 64, 66, 66, 64, 66, 66,
+	66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+	64, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 62, 66, 66, 66, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 66, 66, 66, 65, 66, 66,
+	66,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 66, 66, 66, 66, 66,
+	66, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 66, 66, 66, 66, 66,
+	66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+	66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+	66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+	66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+	66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+	66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+	66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66,
+	66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66, 66
+};
+
+static int needs_escape(unsigned char c) {
+	return c == '&' || c == '<' || c == '>';
+}
+
+static int json_special(unsigned char c) {
+	return c == '"' || c == '\\' || c < 0x20;
+}
+
+#ifdef SIMD_AVX2
+// '<' and '>' differ only in bit 1, so one compare after setting it finds both
+AVX2 static long escape_scan_avx2(const char *bytes, long len) {
+	const __m256i amp = _mm256_set1_epi8('&'), angle = _mm256_set1_epi8('>'), two = _mm256_set1_epi8(2);
+	long i;
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+		__m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(_mm256_or_si256(v, two), angle));
+		unsigned mask = _mm256_movemask_epi8(hit);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+	for (; i < len; i++)
+		if (needs_escape(bytes[i])) return i;
+	return len;
+}
+
+AVX2 static long find2_avx2(const char *bytes, long len, char a, char b) {
+	const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+	long i;
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+		unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+		if (mask) return i + __builtin_ctz(mask);
+	}
+	for (; i < len; i++)
+		if (bytes[i] == a || bytes[i] == b) return i;
+	return len;
+}
+
+// Control characters are the bytes v with min(v, 0x1f) == v
+AVX2 static long json_scan_avx2(const char *bytes, long len) {
+	const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\'), control = _mm256_set1_epi8(0x1f);
+	long i;
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+		__m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+		unsigned mask = _mm256_movemask_epi8(hit);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+	for (; i < len; i++)
+		if (json_special(bytes[i])) return i;
+	return len;
+}
+
+// Spreads the 24 bytes at 4..15 of the low lane and 0..11 of the high
+// lane into 32 six-bit values, one per byte
+AVX2 static __m256i encode_unpack(__m256i in) {
+	in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+		10, 11,  9, 10,  7,  8,  6,  7,  4,  5,  3,  4,  1,  2,  0,  1,
+		14, 15, 13, 14, 11, 12, 10, 11,  8,  9,  7,  8,  5,  6,  4,  5));
+	__m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+	__m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+	return _mm256_or_si256(t0, t1);
+}
+
+// Maps six-bit values to the alphabet by adding an offset chosen per range
+AVX2 static __m256i encode_translate(__m256i in) {
+	const __m256i offsets = _mm256_setr_epi8(
+		65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+		65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+	__m256i index = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+	index = _mm256_sub_epi8(index, _mm256_cmpgt_epi8(in, _mm256_set1_epi8(25)));
+	return _mm256_add_epi8(in, _mm256_shuffle_epi8(offsets, index));
+}
+
+// Encodes 24 bytes at a time while 28 can be read; returns the bytes consumed
+AVX2 static long base64_encode_avx2(const unsigned char *bytes, long len, char *out) {
+	if (len < 28) return 0;
+	// The first load starts 4 bytes early like the rest but leaves them out
+	__m256i v = _mm256_maskload_epi32((const int *)(bytes - 4), _mm256_set_epi32(-1, -1, -1, -1, -1, -1, -1, 0));
+	long i = 0;
+	for (;;) {
+		_mm256_storeu_si256((__m256i *)out, encode_translate(encode_unpack(v)));
+		i += 24, out += 32;
+		if (i + 28 > len) break;
+		v = _mm256_loadu_si256((const __m256i *)(bytes + i - 4));
+	}
+	return i;
+}
+
+// Decodes 32 base64 characters into 24 bytes followed by 8 of junk;
+// returns 0 with the position of the first other character in *bad
+// if there is one
+AVX2 static int base64_decode_block_avx2(const char *text, char *out, int *bad) {
+	const __m256i shifts = _mm256_setr_epi8(
+		0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	// A bit per high nibble that makes a valid character, indexed by low nibble
+	const __m256i valid = _mm256_setr_epi8(
+		(char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+		(char)0xf8, (char)0xf8, (char)0xf0, 0x54, 0x50, 0x50, 0x50, 0x54,
+		(char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+		(char)0xf8, (char)0xf8, (char)0xf0, 0x54, 0x50, 0x50, 0x50, 0x54);
+	const __m256i bits = _mm256_setr_epi8(
+		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0,
+		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0);
+	__m256i v = _mm256_loadu_si256((const __m256i *)text);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), _mm256_set1_epi8(0x0f));
+	__m256i lo = _mm256_and_si256(v, _mm256_set1_epi8(0x0f));
+	__m256i ok = _mm256_and_si256(_mm256_shuffle_epi8(valid, lo), _mm256_shuffle_epi8(bits, hi));
+	unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(ok, _mm256_setzero_si256()));
+	if (mask) {
+		*bad = __builtin_ctz(mask);
+		return 0;
+	}
+	// '/' shares its high nibble with '+' but needs its own offset
+	__m256i shift = _mm256_blendv_epi8(_mm256_shuffle_epi8(shifts, hi), _mm256_set1_epi8(16), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+	v = _mm256_add_epi8(v, shift);
+	// Packs each four six-bit values into three bytes, then the bytes together
+	v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+	v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+	v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+	_mm256_storeu_si256((__m256i *)out, v);
+	return 1;
+}
+#endif
+
+#ifdef SIMD_SSE2
+static long escape_scan_sse2(const char *bytes, long len) {
+	const __m128i amp = _mm_set1_epi8('&'), angle = _mm_set1_epi8('>'), two = _mm_set1_epi8(2);
+	long i;
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+		__m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(_mm_or_si128(v, two), angle));
+		int mask = _mm_movemask_epi8(hit);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+	for (; i < len; i++)
+		if (needs_escape(bytes[i])) return i;
+	return len;
+}
+
+static long find2_sse2(const char *bytes, long len, char a, char b) {
+	const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+	long i;
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+		if (mask) return i + __builtin_ctz(mask);
+	}
+	for (; i < len; i++)
+		if (bytes[i] == a || bytes[i] == b) return i;
+	return len;
+}
+static long json_scan_sse2(const char *bytes, long len) {
+	const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'), control = _mm_set1_epi8(0x1f);
+	long i;
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+		__m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+		int mask = _mm_movemask_epi8(hit);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+	for (; i < len; i++)
+		if (json_special(bytes[i])) return i;
+	return len;
+}
+#endif
+
+// Offset of the first '&', '<' or '>' in bytes, or len if there is none
+long plist_escape_scan(const char *bytes, long len) {
+#ifdef SIMD_AVX2
+	if (plist_simd_level >= PLIST_SIMD_AVX2) return escape_scan_avx2(bytes, len);
+#endif
+#ifdef SIMD_SSE2
+	if (plist_simd_level >= PLIST_SIMD_SSE2) return escape_scan_sse2(bytes, len);
+#endif
+	long i;
+	for (i = 0; i < len; i++)
+		if (needs_escape(bytes[i])) return i;
+	return len;
+}
+
+// Offset of the first a or b in bytes, or len if there is neither
+long plist_find2(const char *bytes, long len, char a, char b) {
+#ifdef SIMD_AVX2
+	if (plist_simd_level >= PLIST_SIMD_AVX2) return find2_avx2(bytes, len, a, b);
+#endif
+#ifdef SIMD_SSE2
+	if (plist_simd_level >= PLIST_SIMD_SSE2) return find2_sse2(bytes, len, a, b);
+#endif
+	long i;
+	for (i = 0; i < len; i++)
+		if (bytes[i] == a || bytes[i] == b) return i;
+	return len;
+}
+
+// Offset of the first '"', '\\' or control character in bytes, or len
+// if there is none; the bytes a JSON string has to escape
+long plist_json_scan(const char *bytes, long len) {
+#ifdef SIMD_AVX2
+	if (plist_simd_level >= PLIST_SIMD_AVX2) return json_scan_avx2(bytes, len);
+#endif
+#ifdef SIMD_SSE2
+	if (plist_simd_level >= PLIST_SIMD_SSE2) return json_scan_sse2(bytes, len);
+#endif
+	long i;
+	for (i = 0; i < len; i++)
+		if (json_special(bytes[i])) return i;
+	return len;
+}
+
+// Writes the padded base64 of len bytes, 4 * ((len + 2) / 3) characters, to out
+void plist_base64_encode(const unsigned char *bytes, long len, char *out) {
+	long i = 0;
+#ifdef SIMD_AVX2
+	if (plist_simd_level >= PLIST_SIMD_AVX2) {
+		i = base64_encode_avx2(bytes, len, out);
+		out += i / 3 * 4;
+	}
+#endif
+	for (; i + 3 <= len; i += 3) {
+		unsigned long v = bytes[i] << 16 | bytes[i + 1] << 8 | bytes[i + 2];
+		*out++ = base64_chars[v >> 18];
+		*out++ = base64_chars[(v >> 12) & 63];
+		*out++ = base64_chars[(v >> 6) & 63];
+		*out++ = base64_chars[v & 63];
+	}
+	if (i < len) {
+		unsigned long v = bytes[i] << 16 | (i + 1 < len ? bytes[i + 1] << 8 : 0);
+		*out++ = base64_chars[v >> 18];
+		*out++ = base64_chars[(v >> 12) & 63];
+		*out++ = i + 1 < len ? base64_chars[(v >> 6) & 63] : '=';
+		*out++ = '=';
+	}
+}
+
+// Decodes base64 text into out, skipping whitespace and stopping at the
+// first '='. Returns the number of bytes written or -1 if the text holds
+// anything else. out needs len / 4 * 3 + PLIST_BASE64_SLACK bytes, and
+// may be text itself.
+long plist_base64_decode(const char *text, long len, char *out) {
+	const unsigned char *p = (const unsigned char *)text, *end = p + len;
+	char *o = out;
+	unsigned long acc = 0;
+	int count = 0;
+#ifdef SIMD_AVX2
+	const unsigned char *resume = p;
+	int avx2 = plist_simd_level >= PLIST_SIMD_AVX2;
+#endif
+	while (p < end) {
+#ifdef SIMD_AVX2
+		// Whole blocks go through the vector path when a group of four
+		// starts here; one with whitespace or padding in it is done
+		// below, up to the character that stopped it
+		if (avx2 && count == 0 && p >= resume) {
+			int bad = 0;
+			while (end - p >= 32 && base64_decode_block_avx2((const char *)p, o, &bad))
+				p += 32, o += 24;
+			resume = p + bad + 1;
+			if (p == end) break;
+		}
+#endif
+		unsigned char v = base64_values[*p++];
+		if (v < 64) {
+			acc = acc << 6 | v;
+			if (++count == 4) {
+				*o++ = acc >> 16;
+				*o++ = acc >> 8;
+				*o++ = acc;
+				acc = 0, count = 0;
+			}
+		} else if (v == B64_PAD) {
+			break;
+		} else if (v != B64_SPACE) {
+			return -1;
+		}
+	}
+	if (count == 3) {
+		*o++ = acc >> 10;
+		*o++ = acc >> 2;
+	} else if (count == 2) {
+		*o++ = acc >> 4;
+	}
+	return o - out;
+}
+
+void Init_plist_simd(void) {
+#ifdef SIMD_SSE2
+	plist_simd_level = PLIST_SIMD_SSE2;
+#endif
+#ifdef SIMD_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) plist_simd_level = PLIST_SIMD_AVX2;
+#endif
+	const char *cap = getenv("TM_PLIST_SIMD");
+	if (cap && strcmp(cap, "scalar") == 0) plist_simd_level = PLIST_SIMD_SCALAR;
+	else if (cap && strcmp(cap, "sse2") == 0 && plist_simd_level > PLIST_SIMD_SSE2) plist_simd_level = PLIST_SIMD_SSE2;
+}
@@ -0,0 +1,25 @@
+#ifndef _PLIST_SIMD_H_
+#define _PLIST_SIMD_H_
+
+#include "plist.h"
+
+// Which kernels plist_simd_* use; TM_PLIST_SIMD can lower it at load time
+enum {
+	PLIST_SIMD_SCALAR = 0,
+	PLIST_SIMD_SSE2 = 1,
+	PLIST_SIMD_AVX2 = 2
+};
+
+extern int plist_simd_level;
+
+// Space plist_base64_decode may write past the decoded bytes
+#define PLIST_BASE64_SLACK 32
+
+long plist_escape_scan(const char *bytes, long len);
+long plist_find2(const char *bytes, long len, char a, char b);
+long plist_json_scan(const char *bytes, long len);
+void plist_base64_encode(const unsigned char *bytes, long len, char *out);
+long plist_base64_decode(const char *text, long len, char *out);
+void Init_plist_simd(void);
+
+#endif /* _PLIST_SIMD_H_ */
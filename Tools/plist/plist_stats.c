@@ -0,0 +1,278 @@
+/*
+ * Per-process counters for load and dump, and the TM_PLIST_TRACE log.
+ *
+ * Every Ruby entry point runs inside plist_stats_call, which keeps a
+ * record of the call on the C stack and points the fiber-local
+ * __plist_call__ at it. Threads and fibers can switch in the middle of
+ * a call (load_many gives up the GVL, an IO can block), so each finds
+ * its own innermost call there. The code doing the work reports
+ * what it read and wrote with plist_stats_load and plist_stats_dump,
+ * and marks the end of each phase with plist_stats_phase, which charges
+ * the time since the previous mark to a format. Objects are counted
+ * where they are created. All of this happens with the GVL held.
+ *
+ * TM_PLIST_TRACE=<ms> logs every call that takes at least that long
+ * to stderr; TM_PLIST_TRACE=<ms>:<path> appends to a file instead,
+ * and a bare path uses a threshold of 10 ms.
+ */
+
+#include "plist_stats.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_DEFAULT_MS 10.0
+
+enum {
+	FORMAT_XML,
+	FORMAT_BINARY,
+	FORMAT_OPENSTEP,
+	FORMAT_JSON,
+	FORMATS
+};
+
+typedef struct {
+	unsigned long long loads;
+	unsigned long long dumps;
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;
+	double time[PLIST_PHASES];      // seconds
+} format_stats_t;
+
+typedef struct plist_call {
+	const char *name;
+	double start;
+	double mark;                    // end of the last phase
+	double time[PLIST_PHASES];
+	long bytes_in;
+	long bytes_out;
+	VALUE format;                   // last one read or written, or Qnil
+	VALUE path;                     // for load_file, or Qnil
+	struct plist_call *outer;       // made earlier on this fiber, from an IO#write, say
+} plist_call_t;
+
+struct call_args {
+	VALUE (*func)(int, VALUE *, VALUE);
+	int argc;
+	VALUE *argv;
+	VALUE self;
+	plist_call_t *call;
+};
+
+unsigned long long plist_objects[PLIST_OBJ_TYPES];
+VALUE id_json;
+
+static format_stats_t formats[FORMATS];
+static FILE *traceFile;
+static double traceThreshold;       // seconds
+
+static ID id_current_call;
+static VALUE id_loads, id_dumps, id_bytes_in, id_bytes_out, id_objects;
+static VALUE id_phases[PLIST_PHASES];
+static VALUE id_types[PLIST_OBJ_TYPES];
+
+// Monotonic seconds; callable without the GVL
+double plist_stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The innermost call running on this fiber, or NULL
+static plist_call_t *current_call(void) {
+	VALUE call = rb_thread_local_aref(rb_thread_current(), id_current_call);
+	return NIL_P(call) ? NULL : (plist_call_t *)(uintptr_t)NUM2ULL(call);
+}
+
+static void set_current_call(plist_call_t *call) {
+	rb_thread_local_aset(rb_thread_current(), id_current_call, call ? ULL2NUM((uintptr_t)call) : Qnil);
+}
+
+static int format_index(VALUE format) {
+	if (format == id_xml) return FORMAT_XML;
+	if (format == id_binary) return FORMAT_BINARY;
+	if (format == id_openstep) return FORMAT_OPENSTEP;
+	return FORMAT_JSON;
+}
+
+// Counts one property list of +bytes+ read in +format+
+void plist_stats_load(VALUE format, long bytes) {
+	format_stats_t *f = &formats[format_index(format)];
+	f->loads++;
+	f->bytes_in += bytes;
+	plist_call_t *current = current_call();
+	if (current) {
+		current->bytes_in += bytes;
+		current->format = format;
+	}
+}
+
+// Counts one property list of +bytes+ written in +format+
+void plist_stats_dump(VALUE format, long bytes) {
+	format_stats_t *f = &formats[format_index(format)];
+	f->dumps++;
+	f->bytes_out += bytes;
+	plist_call_t *current = current_call();
+	if (current) {
+		current->bytes_out += bytes;
+		current->format = format;
+	}
+}
+
+// Charges +seconds+ of +phase+ to +format+, for work timed elsewhere
+void plist_stats_time(VALUE format, int phase, double seconds) {
+	formats[format_index(format)].time[phase] += seconds;
+	plist_call_t *current = current_call();
+	if (current) current->time[phase] += seconds;
+}
+
+// Charges the time since the last mark to +phase+ of +format+, or
+// just moves the mark when +format+ is Qnil
+void plist_stats_phase(VALUE format, int phase) {
+	plist_call_t *current = current_call();
+	if (!current) return;
+	double now = plist_stats_now();
+	if (!NIL_P(format)) plist_stats_time(format, phase, now - current->mark);
+	current->mark = now;
+}
+
+void plist_stats_path(VALUE path) {
+	plist_call_t *current = current_call();
+	if (current) current->path = path;
+}
+
+static void trace(plist_call_t *call, double elapsed) {
+	const char *file = rb_sourcefile();
+	fprintf(traceFile, "plist[%d] %s %s %.1f ms (parse %.1f, convert %.1f, write %.1f) %ld bytes in, %ld out%s%s from %s:%d\n",
+		(int)getpid(), call->name, NIL_P(call->format) ? "-" : rb_id2name(call->format), elapsed * 1000,
+		call->time[PLIST_PARSE] * 1000, call->time[PLIST_CONVERT] * 1000, call->time[PLIST_WRITE] * 1000,
+		call->bytes_in, call->bytes_out, NIL_P(call->path) ? "" : " ", NIL_P(call->path) ? "" : StringValueCStr(call->path),
+		file ? file : "-", file ? rb_sourceline() : 0);
+}
+
+static VALUE call_body(VALUE arg) {
+	struct call_args *args = (struct call_args *)arg;
+	return args->func(args->argc, args->argv, args->self);
+}
+
+static VALUE call_end(VALUE arg) {
+	plist_call_t *call = ((struct call_args *)arg)->call;
+	double now = plist_stats_now();
+	set_current_call(call->outer);
+	// The outer call's next phase shouldn't include this one
+	if (call->outer) call->outer->mark = now;
+	if (traceFile && now - call->start >= traceThreshold) trace(call, now - call->start);
+	return Qnil;
+}
+
+// Runs +func+ as the Ruby method +name+, keeping a record of the call
+// for the phase marks made while it runs and for the trace
+VALUE plist_stats_call(const char *name, VALUE (*func)(int, VALUE *, VALUE), int argc, VALUE *argv, VALUE self) {
+	plist_call_t call;
+	struct call_args args;
+	memset(&call, 0, sizeof(call));
+	call.name = name;
+	call.start = call.mark = plist_stats_now();
+	call.format = Qnil;
+	call.path = Qnil;
+	call.outer = current_call();
+	args.func = func;
+	args.argc = argc;
+	args.argv = argv;
+	args.self = self;
+	args.call = &call;
+	set_current_call(&call);
+	return rb_ensure(call_body, (VALUE)&args, call_end, (VALUE)&args);
+}
+
+static VALUE format_hash(format_stats_t *f) {
+	VALUE hash = rb_hash_new();
+	int i;
+	rb_hash_aset(hash, ID2SYM(id_loads), ULL2NUM(f->loads));
+	rb_hash_aset(hash, ID2SYM(id_dumps), ULL2NUM(f->dumps));
+	rb_hash_aset(hash, ID2SYM(id_bytes_in), ULL2NUM(f->bytes_in));
+	rb_hash_aset(hash, ID2SYM(id_bytes_out), ULL2NUM(f->bytes_out));
+	for (i = 0; i < PLIST_PHASES; i++) rb_hash_aset(hash, ID2SYM(id_phases[i]), rb_float_new(f->time[i]));
+	return hash;
+}
+
+/* call-seq:
+ *    PropertyList.stats -> Hash
+ *
+ * Returns counters for this process since it started or since the last
+ * reset_stats. There is an entry for each of <tt>:xml1</tt>,
+ * <tt>:binary1</tt>, <tt>:openstep</tt> and <tt>:json</tt>, holding the
+ * number of <tt>:loads</tt> and <tt>:dumps</tt>, <tt>:bytes_in</tt> and
+ * <tt>:bytes_out</tt>, and the seconds spent on <tt>:parse_time</tt>,
+ * <tt>:convert_time</tt> and <tt>:write_time</tt>. <tt>:objects</tt>
+ * counts the values handed to Ruby by type.
+ *
+ * Loads that build objects as they read, which is load and load_file
+ * unless the cache is used, count all their time as parsing; load_many,
+ * load_lazy views and cache hits convert separately. Converting to or
+ * from JSON counts as a load of one format and a dump of the other, with
+ * all the time spent writing.
+ */
+static VALUE plist_stats(VALUE self) {
+	VALUE stats = rb_hash_new(), objects = rb_hash_new();
+	int i;
+	rb_hash_aset(stats, ID2SYM(id_xml), format_hash(&formats[FORMAT_XML]));
+	rb_hash_aset(stats, ID2SYM(id_binary), format_hash(&formats[FORMAT_BINARY]));
+	rb_hash_aset(stats, ID2SYM(id_openstep), format_hash(&formats[FORMAT_OPENSTEP]));
+	rb_hash_aset(stats, ID2SYM(id_json), format_hash(&formats[FORMAT_JSON]));
+	for (i = 0; i < PLIST_OBJ_TYPES; i++) rb_hash_aset(objects, ID2SYM(id_types[i]), ULL2NUM(plist_objects[i]));
+	rb_hash_aset(stats, ID2SYM(id_objects), objects);
+	return stats;
+}
+
+/* call-seq:
+ *    PropertyList.reset_stats -> nil
+ *
+ * Sets every counter stats reports back to zero.
+ */
+static VALUE plist_resetStats(VALUE self) {
+	memset(formats, 0, sizeof(formats));
+	memset(plist_objects, 0, sizeof(plist_objects));
+	return Qnil;
+}
+
+static void open_trace(const char *setting) {
+	char *end;
+	const char *path = NULL;
+	double ms = strtod(setting, &end);
+	if (end == setting) {
+		ms = TRACE_DEFAULT_MS;
+		path = setting;
+	} else if (*end == ':' && end[1]) {
+		path = end + 1;
+	}
+	traceThreshold = ms / 1000;
+	traceFile = stderr;
+	if (path) {
+		traceFile = fopen(path, "a");
+		if (traceFile) setvbuf(traceFile, NULL, _IOLBF, 0);
+		else rb_warn("TM_PLIST_TRACE: can't open %s", path);
+	}
+}
+
+void Init_plist_stats(void) {
+	static const char *phases[PLIST_PHASES] = { "parse_time", "convert_time", "write_time" };
+	static const char *types[PLIST_OBJ_TYPES] = { "dict", "array", "key", "string", "data", "integer", "real", "boolean", "date" };
+	int i;
+	rb_define_module_function(mPlist, "stats", plist_stats, 0);
+	rb_define_module_function(mPlist, "reset_stats", plist_resetStats, 0);
+	id_json = rb_intern("json");
+	id_current_call = rb_intern("__plist_call__");
+	id_loads = rb_intern("loads");
+	id_dumps = rb_intern("dumps");
+	id_bytes_in = rb_intern("bytes_in");
+	id_bytes_out = rb_intern("bytes_out");
+	id_objects = rb_intern("objects");
+	for (i = 0; i < PLIST_PHASES; i++) id_phases[i] = rb_intern(phases[i]);
+	for (i = 0; i < PLIST_OBJ_TYPES; i++) id_types[i] = rb_intern(types[i]);
+	const char *setting = getenv("TM_PLIST_TRACE");
+	if (setting && *setting) open_trace(setting);
+}
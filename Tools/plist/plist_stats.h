@@ -0,0 +1,50 @@
+#ifndef _PLIST_STATS_H_
+#define _PLIST_STATS_H_
+
+#include "plist.h"
+
+// What the time of a call is spent on
+enum {
+	PLIST_PARSE,                    // reading the input, and building objects in one-pass loads
+	PLIST_CONVERT,                  // turning parsed documents into Ruby objects
+	PLIST_WRITE,                    // producing output
+	PLIST_PHASES
+};
+
+// Kinds of value handed to Ruby, for PLIST_COUNT
+enum {
+	PLIST_OBJ_DICT,
+	PLIST_OBJ_ARRAY,
+	PLIST_OBJ_KEY,
+	PLIST_OBJ_STRING,
+	PLIST_OBJ_DATA,
+	PLIST_OBJ_INTEGER,
+	PLIST_OBJ_REAL,
+	PLIST_OBJ_BOOLEAN,
+	PLIST_OBJ_DATE,
+	PLIST_OBJ_TYPES
+};
+
+extern unsigned long long plist_objects[PLIST_OBJ_TYPES];
+extern VALUE id_json;
+
+// Only ever touched with the GVL held, so a plain increment will do
+#define PLIST_COUNT(type) (plist_objects[type]++)
+
+VALUE plist_stats_call(const char *name, VALUE (*func)(int, VALUE *, VALUE), int argc, VALUE *argv, VALUE self);
+
+// Defines func##Traced, which runs +func+ as a call named +label+
+#define PLIST_TRACED(label, func)										\
+	static VALUE func##Traced(int argc, VALUE *argv, VALUE self) {		\
+		return plist_stats_call(label, func, argc, argv, self);			\
+	}
+
+double plist_stats_now(void);
+void plist_stats_load(VALUE format, long bytes);
+void plist_stats_dump(VALUE format, long bytes);
+void plist_stats_time(VALUE format, int phase, double seconds);
+void plist_stats_phase(VALUE format, int phase);
+void plist_stats_path(VALUE path);
+void Init_plist_stats(void);
+
+#endif /* _PLIST_STATS_H_ */
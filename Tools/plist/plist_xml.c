@@ -0,0 +1,723 @@
+/*
+ * Native reader and writer for XML property lists.
+ *
+ * The reader is a single pass over the input bytes: every element is
+ * reported to a plist_handler_t as soon as it is recognised, so callers
+ * can build Ruby objects (or anything else) without an intermediate tree.
+ * Text that needs no entity decoding is handed out as a pointer into the
+ * input; everything else is decoded into a caller-supplied scratch buffer.
+ */
+
+#include "plist_xml.h"
+#include "plist_ruby.h"
+#include "plist_simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+typedef struct {
+	const char *start;
+	const char *p;
+	const char *end;
+	const plist_handler_t *handler;
+	void *ctx;
+	plist_buf_t *scratch;
+	plist_error_t *error;
+	int depth;
+	int stopped;
+} xml_parser_t;
+
+typedef struct {
+	const char *name;
+	long len;
+	int closing;
+	int empty;
+} xml_tag_t;
+
+static int parse_value(xml_parser_t *ps, xml_tag_t *tag, int skip);
+
+// Records an error at the current position and unwinds the parse
+static int fail(xml_parser_t *ps, const char *message) {
+	ps->error->message = message;
+	ps->error->offset = ps->p - ps->start;
+	return -1;
+}
+
+// Checks a handler return code, stopping the parse if requested
+#define EMIT(ps, call) do {								\
+		if ((call) == PLIST_STOP) {						\
+			(ps)->stopped = 1;							\
+			return -1;									\
+		}												\
+	} while (0)
+
+static int is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int tag_is(xml_tag_t *tag, const char *name) {
+	long len = (long)strlen(name);
+	return tag->len == len && memcmp(tag->name, name, len) == 0;
+}
+
+static const char *find_str(const char *p, const char *end, const char *needle) {
+	long len = (long)strlen(needle);
+	while (end - p >= len) {
+		const char *hit = memchr(p, needle[0], end - p - len + 1);
+		if (!hit) return NULL;
+		if (memcmp(hit, needle, len) == 0) return hit;
+		p = hit + 1;
+	}
+	return NULL;
+}
+
+// Skips whitespace, comments, processing instructions and the DOCTYPE
+static int skip_misc(xml_parser_t *ps) {
+	for (;;) {
+		while (ps->p < ps->end && is_space(*ps->p)) ps->p++;
+		if (ps->end - ps->p < 2 || ps->p[0] != '<') return 0;
+		if (ps->p[1] == '?') {
+			const char *close = find_str(ps->p, ps->end, "?>");
+			if (!close) return fail(ps, "unterminated processing instruction");
+			ps->p = close + 2;
+		} else if (ps->end - ps->p >= 4 && memcmp(ps->p, "<!--", 4) == 0) {
+			const char *close = find_str(ps->p + 4, ps->end, "-->");
+			if (!close) return fail(ps, "unterminated comment");
+			ps->p = close + 3;
+		} else if (ps->end - ps->p >= 9 && memcmp(ps->p, "<!DOCTYPE", 9) == 0) {
+			int brackets = 0;
+			for (ps->p += 9; ps->p < ps->end; ps->p++) {
+				if (*ps->p == '[') brackets++;
+				else if (*ps->p == ']') brackets--;
+				else if (*ps->p == '>' && brackets <= 0) break;
+			}
+			if (ps->p >= ps->end) return fail(ps, "unterminated DOCTYPE");
+			ps->p++;
+		} else {
+			return 0;
+		}
+	}
+}
+
+// Reads the tag starting at the current '<', attributes are ignored
+static int read_tag(xml_parser_t *ps, xml_tag_t *tag) {
+	if (ps->p >= ps->end) return fail(ps, "unexpected end of input");
+	if (*ps->p != '<') return fail(ps, "expected a tag");
+	ps->p++;
+	tag->closing = 0;
+	tag->empty = 0;
+	if (ps->p < ps->end && *ps->p == '/') {
+		tag->closing = 1;
+		ps->p++;
+	}
+	tag->name = ps->p;
+	while (ps->p < ps->end && !is_space(*ps->p) && *ps->p != '>' && *ps->p != '/') ps->p++;
+	tag->len = ps->p - tag->name;
+	if (tag->len == 0) return fail(ps, "malformed tag");
+	char quote = 0;
+	for (; ps->p < ps->end; ps->p++) {
+		char c = *ps->p;
+		if (quote) {
+			if (c == quote) quote = 0;
+		} else if (c == '"' || c == '\'') {
+			quote = c;
+		} else if (c == '>') {
+			tag->empty = (ps->p[-1] == '/');
+			ps->p++;
+			return 0;
+		}
+	}
+	return fail(ps, "unterminated tag");
+}
+
+static int next_tag(xml_parser_t *ps, xml_tag_t *tag) {
+	if (skip_misc(ps) < 0) return -1;
+	return read_tag(ps, tag);
+}
+
+// Decodes entity references in [p, end) onto the end of the scratch buffer
+static int append_unescaped(xml_parser_t *ps, const char *p, const char *end) {
+	while (p < end) {
+		const char *amp = memchr(p, '&', end - p);
+		if (!amp) return plist_buf_append(ps->scratch, p, end - p) < 0 ? fail(ps, "out of memory") : 0;
+		if (plist_buf_append(ps->scratch, p, amp - p) < 0) return fail(ps, "out of memory");
+		const char *semi = memchr(amp, ';', end - amp);
+		if (!semi) return fail(ps, "unterminated entity reference");
+		const char *name = amp + 1;
+		long len = semi - name;
+		char c = 0;
+		if (len == 2 && memcmp(name, "lt", 2) == 0) c = '<';
+		else if (len == 2 && memcmp(name, "gt", 2) == 0) c = '>';
+		else if (len == 3 && memcmp(name, "amp", 3) == 0) c = '&';
+		else if (len == 4 && memcmp(name, "quot", 4) == 0) c = '"';
+		else if (len == 4 && memcmp(name, "apos", 4) == 0) c = '\'';
+		if (c) {
+			if (plist_buf_append(ps->scratch, &c, 1) < 0) return fail(ps, "out of memory");
+		} else if (len >= 2 && name[0] == '#') {
+			char digits[16];
+			int hex = (name[1] == 'x' || name[1] == 'X');
+			long ndigits = len - 1 - hex;
+			if (ndigits <= 0 || ndigits >= (long)sizeof(digits)) return fail(ps, "malformed character reference");
+			memcpy(digits, name + 1 + hex, ndigits);
+			digits[ndigits] = '\0';
+			char *stop;
+			unsigned long cp = strtoul(digits, &stop, hex ? 16 : 10);
+			if (*stop || cp > 0x10FFFF) return fail(ps, "malformed character reference");
+			if (plist_buf_append_utf8(ps->scratch, cp) < 0) return fail(ps, "out of memory");
+		} else {
+			return fail(ps, "unknown entity reference");
+		}
+		p = semi + 1;
+	}
+	return 0;
+}
+
+/*
+ * Reads the character content of the element +name+ up to and including
+ * its closing tag. When +decode+ is false the content is only skipped.
+ * The result points into the input when no decoding was necessary.
+ */
+static int read_text(xml_parser_t *ps, xml_tag_t *tag, int decode, const char **text, long *text_len) {
+	// One pass finds the end of text that can be handed out as it is
+	const char *lt = ps->p + plist_find2(ps->p, ps->end - ps->p, '<', '&');
+	if (!decode && lt < ps->end && *lt == '&') lt = memchr(lt, '<', ps->end - lt);
+	if (lt && ps->end - lt >= 2 && lt[0] == '<' && lt[1] == '/') {
+		*text = ps->p;
+		*text_len = lt - ps->p;
+		ps->p = lt;
+	} else {
+		if (decode) ps->scratch->len = 0;
+		for (;;) {
+			lt = memchr(ps->p, '<', ps->end - ps->p);
+			if (!lt) return fail(ps, "unexpected end of input");
+			if (decode && append_unescaped(ps, ps->p, lt) < 0) return -1;
+			ps->p = lt;
+			if (ps->end - lt >= 9 && memcmp(lt, "<![CDATA[", 9) == 0) {
+				const char *close = find_str(lt + 9, ps->end, "]]>");
+				if (!close) return fail(ps, "unterminated CDATA section");
+				if (decode && plist_buf_append(ps->scratch, lt + 9, close - lt - 9) < 0) return fail(ps, "out of memory");
+				ps->p = close + 3;
+			} else if (ps->end - lt >= 4 && memcmp(lt, "<!--", 4) == 0) {
+				const char *close = find_str(lt + 4, ps->end, "-->");
+				if (!close) return fail(ps, "unterminated comment");
+				ps->p = close + 3;
+			} else {
+				break;
+			}
+		}
+		*text = ps->scratch->ptr;
+		*text_len = ps->scratch->len;
+	}
+	xml_tag_t close;
+	if (read_tag(ps, &close) < 0) return -1;
+	if (!close.closing || close.len != tag->len || memcmp(close.name, tag->name, tag->len) != 0)
+		return fail(ps, "mismatched closing tag");
+	return 0;
+}
+
+// Like read_text, with surrounding whitespace trimmed and copied into +out+
+static int read_token(xml_parser_t *ps, xml_tag_t *tag, char *out, long out_size) {
+	const char *text;
+	long len;
+	if (tag->empty) return fail(ps, "empty value");
+	if (read_text(ps, tag, 1, &text, &len) < 0) return -1;
+	while (len > 0 && is_space(*text)) { text++; len--; }
+	while (len > 0 && is_space(text[len - 1])) len--;
+	if (len == 0 || len >= out_size) return fail(ps, "malformed value");
+	memcpy(out, text, len);
+	out[len] = '\0';
+	return 0;
+}
+
+static int decode_base64(xml_parser_t *ps, const char *text, long len, const char **out, long *out_len) {
+	// Decoding in place is safe since the output never overtakes the input
+	char *dst;
+	if (text == ps->scratch->ptr) {
+		dst = ps->scratch->ptr;
+	} else {
+		ps->scratch->len = 0;
+		if (plist_buf_reserve(ps->scratch, len / 4 * 3 + PLIST_BASE64_SLACK) < 0) return fail(ps, "out of memory");
+		dst = ps->scratch->ptr;
+	}
+	long n = plist_base64_decode(text, len, dst);
+	if (n < 0) return fail(ps, "invalid base64 data");
+	*out = dst;
+	*out_len = n;
+	return 0;
+}
+
+static int parse_container(xml_parser_t *ps, xml_tag_t *tag, int is_dict, int skip) {
+	const plist_handler_t *h = ps->handler;
+	int report = !skip;
+	if (report) {
+		int rc = is_dict ? h->begin_dict(ps->ctx) : h->begin_array(ps->ctx);
+		if (rc == PLIST_STOP) {
+			ps->stopped = 1;
+			return -1;
+		}
+		if (rc == PLIST_SKIP) skip = 1;
+	}
+	if (!tag->empty) {
+		if (++ps->depth > PLIST_MAX_DEPTH) return fail(ps, "nesting too deep");
+		for (;;) {
+			xml_tag_t child;
+			if (next_tag(ps, &child) < 0) return -1;
+			if (child.closing) {
+				if (!tag_is(&child, is_dict ? "dict" : "array")) return fail(ps, "mismatched closing tag");
+				break;
+			}
+			if (is_dict) {
+				const char *key;
+				long key_len;
+				if (!tag_is(&child, "key")) return fail(ps, "expected <key> in <dict>");
+				if (child.empty) {
+					key = "";
+					key_len = 0;
+				} else if (read_text(ps, &child, !skip, &key, &key_len) < 0) {
+					return -1;
+				}
+				if (!skip) EMIT(ps, h->key(ps->ctx, key, key_len));
+				if (next_tag(ps, &child) < 0) return -1;
+				if (child.closing) return fail(ps, "missing value for <key>");
+			}
+			if (parse_value(ps, &child, skip) < 0) return -1;
+		}
+		ps->depth--;
+	}
+	if (report && !skip) EMIT(ps, is_dict ? h->end_dict(ps->ctx) : h->end_array(ps->ctx));
+	return 0;
+}
+
+static int parse_value(xml_parser_t *ps, xml_tag_t *tag, int skip) {
+	const plist_handler_t *h = ps->handler;
+	if (tag->closing) return fail(ps, "unexpected closing tag");
+	if (tag_is(tag, "dict")) return parse_container(ps, tag, 1, skip);
+	if (tag_is(tag, "array")) return parse_container(ps, tag, 0, skip);
+	if (tag_is(tag, "true") || tag_is(tag, "false")) {
+		if (!tag->empty) {
+			xml_tag_t close;
+			if (next_tag(ps, &close) < 0) return -1;
+			if (!close.closing || close.len != tag->len || memcmp(close.name, tag->name, tag->len) != 0)
+				return fail(ps, "mismatched closing tag");
+		}
+		if (!skip) EMIT(ps, h->boolean(ps->ctx, tag->len == 4));
+		return 0;
+	}
+	if (tag_is(tag, "string") || tag_is(tag, "data")) {
+		const char *text = "";
+		long len = 0;
+		int is_data = (tag->len == 4);
+		if (!tag->empty && read_text(ps, tag, !skip, &text, &len) < 0) return -1;
+		if (skip) return 0;
+		if (is_data) {
+			if (decode_base64(ps, text, len, &text, &len) < 0) return -1;
+			EMIT(ps, h->data(ps->ctx, text, len));
+		} else {
+			EMIT(ps, h->string(ps->ctx, text, len));
+		}
+		return 0;
+	}
+	if (tag_is(tag, "integer")) {
+		char token[72];
+		if (read_token(ps, tag, token, sizeof(token)) < 0) return -1;
+		if (skip) return 0;
+		// Decimal, even with leading zeros, unless it starts with 0x
+		const char *digits = token + (*token == '-' || *token == '+');
+		int base = digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X') ? 16 : 10;
+		char *stop;
+		errno = 0;
+		long long value = strtoll(token, &stop, base);
+		if (!*stop && errno == ERANGE && *token != '-') {
+			// Up to 2**64 - 1, as a bplist can hold
+			errno = 0;
+			unsigned long long big = strtoull(token, &stop, base);
+			if (!*stop && errno != ERANGE) {
+				EMIT(ps, h->unsigned_integer(ps->ctx, big));
+				return 0;
+			}
+		}
+		if (*stop || errno == ERANGE) return fail(ps, "malformed <integer>");
+		EMIT(ps, h->integer(ps->ctx, value));
+		return 0;
+	}
+	if (tag_is(tag, "real")) {
+		char token[72];
+		if (read_token(ps, tag, token, sizeof(token)) < 0) return -1;
+		if (skip) return 0;
+		char *stop;
+		double value = strtod(token, &stop);
+		if (*stop) return fail(ps, "malformed <real>");
+		EMIT(ps, h->real(ps->ctx, value));
+		return 0;
+	}
+	if (tag_is(tag, "date")) {
+		char token[72];
+		double seconds;
+		if (read_token(ps, tag, token, sizeof(token)) < 0) return -1;
+		if (skip) return 0;
+		if (plist_date_parse(token, (long)strlen(token), &seconds) < 0) return fail(ps, "malformed <date>");
+		EMIT(ps, h->date(ps->ctx, seconds));
+		return 0;
+	}
+	if (tag_is(tag, "key")) return fail(ps, "<key> outside of <dict>");
+	return fail(ps, "unknown element");
+}
+
+// Returns true when the input looks like an XML document
+int plist_xml_detect(const char *bytes, long len) {
+	const char *p = bytes, *end = bytes + len;
+	if (len >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+	while (p < end && is_space(*p)) p++;
+	return p < end && *p == '<';
+}
+
+// Parses an XML property list, reporting every element to +handler+
+int plist_xml_parse(const char *bytes, long len, const plist_handler_t *handler, void *ctx, plist_buf_t *scratch, plist_error_t *error) {
+	xml_parser_t ps;
+	ps.start = ps.p = bytes;
+	ps.end = bytes + len;
+	ps.handler = handler;
+	ps.ctx = ctx;
+	ps.scratch = scratch;
+	ps.error = error;
+	ps.depth = 0;
+	ps.stopped = 0;
+	if (len >= 3 && memcmp(ps.p, "\xEF\xBB\xBF", 3) == 0) ps.p += 3;
+
+	xml_tag_t tag;
+	if (next_tag(&ps, &tag) < 0) return -1;
+	int wrapped = tag_is(&tag, "plist");
+	if (wrapped) {
+		if (tag.empty) return fail(&ps, "empty <plist>");
+		if (next_tag(&ps, &tag) < 0) return -1;
+	}
+	if (parse_value(&ps, &tag, 0) < 0) return ps.stopped ? 0 : -1;
+	if (wrapped) {
+		if (next_tag(&ps, &tag) < 0) return -1;
+		if (!tag.closing || !tag_is(&tag, "plist")) return fail(&ps, "expected </plist>");
+	}
+	return 0;
+}
+
+static long days_from_civil(long y, long m, long d) {
+	y -= m <= 2;
+	long era = (y >= 0 ? y : y - 399) / 400;
+	long yoe = y - era * 400;
+	long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days(long z, long *y, long *m, long *d) {
+	z += 719468;
+	long era = (z >= 0 ? z : z - 146096) / 146097;
+	long doe = z - era * 146097;
+	long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	long mp = (5 * doy + 2) / 153;
+	*d = doy - (153 * mp + 2) / 5 + 1;
+	*m = mp + (mp < 10 ? 3 : -9);
+	*y = yoe + era * 400 + (*m <= 2);
+}
+
+// Parses an ISO 8601 "YYYY-MM-DDTHH:MM:SSZ" timestamp
+int plist_date_parse(const char *bytes, long len, double *seconds) {
+	int f[6] = { 0, 1, 1, 0, 0, 0 };
+	const int widths[6] = { 4, 2, 2, 2, 2, 2 };
+	const char seps[6] = { '-', '-', 'T', ':', ':', 'Z' };
+	const char *p = bytes, *end = bytes + len;
+	int i, j;
+	for (i = 0; i < 6 && p < end; i++) {
+		for (j = 0; j < widths[i]; j++, p++) {
+			if (p >= end || *p < '0' || *p > '9') return -1;
+			f[i] = (j ? f[i] * 10 : 0) + (*p - '0');
+		}
+		if (p < end) {
+			if (*p != seps[i]) return -1;
+			p++;
+		}
+	}
+	if (p != end) return -1;
+	long days = days_from_civil(f[0], f[1], f[2]);
+	*seconds = (double)days * 86400.0 + f[3] * 3600.0 + f[4] * 60.0 + f[5] - PLIST_EPOCH_OFFSET;
+	return 0;
+}
+
+// Formats seconds since 2001 as an ISO 8601 UTC timestamp
+void plist_date_format(double seconds, char out[21]) {
+	double unix_time = floor(seconds + PLIST_EPOCH_OFFSET);
+	long days = (long)floor(unix_time / 86400.0);
+	long rem = (long)(unix_time - (double)days * 86400.0);
+	long y, m, d;
+	civil_from_days(days, &y, &m, &d);
+	snprintf(out, 21, "%04ld-%02ld-%02ldT%02ld:%02ld:%02ldZ", y, m, d, rem / 3600, rem / 60 % 60, rem % 60);
+}
+
+// Shortest of %.15g/%.17g that reads back as the same double
+void plist_real_format(double value, char out[32]) {
+	if (isnan(value)) {
+		strcpy(out, "nan");
+	} else if (isinf(value)) {
+		strcpy(out, value > 0 ? "+infinity" : "-infinity");
+	} else {
+		snprintf(out, 32, "%.15g", value);
+		if (strtod(out, NULL) != value) snprintf(out, 32, "%.17g", value);
+	}
+}
+
+// Writer
+
+static const char xml_header[] =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	"<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+	"<plist version=\"1.0\">\n";
+
+#define DATA_LINE_LENGTH 68
+#define DATA_LINE_BYTES (DATA_LINE_LENGTH / 4 * 3)
+#define DATA_BATCH_LINES 48
+// Deeper <data> elements are indented line by line instead
+#define DATA_INDENT_MAX 16
+
+// Hands the buffered output to the IO as a String of its own, which the
+// IO may keep; the next chunk goes into a new one.
+static void flush_chunk(plist_xml_writer_t *w) {
+	long len = RSTRING_LEN(w->out);
+	if (len == 0) return;
+	rb_funcall(w->io, id_write, 1, w->out);
+	w->written += len;
+	w->out = rb_str_buf_new(w->chunk);
+}
+
+static void put(plist_xml_writer_t *w, const char *bytes, long len) {
+	if (NIL_P(w->io)) {
+		rb_str_buf_cat(w->out, bytes, len);
+		return;
+	}
+	while (len > 0) {
+		long n = w->chunk - RSTRING_LEN(w->out);
+		if (n > len) n = len;
+		rb_str_buf_cat(w->out, bytes, n);
+		bytes += n;
+		len -= n;
+		if (RSTRING_LEN(w->out) >= w->chunk) flush_chunk(w);
+	}
+}
+
+static void put_indent(plist_xml_writer_t *w, int depth) {
+	static const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+	while (depth > 0) {
+		int n = depth > 16 ? 16 : depth;
+		put(w, tabs, n);
+		depth -= n;
+	}
+}
+
+static void put_escaped(plist_xml_writer_t *w, const char *p, long len) {
+	const char *end = p + len;
+	for (;;) {
+		long run = plist_escape_scan(p, end - p);
+		put(w, p, run);
+		p += run;
+		if (p == end) break;
+		switch (*p++) {
+			case '&': put(w, "&amp;", 5); break;
+			case '<': put(w, "&lt;", 4); break;
+			default: put(w, "&gt;", 4); break;
+		}
+	}
+}
+
+// Writes the open tag of a container once we know it isn't empty
+static void open_pending(plist_xml_writer_t *w) {
+	if (w->pending) {
+		put_indent(w, w->depth - 1);
+		if (w->pending == 'd') put(w, "<dict>\n", 7);
+		else put(w, "<array>\n", 8);
+		w->pending = 0;
+	}
+}
+
+static void put_element(plist_xml_writer_t *w, const char *tag, const char *text, long len, int escape) {
+	long tag_len = (long)strlen(tag);
+	open_pending(w);
+	put_indent(w, w->depth);
+	put(w, "<", 1);
+	put(w, tag, tag_len);
+	put(w, ">", 1);
+	if (escape) put_escaped(w, text, len);
+	else put(w, text, len);
+	put(w, "</", 2);
+	put(w, tag, tag_len);
+	put(w, ">\n", 2);
+}
+
+static int w_begin_dict(void *ctx) {
+	plist_xml_writer_t *w = ctx;
+	open_pending(w);
+	w->pending = 'd';
+	w->depth++;
+	return PLIST_CONTINUE;
+}
+
+static int w_begin_array(void *ctx) {
+	plist_xml_writer_t *w = ctx;
+	open_pending(w);
+	w->pending = 'a';
+	w->depth++;
+	return PLIST_CONTINUE;
+}
+
+static int w_end(plist_xml_writer_t *w, const char *tag) {
+	w->depth--;
+	put_indent(w, w->depth);
+	if (w->pending) {
+		put(w, "<", 1);
+		put(w, tag, (long)strlen(tag));
+		put(w, "/>\n", 3);
+		w->pending = 0;
+	} else {
+		put(w, "</", 2);
+		put(w, tag, (long)strlen(tag));
+		put(w, ">\n", 2);
+	}
+	return PLIST_CONTINUE;
+}
+
+static int w_end_dict(void *ctx) {
+	return w_end(ctx, "dict");
+}
+
+static int w_end_array(void *ctx) {
+	return w_end(ctx, "array");
+}
+
+static int w_key(void *ctx, const char *bytes, long len) {
+	put_element(ctx, "key", bytes, len, 1);
+	return PLIST_CONTINUE;
+}
+
+static int w_string(void *ctx, const char *bytes, long len) {
+	put_element(ctx, "string", bytes, len, 1);
+	return PLIST_CONTINUE;
+}
+
+static int w_data(void *ctx, const char *bytes, long len) {
+	plist_xml_writer_t *w = ctx;
+	const unsigned char *s = (const unsigned char *)bytes;
+	char text[DATA_BATCH_LINES * DATA_LINE_LENGTH];
+	char lines[DATA_BATCH_LINES * (DATA_INDENT_MAX + DATA_LINE_LENGTH + 1)];
+	int inline_indent = w->depth <= DATA_INDENT_MAX;
+	open_pending(w);
+	put_indent(w, w->depth);
+	put(w, "<data>\n", 7);
+	// Encodes many lines at once so the encoder sees long runs, and
+	// indents them in a buffer so each batch is a single put
+	while (len > 0) {
+		long n = len < DATA_BATCH_LINES * DATA_LINE_BYTES ? len : DATA_BATCH_LINES * DATA_LINE_BYTES;
+		long text_len = (n + 2) / 3 * 4, i;
+		char *o = lines;
+		plist_base64_encode(s, n, text);
+		for (i = 0; i < text_len; i += DATA_LINE_LENGTH) {
+			long line_len = text_len - i < DATA_LINE_LENGTH ? text_len - i : DATA_LINE_LENGTH;
+			if (!inline_indent) {
+				put_indent(w, w->depth);
+				put(w, text + i, line_len);
+				put(w, "\n", 1);
+				continue;
+			}
+			memset(o, '\t', w->depth);
+			o += w->depth;
+			memcpy(o, text + i, line_len);
+			o += line_len;
+			*o++ = '\n';
+		}
+		put(w, lines, o - lines);
+		s += n;
+		len -= n;
+	}
+	put_indent(w, w->depth);
+	put(w, "</data>\n", 8);
+	return PLIST_CONTINUE;
+}
+
+static int w_integer(void *ctx, long long value) {
+	char text[32];
+	snprintf(text, sizeof(text), "%lld", value);
+	put_element(ctx, "integer", text, (long)strlen(text), 0);
+	return PLIST_CONTINUE;
+}
+
+static int w_unsigned_integer(void *ctx, unsigned long long value) {
+	char text[32];
+	snprintf(text, sizeof(text), "%llu", value);
+	put_element(ctx, "integer", text, (long)strlen(text), 0);
+	return PLIST_CONTINUE;
+}
+
+static int w_real(void *ctx, double value) {
+	char text[32];
+	plist_real_format(value, text);
+	put_element(ctx, "real", text, (long)strlen(text), 0);
+	return PLIST_CONTINUE;
+}
+
+static int w_boolean(void *ctx, int value) {
+	plist_xml_writer_t *w = ctx;
+	open_pending(w);
+	put_indent(w, w->depth);
+	if (value) put(w, "<true/>\n", 8);
+	else put(w, "<false/>\n", 9);
+	return PLIST_CONTINUE;
+}
+
+static int w_date(void *ctx, double seconds) {
+	char text[21];
+	plist_date_format(seconds, text);
+	put_element(ctx, "date", text, (long)strlen(text), 0);
+	return PLIST_CONTINUE;
+}
+
+const plist_handler_t plist_xml_writer_handler = {
+	w_begin_dict, w_end_dict, w_begin_array, w_end_array,
+	w_key, w_string, w_data, w_integer, w_real, w_boolean, w_date, w_unsigned_integer
+};
+
+/*
+ * Starts a document; feed it one value through plist_xml_writer_handler.
+ * +out+ is either a String to append everything to, or anything with
+ * #write, which is then given the output +chunk+ bytes at a time.
+ */
+void plist_xml_writer_init(plist_xml_writer_t *writer, VALUE out, long chunk) {
+	if (TYPE(out) == T_STRING) {
+		writer->out = out;
+		writer->io = Qnil;
+		writer->written = RSTRING_LEN(out);
+	} else {
+		writer->out = rb_str_buf_new(chunk);
+		writer->io = out;
+		writer->written = 0;
+	}
+	writer->chunk = chunk;
+	writer->depth = 0;
+	writer->pending = 0;
+	put(writer, xml_header, (long)sizeof(xml_header) - 1);
+}
+
+// Ends the document, returning the number of bytes written
+long plist_xml_writer_finish(plist_xml_writer_t *writer) {
+	put(writer, "</plist>\n", 9);
+	if (NIL_P(writer->io)) return RSTRING_LEN(writer->out) - writer->written;
+	flush_chunk(writer);
+	return writer->written;
+}
+
+// Writes +obj+ as XML to +out+, a String or anything with #write, in
+// pieces of +chunk+ bytes. Returns the number of bytes written.
+long plist_xml_dump(VALUE obj, VALUE out, long chunk, int flags) {
+	plist_xml_writer_t writer;
+	plist_xml_writer_init(&writer, out, chunk);
+	plist_emit_object(obj, &plist_xml_writer_handler, &writer, flags);
+	return plist_xml_writer_finish(&writer);
+}
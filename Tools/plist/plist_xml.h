@@ -0,0 +1,29 @@
+#ifndef _PLIST_XML_H_
+#define _PLIST_XML_H_
+
+#include "plist.h"
+
+int plist_xml_detect(const char *bytes, long len);
+int plist_xml_parse(const char *bytes, long len, const plist_handler_t *handler, void *ctx, plist_buf_t *scratch, plist_error_t *error);
+
+typedef struct {
+	VALUE out;                      // the String being written
+	VALUE io;                       // takes out every +chunk+ bytes, or Qnil
+	long chunk;
+	long written;                   // bytes handed to io, or out's length before
+	int depth;
+	char pending;
+} plist_xml_writer_t;
+
+extern const plist_handler_t plist_xml_writer_handler;
+
+void plist_xml_writer_init(plist_xml_writer_t *writer, VALUE out, long chunk);
+long plist_xml_writer_finish(plist_xml_writer_t *writer);
+long plist_xml_dump(VALUE obj, VALUE out, long chunk, int flags);
+
+// Calendar helpers shared by everything that reads or writes <date>
+int plist_date_parse(const char *bytes, long len, double *seconds);
+void plist_date_format(double seconds, char out[21]);
+void plist_real_format(double value, char out[32]);
+
+#endif /* _PLIST_XML_H_ */
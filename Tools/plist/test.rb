@@ -1,8 +1,15 @@
 require './plist'
 require 'stringio'
 require 'test/unit'
+require 'tmpdir'
 
 class TestPlist < Test::Unit::TestCase
+  # setup_hash, as written by a bplist00 encoder
+  BINARY = ("YnBsaXN0MDDTAQIDBAgRU2JhclNmb29Xc3RyaW5nIaMFBgcQARACEAPUCQoLDA0ODxBYY29ycmVjdD9ScGlWcmFuZG9tVXRvZGF5CSNACSH7U8jU8UQj" +
+            "RWeJM0GgQXYwAAAAV2luZGVlZHkIDxMXHyMlJykyOz5FS0xVWmMAAAAAAAABAQAAAAAAAAASAAAAAAAAAAAAAAAAAAAAaw==").unpack("m")[0]
+  # [ "repeated", "repeated", { "repeated" => "repeated" } ] with a single string object
+  BINARY_SHARED = "YnBsaXN0MDCjAQECWHJlcGVhdGVk0QEBCAwVAAAAAAAAAQEAAAAAAAAAAwAAAAAAAAAAAAAAAAAAABg=".unpack("m")[0]
+
   def test_deprecation_warning
     savederr = STDERR.clone
     rd, wr = IO.pipe
@@ -34,9 +41,28 @@ class TestPlist < Test::Unit::TestCase
     assert_raise(OSX::PropertyListError) { OSX::PropertyList.load("") }
   end
 
+  def test_openstep
+    source = <<-'PLIST'
+      // comment
+      { list = ( a, "b c", <0fbd 77>, {}, ); /* comment */
+        escapes = "tab\t quote\" \U00e9 \101";
+        'single' = x; }
+    PLIST
+    plist, format = OSX::PropertyList.load(source, true)
+    assert_equal(:openstep, format)
+    assert_equal(["a", "b c", [0x0f, 0xbd, 0x77].pack("C*"), {}], plist["list"])
+    assert(plist["list"][2].blob?)
+    assert_equal("tab\t quote\" \xC3\xA9 A".unpack("C*"), plist["escapes"].unpack("C*"))
+    assert_equal("x", plist["single"])
+    # .strings files are a dictionary without the braces
+    assert_equal({ "a" => "b", "c" => "c" }, OSX::PropertyList.load('"a" = "b"; "c";'))
+    error = assert_raise(OSX::PropertyListError) { OSX::PropertyList.load("{\n a = b\n}") }
+    assert_match(/line 3/, error.message)
+  end
+
   def setup_hash
     time = Time.gm(2005, 4, 28, 6, 32, 56)
-    random = "\x23\x45\x67\x89"
+    random = [0x23, 0x45, 0x67, 0x89].pack("C*")
     random.blob = true
     {
       "string!" => "indeedy",
@@ -70,11 +96,461 @@ class TestPlist < Test::Unit::TestCase
     assert_equal(hash, hash2)
   end
 
+  def test_binary
+    plist, format = OSX::PropertyList.load(BINARY, true)
+    assert_equal(setup_hash, plist)
+    assert_equal(true, plist['foo']['random'].blob?)
+    assert_equal(:binary1, format)
+    assert_raise(OSX::PropertyListError) { OSX::PropertyList.load(BINARY[0, BINARY.size - 1]) }
+  end
+
+  def test_binary_shared_strings
+    plist = OSX::PropertyList.load(BINARY_SHARED)
+    assert_same(plist[0], plist[1])
+    assert_same(plist[0], plist[2]["repeated"])
+    assert(plist[0].frozen?)
+  end
+
+  def test_load_file
+    path = File.join(Dir.tmpdir, "plist-test-#{$$}.plist")
+    File.open(path, "wb") { |f| f.write(BINARY) }
+    assert_equal([setup_hash, :binary1], OSX::PropertyList.load_file(path, true))
+    File.open(path, "wb") { |f| f.write(setup_hash.to_plist) }
+    assert_equal(setup_hash, OSX::PropertyList.load_file(path))
+  ensure
+    File.delete(path) if File.exist?(path)
+  end
+
+  def test_load_lazy
+    [setup_hash.to_plist, BINARY].each do |source|
+      plist, format = OSX::PropertyList.load_lazy(source, true)
+      assert_kind_of(OSX::PropertyList::LazyHash, plist)
+      assert_equal(0, plist.materialized)
+      assert_equal("indeedy", plist["string!"])
+      assert_equal(1, plist.materialized)
+      foo = plist["foo"]
+      assert_kind_of(OSX::PropertyList::LazyHash, foo)
+      assert_same(foo, plist["foo"])
+      assert_equal(1, plist.materialized)
+      assert_equal(2, plist["bar"][1])
+      assert_nil(plist["missing"])
+      assert_equal(setup_hash, plist.to_h)
+      assert_equal(plist.nodes, plist.materialized)
+      assert_equal(setup_hash, plist.to_h)
+      assert(plist == setup_hash)
+      assert_operator(plist.materialized, :<=, plist.nodes)
+      assert_equal([1, 2, 3, 3, nil], [0, 1, 2, -1, 3].map { |i| plist["bar"][i] })
+      assert_equal([2, 3, 4], plist["bar"].each.map { |n| n + 1 })
+      assert_equal(setup_hash.keys.sort, plist.each.map(&:first).sort)
+    end
+  end
+
+  def test_extract
+    [setup_hash.to_plist, BINARY].each do |source|
+      assert_equal(["indeedy", 2, 3.14159265, nil, nil, [1, 2, 3]],
+                   OSX::PropertyList.extract(source, "string!", ["bar", 1], ["foo", "pi"], ["foo", "nope"], ["bar", 3], ["bar"]))
+      assert_equal([setup_hash], OSX::PropertyList.extract(source, []))
+    end
+    assert_raise(ArgumentError) { OSX::PropertyList.extract(BINARY, ["bar", -1]) }
+  end
+
+  def test_load_many
+    dir = File.join(Dir.tmpdir, "plist-test-#{$$}")
+    Dir.mkdir(dir)
+    paths = %w[a.plist b.plist c.plist missing.plist].map { |name| File.join(dir, name) }
+    File.open(paths[0], "wb") { |f| f.write(setup_hash.to_plist) }
+    File.open(paths[1], "wb") { |f| f.write(BINARY) }
+    File.open(paths[2], "wb") { |f| f.write("<plist><dict><key>a</key></dict></plist>") }
+    [1, 3].each do |threads|
+      results = OSX::PropertyList.load_many(paths, :threads => threads)
+      assert_equal([setup_hash, setup_hash], results[0, 2])
+      assert_kind_of(OSX::PropertyListError, results[2])
+      assert_kind_of(Errno::ENOENT, results[3])
+    end
+    lazy = OSX::PropertyList.load_many(paths, :lazy => true)
+    assert_kind_of(OSX::PropertyList::LazyHash, lazy[1])
+    assert_equal(setup_hash, lazy[1].to_h)
+  ensure
+    paths[0, 3].each { |path| File.delete(path) if File.exist?(path) }
+    Dir.rmdir(dir)
+  end
+
+  def test_load_many_trapped_signal
+    dir = File.join(Dir.tmpdir, "plist-signal-#{$$}")
+    Dir.mkdir(dir)
+    big = setup_hash.merge("padding" => ["x" * 100] * 200)
+    paths = (0...200).map { |i| File.join(dir, "#{i}.plist") }
+    paths.each { |path| File.open(path, "wb") { |f| f.write(big.to_plist) } }
+    trapped = 0
+    previous = trap("USR1") { trapped += 1 }
+    OSX::PropertyList.reset_stats
+    # the signals arrive while the main thread waits on the workers
+    done = false
+    killer = Thread.new { until done; Process.kill("USR1", $$); sleep 0.001; end }
+    results = OSX::PropertyList.load_many(paths, :threads => 2)
+    done = true
+    killer.join
+    assert_operator(trapped, :>, 0)
+    assert(results.all? { |result| result == big })
+    assert_equal(200, OSX::PropertyList.stats[:xml1][:loads])
+    assert_equal(0, OSX::PropertyList.stats[:json][:loads])
+  ensure
+    trap("USR1", previous || "DEFAULT")
+    (paths || []).each { |path| File.delete(path) if File.exist?(path) }
+    Dir.rmdir(dir)
+  end
+
+  def test_cache
+    dir = File.join(Dir.tmpdir, "plist-cache-#{$$}")
+    path = File.join(Dir.tmpdir, "plist-cached-#{$$}.plist")
+    big = setup_hash.merge("padding" => "x" * 8192)
+    File.open(path, "wb") { |f| f.write(big.to_plist) }
+    OSX::PropertyList.cache_dir = dir
+    before = OSX::PropertyList.cache_stats
+    assert_equal([big, :xml1], OSX::PropertyList.load_file(path, true))
+    assert_equal([big, :xml1], OSX::PropertyList.load_file(path, true))
+    after = OSX::PropertyList.cache_stats
+    assert_equal(1, after[:misses] - before[:misses])
+    assert_equal(1, after[:hits] - before[:hits])
+    # a rewrite that keeps the size is still noticed
+    File.open(path, "wb") { |f| f.write(big.merge("padding" => "y" * 8192).to_plist) }
+    assert_equal("y" * 8192, OSX::PropertyList.load_file(path)["padding"])
+  ensure
+    OSX::PropertyList.cache_dir = nil
+    File.delete(path) if File.exist?(path)
+    Dir[File.join(dir, "*")].each { |entry| File.delete(entry) }
+    Dir.rmdir(dir) if File.directory?(dir)
+  end
+
+  def test_dump_chunks
+    hash = setup_hash.merge("long" => "x" * 1000)
+    [:xml1, :binary1].each do |format|
+      pieces = []
+      io = Object.new
+      io.instance_eval { @pieces = pieces }
+      def io.write(data) @pieces << data; data.size end
+      data = hash.to_plist(format)
+      assert_equal(data.size, OSX::PropertyList.dump(io, hash, format, :buffer_size => 100))
+      assert_equal(data.unpack("C*"), pieces.join.unpack("C*"))
+      assert(pieces.size > 10)
+      assert(pieces.all? { |piece| piece.size <= 100 })
+    end
+    assert_raise(ArgumentError) { OSX::PropertyList.dump(StringIO.new, hash, :xml1, :buffer_size => 0) }
+    io = StringIO.new
+    assert_equal(hash.to_plist.size, OSX::PropertyList.dump(io, hash, :buffer_size => 64))
+    assert_equal(hash, OSX::PropertyList.load(io.string))
+  end
+
+  def test_intern_keys
+    list = [{ "name" => "a", "match" => "b" }, { "name" => "c", "match" => "d", "nested" => { "name" => "e" } }]
+    [list.to_plist, list.to_plist(:binary1), "({name = a; match = b;}, {name = c; match = d; nested = {name = e;};})"].each do |source|
+      [true, :load, :process].each do |mode|
+        loaded = OSX::PropertyList.load(source, false, :intern_keys => mode)
+        assert_equal(list, loaded)
+        names = [loaded[0], loaded[1], loaded[1]["nested"]].map { |hash| hash.keys.find { |key| key == "name" } }
+        assert(names.all? { |key| key.frozen? && key.equal?(names[0]) })
+        assert_equal({ :keys => 6, :created => 3, :avoided => 3 }, OSX::PropertyList.intern_stats)
+      end
+      loaded, format = OSX::PropertyList.load(source, true, :intern_keys => :symbols)
+      assert_equal([{ :name => "a", :match => "b" }, { :name => "c", :match => "d", :nested => { :name => "e" } }], loaded)
+      assert_kind_of(Symbol, format)
+    end
+    assert_equal(list, OSX::PropertyList.load(list.to_plist, :intern_keys => true))
+    assert_raise(ArgumentError) { OSX::PropertyList.load(list.to_plist, false, :intern_keys => :global) }
+    path = File.join(Dir.tmpdir, "plist-test-intern-#{$$}.plist")
+    File.open(path, "wb") { |f| f.write(list.to_plist) }
+    assert_equal(:name, OSX::PropertyList.load_file(path, false, :intern_keys => :symbols)[0].keys[0])
+    assert_equal(:name, OSX::PropertyList.load_many([path], :intern_keys => :symbols)[0][1].keys[0])
+  ensure
+    File.delete(path) if path && File.exist?(path)
+  end
+
+  def test_xml_codec
+    # Lengths around the vector block sizes, so both the kernels and the
+    # scalar tails are exercised
+    [0, 1, 2, 3, 23, 24, 27, 28, 29, 51, 52, 100, 1000, 4096].each do |len|
+      data = (0...len).map { |i| (i * 37 + len) % 256 }.pack("C*")
+      data.blob = true
+      plist = { "data" => data }.to_plist
+      lines = plist[/<data>\n(.*?)<\/data>/m, 1].split("\n").map { |line| line.strip }
+      assert_equal([data].pack("m0"), lines.join)
+      assert(lines.all? { |line| line.size <= 68 })
+      assert_equal(data.unpack("C*"), OSX::PropertyList.load(plist)["data"].unpack("C*"))
+      spaced = [data].pack("m0").scan(/.{1,7}/m).join(" \r\n\t")
+      assert_equal(data.unpack("C*"), OSX::PropertyList.load("<plist><data>#{spaced}</data></plist>").unpack("C*"))
+    end
+    long = ("A" * 40 + "*") * 3
+    assert_raise(OSX::PropertyListError) { OSX::PropertyList.load("<plist><data>#{long}</data></plist>") }
+    text = ("echo \"$TM_SELECTED_TEXT\" 2>&1 | sort > /tmp/out <<EOF\n" * 20)
+    plist = text.to_plist
+    assert_equal(text.size + text.count("&") * 4 + text.count("<>") * 3, plist[/<string>(.*)<\/string>/m, 1].size)
+    assert_equal(text, OSX::PropertyList.load(plist))
+    { "010" => 10, "09" => 9, "-007" => -7, "0x1F" => 31, "-0x10" => -16 }.each do |token, value|
+      assert_equal(value, OSX::PropertyList.load("<plist><integer>#{token}</integer></plist>"))
+    end
+    assert_raise(OSX::PropertyListError) { OSX::PropertyList.load("<plist><integer>0x</integer></plist>") }
+  end
+
+  def test_map_data
+    path = File.join(Dir.tmpdir, "plist-test-map-#{$$}.plist")
+    blobs = (0...10).map { |i| data = (65 + i).chr * (10 << 20); data.blob = true; data }
+    small = "tiny".dup
+    small.blob = true
+    File.open(path, "wb") { |f| f.write({ "blobs" => blobs, "small" => small }.to_plist(:binary1)) }
+    blobs = nil
+    loaded = OSX::PropertyList.load_file(path, false, :map_data => true)
+    assert_equal([10 << 20] * 10, loaded["blobs"].map { |data| data.size })
+    assert(loaded["blobs"].all? { |data| data.blob? && !data.frozen? })
+    assert_equal("tiny", loaded["small"])
+    data = loaded["blobs"][2]
+    data.setbyte(0, 0)
+    data << "!"
+    assert_equal([0, 67, 33], [data.getbyte(0), data.getbyte(1), data.getbyte(-1)])
+    assert_equal(67, OSX::PropertyList.load_file(path, false, :map_data => true)["blobs"][2].getbyte(0))
+    return unless File.exist?("/proc/self/status")
+    # Resident memory added by each kind of load, measured in a fresh child
+    growth = [false, true].map do |map_data|
+      rd, wr = IO.pipe
+      pid = fork do
+        rss = lambda { File.read("/proc/self/status")[/VmRSS:\s+(\d+)/, 1].to_i }
+        GC.start
+        before = rss.call
+        kept = OSX::PropertyList.load_file(path, false, :map_data => map_data)
+        wr.puts(rss.call - before)
+        exit!(kept.size)
+      end
+      wr.close
+      Process.wait(pid)
+      rd.read.to_i
+    end
+    assert_operator(growth[0], :>, 80 * 1024)
+    assert_operator(growth[1], :<, growth[0] / 3)
+  ensure
+    File.delete(path) if path && File.exist?(path)
+  end
+
+  def test_stats
+    xml = setup_hash.to_plist
+    OSX::PropertyList.reset_stats
+    assert_equal(setup_hash, OSX::PropertyList.load(xml))
+    binary = setup_hash.to_plist(:binary1)
+    OSX::PropertyList.to_json(binary)
+    stats = OSX::PropertyList.stats
+    assert_equal([1, 0, xml.bytesize, 0], stats[:xml1].values_at(:loads, :dumps, :bytes_in, :bytes_out))
+    assert_equal([1, 1, binary.bytesize, binary.bytesize], stats[:binary1].values_at(:loads, :dumps, :bytes_in, :bytes_out))
+    assert_equal(1, stats[:json][:dumps])
+    assert_operator(stats[:xml1][:parse_time], :>, 0)
+    assert_operator(stats[:binary1][:write_time], :>, 0)
+    assert_equal({ :dict => 2, :array => 1, :key => 7, :string => 1, :data => 1, :integer => 3, :real => 1,
+                   :boolean => 1, :date => 1 }, stats[:objects])
+    OSX::PropertyList.reset_stats
+    assert_equal(0, OSX::PropertyList.stats[:xml1][:loads])
+    log = File.join(Dir.tmpdir, "plist-trace-#{$$}.log")
+    system({ "TM_PLIST_TRACE" => "0:#{log}" }, RbConfig.ruby, "-e", "require './plist'; OSX::PropertyList.load('{a = b;}')")
+    assert_match(/\Aplist\[\d+\] load openstep [\d.]+ ms \(parse [\d.]+, convert 0\.0, write 0\.0\) 8 bytes in, 0 out from -e:1\n\z/,
+                 File.read(log))
+  ensure
+    File.delete(log) if log && File.exist?(log)
+  end
+
+  def test_stats_threads
+    log = File.join(Dir.tmpdir, "plist-trace-threads-#{$$}.log")
+    # each read blocks, so the other thread's load starts in the middle of this one's
+    script = <<-'RUBY'
+      require './plist'
+      Slow = Struct.new(:text) { def read; sleep 0.1; text; end }
+      [Slow.new('{a = b;}'), Slow.new('{long = "' + 'x' * 100 + '";}')].map do |io|
+        Thread.new { 3.times { OSX::PropertyList.load(io) } }
+      end.each(&:join)
+    RUBY
+    system({ "TM_PLIST_TRACE" => "0:#{log}" }, RbConfig.ruby, "-e", script)
+    sizes = File.readlines(log).map { |line| line[/ (\d+) bytes in, 0 out /, 1].to_i }
+    assert_equal([8, 8, 8, 112, 112, 112], sizes.sort)
+  ensure
+    File.delete(log) if log && File.exist?(log)
+  end
+
+  def test_json
+    hash = setup_hash()
+    json = OSX::PropertyList.to_json(hash.to_plist)
+    assert_equal(json, OSX::PropertyList.to_json(hash.to_plist(:binary1)))
+    assert_equal('{"string!":"indeedy","bar":[1,2,3],"foo":{"correct?":true,"pi":3.14159265,' \
+      '"random":{"$data":"I0VniQ=="},"today":{"$date":"2005-04-28T06:32:56Z"}}}', json)
+    assert_equal(hash, OSX::PropertyList.load(OSX::PropertyList.from_json(json)))
+    assert_equal([hash, :binary1], OSX::PropertyList.load(OSX::PropertyList.from_json(json, :binary1), true))
+    assert_equal('["a\"\\\\\n\u0001é",2.0,-1]', OSX::PropertyList.to_json(["a\"\\\n\u0001é", 2.0, -1].to_plist))
+    assert_equal(["\u{1F600}/", { "$data" => "x", "n" => 1 }, 1.0e20],
+      OSX::PropertyList.load(OSX::PropertyList.from_json(" [\"\\ud83d\\ude00\\/\", {\"$data\": \"x\", \"n\": 1}, 1e20] ")))
+    io = StringIO.new
+    assert_equal(json.bytesize, OSX::PropertyList.to_json(StringIO.new(hash.to_plist), io))
+    assert_equal(json.b, io.string.b)
+    io = StringIO.new
+    xml = OSX::PropertyList.from_json(json)
+    assert_equal(xml.bytesize, OSX::PropertyList.from_json(StringIO.new(json), io, :xml1))
+    assert_equal(xml.b, io.string.b)
+    # more than one chunk, to an IO that keeps every piece
+    long = { "long" => "x" * 100_000 }.to_plist
+    pieces = []
+    io = Object.new
+    io.instance_eval { @pieces = pieces }
+    def io.write(data) @pieces << data; data.size end
+    OSX::PropertyList.to_json(StringIO.new(long), io)
+    assert_operator(pieces.size, :>, 1)
+    assert_equal(OSX::PropertyList.to_json(long).b, pieces.join.b)
+    ['{"a": null}', '[1, 2,]', '{"a" 1}', '[1] 2', '99999999999999999999', '{"$data": "@@"}', "\"\t\""].each do |bad|
+      assert_raise(OSX::PropertyListError) { OSX::PropertyList.from_json(bad) }
+    end
+    assert_raise(ArgumentError) { OSX::PropertyList.to_json([0.0 / 0].to_plist) }
+    assert_raise(ArgumentError) { OSX::PropertyList.from_json("[]", :openstep) }
+  end
+
+  def test_canonical
+    hash = setup_hash()
+    reordered = Hash[hash.to_a.reverse]
+    reordered["foo"] = Hash[hash["foo"].to_a.reverse]
+    [:xml1, :binary1].each do |format|
+      canonical = hash.to_plist(format, :canonical => true)
+      assert_equal(canonical, reordered.to_plist(format, :canonical => true))
+      assert_not_equal(canonical, reordered.to_plist(format))
+      assert_equal(hash, OSX::PropertyList.load(canonical))
+      io = StringIO.new
+      assert_equal(canonical.bytesize, OSX::PropertyList.dump(io, reordered, format, :canonical => true))
+      assert_equal(canonical.b, io.string.b)
+    end
+    xml = { "b" => 1, :a => 2, "B" => 3 }.to_plist(:canonical => true)
+    assert_equal(%w{B a b}, xml.scan(/<key>(.*)<\/key>/).flatten)
+  end
+
+  def test_digest
+    hash = setup_hash()
+    digest = OSX::PropertyList.digest(hash)
+    assert_match(/\A[0-9a-f]{32}\z/, digest)
+    assert_equal(digest, OSX::PropertyList.digest(Hash[hash.to_a.reverse]))
+    assert_equal(digest, OSX::PropertyList.digest(OSX::PropertyList.load(hash.to_plist(:binary1))))
+    assert_not_equal(digest, OSX::PropertyList.digest(hash.merge("bar" => [1, 2])))
+    blob = "abc".dup
+    blob.blob = true
+    assert_not_equal(OSX::PropertyList.digest("abc"), OSX::PropertyList.digest(blob))
+    assert_not_equal(OSX::PropertyList.digest(1), OSX::PropertyList.digest(1.0))
+    assert_not_equal(OSX::PropertyList.digest([["a"], "b"]), OSX::PropertyList.digest([["a", "b"]]))
+    assert_not_equal(OSX::PropertyList.digest({ "ab" => "c" }), OSX::PropertyList.digest({ "a" => "bc" }))
+    assert_equal(OSX::PropertyList.digest(0.0), OSX::PropertyList.digest(-0.0))
+    assert_raise(ArgumentError) { OSX::PropertyList.digest([nil]) }
+  end
+
+  def apply_patch(obj, ops)
+    obj = Marshal.load(Marshal.dump(obj))
+    ops.each do |op, path, value|
+      return value if path.empty?
+      parent = path[0..-2].inject(obj) { |o, k| o[k] }
+      if op == :set
+        parent[path.last] = value
+      elsif parent.is_a?(Array)
+        parent.delete_at(path.last)
+      else
+        parent.delete(path.last)
+      end
+    end
+    obj
+  end
+
+  def test_diff
+    hash = setup_hash()
+    assert_equal([], OSX::PropertyList.diff(hash.to_plist, Hash[hash.to_a.reverse]))
+    changed = Marshal.load(Marshal.dump(hash))
+    changed["foo"]["pi"] = 3.0
+    changed["foo"].delete("correct?")
+    changed["bar"] = [1, 5]
+    changed["new"] = { "a" => [] }
+    ops = OSX::PropertyList.diff(hash.to_plist(:binary1), StringIO.new(changed.to_plist))
+    assert_equal([[:set, ["bar", 1], 5], [:delete, ["bar", 2]], [:delete, ["foo", "correct?"]],
+                  [:set, ["foo", "pi"], 3.0], [:set, ["new"], { "a" => [] }]],
+                 ops.sort_by { |op| op[1].map(&:to_s) })
+    assert_equal(changed, apply_patch(hash, ops))
+    assert_equal([[:set, [], [1]]], OSX::PropertyList.diff(hash, [1]))
+    assert_equal([[:set, [1], "x"], [:set, [2], "y"]], OSX::PropertyList.diff(%w{a}, %w{a x y}))
+    assert_equal([[:delete, [2]], [:delete, [1]]], OSX::PropertyList.diff(%w{a x y}, %w{a}))
+    blob = "abc".dup
+    blob.blob = true
+    assert_equal([[:set, [0], blob]], OSX::PropertyList.diff(["abc"], [blob]))
+    assert_raise(OSX::PropertyListError) { OSX::PropertyList.diff("<plist><dict>", hash) }
+  end
+
+  def test_merge
+    base = { "name" => "Ruby", "patterns" => [{ "include" => "#a" }], "repository" => { "a" => { "match" => "a" }, "b" => { "match" => "b" } } }
+    overlay = { "patterns" => [{ "include" => "#c" }], "repository" => { "a" => { "name" => "x" }, "c" => { "match" => "c" } } }
+    deep = OSX::PropertyList.merge(base.to_plist, overlay)
+    assert_equal({ "name" => "Ruby", "patterns" => [{ "include" => "#c" }],
+                   "repository" => { "a" => { "match" => "a", "name" => "x" }, "b" => { "match" => "b" }, "c" => { "match" => "c" } } },
+                 OSX::PropertyList.load(deep))
+    assert_equal(%w{name patterns repository}, OSX::PropertyList.load(deep).keys)
+    assert_equal([base.merge(overlay), :binary1],
+                 OSX::PropertyList.load(OSX::PropertyList.merge(base.to_plist(:binary1), overlay.to_plist, :strategy => :shallow), true))
+    appended = OSX::PropertyList.merge(base, overlay, :strategy => :append, :format => :lazy)
+    assert_kind_of(OSX::PropertyList::LazyHash, appended)
+    assert_equal([{ "include" => "#a" }, { "include" => "#c" }], appended["patterns"].to_a)
+    assert_operator(appended.materialized, :<, appended.nodes)
+    assert_equal([1], OSX::PropertyList.load(OSX::PropertyList.merge(base, [1], :format => :binary1)))
+    assert_equal(base, OSX::PropertyList.load(OSX::PropertyList.merge(base, {})))
+    assert_raise(ArgumentError) { OSX::PropertyList.merge(base, overlay, :strategy => :wrong) }
+    assert_raise(ArgumentError) { OSX::PropertyList.merge(base, overlay, :format => :openstep) }
+  end
+
   def test_to_plist
     assert_raise(OSX::PropertyListError) { "foo".to_plist(:openstep) }
     assert_equal("foo", OSX::PropertyList.load("foo".to_plist))
     hash = setup_hash()
     assert_equal(hash, OSX::PropertyList.load(hash.to_plist))
+    latin = "caf\xE9".dup.force_encoding("ISO-8859-1")
+    [:xml1, :binary1].each do |format|
+      assert_equal({ "café" => "café" }, OSX::PropertyList.load({ latin => latin }.to_plist(format)))
+      assert_raise(Encoding::InvalidByteSequenceError) { ["\xA4".dup.force_encoding("EUC-JP")].to_plist(format) }
+    end
+    assert_equal(OSX::PropertyList.digest(["café"]), OSX::PropertyList.digest([latin]))
+  end
+
+  def test_binary_dump
+    hash = setup_hash()
+    data = hash.to_plist(:binary1)
+    assert_equal([hash, :binary1], OSX::PropertyList.load(data, true))
+    io = StringIO.new
+    assert_equal(data.size, OSX::PropertyList.dump(io, hash, :binary1))
+    assert_equal(data, io.string.force_encoding(data.encoding))
+    # identical values share one object table entry
+    long = "x" * 100
+    assert(["#{long}a", "#{long}b"].to_plist(:binary1).size > [long, long.dup].to_plist(:binary1).size + 90)
+    shared = OSX::PropertyList.load([long, long.dup].to_plist(:binary1))
+    assert_same(shared[0], shared[1])
+  end
+
+  # A bplist00 holding +objects+, each already encoded, the first on top
+  def bplist(*objects)
+    data = "bplist00".b
+    offsets = objects.map { |object| data.size.tap { data << object.b } }
+    table = data.size
+    data << offsets.pack("C*") << [0, 0, 0, 0, 0, 0, 1, 1].pack("C*") << [objects.size, 0, table].pack("Q>3")
+  end
+
+  def test_binary_unsigned_and_null
+    top = 2**64 - 1
+    data = bplist("\xA1\x01", "\x14" + "\0" * 8 + "\xFF" * 8)
+    assert_equal([top], OSX::PropertyList.load(data))
+    assert_equal([top], OSX::PropertyList.load_lazy(data).to_a)
+    assert_equal([top], OSX::PropertyList.extract(data, [0]))
+    assert_equal("[#{top}]", OSX::PropertyList.to_json(data))
+    assert_equal([top], OSX::PropertyList.load(OSX::PropertyList.from_json("[#{top}]")))
+    assert_equal(data, [top].to_plist(:binary1))
+    assert_equal([top, -1], OSX::PropertyList.load([top, -1].to_plist))
+    assert_not_equal(OSX::PropertyList.digest([top]), OSX::PropertyList.digest([-1]))
+    path = File.join(Dir.tmpdir, "plist-unsigned-#{$$}.plist")
+    File.open(path, "wb") { |f| f.write(data) }
+    assert_equal([[top]], OSX::PropertyList.load_many([path]))
+    null = bplist("\xA1\x01", "\x00")
+    [:load, :load_lazy, :to_json].each do |method|
+      assert_raise(OSX::PropertyListError) { OSX::PropertyList.send(method, null) }
+    end
+  ensure
+    File.delete(path) if path && File.exist?(path)
   end
 end
 
@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+
+# Has the stub dialog answer with 50 MB (or $1 MB) and reads it back in 4 KB
+# and 1 byte reads, to see what the input buffer costs per call for a large
+# paste. Linux only; run ../build.sh first.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+LIB="$SCRIPT_DIR/../build/tm_interactive_input.so"
+READER="$SCRIPT_DIR/../build/answer_reader"
+MEGABYTES="${1:-50}"
+
+if [ ! -f "$LIB" ]; then echo "$LIB doesn't exist, build it first"; exit 1; fi
+${CC:-gcc} -O2 -o "$READER" "$SCRIPT_DIR/answer_reader.c" || exit 1
+
+# stdin is a pipe nobody writes to, as for a command run from TextMate
+exec < <(sleep 100000)
+ANSWER="$(mktemp)"
+trap 'rm -f "$ANSWER"; kill $!' EXIT
+head -c "${MEGABYTES}M" /dev/zero | tr '\0' 'a' > "$ANSWER"
+unset TM_PID
+export DIALOG="$SCRIPT_DIR/../test/dialog-stub.sh"
+. "$SCRIPT_DIR/../test/setup.sh"
+
+echo "$MEGABYTES MB answer:"
+for CHUNK in 4096 1; do
+  printf '  '
+  TM_DIALOG_STUB_ANSWER_FILE="$ANSWER" TM_INTERACTIVE_INPUT=AUTO "$READER" $(( MEGABYTES * 1024 * 1024 + 1 )) "$CHUNK"
+done
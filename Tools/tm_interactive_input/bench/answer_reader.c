@@ -0,0 +1,41 @@
+/*
+    Reads the given number of bytes from stdin in reads of the given size,
+    the way a program reading a large pasted answer would, and reports on
+    stderr how long that took and the cost per call. The time includes
+    bringing up the dialog and parsing its output.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s bytes chunk\n", argv[0]);
+        return 1;
+    }
+    unsigned long long expected = strtoull(argv[1], NULL, 10);
+    size_t chunk = strtoul(argv[2], NULL, 10);
+    char* buffer = malloc(chunk);
+    if (buffer == NULL) return 1;
+
+    unsigned long long calls = 0, bytes = 0;
+    double start = now();
+    while (bytes < expected) {
+        ssize_t len = read(STDIN_FILENO, buffer, chunk);
+        if (len <= 0) break;
+        bytes += len;
+        ++calls;
+    }
+    double elapsed = now() - start;
+
+    fprintf(stderr, "%6zu byte reads: %.3f s, %llu calls, %.1f ns per call, %.1f MB/s\n", chunk, elapsed, calls, elapsed * 1e9 / calls, bytes / elapsed / 1e6);
+    return bytes == expected ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+/*
+    Writes output the way a chatty program does, to stdout, and reports on
+    stderr how long it took and the cost per call: many short lines, one
+    write() or fwrite() each, and the same lines in 1 MB writes. Every
+    write to stdout is looked at for a prompt while tm_interactive_input
+    is active.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(char const* what, double elapsed, unsigned long calls, unsigned long long bytes) {
+    fprintf(stderr, "%-28s %.3f s, %8.1f ns per call, %7.1f MB/s\n", what, elapsed, elapsed * 1e9 / calls, bytes / elapsed / 1e6);
+}
+
+int main(int argc, char** argv) {
+    unsigned long lines = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+    char const line[] = "compiling src/some/rather/long/path/to/a/file.c ... ok (0.012 s, 2 warnings) ....\n";
+    size_t line_length = strlen(line);
+
+    unsigned long i;
+    double start = now();
+    for (i = 0; i < lines; ++i) {
+        if (write(STDOUT_FILENO, line, line_length) < 0) return 1;
+    }
+    report("line per write()", now() - start, lines, (unsigned long long)lines * line_length);
+
+    start = now();
+    for (i = 0; i < lines; ++i) {
+        fwrite(line, 1, line_length, stdout);
+        fflush(stdout);
+    }
+    report("line per fwrite+fflush", now() - start, lines, (unsigned long long)lines * line_length);
+
+    size_t chunk_lines = (1 << 20) / line_length;
+    char* chunk = malloc(chunk_lines * line_length);
+    if (chunk == NULL) return 1;
+    for (i = 0; i < chunk_lines; ++i) memcpy(chunk + i * line_length, line, line_length);
+
+    unsigned long chunks = lines / chunk_lines + 1;
+    start = now();
+    for (i = 0; i < chunks; ++i) {
+        if (write(STDOUT_FILENO, chunk, chunk_lines * line_length) < 0) return 1;
+    }
+    report("1 MB per write()", now() - start, chunks, (unsigned long long)chunks * chunk_lines * line_length);
+
+    // The worst case for a backwards scan: no newline to stop at
+    memset(chunk, ' ', chunk_lines * line_length);
+    start = now();
+    for (i = 0; i < chunks; ++i) {
+        if (write(STDOUT_FILENO, chunk, chunk_lines * line_length) < 0) return 1;
+    }
+    report("1 MB of spaces per write()", now() - start, chunks, (unsigned long long)chunks * chunk_lines * line_length);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+
+# Has a program as small as it gets, and one that has touched 1 GB (or $2
+# MB), make 200 (or $1) reads that each bring up a dialog, to see how long
+# a read() takes to start one and get its answer. A compiled stub answers,
+# so the dialog itself costs next to nothing. Then the small one asks the
+# stand-in input broker instead, once for every answer and once with all
+# of them to hand. Linux only; run ../build.sh first.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+LIB="$SCRIPT_DIR/../build/tm_interactive_input.so"
+READER="$SCRIPT_DIR/../build/dialog_reader"
+STUB="$SCRIPT_DIR/../build/instant_dialog"
+READS="${1:-200}"
+MEGABYTES="${2:-1024}"
+
+if [ ! -f "$LIB" ]; then echo "$LIB doesn't exist, build it first"; exit 1; fi
+${CC:-gcc} -O2 -o "$READER" "$SCRIPT_DIR/dialog_reader.c" || exit 1
+${CC:-gcc} -O2 -o "$STUB" "$SCRIPT_DIR/instant_dialog.c" || exit 1
+
+# stdin is a pipe nobody writes to, as for a command run from TextMate
+exec < <(sleep 100000)
+writer=$!
+BROKER_DIR="$(mktemp -d)"
+trap 'kill $writer; rm -rf "$BROKER_DIR"' EXIT
+unset TM_PID
+export DIALOG="$STUB"
+. "$SCRIPT_DIR/../test/setup.sh"
+
+for SIZE in 0 "$MEGABYTES"; do
+  printf '  '
+  TM_INTERACTIVE_INPUT=AUTO "$READER" "$READS" "$SIZE"
+done
+
+seq "$READS" > "$BROKER_DIR/answers"
+for ANSWERS in "" "$BROKER_DIR/answers"; do
+  ruby "$SCRIPT_DIR/../test/broker-stub.rb" "$BROKER_DIR/socket" $ANSWERS & broker=$!
+  while [ ! -S "$BROKER_DIR/socket" ]; do sleep 0.05; done
+  printf '  broker%s, ' "${ANSWERS:+ with answers to hand}"
+  TM_INTERACTIVE_INPUT_BROKER="$BROKER_DIR/socket" TM_INTERACTIVE_INPUT=AUTO "$READER" "$READS" 0
+  kill $broker; wait $broker 2>/dev/null
+done
@@ -0,0 +1,48 @@
+/*
+    Touches the given number of megabytes of heap, so it's as big as a
+    loaded interpreter, then makes the given number of reads from stdin,
+    each of which brings up a dialog. Reports on stderr how long a read()
+    took from the call to the answer: mostly starting the dialog.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s reads megabytes\n", argv[0]);
+        return 1;
+    }
+    unsigned long reads = strtoul(argv[1], NULL, 10);
+    size_t megabytes = strtoul(argv[2], NULL, 10);
+
+    char* heap = malloc(megabytes * 1024 * 1024 + 1);
+    if (heap == NULL) return 1;
+    memset(heap, 1, megabytes * 1024 * 1024);
+
+    char buffer[4096];
+    double total = 0, fastest = 1e9, slowest = 0;
+    unsigned long i;
+    for (i = 0; i < reads; ++i) {
+        double start = now();
+        ssize_t len = read(STDIN_FILENO, buffer, sizeof(buffer));
+        double elapsed = now() - start;
+        if (len <= 0) break;
+
+        total += elapsed;
+        if (elapsed < fastest) fastest = elapsed;
+        if (elapsed > slowest) slowest = elapsed;
+    }
+
+    fprintf(stderr, "%5zu MB: %lu reads, %.0f µs mean, %.0f µs min, %.0f µs max\n", megabytes, i, total * 1e6 / i, fastest * 1e6, slowest * 1e6);
+    return i == reads && heap[0] == 1 ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+#!/usr/bin/env bash
+
+# Pipes 1 GB (or $1 MB) through a cat-like reader, once without the library
+# and then preloaded with TM_INTERACTIVE_INPUT unset, NEVER and AUTO, for
+# 4 KB and 64 KB reads. In none of these is stdin TextMate's, so the
+# difference is what the interposed read() and write() cost a process
+# that never gets a dialog. Linux only; run ../build.sh first.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+LIB="$SCRIPT_DIR/../build/tm_interactive_input.so"
+READER="$SCRIPT_DIR/../build/pipe_reader"
+MEGABYTES="${1:-1024}"
+
+if [ ! -f "$LIB" ]; then echo "$LIB doesn't exist, build it first"; exit 1; fi
+${CC:-gcc} -O2 -o "$READER" "$SCRIPT_DIR/pipe_reader.c" || exit 1
+
+# Best of three, as the pipe itself makes single runs noisy
+function run {
+  printf '%-34s' "$1"
+  shift
+  for i in 1 2 3; do
+    head -c "${MEGABYTES}M" /dev/zero | env -u TM_PID "$@" "$READER" "$CHUNK" 2>&1 >/dev/null
+  done | sort -k4,4n | head -1
+}
+
+for CHUNK in 4096 65536; do
+  echo "$MEGABYTES MB in $CHUNK byte reads:"
+  run "  not preloaded" env -u LD_PRELOAD
+  run "  preloaded, variable unset" env -u TM_INTERACTIVE_INPUT LD_PRELOAD="$LIB"
+  run "  preloaded, NEVER" env LD_PRELOAD="$LIB" TM_INTERACTIVE_INPUT=NEVER
+  run "  preloaded, AUTO" env LD_PRELOAD="$LIB" TM_INTERACTIVE_INPUT=AUTO
+done
@@ -0,0 +1,42 @@
+/*
+    A minimal cat: copies stdin to stdout in reads of the given size and
+    reports on stderr how long the loop took and the cost per call, so
+    runs with and without tm_interactive_input preloaded can be compared.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    size_t chunk = (argc > 1) ? strtoul(argv[1], NULL, 10) : 4096;
+    char* buffer = malloc(chunk);
+    if (buffer == NULL) return 1;
+
+    unsigned long long calls = 0, bytes = 0;
+    double start = now();
+    ssize_t len;
+    while ((len = read(STDIN_FILENO, buffer, chunk)) > 0) {
+        ssize_t written = 0;
+        while (written < len) {
+            ssize_t res = write(STDOUT_FILENO, buffer + written, len - written);
+            if (res < 0) return 1;
+            written += res;
+            ++calls;
+        }
+        bytes += len;
+        ++calls;
+    }
+    double elapsed = now() - start;
+
+    fprintf(stderr, "%llu MB in %.3f s, %.0f MB/s, %llu calls, %.1f ns per call\n",
+        bytes >> 20, elapsed, bytes / elapsed / 1048576, calls + 1, elapsed * 1e9 / (calls + 1));
+    return 0;
+}
@@ -0,0 +1,18 @@
+#!/usr/bin/env bash
+
+# Runs chatty_writer with 1 million lines (or $1) into /dev/null, not
+# preloaded and preloaded in AUTO mode, to see what looking for prompts
+# costs a program that writes a lot. Linux only; run ../build.sh first.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+LIB="$SCRIPT_DIR/../build/tm_interactive_input.so"
+WRITER="$SCRIPT_DIR/../build/chatty_writer"
+LINES="${1:-1000000}"
+
+if [ ! -f "$LIB" ]; then echo "$LIB doesn't exist, build it first"; exit 1; fi
+${CC:-gcc} -O2 -o "$WRITER" "$SCRIPT_DIR/chatty_writer.c" || exit 1
+
+echo "not preloaded:"
+env -u LD_PRELOAD -u TM_PID "$WRITER" "$LINES" >/dev/null
+echo "preloaded, AUTO:"
+env -u TM_PID LD_PRELOAD="$LIB" TM_INTERACTIVE_INPUT=AUTO "$WRITER" "$LINES" >/dev/null
@@ -0,0 +1,52 @@
+/*
+    Starts the given number of threads, each making 1 byte reads from its
+    own descriptor for /dev/zero, and reports on stderr the cost per call.
+    Every read asks the stdin tracker about its descriptor, so this shows
+    whether threads that never touch stdin wait on each other there.
+*/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static unsigned long calls_per_thread = 2000000;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* reader(void* arg) {
+    int fd = open("/dev/zero", O_RDONLY);
+    if (fd < 0) exit(1);
+
+    char byte;
+    unsigned long i;
+    for (i = 0; i < calls_per_thread; ++i) {
+        if (read(fd, &byte, 1) != 1) exit(1);
+    }
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    int threads = (argc > 1) ? atoi(argv[1]) : 1;
+    if (argc > 2) calls_per_thread = strtoul(argv[2], NULL, 10);
+
+    pthread_t* ids = calloc(threads, sizeof(pthread_t));
+    if (ids == NULL) return 1;
+
+    double start = now();
+    int i;
+    for (i = 0; i < threads; ++i) pthread_create(&ids[i], NULL, reader, NULL);
+    for (i = 0; i < threads; ++i) pthread_join(ids[i], NULL);
+    double elapsed = now() - start;
+
+    unsigned long long calls = (unsigned long long)threads * calls_per_thread;
+    fprintf(stderr, "%d threads: %.3f s, %.1f ns per read, %.1f M reads/s\n", threads, elapsed, elapsed * 1e9 / calls, calls / elapsed / 1e6);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+
+# Runs threaded_reader with 1, 2, 4 and 8 threads, not preloaded and
+# preloaded in AUTO mode, to see what the stdin tracker adds to a read()
+# and whether it grows with the number of threads. Linux only; run
+# ../build.sh first.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+LIB="$SCRIPT_DIR/../build/tm_interactive_input.so"
+READER="$SCRIPT_DIR/../build/threaded_reader"
+CALLS="${1:-2000000}"
+
+if [ ! -f "$LIB" ]; then echo "$LIB doesn't exist, build it first"; exit 1; fi
+${CC:-gcc} -O2 -pthread -o "$READER" "$SCRIPT_DIR/threaded_reader.c" || exit 1
+
+# Best of three
+function run {
+  for i in 1 2 3; do
+    env -u TM_PID "$@" "$READER" "$THREADS" "$CALLS" 2>&1
+  done | sort -k5,5n | head -1
+}
+
+for THREADS in 1 2 4 8; do
+  printf '  not preloaded,   '; run env -u LD_PRELOAD
+  printf '  preloaded, AUTO, '; run env LD_PRELOAD="$LIB" TM_INTERACTIVE_INPUT=AUTO
+done
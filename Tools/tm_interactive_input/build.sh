@@ -1,12 +1,25 @@
 #!/usr/bin/env bash
 
-NDEBUG=1
+# NDEBUG= ./build.sh makes a debug build, which traces every call
+NDEBUG=${NDEBUG-1}
 
 SCRIPT_DIR="$(dirname "$0")"
 SRC_DIR="$SCRIPT_DIR/src"
 DST_DIR="$SCRIPT_DIR/build"
 LIB_NAME="tm_interactive_input.dylib"
 
+# On Linux the library is loaded with LD_PRELOAD instead of DYLD_INSERT_LIBRARIES
+function build_linux {
+  echo "Building ‘tm_interactive_input.so’ (for $(uname -m)${NDEBUG:+, no debug})…"
+  ${CC:-gcc} -shared -fPIC -Wall -O2 -fvisibility=hidden \
+    -D_GNU_SOURCE \
+    -DDATE=\"$(date +%Y-%m-%d)\" \
+    ${NDEBUG:+-DNDEBUG=1} \
+    -o "$DST_DIR/tm_interactive_input.so" \
+    "$SRC_DIR"/*.c -ldl -lpthread -lm
+    [ $? = 0 ] || exit 1
+}
+
 function build {
   DEPLOYMENT=10.4
   SDK=/Developer/SDKs/MacOSX10.4u.sdk
@@ -35,6 +48,11 @@ fi
 
 if ! mkdir "$DST_DIR"; then exit; fi
 
+if [[ "$(uname)" = Linux ]]; then
+  build_linux
+  exit
+fi
+
 for ARCH in ppc i386 ppc64 x86_64; do build "$ARCH"; done
 
 echo "Merging…"
@@ -0,0 +1,168 @@
+#include "broker.h"
+#include "system_function_overrides.h"
+#include "die.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SO_NOSIGPIPE is set on the socket instead
+#endif
+
+// Longest header line we accept from the broker
+#define BROKER_LINE_LIMIT 64
+
+/*
+    Dialogs are only asked for with the input mutex locked, so every thread
+    uses the one connection, a request at a time. What the broker sent that
+    we haven't used yet stays in +from_broker+: that's where the answers of
+    a batch wait for their dialogs.
+*/
+static int broker_fd = -1;
+static buffer_t* from_broker = NULL;
+static unsigned long answers_pending = 0;
+
+static pthread_once_t broker_once = PTHREAD_ONCE_INIT;
+
+static void disconnect_from_broker() {
+    if (broker_fd != -1) system_close(broker_fd);
+    broker_fd = -1;
+    if (from_broker != NULL) destroy_buffer(from_broker);
+    from_broker = NULL;
+    answers_pending = 0;
+}
+
+// A forked child must have a connection, and answers, of its own
+static void register_fork_handler() {
+    pthread_atfork(NULL, NULL, disconnect_from_broker);
+}
+
+static bool connect_to_broker() {
+    char const* path = getenv("TM_INTERACTIVE_INPUT_BROKER");
+    if (path == NULL || *path == '\0') return false;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        D("broker socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        D("can't connect to broker at %s: %s\n", path, strerror(errno));
+        system_close(fd);
+        return false;
+    }
+
+    pthread_once(&broker_once, register_fork_handler);
+    broker_fd = fd;
+    from_broker = create_buffer();
+    D("connected to broker at %s as fd %d\n", path, fd);
+    return true;
+}
+
+static bool send_to_broker(char const* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(broker_fd, bytes, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            D("sending to broker failed: %s\n", strerror(errno));
+            return false;
+        }
+        bytes += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// Reads until +from_broker+ holds at least +length+ bytes
+static bool receive_from_broker(size_t length) {
+    while (get_buffer_size(from_broker) < length) {
+        ssize_t received = add_to_buffer_from_fd(from_broker, broker_fd, 4096);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) {
+            D("broker closed the connection or failed: %s\n", received == 0 ? "EOF" : strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Takes the next line the broker sent, without its newline
+static bool receive_line_from_broker(char line[BROKER_LINE_LIMIT]) {
+    char const* newline;
+    while ((newline = memchr(get_buffer_data(from_broker), '\n', get_buffer_size(from_broker))) == NULL) {
+        if (get_buffer_size(from_broker) >= BROKER_LINE_LIMIT || !receive_from_broker(get_buffer_size(from_broker) + 1))
+            return false;
+    }
+
+    size_t length = newline - get_buffer_data(from_broker);
+    if (length >= BROKER_LINE_LIMIT) return false;
+    consume_from_head_of_buffer(from_broker, line, length + 1);
+    line[length] = '\0';
+    return true;
+}
+
+static buffer_t* receive_answer_from_broker() {
+    char line[BROKER_LINE_LIMIT];
+    char* end;
+
+    if (answers_pending == 0) {
+        if (!receive_line_from_broker(line) || strncmp(line, "answers ", strlen("answers ")) != 0)
+            return NULL;
+        answers_pending = strtoul(line + strlen("answers "), &end, 10);
+        if (*end != '\0' || answers_pending == 0) return NULL;
+        D("broker sent %lu answers\n", answers_pending);
+    }
+
+    if (!receive_line_from_broker(line)) return NULL;
+    size_t length = strtoul(line, &end, 10);
+    if (*end != '\0' || end == line || !receive_from_broker(length)) return NULL;
+
+    char* output = malloc(length + 1);
+    if (output == NULL) die("failed to allocate broker answer");
+    consume_from_head_of_buffer(from_broker, output, length);
+    --answers_pending;
+    return create_buffer_with(output, length);
+}
+
+buffer_t* create_output_from_broker(buffer_t* parameters, char const* nib) {
+    if (broker_fd == -1 && !connect_to_broker()) return NULL;
+
+    if (answers_pending == 0) {
+        char header[BROKER_LINE_LIMIT + 32];
+        int header_length = snprintf(header, sizeof(header), "request %d %s %zu\n", (int)getpid(), nib, get_buffer_size(parameters));
+        if (!send_to_broker(header, header_length) || !send_to_broker(get_buffer_data(parameters), get_buffer_size(parameters))) {
+            disconnect_from_broker();
+            return NULL;
+        }
+    } else {
+        D("using one of %lu answers the broker sent before\n", answers_pending);
+    }
+
+    buffer_t* output = receive_answer_from_broker();
+    if (output == NULL) {
+        D("broker didn't answer, falling back to tm_dialog\n");
+        disconnect_from_broker();
+    }
+    return output;
+}
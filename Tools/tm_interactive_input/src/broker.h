@@ -0,0 +1,29 @@
+#ifndef _BROKER_H_
+#define _BROKER_H_
+
+#include "buffer.h"
+
+/*
+    When TM_INTERACTIVE_INPUT_BROKER names a Unix socket, dialogs are asked
+    of the input broker listening there instead of a new tm_dialog each.
+    A process connects once and sends, for each dialog,
+
+        request <pid> <nib> <length>\n<length bytes of parameters plist>
+
+    where the plist is what tm_dialog would have read. The broker replies
+
+        answers <count>\n
+
+    followed by <count> (at least one) answers, each
+
+        <length>\n<length bytes of tm_dialog output plist>
+
+    The first answers this request; the rest are kept, in order, for the
+    dialogs that follow, so a broker with answers to hand can send them
+    all at once.
+*/
+
+// tm_dialog's output as the broker gave it, or NULL without a broker
+buffer_t* create_output_from_broker(buffer_t* parameters, char const* nib);
+
+#endif /* _BROKER_H_ */
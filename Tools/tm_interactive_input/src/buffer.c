@@ -5,9 +5,10 @@
 #include "system_function_overrides.h"
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
+#include <stdbool.h>
 
 #ifndef ALLOC_SIZE
 #define ALLOC_SIZE 128
@@ -21,6 +22,7 @@ buffer_t* create_buffer() {
     buffer_t* res = malloc(sizeof(buffer_t));
     if (res == NULL)  die("create_buffer() malloc failed");
     res->data = NULL;
+    res->head = 0;
     res->size = 0;
     res->capacity = 0;
     return res;
@@ -32,23 +34,73 @@ size_t get_buffer_size(buffer_t *b) {
 size_t get_buffer_capacity(buffer_t *b) {
     return b->capacity;
 }
+
+// Moves the contents to a new allocation of +capacity+ bytes, unwrapped
+static void reallocate_buffer(buffer_t *b, size_t capacity) {
+    char* data = malloc(capacity);
+    if (data == NULL) die("reallocation of buffer failed");
+
+    size_t first = b->capacity - b->head;
+    if (first > b->size) first = b->size;
+    if (first > 0) memcpy(data, b->data + b->head, first);
+    if (b->size > first) memcpy(data + first, b->data, b->size - first);
+
+    free(b->data);
+    b->data = data;
+    b->head = 0;
+    b->capacity = capacity;
+}
+
+// Makes room for +len+ more bytes, at least doubling the capacity so
+// adding n bytes costs O(n) however they arrive
+static void reserve_in_buffer(buffer_t *b, size_t len) {
+    if (b->capacity - b->size >= len) return;
+
+    size_t capacity = b->capacity ? b->capacity * 2 : ALLOC_SIZE;
+    while (capacity < b->size + len) capacity *= 2;
+    D("Resizing buffer (need to add %d) from %d to %d\n", (int)len, (int)b->capacity, (int)capacity);
+    reallocate_buffer(b, capacity);
+}
+
+// The (up to two) stretches of +data+ holding the contents, or the free
+// space after them, in order
+static int buffer_segments(buffer_t *b, bool free_space, struct iovec segments[2]) {
+    size_t start = free_space ? b->head + b->size : b->head;
+    size_t len = free_space ? b->capacity - b->size : b->size;
+    if (b->capacity == 0 || len == 0) return 0;
+
+    start %= b->capacity;
+    size_t first = b->capacity - start;
+    if (first >= len) {
+        segments[0] = (struct iovec){ b->data + start, len };
+        return 1;
+    }
+    segments[0] = (struct iovec){ b->data + start, first };
+    segments[1] = (struct iovec){ b->data, len - first };
+    return 2;
+}
+
+// Contiguous contents; a wrapped buffer is straightened out first
 char* get_buffer_data(buffer_t *b) {
-    return b->data;
+    if (b->head + b->size > b->capacity) reallocate_buffer(b, b->capacity);
+    return b->data + b->head;
 }
 
 char get_buffer_byte_at(buffer_t *b, size_t at) {
     if (at >= b->size) die("buffer access out of range: %d for buffer of size %d", at, b->size);
-    return b->data[at];
+    return b->data[(b->head + at) % b->capacity];
 }
 
 buffer_t* create_buffer_with(char* bytes, size_t len) {
     buffer_t* b = create_buffer();
     b->data = bytes;
+    b->head = 0;
     b->size = len;
     b->capacity = len;
     return b;
 }
 
+#ifdef __APPLE__
 buffer_t* create_buffer_from_cfstr(CFStringRef cfstr) {
     buffer_t* b = create_buffer();
     CFIndex cfstr_length = CFStringGetLength(cfstr);
@@ -66,20 +118,30 @@ buffer_t* create_buffer_from_cfstr(CFStringRef cfstr) {
     b->capacity = storage_max_length;
     return b;
 }
+#endif
+
+// Reads at least +len+ bytes' worth straight into the free space, which may be in two pieces
+ssize_t add_to_buffer_from_fd(buffer_t* buffer, int fd, size_t len) {
+    reserve_in_buffer(buffer, len);
+
+    struct iovec segments[2];
+    int count = buffer_segments(buffer, true, segments);
+    ssize_t bytes_read = system_readv(fd, segments, count);
+    if (bytes_read > 0) buffer->size += bytes_read;
+    return bytes_read;
+}
 
 buffer_t * create_buffer_from_file_descriptor(int fd) {
 
-    char intermediary_buffer[READ_BLOCK_SIZE];
     buffer_t *buffer = create_buffer();
 
     ssize_t bytes_read;
     do {
-        bytes_read = system_read("read", fd, intermediary_buffer, sizeof(intermediary_buffer));
+        bytes_read = add_to_buffer_from_fd(buffer, fd, READ_BLOCK_SIZE);
         D("got %zd bytes from fd\n", bytes_read);
-        if (bytes_read > 0) {
-            add_to_buffer(buffer, intermediary_buffer, bytes_read);
-        } else if (bytes_read < 0) {
+        if (bytes_read < 0) {
             D("read error = '%s'\n", strerror(errno));
+            if (errno != EINTR) break;
         }
 
     } while(bytes_read != 0);
@@ -87,6 +149,7 @@ buffer_t * create_buffer_from_file_descriptor(int fd) {
     return buffer;
 }
 
+#ifdef __APPLE__
 buffer_t* create_buffer_from_dictionary_as_xml(CFDictionaryRef dictionary) {
 
     CFStringRef error;
@@ -114,42 +177,66 @@ buffer_t* create_buffer_from_dictionary_as_xml(CFDictionaryRef dictionary) {
 
     return buffer;
 }
+#endif
 
 char* create_cstr_from_buffer(buffer_t* buffer) {
     char *cstr = malloc(buffer->size + 1);
-    memcpy(cstr, buffer->data, buffer->size);
+    if (cstr == NULL) die("failed to allocate string for buffer");
+    memcpy(cstr, get_buffer_data(buffer), buffer->size);
     cstr[buffer->size] = '\0';
     return cstr;
 }
 
 void add_to_buffer(buffer_t* buffer, char* bytes, size_t len) {
-    if (buffer->capacity < buffer->size + len) {
-        
-        D("Resizing buffer (need to add %d) from %d\n", (int)len, (int)buffer->capacity); 
-        buffer->capacity = ceil((buffer->size + len) / ALLOC_SIZE + 1) * ALLOC_SIZE;
-        D("New target size = %d\n", (int)buffer->capacity);
-        buffer->data = realloc(buffer->data, buffer->capacity);
-        if (buffer->data == NULL) die("reallocation of buffer failed");
+    reserve_in_buffer(buffer, len);
+
+    struct iovec segments[2];
+    int i, count = buffer_segments(buffer, true, segments);
+    for (i = 0; i < count && len > 0; ++i) {
+        size_t n = (segments[i].iov_len < len) ? segments[i].iov_len : len;
+        memcpy(segments[i].iov_base, bytes, n);
+        bytes += n;
+        len -= n;
+        buffer->size += n;
     }
-    memcpy(buffer->data + buffer->size, bytes, len);
-    buffer->size += len;
 }
 
-size_t consume_from_head_of_buffer(buffer_t* buffer, char* dest, size_t dest_size) {
-    D("consuming %d from buffer of size %d\n", (int)dest_size, (int)buffer->size);
-    if (buffer->size == 0 || dest_size == 0) return 0;
-
-    size_t consumption_size = (buffer->size < dest_size) ? buffer->size : dest_size;
-    D("consumption_size = %d\n", (int)consumption_size);
-    
-    if (dest != NULL) {
-        strncpy(dest, buffer->data, consumption_size);
+// Copies out of the head and drops what was copied; NUL bytes are data like any other
+size_t consume_iovec_from_head_of_buffer(buffer_t* buffer, const struct iovec* iov, int iovcnt) {
+    struct iovec segments[2];
+    int count = buffer_segments(buffer, false, segments);
+    size_t consumed = 0;
+
+    int i, j = 0;
+    size_t into = 0;
+    for (i = 0; i < count; ++i) {
+        char* from = segments[i].iov_base;
+        size_t left = segments[i].iov_len;
+        while (left > 0 && j < iovcnt) {
+            size_t n = iov[j].iov_len - into;
+            if (n > left) n = left;
+            if (iov[j].iov_base != NULL) memcpy((char*)iov[j].iov_base + into, from, n);
+            from += n;
+            left -= n;
+            into += n;
+            consumed += n;
+            if (into == iov[j].iov_len) {
+                ++j;
+                into = 0;
+            }
+        }
     }
 
-    buffer->size -= consumption_size;
-    D("new_data_size = %d\n", (int)buffer->size);
-    memmove(buffer->data, buffer->data + consumption_size, buffer->size);
-    return consumption_size;
+    buffer->size -= consumed;
+    buffer->head = (buffer->size == 0) ? 0 : (buffer->head + consumed) % buffer->capacity;
+    D("consumed %d, new_data_size = %d\n", (int)consumed, (int)buffer->size);
+    return consumed;
+}
+
+size_t consume_from_head_of_buffer(buffer_t* buffer, char* dest, size_t dest_size) {
+    D("consuming %d from buffer of size %d\n", (int)dest_size, (int)buffer->size);
+    struct iovec iov = { dest, dest_size };
+    return consume_iovec_from_head_of_buffer(buffer, &iov, 1);
 }
 
 void destroy_buffer(buffer_t* buffer) {
@@ -158,5 +245,5 @@ void destroy_buffer(buffer_t* buffer) {
 }
 
 int write_buffer_to_fd(buffer_t* b, int fd) {
-    return write(fd, b->data, b->size);
+    return write(fd, get_buffer_data(b), b->size);
 }
\ No newline at end of file
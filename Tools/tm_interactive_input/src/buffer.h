@@ -2,10 +2,15 @@
 #define _BUFFER_H_
 
 #include <sys/types.h>
+#include <sys/uio.h>
+#ifdef __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
+#endif
 
+// A ring: the +size+ bytes starting at +head+ may wrap around the end of +data+
 typedef struct {
     char* data;
+    size_t head;
     size_t size;
     size_t capacity;
 } buffer_t;
@@ -17,12 +22,16 @@ size_t get_buffer_capacity(buffer_t*);
 char* get_buffer_data(buffer_t*);
 char get_buffer_byte_at(buffer_t*, size_t);
 buffer_t* create_buffer_with(char*, size_t);
-buffer_t* create_buffer_from_cfstr(CFStringRef);
 buffer_t * create_buffer_from_file_descriptor(int);
+#ifdef __APPLE__
+buffer_t* create_buffer_from_cfstr(CFStringRef);
 buffer_t* create_buffer_from_dictionary_as_xml(CFDictionaryRef);
+#endif
 char* create_cstr_from_buffer(buffer_t*);
 void add_to_buffer(buffer_t*, char*, size_t);
 size_t consume_from_head_of_buffer(buffer_t*, char*, size_t);
+size_t consume_iovec_from_head_of_buffer(buffer_t*, const struct iovec*, int);
+ssize_t add_to_buffer_from_fd(buffer_t*, int, size_t);
 int write_buffer_to_fd(buffer_t*, int);
 
 #endif /* _BUFFER_H_ */
@@ -3,8 +3,10 @@
 
 #include <stdio.h>
 
+// Messages go to the trace ring of the calling thread; see trace.h
 #ifndef NDEBUG
-#define D(format, args...) ; if (true) { FILE *f = fopen("/tmp/tm_interactive_read.log","a"); fprintf(f, "%s(): ", __FUNCTION__); fprintf (f, format,## args); fclose(f); }
+#include "trace.h"
+#define D(format, args...) trace_message(__FUNCTION__, format,## args)
 #else
 #define D(format, args...) 
 #endif
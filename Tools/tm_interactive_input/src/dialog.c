@@ -1,32 +1,88 @@
 #include "die.h"
 #include "debug.h"
+#include "trace.h"
 #include "stringutil.h"
 #include "plist.h"
 #include "buffer.h"
+#include "broker.h"
 #include "process_name.h"
 #include "mode.h"
 #include "system_function_overrides.h"
+#include "stdin_readiness.h"
+#include "dialog.h"
 
+#include <assert.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdlib.h>
-#include <CoreFoundation/CoreFoundation.h>
+#include <string.h>
 #include <unistd.h>
-#include <ctype.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#ifdef __APPLE__
+#include <AvailabilityMacros.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <crt_externs.h>
 #include <xlocale.h>
+#define environ (*_NSGetEnviron())
+#if MAC_OS_X_VERSION_MIN_REQUIRED < 1050
+// posix_spawn() is new in 10.5
+#define SPAWN_WITH_FORK 1
+#endif
+#else
+#include <locale.h>
+#include <wchar.h>
+#endif
+#ifndef SPAWN_WITH_FORK
+#include <spawn.h>
+#endif
 
 buffer_t* input_buffer = NULL;
 pthread_mutex_t input_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static char prompt[128];
-pthread_mutex_t prompt_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+    The last line written to stdout or stderr. The sequence number is odd
+    while a writer is storing; another writer spins until it's even and
+    then claims it in turn, which takes no longer than copying 127 bytes,
+    so the line stored last always ends up in the slot. Readers copy the
+    line until the sequence number didn't change.
+*/
+static struct {
+    unsigned sequence;
+    char text[128];
+} prompt;
+
+static void store_prompt(char const* line, size_t length) {
+    unsigned sequence;
+    do {
+        while ((sequence = __atomic_load_n(&prompt.sequence, __ATOMIC_RELAXED)) & 1)
+            ;
+    } while (!__atomic_compare_exchange_n(&prompt.sequence, &sequence, sequence + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(prompt.text, line, length);
+    prompt.text[length] = '\0';
+    __atomic_store_n(&prompt.sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static void load_prompt(char text[sizeof(prompt.text)]) {
+    unsigned sequence;
+    do {
+        while ((sequence = __atomic_load_n(&prompt.sequence, __ATOMIC_ACQUIRE)) & 1)
+            ;
+        memcpy(text, prompt.text, sizeof(prompt.text));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&prompt.sequence, __ATOMIC_RELAXED) != sequence);
+    text[sizeof(prompt.text) - 1] = '\0';
+}
 
 char* create_prompt_copy() {
-    pthread_mutex_lock(&prompt_mutex);
-    char* prompt_copy = malloc(strlen(prompt) + 1);
-    strcpy(prompt_copy, prompt);
-    pthread_mutex_unlock(&prompt_mutex);
+    char text[sizeof(prompt.text)];
+    load_prompt(text);
+    char* prompt_copy = strdup(text);
+    if (prompt_copy == NULL) die("failed to allocate prompt copy");
     return prompt_copy;
 }
 
@@ -35,6 +91,11 @@ buffer_t* get_input_buffer() {
     return input_buffer; 
 }
 
+char const* get_dialog_prompt(char const* prompt_copy) {
+    return (strlen(prompt_copy) == 0) ? "The processing is requesting input:" : prompt_copy;
+}
+
+#ifdef __APPLE__
 CFDictionaryRef create_input_dictionary() {
 
     CFMutableDictionaryRef parameters = CFDictionaryCreateMutable(kCFAllocatorDefault, 5, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
@@ -48,9 +109,9 @@ CFDictionaryRef create_input_dictionary() {
     CFRelease(cf_title);
 
     char* prompt_copy = create_prompt_copy();
-    CFStringRef dialog_prompt = cstr_2_cfstr((strlen(prompt) == 0) ? "The processing is requesting input:" : prompt);
-    free(prompt_copy);
+    CFStringRef dialog_prompt = cstr_2_cfstr((char*)get_dialog_prompt(prompt_copy));
     CFDictionaryAddValue(parameters, CFSTR("prompt"), dialog_prompt);
+    free(prompt_copy);
     CFRelease(dialog_prompt);
 
     CFDictionaryAddValue(parameters, CFSTR("string"), CFSTR(""));
@@ -61,6 +122,25 @@ CFDictionaryRef create_input_dictionary() {
     return parameters;
 }
 
+buffer_t* create_parameters_buffer() {
+    CFDictionaryRef parameters = create_input_dictionary();
+    buffer_t* parameters_buffer = create_buffer_from_dictionary_as_xml(parameters);
+    CFRelease(parameters);
+    return parameters_buffer;
+}
+#else
+buffer_t* create_parameters_buffer() {
+    char* process_name = create_process_name();
+    char* prompt_copy = create_prompt_copy();
+    char const* keys[] = { "title", "prompt", "string", "button1", "button2" };
+    char const* values[] = { process_name, get_dialog_prompt(prompt_copy), "", "Send", "Send EOF" };
+    buffer_t* parameters_buffer = create_xml_plist_from_strings(keys, values, 5);
+    free(prompt_copy);
+    free(process_name);
+    return parameters_buffer;
+}
+#endif
+
 char * get_path() {
 
     char *path = getenv("DIALOG");
@@ -71,10 +151,9 @@ char * get_path() {
 }
 
 bool use_secure_nib() {
-    pthread_mutex_lock(&prompt_mutex);
-    bool should = (strcasestr(prompt, "password") != NULL);
-    pthread_mutex_unlock(&prompt_mutex);
-    return should;
+    char text[sizeof(prompt.text)];
+    load_prompt(text);
+    return strcasestr(text, "password") != NULL;
 }
 
 char* get_nib() {
@@ -86,6 +165,7 @@ int get_echo_fd() {
     return (echo_fd == NULL) ? STDERR_FILENO : atoi(echo_fd);
 }
 
+#ifdef __APPLE__
 CFStringRef get_return_argument_from_output_plist(CFPropertyListRef plist) {
 
     if (CFGetTypeID(plist) != CFDictionaryGetTypeID())
@@ -116,28 +196,94 @@ CFStringRef get_return_argument_from_output_plist(CFPropertyListRef plist) {
 
     return return_argument;
 }
+#endif
+
+/*
+    tm_dialog gets our environment without what loads this library, so it
+    doesn't use our read() implementation
+*/
+static bool loads_this_library(char const* entry) {
+    static char const* names[] = { "DYLD_INSERT_LIBRARIES=", "DYLD_FORCE_FLAT_NAMESPACE=", "LD_PRELOAD=" };
+    size_t i;
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strncmp(entry, names[i], strlen(names[i])) == 0) return true;
+    }
+    return false;
+}
+
+static char** create_tm_dialog_environment() {
+    char** env = environ;
+    size_t count = 0;
+    while (env[count] != NULL) ++count;
 
-void open_tm_dialog(int in[], int out[]) {
+    char** tm_dialog_env = malloc((count + 1) * sizeof(char*));
+    if (tm_dialog_env == NULL) die("failed to allocate environment for tm_dialog");
+
+    size_t i, j = 0;
+    for (i = 0; i < count; ++i) {
+        if (!loads_this_library(env[i])) tm_dialog_env[j++] = env[i];
+    }
+    tm_dialog_env[j] = NULL;
+    return tm_dialog_env;
+}
+
+#ifdef SPAWN_WITH_FORK
+void open_tm_dialog(int in[], int out[], char* const argv[], char* const envp[]) {
 
     enum {R,W,N};
 
-    close(0);
-    dup(in[R]);
-    close(in[0]);
-    close(in[1]);
-    close(1);
-    dup(out[W]);
-    close(out[0]);
-    close(out[1]);
-
-    // Prevent tm_dialog from using our read() implementation
-    unsetenv("DYLD_INSERT_LIBRARIES");
-    unsetenv("DYLD_FORCE_FLAT_NAMESPACE");
-
-    if (execl(get_path(), get_path(), "-m", get_nib(), NULL) < 0) 
-        die("execl() failed, %s", strerror(errno));
+    dup2(in[R], 0);
+    dup2(out[W], 1);
+
+    execve(argv[0], argv, envp);
+    die("execve() failed, %s", strerror(errno));
 }
+#endif
+
+/*
+    Starts tm_dialog reading in[R] and writing out[W], both close-on-exec.
+    posix_spawn() doesn't copy our page tables the way fork() does, which
+    for a big interpreter costs more than running tm_dialog.
+*/
+static pid_t spawn_tm_dialog(int in[], int out[]) {
 
+    enum {R,W,N};
+
+    char* const argv[] = { get_path(), "-m", get_nib(), NULL };
+    char** envp = create_tm_dialog_environment();
+    pid_t child;
+
+#ifdef SPAWN_WITH_FORK
+    child = fork();
+    if (child < 0) die("failed to fork() for tm_dialog");
+    if (child == 0) open_tm_dialog(in, out, argv, envp);
+#else
+    posix_spawn_file_actions_t actions;
+    if (posix_spawn_file_actions_init(&actions) != 0) die("failed to allocate file actions for tm_dialog");
+    posix_spawn_file_actions_adddup2(&actions, in[R], 0);
+    posix_spawn_file_actions_adddup2(&actions, out[W], 1);
+
+    int error = posix_spawn(&child, argv[0], &actions, NULL, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) die("failed to spawn tm_dialog, %s", strerror(error));
+#endif
+
+    free(envp);
+    D("tm_dialog pid = %d\n", (int)child);
+    return child;
+}
+
+static void create_close_on_exec_pipe(int fds[2], char const* name) {
+#ifdef __linux__
+    if (pipe2(fds, O_CLOEXEC) < 0) die("failed to create %s pipe for tm_dialog", name);
+#else
+    if (pipe(fds) < 0) die("failed to create %s pipe for tm_dialog", name);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+}
+
+#ifdef __APPLE__
 buffer_t* create_user_input_from_output(buffer_t* output) {
 
     CFPropertyListRef plist = create_plist_from_buffer(output);
@@ -152,28 +298,47 @@ buffer_t* create_user_input_from_output(buffer_t* output) {
     CFRelease(plist);
     return input;
 }
+#else
+buffer_t* create_user_input_from_output(buffer_t* output) {
 
-void get_input_from_user() {
+    char const* keys[] = { "result", "returnArgument" };
+    if (!xml_plist_contains_key(output, keys, 1)) {
+        D("plist has no result key, so returning nothing\n");
+        return NULL;
+    }
 
-    assert(input_buffer == NULL);
+    buffer_t* input = create_string_from_xml_plist(output, keys, 2);
+    if (input == NULL) input = create_buffer();
+    add_to_buffer(input, "\n", 1);
+    return input;
+}
+#endif
+
+// Length of the (multibyte) character at +str+ in locale +l+
+int character_length(char const* str, size_t len, locale_t l) {
+#ifdef __APPLE__
+    return mblen_l(str, len, l);
+#else
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    locale_t previous = uselocale(l);
+    int res = (int)mbrlen(str, len, &state);
+    uselocale(previous);
+    return res;
+#endif
+}
 
-    // We do this now so we hit any errors before we attempt a fork.
-    CFDictionaryRef parameters = create_input_dictionary();
-    buffer_t* parameters_buffer = create_buffer_from_dictionary_as_xml(parameters);
-    CFRelease(parameters);
+buffer_t* create_output_from_tm_dialog(buffer_t* parameters_buffer) {
 
     enum {R,W,N};
     int input[N],output[N];
 
-    if (pipe(input) < 0) die("failed to create input pipe for tm_dialog");
-    if (pipe(output) < 0) die("failed to create output pipe for tm_dialog");
+    create_close_on_exec_pipe(input, "input");
+    create_close_on_exec_pipe(output, "output");
 
     sig_t previous_sigchld_handler = signal(SIGCHLD, SIG_DFL);
 
-    int child = fork();
-    if (child < 0) die("failed to fork() for tm_dialog");
-
-    if (child == 0) open_tm_dialog(input, output);
+    pid_t child = spawn_tm_dialog(input, output);
 
     // These aren't used.
     close(input[R]);
@@ -183,7 +348,6 @@ void get_input_from_user() {
     size_t bytes_written = write_buffer_to_fd(parameters_buffer, input[W]);
     if (bytes_written < get_buffer_size(parameters_buffer)) die("failed to write all of parameter input to tm_dialog");
     close(input[W]);
-    destroy_buffer(parameters_buffer);
 
     // Read all of tm_dialog's output
     D("about to consume tm_dialog's output\n");
@@ -194,7 +358,10 @@ void get_input_from_user() {
     int return_code;
 
     D("about to wait ...\n");
-    int waitError = wait(&return_code);
+    pid_t waitError;
+    do {
+        waitError = waitpid(child, &return_code, 0);
+    } while (waitError == -1 && errno == EINTR);
     if(waitError == -1)
         die("tm_dialog wait() failed: %s\n", strerror(errno));
     if (WEXITSTATUS(return_code) != 0)
@@ -202,8 +369,25 @@ void get_input_from_user() {
 
     signal(SIGCHLD, previous_sigchld_handler);
 
+    return output_buffer;
+}
+
+void get_input_from_user() {
+
+    assert(input_buffer == NULL);
+    TRACE_START();
+
+    // We do this now so we hit any errors before we start tm_dialog.
+    buffer_t* parameters_buffer = create_parameters_buffer();
+
+    // An input broker answers without a process per dialog
+    buffer_t* output_buffer = create_output_from_broker(parameters_buffer, get_nib());
+    if (output_buffer == NULL) output_buffer = create_output_from_tm_dialog(parameters_buffer);
+    destroy_buffer(parameters_buffer);
+
     input_buffer = create_user_input_from_output(output_buffer);
     destroy_buffer(output_buffer);
+    (void)TRACE_END(TRACE_DIALOG, -1, input_buffer != NULL ? (ssize_t)get_buffer_size(input_buffer) : -1);
 }
 
 ssize_t tm_dialog_read(void *buffer, size_t buffer_length) {
@@ -212,22 +396,32 @@ ssize_t tm_dialog_read(void *buffer, size_t buffer_length) {
     pthread_mutex_lock(&input_mutex);
     if (input_buffer == NULL) {
         D("input_buffer == NULL, getting input from user\n");
+        capture_stdio_for_prompt(stdout);
         get_input_from_user();
 
+        // The user sent EOF, so waits on stdin block until there's a new prompt
+        if (input_buffer == NULL) stdin_readiness_set_dialog_due(false);
+
         
         if (tm_interactive_input_is_in_echo_mode() && input_buffer != NULL) {
             int echo_fd = get_echo_fd();
             if (use_secure_nib()) {
+                // An asterisk per character, written in one go
                 locale_t l = newlocale(LC_CTYPE_MASK, "", NULL);
                 char const* str = get_buffer_data(input_buffer);
                 int i, len = get_buffer_size(input_buffer);
-                for(i = 0; i < len - 1; i += mblen_l(str + i, len - i, l))
+                char* echo = malloc(len + 1);
+                if (echo == NULL) die("failed to allocate echo of secure input");
+                int echo_length = 0;
+                for(i = 0; i < len - 1; i += character_length(str + i, len - i, l))
                 {
-                    system_write("write", echo_fd, "*", 1);
-                    if(mblen_l(str + i, len - i, l) <= 0) // encoding error
+                    echo[echo_length++] = '*';
+                    if(character_length(str + i, len - i, l) <= 0) // encoding error
                         break;
                 }
-                system_write("write", echo_fd, "\n", 1);
+                echo[echo_length++] = '\n';
+                system_write(echo_fd, echo, echo_length);
+                free(echo);
                 freelocale(l);
             } else {
                 write_buffer_to_fd(input_buffer, echo_fd);
@@ -246,38 +440,103 @@ ssize_t tm_dialog_read(void *buffer, size_t buffer_length) {
             input_buffer = NULL;
         }
     }
+    stdin_readiness_set_input_buffered(input_buffer != NULL);
 
     pthread_mutex_unlock(&input_mutex);
     return consumed;
 }
 
+// Only hands out what the last dialog left; never brings up a new one
+ssize_t tm_dialog_readv(const struct iovec *iov, int iovcnt) {
+    size_t consumed = 0;
+
+    pthread_mutex_lock(&input_mutex);
+    if (input_buffer != NULL) {
+        consumed = consume_iovec_from_head_of_buffer(input_buffer, iov, iovcnt);
+        if (get_buffer_size(input_buffer) == 0) {
+            destroy_buffer(input_buffer);
+            input_buffer = NULL;
+        }
+    }
+    stdin_readiness_set_input_buffered(input_buffer != NULL);
+    pthread_mutex_unlock(&input_mutex);
+
+    return consumed;
+}
+
+/*
+    Only the end of a write can hold the prompt, so however long it is we
+    look at no more than the trailing whitespace (up to a limit) and the
+    line before it (up to the prompt's capacity).
+*/
+
+#define PROMPT_WHITESPACE_LIMIT 4096
+
+#ifdef __APPLE__
+static void* memrchr(void const* buffer, int c, size_t length) {
+    unsigned char const* p = (unsigned char const*)buffer + length;
+    while (p != buffer)
+        if (*--p == (unsigned char)c) return (void*)p;
+    return NULL;
+}
+#endif
+
+static bool is_prompt_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
 void capture_for_prompt(const void *buffer, size_t buffer_length) {
-	char const* cbuffer = buffer;
+    char const* cbuffer = buffer;
     D("buffer_length = %d\n", (int)buffer_length);
 
     // First skip trailing whitespace (including newlines)
-	char const* to = cbuffer + buffer_length;
-    while(to != cbuffer && isspace(to[-1]))
+    char const* to = cbuffer + buffer_length;
+    char const* limit = (buffer_length > PROMPT_WHITESPACE_LIMIT) ? to - PROMPT_WHITESPACE_LIMIT : cbuffer;
+    while(to != limit && is_prompt_space(to[-1]))
         --to;
 
-    // Second search back for the begin-of-(last)-line
-	char const* from = to;
-    while(from != cbuffer && from[-1] != '\n')
-        --from;
-
     // If we end with an empty string, do nothing (we probably have a prompt from a previous write)
-    if(from == to)
+    if(to == limit)
         return;
 
-    // Third, truncate line (by cutting head) if larger than prompt capacity
-    if(to - from > sizeof(prompt)-1)
-        from = to - (sizeof(prompt)-1);
+    // Second search back for the begin-of-(last)-line, in only as much as the prompt can hold
+    size_t window = sizeof(prompt.text) - 1;
+    if (window > (size_t)(to - cbuffer)) window = to - cbuffer;
+    char const* newline = memrchr(to - window, '\n', window);
+    char const* from = (newline != NULL) ? newline + 1 : to - window;
+
+    store_prompt(from, to - from);
+    D("copied %i bytes to prompt\n", (int)(to - from));
 
-    pthread_mutex_lock(&prompt_mutex);
-    strncpy(prompt, from, to - from);
-    prompt[to - from] = '\0';
-    D("copied %i bytes to prompt\n", (int)to - from);
-    pthread_mutex_unlock(&prompt_mutex);
+    stdin_readiness_set_dialog_due(true);
+}
+
+// The last line of a writev(), from as much of its tail as capture_for_prompt() would look at
+void capture_iovec_for_prompt(const struct iovec *iov, int iovcnt) {
+    char tail[PROMPT_WHITESPACE_LIMIT + sizeof(prompt.text)];
+    size_t length = 0;
+
+    int i;
+    for (i = iovcnt - 1; i >= 0 && length < sizeof(tail); --i) {
+        size_t n = iov[i].iov_len;
+        if (n > sizeof(tail) - length) n = sizeof(tail) - length;
+        memcpy(tail + sizeof(tail) - length - n, (char const*)iov[i].iov_base + iov[i].iov_len - n, n);
+        length += n;
+    }
+
+    if (length > 0) capture_for_prompt(tail + sizeof(tail) - length, length);
+}
 
-    D("prompt = '%s'\n", prompt);
+/*
+    glibc's stdio writes with an internal write() we can't replace, so we
+    look at what a stream to stdout or stderr holds before it is flushed,
+    and before a dialog in case a prompt is still waiting there.
+*/
+void capture_stdio_for_prompt(FILE *stream) {
+#ifdef __GLIBC__
+    flockfile(stream);
+    if ((stream->_fileno == STDOUT_FILENO || stream->_fileno == STDERR_FILENO) && stream->_IO_write_ptr > stream->_IO_write_base)
+        capture_for_prompt(stream->_IO_write_base, stream->_IO_write_ptr - stream->_IO_write_base);
+    funlockfile(stream);
+#endif
 }
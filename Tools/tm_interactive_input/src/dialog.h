@@ -2,8 +2,13 @@
 #define _DIALOG_H_
 
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <stdio.h>
 
 ssize_t tm_dialog_read(void *, size_t);
+ssize_t tm_dialog_readv(const struct iovec *, int);
 void capture_for_prompt(const void *buffer, size_t buffer_length);
+void capture_iovec_for_prompt(const struct iovec *iov, int iovcnt);
+void capture_stdio_for_prompt(FILE *stream);
 
 #endif /* _DIALOG_H_ */
\ No newline at end of file
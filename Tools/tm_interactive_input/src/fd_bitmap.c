@@ -0,0 +1,55 @@
+#include "fd_bitmap.h"
+#include "die.h"
+#include "debug.h"
+#include <stdlib.h>
+
+// The page holding +fd+, allocated if +create+ is set; threads racing to
+// allocate it agree on the first one published
+static uint64_t* get_page(fd_bitmap_t* bitmap, int fd, bool create) {
+    if (fd < 0 || fd >= FD_BITMAP_PAGES * FD_BITMAP_PAGE_BITS) return NULL;
+
+    uint64_t** slot = &bitmap->pages[fd / FD_BITMAP_PAGE_BITS];
+    uint64_t* page = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (page != NULL || !create) return page;
+
+    uint64_t* fresh = calloc(FD_BITMAP_PAGE_WORDS, sizeof(uint64_t));
+    if (fresh == NULL) die("failed to allocate fd bitmap page");
+    if (__atomic_compare_exchange_n(slot, &page, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return fresh;
+
+    free(fresh);
+    return page;
+}
+
+void fd_bitmap_add(fd_bitmap_t* bitmap, int fd) {
+    uint64_t* page = get_page(bitmap, fd, true);
+    if (page == NULL) return;
+    __atomic_fetch_or(&page[(fd % FD_BITMAP_PAGE_BITS) / 64], (uint64_t)1 << (fd % 64), __ATOMIC_RELEASE);
+}
+
+void fd_bitmap_remove(fd_bitmap_t* bitmap, int fd) {
+    uint64_t* page = get_page(bitmap, fd, false);
+    if (page == NULL) return;
+    __atomic_fetch_and(&page[(fd % FD_BITMAP_PAGE_BITS) / 64], ~((uint64_t)1 << (fd % 64)), __ATOMIC_RELEASE);
+}
+
+int fd_bitmap_next(fd_bitmap_t* bitmap, int from, int max) {
+    if (from < 0) from = 0;
+    if (max > FD_BITMAP_PAGES * FD_BITMAP_PAGE_BITS) max = FD_BITMAP_PAGES * FD_BITMAP_PAGE_BITS;
+
+    while (from < max) {
+        uint64_t* page = get_page(bitmap, from, false);
+        if (page == NULL) {
+            from = (from / FD_BITMAP_PAGE_BITS + 1) * FD_BITMAP_PAGE_BITS;
+            continue;
+        }
+
+        uint64_t word = __atomic_load_n(&page[(from % FD_BITMAP_PAGE_BITS) / 64], __ATOMIC_ACQUIRE);
+        word &= ~(uint64_t)0 << (from % 64);
+        if (word != 0) {
+            int fd = from - from % 64 + __builtin_ctzll(word);
+            return fd < max ? fd : -1;
+        }
+        from = from - from % 64 + 64;
+    }
+    return -1;
+}
@@ -0,0 +1,38 @@
+#ifndef _FD_BITMAP_H_
+#define _FD_BITMAP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    A set of file descriptors, one bit each. Pages of bits are allocated as
+    descriptors get that high and never freed, so membership tests need
+    no lock: a bit is read with a single atomic load.
+*/
+
+enum {
+    FD_BITMAP_PAGE_WORDS = 64,                              // 4096 descriptors a page
+    FD_BITMAP_PAGE_BITS  = FD_BITMAP_PAGE_WORDS * 64,
+    FD_BITMAP_PAGES      = 1024                             // up to 4M descriptors
+};
+
+typedef struct {
+    uint64_t* pages[FD_BITMAP_PAGES];
+} fd_bitmap_t;
+
+void fd_bitmap_add(fd_bitmap_t*, int);
+void fd_bitmap_remove(fd_bitmap_t*, int);
+
+// The first member from +from+ up to (not including) +max+, or -1
+int fd_bitmap_next(fd_bitmap_t*, int from, int max);
+
+static inline bool fd_bitmap_contains(fd_bitmap_t* bitmap, int fd) {
+    if (fd < 0 || fd >= FD_BITMAP_PAGES * FD_BITMAP_PAGE_BITS) return false;
+    uint64_t* page = __atomic_load_n(&bitmap->pages[fd / FD_BITMAP_PAGE_BITS], __ATOMIC_ACQUIRE);
+    if (page == NULL) return false;
+    uint64_t word = __atomic_load_n(&page[(fd % FD_BITMAP_PAGE_BITS) / 64], __ATOMIC_ACQUIRE);
+    return (word >> (fd % 64)) & 1;
+}
+
+#endif /* _FD_BITMAP_H_ */
@@ -4,16 +4,17 @@
 #include <string.h>
 #include <stdlib.h>
 
+int tm_interactive_input_mode = 0;
+
 char* get_tm_interactive_input_mode_mask() {
     return getenv("TM_INTERACTIVE_INPUT");
 }
 
-bool mode_contains(char *target) {
+bool mode_contains(char *mode_mask, char *target) {
     
     // Because strsep modifies the string in place, we need to make a copy.
-    char *mode_mask = get_tm_interactive_input_mode_mask();
-    if (mode_mask == NULL) return false;
     char *mode_mask_copy = strdup(mode_mask);
+    if (mode_mask_copy == NULL) return false;
     char *strsep_index = mode_mask_copy;
     
     char *mode_flag = NULL;
@@ -30,14 +31,18 @@ bool mode_contains(char *target) {
     return contains;
 }
 
-bool tm_interactive_input_is_active() {
-    return (get_tm_interactive_input_mode_mask() != NULL && mode_contains("NEVER") == false);
-}
-
-bool tm_interactive_input_is_in_always_mode() {
-    return mode_contains("ALWAYS");
+// The environment is read when the library is loaded rather than on
+// every intercepted call, so changing TM_INTERACTIVE_INPUT afterwards
+// only affects child processes.
+int tm_interactive_input_parse_mode() {
+    int mode = MODE_PARSED;
+    char *mode_mask = get_tm_interactive_input_mode_mask();
+    if (mode_mask != NULL) {
+        if (!mode_contains(mode_mask, "NEVER")) mode |= MODE_ACTIVE;
+        if (mode_contains(mode_mask, "ALWAYS")) mode |= MODE_ALWAYS;
+        if (mode_contains(mode_mask, "ECHO")) mode |= MODE_ECHO;
+    }
+    D("mode = %d\n", mode);
+    tm_interactive_input_mode = mode;
+    return mode;
 }
-
-bool tm_interactive_input_is_in_echo_mode() {
-    return mode_contains("ECHO");
-}
\ No newline at end of file
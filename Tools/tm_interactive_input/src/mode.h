@@ -3,8 +3,34 @@
 
 #include <stdbool.h>
 
-bool tm_interactive_input_is_active();
-bool tm_interactive_input_is_in_always_mode();
-bool tm_interactive_input_is_in_echo_mode();
+// TM_INTERACTIVE_INPUT is parsed once into these flags; MODE_PARSED
+// marks that it has been, so a zero value means not yet.
+enum {
+    MODE_PARSED = 1 << 0,
+    MODE_ACTIVE = 1 << 1,
+    MODE_ALWAYS = 1 << 2,
+    MODE_ECHO   = 1 << 3
+};
+
+extern int tm_interactive_input_mode;
+int tm_interactive_input_parse_mode();
+
+static inline int tm_interactive_input_get_mode() {
+    int mode = tm_interactive_input_mode;
+    if (__builtin_expect(mode == 0, 0)) mode = tm_interactive_input_parse_mode();
+    return mode;
+}
+
+static inline bool tm_interactive_input_is_active() {
+    return (tm_interactive_input_get_mode() & MODE_ACTIVE) != 0;
+}
+
+static inline bool tm_interactive_input_is_in_always_mode() {
+    return (tm_interactive_input_get_mode() & MODE_ALWAYS) != 0;
+}
+
+static inline bool tm_interactive_input_is_in_echo_mode() {
+    return (tm_interactive_input_get_mode() & MODE_ECHO) != 0;
+}
 
 #endif /* _MODE_H_ */
@@ -3,11 +3,16 @@
 #include "stringutil.h"
 #include "die.h"
 
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#ifdef __APPLE__
 CFPropertyListRef create_plist_from_buffer(buffer_t *buffer) {
 
     D("creating data ref of buffer\n");
 
-    CFDataRef buffer_as_data = CFDataCreate(kCFAllocatorDefault, (UInt8*)get_buffer_data(buffer), buffer->size);
+    CFDataRef buffer_as_data = CFDataCreate(kCFAllocatorDefault, (UInt8*)get_buffer_data(buffer), get_buffer_size(buffer));
     if (buffer_as_data == NULL) die("failed to allocate tm_dialog_output_data");
 
     D("creating property list from data\n");
@@ -23,4 +28,129 @@ CFPropertyListRef create_plist_from_buffer(buffer_t *buffer) {
     CFRelease(buffer_as_data);
 
     return plist;
-}
\ No newline at end of file
+}
+#else
+/*
+    Without CoreFoundation we only need to write a dictionary of strings for
+    tm_dialog's parameters and pick a string back out of its output, so this
+    is just enough XML for that.
+*/
+
+static void add_cstr_to_buffer(buffer_t* buffer, char const* str) {
+    add_to_buffer(buffer, (char*)str, strlen(str));
+}
+
+static void add_escaped_to_buffer(buffer_t* buffer, char const* str) {
+    for (; *str != '\0'; ++str) {
+        switch (*str) {
+            case '&': add_cstr_to_buffer(buffer, "&amp;"); break;
+            case '<': add_cstr_to_buffer(buffer, "&lt;"); break;
+            case '>': add_cstr_to_buffer(buffer, "&gt;"); break;
+            default: add_to_buffer(buffer, (char*)str, 1);
+        }
+    }
+}
+
+buffer_t* create_xml_plist_from_strings(char const* keys[], char const* values[], size_t count) {
+    buffer_t* buffer = create_buffer();
+    add_cstr_to_buffer(buffer, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+        "<plist version=\"1.0\">\n<dict>\n");
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        add_cstr_to_buffer(buffer, "\t<key>");
+        add_escaped_to_buffer(buffer, keys[i]);
+        add_cstr_to_buffer(buffer, "</key>\n\t<string>");
+        add_escaped_to_buffer(buffer, values[i]);
+        add_cstr_to_buffer(buffer, "</string>\n");
+    }
+    add_cstr_to_buffer(buffer, "</dict>\n</plist>\n");
+    D("buffer = %*s\n", (int)get_buffer_size(buffer), get_buffer_data(buffer));
+    return buffer;
+}
+
+// Position just past <key>keys[count-1]</key>, looking for each key after
+// the previous one, or NULL
+static char const* find_key_path(buffer_t* plist, char const* keys[], size_t count) {
+    char const* from = get_buffer_data(plist);
+    char const* end = from + get_buffer_size(plist);
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        char* tag;
+        if (asprintf(&tag, "<key>%s</key>", keys[i]) < 0) die("failed to allocate key tag");
+        size_t tag_length = strlen(tag);
+        char const* found = memmem(from, end - from, tag, tag_length);
+        free(tag);
+        if (found == NULL) return NULL;
+        from = found + tag_length;
+    }
+    return from;
+}
+
+bool xml_plist_contains_key(buffer_t* plist, char const* keys[], size_t count) {
+    return find_key_path(plist, keys, count) != NULL;
+}
+
+static void add_utf8_to_buffer(buffer_t* buffer, unsigned long code) {
+    char bytes[4];
+    size_t len;
+    if (code < 0x80) {
+        bytes[0] = code; len = 1;
+    } else if (code < 0x800) {
+        bytes[0] = 0xC0 | (code >> 6); bytes[1] = 0x80 | (code & 0x3F); len = 2;
+    } else if (code < 0x10000) {
+        bytes[0] = 0xE0 | (code >> 12); bytes[1] = 0x80 | ((code >> 6) & 0x3F); bytes[2] = 0x80 | (code & 0x3F); len = 3;
+    } else {
+        bytes[0] = 0xF0 | (code >> 18); bytes[1] = 0x80 | ((code >> 12) & 0x3F); bytes[2] = 0x80 | ((code >> 6) & 0x3F); bytes[3] = 0x80 | (code & 0x3F); len = 4;
+    }
+    add_to_buffer(buffer, bytes, len);
+}
+
+static buffer_t* create_unescaped_buffer(char const* from, char const* to) {
+    static struct { char const* name; char value; } entities[] = {
+        { "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' }, { "&quot;", '"' }, { "&apos;", '\'' }
+    };
+    buffer_t* buffer = create_buffer();
+    while (from < to) {
+        char const* amp = memchr(from, '&', to - from);
+        if (amp == NULL) amp = to;
+        if (amp > from) add_to_buffer(buffer, (char*)from, amp - from);
+        if (amp == to) break;
+
+        char const* semicolon = memchr(amp, ';', to - amp);
+        if (semicolon == NULL) die("unterminated entity in tm_dialog output");
+        size_t i, len = semicolon + 1 - amp;
+        for (i = 0; i < sizeof(entities) / sizeof(entities[0]); ++i) {
+            if (strlen(entities[i].name) == len && memcmp(amp, entities[i].name, len) == 0) {
+                add_to_buffer(buffer, &entities[i].value, 1);
+                break;
+            }
+        }
+        if (i == sizeof(entities) / sizeof(entities[0])) {
+            if (len < 4 || amp[1] != '#') die("unknown entity in tm_dialog output");
+            bool hex = amp[2] == 'x';
+            add_utf8_to_buffer(buffer, strtoul(amp + (hex ? 3 : 2), NULL, hex ? 16 : 10));
+        }
+        from = semicolon + 1;
+    }
+    return buffer;
+}
+
+// The string stored under the nested +keys+, or NULL if they aren't there
+buffer_t* create_string_from_xml_plist(buffer_t* plist, char const* keys[], size_t count) {
+    char const* from = find_key_path(plist, keys, count);
+    if (from == NULL) return NULL;
+
+    char const* end = get_buffer_data(plist) + get_buffer_size(plist);
+    while (from < end && isspace(*from)) ++from;
+    if ((size_t)(end - from) >= strlen("<string/>") && memcmp(from, "<string/>", strlen("<string/>")) == 0)
+        return create_buffer();
+    if ((size_t)(end - from) < strlen("<string>") || memcmp(from, "<string>", strlen("<string>")) != 0)
+        die("value of %s in tm_dialog output is not a string", keys[count - 1]);
+
+    from += strlen("<string>");
+    char const* to = memmem(from, end - from, "</string>", strlen("</string>"));
+    if (to == NULL) die("unterminated string in tm_dialog output");
+    return create_unescaped_buffer(from, to);
+}
+#endif
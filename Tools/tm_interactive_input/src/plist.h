@@ -2,8 +2,16 @@
 #define _PLIST_H_
 
 #include "buffer.h"
+#include <stdbool.h>
+
+#ifdef __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
 
 CFPropertyListRef create_plist_from_buffer(buffer_t*);
+#else
+buffer_t* create_xml_plist_from_strings(char const* keys[], char const* values[], size_t count);
+bool xml_plist_contains_key(buffer_t* plist, char const* keys[], size_t count);
+buffer_t* create_string_from_xml_plist(buffer_t* plist, char const* keys[], size_t count);
+#endif
 
-#endif /* _PLIST_H_ */
\ No newline at end of file
+#endif /* _PLIST_H_ */
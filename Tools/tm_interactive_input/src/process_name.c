@@ -1,63 +1,64 @@
 #include "process_name.h"
-#include "buffer.h"
 #include "die.h"
 #include "debug.h"
+#include "system_function_overrides.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
-#include <stdio.h>
-#include <sys/types.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <signal.h>
-
-buffer_t* get_ps_output() {
-    pid_t pid = getpid();
-    D("pid = %d\n", pid);
-
-    char* get_process_name_command;
-    asprintf(&get_process_name_command, "ps -p %i -o ucomm", pid);
-    if (get_process_name_command == NULL) die("failed to create ps command");
-    D("ps command = %s\n", get_process_name_command);
-    sig_t previous_sigchld_handler = signal(SIGCHLD, SIG_DFL);
-    FILE* out = popen(get_process_name_command, "r");
-    free(get_process_name_command);
-
-    buffer_t* ps_output = create_buffer_from_file_descriptor(fileno(out));
-
-    int ps_result = pclose(out);
-    signal(SIGCHLD, previous_sigchld_handler);
-    
-    if (ps_result != 0) die("ps returned %d, output = %*.s", ps_result, get_buffer_size(ps_output), get_buffer_data(ps_output));
-    if (get_buffer_size(ps_output) == 0) die("ps did not return any output");
-    
-    return ps_output;
+
+/*
+    The dialog is titled with our process name. It can't change without an
+    exec (which reloads us) short of a prctl(), so it's looked up once
+    rather than asking ps for every dialog.
+*/
+
+static pthread_once_t process_name_once = PTHREAD_ONCE_INIT;
+static char process_name[64];
+
+#ifdef __linux__
+// /proc/self/comm is what ps shows as the command, ending in a newline
+static bool read_proc_comm(char* name, size_t size) {
+    int fd = open("/proc/self/comm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    ssize_t len;
+    do {
+        len = system_read(fd, name, size - 1);
+    } while (len < 0 && errno == EINTR);
+    close(fd);
+    if (len <= 0) return false;
+
+    while (len > 0 && isspace((unsigned char)name[len - 1])) --len;
+    name[len] = '\0';
+    return len > 0;
 }
+#endif
 
-char* create_process_name() {
-    buffer_t* ps_output = get_ps_output();
-    
-    // ps output has a column name header line, so we need ignore it
-    int index_of_process_name_line = strlen("UCOMM\n");
-    
-    // Ignore any whitespace before the process name
-    int first_non_space_char_index;
-    for (first_non_space_char_index = index_of_process_name_line; first_non_space_char_index < get_buffer_size(ps_output); ++first_non_space_char_index) {
-        if (isspace(get_buffer_byte_at(ps_output, first_non_space_char_index)) == false) break;
+static void look_up_process_name() {
+#ifdef __linux__
+    if (read_proc_comm(process_name, sizeof(process_name))) {
+        D("process name = %s\n", process_name);
+        return;
     }
-    
-    // Ignore any whitespace after the process name
-    int last_non_space_char_index;
-    for (last_non_space_char_index = get_buffer_size(ps_output) - 1; last_non_space_char_index >= index_of_process_name_line; --last_non_space_char_index) {
-        if (isspace(get_buffer_byte_at(ps_output, last_non_space_char_index)) == false) break;
-    }
-    
-    size_t process_name_length = last_non_space_char_index - first_non_space_char_index + 1;
-    char* process_name = malloc(process_name_length + 1); // +1 for \0
-    strncpy(process_name, get_buffer_data(ps_output) + index_of_process_name_line, process_name_length);
-    process_name[process_name_length] = '\0';
-    
-    destroy_buffer(ps_output);
-    
+    char const* name = program_invocation_short_name;
+#else
+    char const* name = getprogname();
+#endif
+    if (name == NULL) name = "";
+    strncpy(process_name, name, sizeof(process_name) - 1);
     D("process name = %s\n", process_name);
-    return process_name;
+}
+
+char* create_process_name() {
+    pthread_once(&process_name_once, look_up_process_name);
+
+    char* copy = strdup(process_name);
+    if (copy == NULL) die("failed to allocate process name");
+    return copy;
 }
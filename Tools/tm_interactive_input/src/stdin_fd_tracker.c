@@ -1,88 +1,265 @@
 #include "stdin_fd_tracker.h"
-#include "intset.h"
+#include "fd_bitmap.h"
 #include "debug.h"
 #include "textmate.h"
+#include "die.h"
 #include <pthread.h>
+#include <stdlib.h>
 
-pthread_mutex_t storage_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Descriptors that refer to the stdin we were started with; checked on
+// every read, so it's a bitmap needing no lock
+static uint64_t first_stdin_page[FD_BITMAP_PAGE_WORDS] = { 1 };
+static fd_bitmap_t stdin_fds = { .pages = { first_stdin_page } };
 
-// Only call this if you have locked the storage mutex
-intset_t* get_storage() {
-    static intset_t* storage = NULL;
-    if (storage == NULL) {
-        storage = create_intset();
-        add_to_intset(storage, 0);
-    }
-    return storage;
-}
+#ifdef __linux__
+static void forget_epoll_registrations_of(int fd);
+#endif
 
 bool stdin_fd_tracker_is_stdin(int target) {
-    pthread_mutex_lock(&storage_mutex);
-    intset_t* fds = get_storage();
-    bool is = intset_contains(fds, target);
-    pthread_mutex_unlock(&storage_mutex);
-    return is;
+    return fd_bitmap_contains(&stdin_fds, target);
 }
 
+// Used for dup(), dup2(), dup3() and fcntl(F_DUPFD): +dup+ now refers to what +orig+ does
 void stdin_fd_tracker_did_dup(int orig, int dup) {
-    pthread_mutex_lock(&storage_mutex);
-    intset_t* fds = get_storage();
-    if (intset_contains(fds, orig)) {
+    if (dup < 0 || dup == orig) return;
+
+    if (fd_bitmap_contains(&stdin_fds, orig)) {
         D("adding %d as dup of %d\n", dup, orig);
-        add_to_intset(fds, dup);
+        fd_bitmap_add(&stdin_fds, dup);
+    } else if (fd_bitmap_contains(&stdin_fds, dup)) {
+        D("%d replaced by a dup of %d\n", dup, orig);
+        fd_bitmap_remove(&stdin_fds, dup);
     }
-    pthread_mutex_unlock(&storage_mutex);
 }
 
 void stdin_fd_tracker_did_close(int target) {
-    pthread_mutex_lock(&storage_mutex);
-    intset_t* fds = get_storage();
-    if (intset_contains(fds, target)) {
-        D("removing %d\n as dup of stdin", target);
-        remove_from_intset(fds, target);
+    if (fd_bitmap_contains(&stdin_fds, target)) {
+        D("removing %d as dup of stdin\n", target);
+        fd_bitmap_remove(&stdin_fds, target);
     }
-    pthread_mutex_unlock(&storage_mutex);
+#ifdef __linux__
+    forget_epoll_registrations_of(target);
+#endif
 }
 
-int stdin_fd_tracker_augment_select_result(int max, fd_set *orig_fds __restrict, fd_set *changed_fds) {
-    pthread_mutex_lock(&storage_mutex);
-    intset_t* storage = get_storage();
+int stdin_fd_tracker_augment_select_result(int max, fd_set * __restrict orig_fds, fd_set * __restrict changed_fds) {
     int count = 0;
 
-    int i;
-    for (i = 0; i < intset_size(storage); ++i) {
-        int fd = intset_get(storage, i);
-        if(fd >= max)
-            continue;
-
+    int fd;
+    for (fd = fd_bitmap_next(&stdin_fds, 0, max); fd != -1; fd = fd_bitmap_next(&stdin_fds, fd + 1, max)) {
         if (FD_ISSET(fd, orig_fds) && !FD_ISSET(fd, changed_fds) && fd_is_owned_by_tm(fd)) {
             ++count;
             FD_SET(fd, changed_fds);
         }
     }
-    
-    pthread_mutex_unlock(&storage_mutex);
-    
+
     return count;
 }
 
 int stdin_fd_tracker_count_stdins_in_fdset(int max, fd_set *fds) {
-    pthread_mutex_lock(&storage_mutex);
-    intset_t* storage = get_storage();
     int count = 0;
 
+    int fd;
+    for (fd = fd_bitmap_next(&stdin_fds, 0, max); fd != -1; fd = fd_bitmap_next(&stdin_fds, fd + 1, max)) {
+        if (FD_ISSET(fd, fds) && fd_is_owned_by_tm(fd)) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+#define POLL_READ_EVENTS (POLLIN | POLLRDNORM)
+
+// poll() entries asking to read a stdin TextMate owns
+static bool pollfd_waits_for_stdin(struct pollfd *pfd) {
+    return (pfd->events & POLL_READ_EVENTS) && fd_bitmap_contains(&stdin_fds, pfd->fd) && fd_is_owned_by_tm(pfd->fd);
+}
+
+int stdin_fd_tracker_count_stdins_in_pollfds(struct pollfd *fds, nfds_t nfds) {
+    int count = 0;
+
+    nfds_t i;
+    for (i = 0; i < nfds; ++i) {
+        if (pollfd_waits_for_stdin(&fds[i])) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+// Returns how many entries became ready, which the caller adds to poll()'s result
+int stdin_fd_tracker_augment_poll_result(struct pollfd *fds, nfds_t nfds) {
+    int count = 0;
+
+    nfds_t i;
+    for (i = 0; i < nfds; ++i) {
+        if (pollfd_waits_for_stdin(&fds[i]) && !(fds[i].revents & POLL_READ_EVENTS)) {
+            if (fds[i].revents == 0) ++count;
+            fds[i].revents |= fds[i].events & POLL_READ_EVENTS;
+        }
+    }
+
+    return count;
+}
+
+#ifdef __linux__
+
+/*
+    epoll keeps its interest list in the kernel, so we remember which epoll
+    instances watch a stdin for reading, along with the data the caller
+    registered, to be able to hand back the event epoll_wait() would have.
+*/
+
+typedef struct {
+    int epfd;
+    int fd;
+    uint32_t events;
+    epoll_data_t data;
+    int readiness_fd; // added to epfd for this stdin, or -1
+} epoll_registration_t;
+
+static pthread_mutex_t epoll_mutex = PTHREAD_MUTEX_INITIALIZER;
+static epoll_registration_t* epoll_registrations = NULL;
+static int epoll_registration_count = 0;
+static int epoll_registration_capacity = 0;
+
+// Only call this if you have locked the epoll mutex
+static void remove_epoll_registration(int i) {
+    epoll_registrations[i] = epoll_registrations[epoll_registration_count - 1];
+    __atomic_store_n(&epoll_registration_count, epoll_registration_count - 1, __ATOMIC_RELEASE);
+}
+
+// Only call this if you have locked the epoll mutex
+static int find_epoll_registration(int epfd, int fd) {
+    int i;
+    for (i = 0; i < epoll_registration_count; ++i) {
+        if (epoll_registrations[i].epfd == epfd && epoll_registrations[i].fd == fd) return i;
+    }
+    return -1;
+}
+
+// Called on every close(), so programs that never put a stdin in an epoll don't take the lock
+static void forget_epoll_registrations_of(int fd) {
+    if (__atomic_load_n(&epoll_registration_count, __ATOMIC_ACQUIRE) == 0) return;
+
+    pthread_mutex_lock(&epoll_mutex);
+    int i;
+    for (i = epoll_registration_count - 1; i >= 0; --i) {
+        if (epoll_registrations[i].epfd == fd || epoll_registrations[i].fd == fd) remove_epoll_registration(i);
+        else if (epoll_registrations[i].readiness_fd == fd) epoll_registrations[i].readiness_fd = -1;
+    }
+    pthread_mutex_unlock(&epoll_mutex);
+}
+
+// Only call this if you have locked the epoll mutex
+static int epoll_readiness_fd(int epfd) {
+    int i;
+    for (i = 0; i < epoll_registration_count; ++i) {
+        if (epoll_registrations[i].epfd == epfd && epoll_registrations[i].readiness_fd != -1) return epoll_registrations[i].readiness_fd;
+    }
+    return -1;
+}
+
+// Returns the readiness descriptor epfd no longer needs once its last stdin is gone, or -1
+int stdin_fd_tracker_did_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    if (op == EPOLL_CTL_DEL ? __atomic_load_n(&epoll_registration_count, __ATOMIC_ACQUIRE) == 0 : !fd_bitmap_contains(&stdin_fds, fd))
+        return -1;
+
+    pthread_mutex_lock(&epoll_mutex);
+    int unneeded_readiness_fd = -1;
+
+    int i = find_epoll_registration(epfd, fd);
+    if (op == EPOLL_CTL_DEL) {
+        if (i != -1) {
+            int readiness_fd = epoll_registrations[i].readiness_fd;
+            remove_epoll_registration(i);
+            if (readiness_fd != -1 && epoll_readiness_fd(epfd) == -1) unneeded_readiness_fd = readiness_fd;
+        }
+    } else if (event != NULL) {
+        if (i == -1) {
+            if (epoll_registration_count == epoll_registration_capacity) {
+                int capacity = epoll_registration_capacity ? epoll_registration_capacity * 2 : 4;
+                epoll_registration_t* grown = realloc(epoll_registrations, capacity * sizeof(epoll_registration_t));
+                if (grown == NULL) die("failed to allocate epoll registrations");
+                epoll_registrations = grown;
+                epoll_registration_capacity = capacity;
+            }
+            i = epoll_registration_count;
+            __atomic_store_n(&epoll_registration_count, i + 1, __ATOMIC_RELEASE);
+        }
+        D("epoll %d watches stdin %d for 0x%x\n", epfd, fd, event->events);
+        epoll_registrations[i] = (epoll_registration_t){ epfd, fd, event->events, event->data, epoll_readiness_fd(epfd) };
+    }
+
+    pthread_mutex_unlock(&epoll_mutex);
+    return unneeded_readiness_fd;
+}
+
+bool stdin_fd_tracker_epoll_watches_readiness(int epfd, int readiness_fd) {
+    pthread_mutex_lock(&epoll_mutex);
+    bool watches = (epoll_readiness_fd(epfd) == readiness_fd);
+    pthread_mutex_unlock(&epoll_mutex);
+    return watches;
+}
+
+void stdin_fd_tracker_did_add_readiness_to_epoll(int epfd, int readiness_fd) {
+    pthread_mutex_lock(&epoll_mutex);
+    int i;
+    for (i = 0; i < epoll_registration_count; ++i) {
+        if (epoll_registrations[i].epfd == epfd) epoll_registrations[i].readiness_fd = readiness_fd;
+    }
+    pthread_mutex_unlock(&epoll_mutex);
+}
+
+int stdin_fd_tracker_count_stdins_in_epoll(int epfd) {
+    if (__atomic_load_n(&epoll_registration_count, __ATOMIC_ACQUIRE) == 0) return 0;
+
+    pthread_mutex_lock(&epoll_mutex);
+    int count = 0;
+
+    int i;
+    for (i = 0; i < epoll_registration_count; ++i) {
+        epoll_registration_t* r = &epoll_registrations[i];
+        if (r->epfd == epfd && (r->events & EPOLLIN) && fd_is_owned_by_tm(r->fd)) {
+            ++count;
+        }
+    }
+
+    pthread_mutex_unlock(&epoll_mutex);
+
+    return count;
+}
+
+// Returns the new number of events, adding one for each stdin the kernel didn't report
+int stdin_fd_tracker_augment_epoll_result(int epfd, struct epoll_event *events, int count, int maxevents) {
+    pthread_mutex_lock(&epoll_mutex);
+
     int i;
-    for (i = 0; i < intset_size(storage); ++i) {
-        int fd = intset_get(storage, i);
-        if(fd >= max)
+    for (i = 0; i < epoll_registration_count && count < maxevents; ++i) {
+        epoll_registration_t* r = &epoll_registrations[i];
+        if (r->epfd != epfd || !(r->events & EPOLLIN) || !fd_is_owned_by_tm(r->fd))
             continue;
 
-        if (FD_ISSET(fd, fds) && fd_is_owned_by_tm(fd)) {
+        // The kernel reports a descriptor with the data it was registered with
+        int j;
+        for (j = 0; j < count; ++j) {
+            if (events[j].data.u64 == r->data.u64) break;
+        }
+
+        if (j < count) {
+            events[j].events |= EPOLLIN;
+        } else {
+            events[count].events = EPOLLIN;
+            events[count].data = r->data;
             ++count;
         }
     }
-    
-    pthread_mutex_unlock(&storage_mutex);
-    
+
+    pthread_mutex_unlock(&epoll_mutex);
+
     return count;
-}
\ No newline at end of file
+}
+
+#endif
@@ -3,11 +3,25 @@
 
 #include <stdbool.h>
 #include <sys/select.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 bool stdin_fd_tracker_is_stdin(int);
 void stdin_fd_tracker_did_dup(int,int);
 void stdin_fd_tracker_did_close(int);
 int stdin_fd_tracker_augment_select_result(int, fd_set * __restrict, fd_set * __restrict);
 int stdin_fd_tracker_count_stdins_in_fdset(int max, fd_set *fds);
+int stdin_fd_tracker_count_stdins_in_pollfds(struct pollfd *fds, nfds_t nfds);
+int stdin_fd_tracker_augment_poll_result(struct pollfd *fds, nfds_t nfds);
+
+#ifdef __linux__
+int stdin_fd_tracker_did_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+bool stdin_fd_tracker_epoll_watches_readiness(int epfd, int readiness_fd);
+void stdin_fd_tracker_did_add_readiness_to_epoll(int epfd, int readiness_fd);
+int stdin_fd_tracker_count_stdins_in_epoll(int epfd);
+int stdin_fd_tracker_augment_epoll_result(int epfd, struct epoll_event *events, int count, int maxevents);
+#endif
 
 #endif /* _STDIN_FD_TRACKER_H_ */
@@ -0,0 +1,136 @@
+#include "stdin_readiness.h"
+#include "system_function_overrides.h"
+#include "die.h"
+#include "debug.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+static pthread_mutex_t readiness_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t readiness_once = PTHREAD_ONCE_INIT;
+
+// On Linux one eventfd is both ends, elsewhere a pipe: we wait on [0] and signal [1]
+static int readiness_fds[2] = { -1, -1 };
+
+// A dialog is due until the user sends EOF, and again once there's a new prompt
+static bool input_buffered = false, dialog_due = true;
+static bool signalled = false, reported = false;
+
+// A forked child must not signal its parent
+static void close_readiness_fds_in_child() {
+    if (readiness_fds[0] != -1) system_close(readiness_fds[0]);
+    if (readiness_fds[1] != readiness_fds[0]) system_close(readiness_fds[1]);
+    readiness_fds[0] = readiness_fds[1] = -1;
+    signalled = false;
+}
+
+static void register_fork_handler() {
+    pthread_atfork(NULL, NULL, close_readiness_fds_in_child);
+}
+
+// Only call this if you have locked the readiness mutex
+static void create_readiness_fds() {
+    pthread_once(&readiness_once, register_fork_handler);
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) die("failed to create stdin readiness eventfd");
+    readiness_fds[0] = readiness_fds[1] = fd;
+#else
+    if (pipe(readiness_fds) < 0) die("failed to create stdin readiness pipe");
+    int i;
+    for (i = 0; i < 2; ++i) {
+        fcntl(readiness_fds[i], F_SETFL, fcntl(readiness_fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(readiness_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    signalled = false;
+    D("created readiness fd %d\n", readiness_fds[0]);
+}
+
+// Only call this if you have locked the readiness mutex
+static void update_readiness() {
+    bool should_signal = input_buffered || dialog_due;
+    if (readiness_fds[0] == -1) {
+        signalled = should_signal;
+        return;
+    }
+    if (should_signal == signalled) return;
+
+    if (should_signal) {
+#ifdef __linux__
+        uint64_t one = 1;
+        system_write(readiness_fds[1], &one, sizeof(one));
+#else
+        system_write(readiness_fds[1], "", 1);
+#endif
+    } else {
+        char drain[8];
+        while (system_read(readiness_fds[0], drain, sizeof(drain)) > 0)
+            ;
+    }
+    signalled = should_signal;
+    D("readiness %s\n", signalled ? "signalled" : "cleared");
+}
+
+int stdin_readiness_fd() {
+    pthread_mutex_lock(&readiness_mutex);
+    if (readiness_fds[0] == -1) {
+        create_readiness_fds();
+        update_readiness();
+    }
+    int fd = readiness_fds[0];
+    pthread_mutex_unlock(&readiness_mutex);
+    return fd;
+}
+
+bool stdin_readiness_is_signalled() {
+    return __atomic_load_n(&input_buffered, __ATOMIC_ACQUIRE) || __atomic_load_n(&dialog_due, __ATOMIC_ACQUIRE);
+}
+
+bool stdin_readiness_has_buffered_input() {
+    return __atomic_load_n(&input_buffered, __ATOMIC_ACQUIRE);
+}
+
+void stdin_readiness_set_input_buffered(bool buffered) {
+    if (__atomic_load_n(&input_buffered, __ATOMIC_ACQUIRE) == buffered) return;
+
+    pthread_mutex_lock(&readiness_mutex);
+    __atomic_store_n(&input_buffered, buffered, __ATOMIC_RELEASE);
+    update_readiness();
+    pthread_mutex_unlock(&readiness_mutex);
+}
+
+void stdin_readiness_set_dialog_due(bool due) {
+    if (__atomic_load_n(&dialog_due, __ATOMIC_ACQUIRE) == due) return;
+
+    pthread_mutex_lock(&readiness_mutex);
+    __atomic_store_n(&dialog_due, due, __ATOMIC_RELEASE);
+    update_readiness();
+    pthread_mutex_unlock(&readiness_mutex);
+}
+
+void stdin_readiness_did_report() {
+    __atomic_store_n(&reported, true, __ATOMIC_RELEASE);
+}
+
+bool stdin_readiness_take_report() {
+    return __atomic_exchange_n(&reported, false, __ATOMIC_ACQ_REL);
+}
+
+// Programs that close every descriptor they don't know about get a new one on the next wait
+void stdin_readiness_did_close(int fd) {
+    if (fd != __atomic_load_n(&readiness_fds[0], __ATOMIC_RELAXED) && fd != __atomic_load_n(&readiness_fds[1], __ATOMIC_RELAXED)) return;
+
+    pthread_mutex_lock(&readiness_mutex);
+    if (fd == readiness_fds[0] || fd == readiness_fds[1]) {
+        int other = (fd == readiness_fds[0]) ? readiness_fds[1] : readiness_fds[0];
+        if (other != fd) system_close(other);
+        readiness_fds[0] = readiness_fds[1] = -1;
+    }
+    pthread_mutex_unlock(&readiness_mutex);
+}
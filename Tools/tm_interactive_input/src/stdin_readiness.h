@@ -0,0 +1,27 @@
+#ifndef _STDIN_READINESS_H_
+#define _STDIN_READINESS_H_
+
+#include <stdbool.h>
+
+/*
+    A descriptor that is readable whenever reading a stdin TextMate owns
+    would return without waiting on TextMate: input from the last dialog is
+    still buffered, or a dialog is due. Waits on stdin add it to their set
+    instead of giving up the caller's timeout.
+*/
+
+int stdin_readiness_fd();
+bool stdin_readiness_is_signalled();
+bool stdin_readiness_has_buffered_input();
+
+void stdin_readiness_set_input_buffered(bool);
+void stdin_readiness_set_dialog_due(bool);
+
+// A wait reported stdin readable because of us, so the next read should
+// give an answer even if the caller made stdin non blocking
+void stdin_readiness_did_report();
+bool stdin_readiness_take_report();
+
+void stdin_readiness_did_close(int);
+
+#endif /* _STDIN_READINESS_H_ */
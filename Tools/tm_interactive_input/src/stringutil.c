@@ -2,6 +2,8 @@
 #include "die.h"
 #include "debug.h"
 
+#ifdef __APPLE__
+
 char* cfstr_2_cstr(CFStringRef cfstr) {
     size_t cstr_size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(cfstr), kCFStringEncodingUTF8) + 1;
     char *cstr = malloc(cstr_size);
@@ -17,4 +19,5 @@ CFStringRef cstr_2_cfstr(char* cstr) {
     CFStringRef cfstr = CFStringCreateWithCString(kCFAllocatorDefault, cstr, kCFStringEncodingUTF8);
     if (cfstr == NULL) die("failed to create CFStringRef from %s", cstr);
     return cfstr;
-}
\ No newline at end of file
+}
+#endif
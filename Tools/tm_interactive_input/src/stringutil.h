@@ -1,10 +1,13 @@
 #ifndef _STRINGUTIL_H_
 #define _STRINGUTIL_H_
 
-#include <CoreFoundation/CoreFoundation.h>
 #include <sys/types.h>
 
+#ifdef __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+
 char* cfstr_2_cstr(CFStringRef);
 CFStringRef cstr_2_cfstr(char*);
+#endif
 
 #endif /* _STRINGUTIL_H_ */
\ No newline at end of file
@@ -3,39 +3,200 @@
 #include "mode.h"
 #include "die.h"
 #include "debug.h"
+#include "trace.h"
 #include "stdin_fd_tracker.h"
 #include "textmate.h"
+#include "stdin_readiness.h"
 
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
-#include <CoreFoundation/CoreFoundation.h>
-#include <sys/errno.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stdarg.h>
 #include <dlfcn.h>
+#include <sys/socket.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
-ssize_t read_override(char* system_symbol, int d, void *buffer, size_t buffer_length) {
+typedef ssize_t (*read_impl_t)(int, void *, size_t);
+typedef ssize_t (*readv_impl_t)(int, const struct iovec *, int);
+typedef ssize_t (*write_impl_t)(int, const void *, size_t);
+typedef ssize_t (*writev_impl_t)(int, const struct iovec *, int);
+typedef ssize_t (*send_impl_t)(int, const void *, size_t, int);
+typedef ssize_t (*sendto_impl_t)(int, const void *, size_t, int, const struct sockaddr *, socklen_t);
+typedef int (*fflush_impl_t)(FILE *);
+typedef int (*select_impl_t)(int, fd_set * __restrict, fd_set * __restrict, fd_set * __restrict, struct timeval * __restrict);
+typedef int (*dup_impl_t)(int);
+typedef int (*dup2_impl_t)(int, int);
+typedef int (*fcntl_impl_t)(int, int, ...);
+typedef int (*close_impl_t)(int);
+typedef int (*poll_impl_t)(struct pollfd *, nfds_t, int);
+#ifdef __linux__
+typedef int (*dup3_impl_t)(int, int, int);
+typedef int (*ppoll_impl_t)(struct pollfd *, nfds_t, const struct timespec *, const sigset_t *);
+typedef int (*epoll_ctl_impl_t)(int, int, int, struct epoll_event *);
+typedef int (*epoll_wait_impl_t)(int, struct epoll_event *, int, int);
+typedef int (*epoll_pwait_impl_t)(int, struct epoll_event *, int, int, const sigset_t *);
+#endif
+
+// Everything we replace, in the order of system_symbols
+enum {
+    SYSTEM_READ,
+    SYSTEM_READV,
+    SYSTEM_WRITE,
+    SYSTEM_WRITEV,
+    SYSTEM_SEND,
+    SYSTEM_SENDTO,
+    SYSTEM_FFLUSH,
+    SYSTEM_DUP,
+    SYSTEM_DUP2,
+    SYSTEM_FCNTL,
+    SYSTEM_CLOSE,
+    SYSTEM_SELECT,
+    SYSTEM_POLL,
+#ifdef __linux__
+    SYSTEM_DUP3,
+    SYSTEM_FCNTL64,
+    SYSTEM_PPOLL,
+    SYSTEM_EPOLL_CTL,
+    SYSTEM_EPOLL_WAIT,
+    SYSTEM_EPOLL_PWAIT,
+#endif
+#ifdef __APPLE__
+    SYSTEM_READ_UNIX2003,
+    SYSTEM_READ_NOCANCEL_UNIX2003,
+    SYSTEM_WRITE_UNIX2003,
+    SYSTEM_WRITE_NOCANCEL_UNIX2003,
+    SYSTEM_SELECT_DARWINEXTSN,
+    SYSTEM_SELECT_DARWINEXTSN_NOCANCEL,
+    SYSTEM_SELECT_NOCANCEL_UNIX2003,
+    SYSTEM_SELECT_UNIX2003,
+#endif
+    SYSTEM_FUNCTION_COUNT
+};
+
+static char const* system_symbols[SYSTEM_FUNCTION_COUNT] = {
+    "read",
+    "readv",
+    "write",
+    "writev",
+    "send",
+    "sendto",
+    "fflush",
+    "dup",
+    "dup2",
+    "fcntl",
+    "close",
+    "select",
+    "poll",
+#ifdef __linux__
+    "dup3",
+    "fcntl64",
+    "ppoll",
+    "epoll_ctl",
+    "epoll_wait",
+    "epoll_pwait",
+#endif
+#ifdef __APPLE__
+    "read$UNIX2003",
+    "read$NOCANCEL$UNIX2003",
+    "write$UNIX2003",
+    "write$NOCANCEL$UNIX2003",
+    "select$DARWIN_EXTSN",
+    "select$DARWIN_EXTSN$NOCANCEL",
+    "select$NOCANCEL$UNIX2003",
+    "select$UNIX2003",
+#endif
+};
+
+static void* system_functions[SYSTEM_FUNCTION_COUNT];
+static bool system_functions_resolved = false;
+
+// Newer than the oldest libc we run with (fcntl64 came in glibc 2.28), so
+// the library mustn't refuse to load without them
+static bool is_optional(int which) {
+#ifdef __linux__
+    return which == SYSTEM_DUP3 || which == SYSTEM_FCNTL64 || which == SYSTEM_PPOLL || which == SYSTEM_EPOLL_PWAIT;
+#else
+    return false;
+#endif
+}
+
+// Runs when the library is loaded, so calls don't have to dlsym(). A
+// call made before that (from another library's initializer) resolves
+// them itself; every thread finds the same addresses, so that's safe.
+__attribute__((constructor))
+static void resolve_system_functions() {
+    int i;
+    for (i = 0; i < SYSTEM_FUNCTION_COUNT; ++i) {
+        if (system_functions[i] != NULL) continue;
+        system_functions[i] = dlsym(RTLD_NEXT, system_symbols[i]);
+        if (system_functions[i] != NULL) continue;
+        if (!is_optional(i)) die("failed to find system implementation of %s()", system_symbols[i]);
+        D("no system implementation of %s()\n", system_symbols[i]);
+    }
+    __atomic_store_n(&system_functions_resolved, true, __ATOMIC_RELEASE);
+    tm_interactive_input_get_mode();
+}
+
+// NULL only for an optional function the system doesn't have
+static inline void* system_function_if_any(int which) {
+    void* impl = system_functions[which];
+    if (__builtin_expect(impl == NULL, 0) && !__atomic_load_n(&system_functions_resolved, __ATOMIC_ACQUIRE)) {
+        resolve_system_functions();
+        impl = system_functions[which];
+    }
+    return impl;
+}
+
+static inline void* system_function(int which) {
+    void* impl = system_function_if_any(which);
+    // Only reached when a caller found the function somewhere else
+    if (__builtin_expect(impl == NULL, 0)) die("failed to find system implementation of %s()", system_symbols[which]);
+    return impl;
+}
+
+ssize_t read_override(int which, int d, void *buffer, size_t buffer_length) {
+    read_impl_t system_read_impl = system_function(which);
 
     // Only interested in STDIN
-    if (!tm_interactive_input_is_active() || !stdin_fd_tracker_is_stdin(d) || !fd_is_owned_by_tm(d)) 
-        return system_read(system_symbol, d, buffer, buffer_length);
+    if (!tm_interactive_input_is_active() || !stdin_fd_tracker_is_stdin(d))
+        return system_read_impl(d, buffer, buffer_length);
+
+    // The rest of the last answer comes first, without asking the pipe again
+    if (stdin_readiness_has_buffered_input())
+        return tm_dialog_read(buffer, buffer_length);
+
+    if (!fd_is_owned_by_tm(d))
+        return system_read_impl(d, buffer, buffer_length);
 
-    // It doesn't make sense to invoke tm_dialog if the caller wanted a non blocking read
+    // It doesn't make sense to invoke tm_dialog if the caller wanted a non blocking read,
+    // unless a wait told them stdin was readable: an event loop would spin on EAGAIN
+    bool reported = stdin_readiness_take_report();
     int oldFlags = fcntl(d, F_GETFL);
-    if (oldFlags & O_NONBLOCK) return system_read(system_symbol, d, buffer, buffer_length);
+    if (oldFlags & O_NONBLOCK) {
+        ssize_t bytes_read = system_read_impl(d, buffer, buffer_length);
+        if (bytes_read == -1 && errno == EAGAIN && (reported || stdin_readiness_has_buffered_input()))
+            return tm_dialog_read(buffer, buffer_length);
+        return bytes_read;
+    }
 
     if (tm_interactive_input_is_in_always_mode()) {
         return tm_dialog_read(buffer, buffer_length);
     } else {
         fcntl(d, F_SETFL, oldFlags | O_NONBLOCK);
-        ssize_t bytes_read = system_read(system_symbol, d, buffer, buffer_length);
+        ssize_t bytes_read = system_read_impl(d, buffer, buffer_length);
         fcntl(d, F_SETFL, oldFlags);
 
         /*
-            If reading from stdin produced an error, then we just return the result 
-            of the syscall (previously we died fatally). Except when the error is EAGAIN. 
-            Processes running under TM may have their stdin closed, and that will cause 
+            If reading from stdin produced an error, then we just return the result
+            of the syscall (previously we died fatally). Except when the error is EAGAIN.
+            Processes running under TM may have their stdin closed, and that will cause
             EAGAIN which in our context is not really an error.
         */
 
@@ -59,106 +220,433 @@ ssize_t read_override(char* system_symbol, int d, void *buffer, size_t buffer_le
 
         if(bytes_read == -1 && errno == EAGAIN)
             return tm_dialog_read(buffer, buffer_length);
-        
+
         return bytes_read;
     }
 }
 
-ssize_t system_read(char *symbol, int d, void *buffer, size_t buffer_length) {
-    int (*read_impl)(int, const void*, size_t) = dlsym(RTLD_NEXT, symbol);
+ssize_t system_read(int d, void *buffer, size_t buffer_length) {
+    read_impl_t read_impl = system_function(SYSTEM_READ);
     return read_impl(d, buffer, buffer_length);
 }
 
-ssize_t read(int d, void *buffer, size_t buffer_length) {
-    return read_override("read", d, buffer, buffer_length);
+INTERPOSED ssize_t read(int d, void *buffer, size_t buffer_length) {
+    TRACE_START();
+    return TRACE_END(TRACE_READ, d, read_override(SYSTEM_READ, d, buffer, buffer_length));
 }
 
-ssize_t read_unix2003(int d, void *buffer, size_t buffer_length) {
-    return read_override("read$UNIX2003", d, buffer, buffer_length);
+#ifdef __APPLE__
+INTERPOSED ssize_t read_unix2003(int d, void *buffer, size_t buffer_length) {
+    TRACE_START();
+    return TRACE_END(TRACE_READ, d, read_override(SYSTEM_READ_UNIX2003, d, buffer, buffer_length));
 }
 
-ssize_t read_nocancel_unix2003(int d, void *buffer, size_t buffer_length) {
-    return read_override("read$NOCANCEL$UNIX2003", d, buffer, buffer_length);
+INTERPOSED ssize_t read_nocancel_unix2003(int d, void *buffer, size_t buffer_length) {
+    TRACE_START();
+    return TRACE_END(TRACE_READ, d, read_override(SYSTEM_READ_NOCANCEL_UNIX2003, d, buffer, buffer_length));
 }
+#else
+// What read() becomes in programs built with _FORTIFY_SOURCE
+INTERPOSED ssize_t __read_chk(int d, void *buffer, size_t buffer_length, size_t buffer_size) {
+    TRACE_START();
+    if (buffer_length > buffer_size) abort();
+    return TRACE_END(TRACE_READ, d, read_override(SYSTEM_READ, d, buffer, buffer_length));
+}
+#endif
 
-ssize_t write_override(char *system_symbol, int d, const void *buffer, size_t buffer_length) {
-    if (tm_interactive_input_is_active() && (d == STDOUT_FILENO || d == STDERR_FILENO)) {
-        capture_for_prompt(buffer, buffer_length);
-    }
-    return system_write(system_symbol, d, buffer, buffer_length);
+/*
+    readv() fills the first buffer the way read() would, and the others
+    with whatever that dialog's answer has left, so a large answer arrives
+    in as few calls as the caller allows.
+*/
+
+ssize_t readv_override(int which, int d, const struct iovec *iov, int iovcnt) {
+    readv_impl_t system_readv_impl = system_function(which);
+
+    if (!tm_interactive_input_is_active() || !stdin_fd_tracker_is_stdin(d) || !fd_is_owned_by_tm(d))
+        return system_readv_impl(d, iov, iovcnt);
+
+    int i = 0;
+    while (i < iovcnt && iov[i].iov_len == 0) ++i;
+    if (i == iovcnt) return system_readv_impl(d, iov, iovcnt);
+
+    ssize_t bytes_read = read_override(SYSTEM_READ, d, iov[i].iov_base, iov[i].iov_len);
+    if (bytes_read == (ssize_t)iov[i].iov_len) bytes_read += tm_dialog_readv(iov + i + 1, iovcnt - i - 1);
+    return bytes_read;
 }
 
-ssize_t system_write(char *symbol, int d, const void *buffer, size_t buffer_length) {
-    int (*write_impl)(int, const void*, size_t) = dlsym(RTLD_NEXT, symbol);
+ssize_t system_readv(int d, const struct iovec *iov, int iovcnt) {
+    readv_impl_t readv_impl = system_function(SYSTEM_READV);
+    return readv_impl(d, iov, iovcnt);
+}
+
+INTERPOSED ssize_t readv(int d, const struct iovec *iov, int iovcnt) {
+    TRACE_START();
+    return TRACE_END(TRACE_READV, d, readv_override(SYSTEM_READV, d, iov, iovcnt));
+}
+
+static inline bool is_prompt_fd(int d) {
+    return tm_interactive_input_is_active() && (d == STDOUT_FILENO || d == STDERR_FILENO);
+}
+
+ssize_t write_override(int which, int d, const void *buffer, size_t buffer_length) {
+    write_impl_t system_write_impl = system_function(which);
+    if (is_prompt_fd(d)) capture_for_prompt(buffer, buffer_length);
+    return system_write_impl(d, buffer, buffer_length);
+}
+
+ssize_t system_write(int d, const void *buffer, size_t buffer_length) {
+    write_impl_t write_impl = system_function(SYSTEM_WRITE);
     return write_impl(d, buffer, buffer_length);
 }
 
-ssize_t write(int d, const void *buffer, size_t buffer_length) {
-    return write_override("write", d, buffer, buffer_length);
+INTERPOSED ssize_t write(int d, const void *buffer, size_t buffer_length) {
+    TRACE_START();
+    return TRACE_END(TRACE_WRITE, d, write_override(SYSTEM_WRITE, d, buffer, buffer_length));
+}
+
+INTERPOSED ssize_t writev(int d, const struct iovec *iov, int iovcnt) {
+    TRACE_START();
+    writev_impl_t writev_impl = system_function(SYSTEM_WRITEV);
+    if (is_prompt_fd(d)) capture_iovec_for_prompt(iov, iovcnt);
+    return TRACE_END(TRACE_WRITEV, d, writev_impl(d, iov, iovcnt));
+}
+
+// stdout may be a socket rather than a pipe
+INTERPOSED ssize_t send(int d, const void *buffer, size_t buffer_length, int flags) {
+    TRACE_START();
+    send_impl_t send_impl = system_function(SYSTEM_SEND);
+    if (is_prompt_fd(d)) capture_for_prompt(buffer, buffer_length);
+    return TRACE_END(TRACE_SEND, d, send_impl(d, buffer, buffer_length, flags));
+}
+
+INTERPOSED ssize_t sendto(int d, const void *buffer, size_t buffer_length, int flags, const struct sockaddr *address, socklen_t address_length) {
+    TRACE_START();
+    sendto_impl_t sendto_impl = system_function(SYSTEM_SENDTO);
+    if (is_prompt_fd(d)) capture_for_prompt(buffer, buffer_length);
+    return TRACE_END(TRACE_SENDTO, d, sendto_impl(d, buffer, buffer_length, flags, address, address_length));
+}
+
+INTERPOSED int fflush(FILE *stream) {
+    TRACE_START();
+    fflush_impl_t fflush_impl = system_function(SYSTEM_FFLUSH);
+    if (tm_interactive_input_is_active()) {
+        if (stream != NULL) {
+            capture_stdio_for_prompt(stream);
+        } else {
+            capture_stdio_for_prompt(stderr);
+            capture_stdio_for_prompt(stdout);
+        }
+    }
+    return TRACE_END(TRACE_FFLUSH, stream != NULL ? fileno(stream) : -1, fflush_impl(stream));
 }
 
-ssize_t write_unix2003(int d, const void *buffer, size_t buffer_length) {
-    return write_override("write$UNIX2003", d, buffer, buffer_length);
+#ifdef __APPLE__
+INTERPOSED ssize_t write_unix2003(int d, const void *buffer, size_t buffer_length) {
+    TRACE_START();
+    return TRACE_END(TRACE_WRITE, d, write_override(SYSTEM_WRITE_UNIX2003, d, buffer, buffer_length));
 }
 
-ssize_t write_nocancel_unix2003(int d, const void *buffer, size_t buffer_length) {
-    return write_override("write$NOCANCEL$UNIX2003", d, buffer, buffer_length);
+INTERPOSED ssize_t write_nocancel_unix2003(int d, const void *buffer, size_t buffer_length) {
+    TRACE_START();
+    return TRACE_END(TRACE_WRITE, d, write_override(SYSTEM_WRITE_NOCANCEL_UNIX2003, d, buffer, buffer_length));
 }
+#endif
 
-int dup(int orig) {
-    int (*system_dup)(int) = dlsym(RTLD_NEXT, "dup");
+INTERPOSED int dup(int orig) {
+    TRACE_START();
+    dup_impl_t system_dup = system_function(SYSTEM_DUP);
     int dup = system_dup(orig);
     if (tm_interactive_input_is_active()) stdin_fd_tracker_did_dup(orig, dup);
-    return dup;
+    return TRACE_END(TRACE_DUP, orig, dup);
 }
 
-int close(int fd) {
-    int (*system_close)(int) = dlsym(RTLD_NEXT, "close");
-    int res = system_close(fd);
-    if (tm_interactive_input_is_active()) stdin_fd_tracker_did_close(fd);
+INTERPOSED int dup2(int orig, int target) {
+    TRACE_START();
+    dup2_impl_t system_dup2 = system_function(SYSTEM_DUP2);
+    int dup = system_dup2(orig, target);
+    if (tm_interactive_input_is_active()) stdin_fd_tracker_did_dup(orig, dup);
+    return TRACE_END(TRACE_DUP2, orig, dup);
+}
+
+#ifdef __linux__
+INTERPOSED int dup3(int orig, int target, int flags) {
+    TRACE_START();
+    dup3_impl_t system_dup3 = system_function(SYSTEM_DUP3);
+    int dup = system_dup3(orig, target, flags);
+    if (tm_interactive_input_is_active()) stdin_fd_tracker_did_dup(orig, dup);
+    return TRACE_END(TRACE_DUP3, orig, dup);
+}
+#endif
+
+// Every command takes at most one argument, an int or a pointer, so we pass it on as a pointer
+int fcntl_override(int which, int fd, int cmd, void *arg) {
+    // fcntl() takes the same commands where there's no fcntl64()
+    fcntl_impl_t fcntl_impl = system_function_if_any(which);
+    if (fcntl_impl == NULL) fcntl_impl = system_function(SYSTEM_FCNTL);
+    int res = fcntl_impl(fd, cmd, arg);
+
+#ifdef F_DUPFD_CLOEXEC
+    bool is_dup = (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC);
+#else
+    bool is_dup = (cmd == F_DUPFD);
+#endif
+    if (is_dup && tm_interactive_input_is_active()) stdin_fd_tracker_did_dup(fd, res);
     return res;
 }
 
-int system_select(char * symbol, int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
-    int (*select_impl)(int, fd_set * __restrict, fd_set * __restrict, fd_set * __restrict, struct timeval * __restrict) = dlsym(RTLD_NEXT, symbol);
+INTERPOSED int fcntl(int fd, int cmd, ...) {
+    TRACE_START();
+    va_list ap;
+    va_start(ap, cmd);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+    return TRACE_END(TRACE_FCNTL, fd, fcntl_override(SYSTEM_FCNTL, fd, cmd, arg));
+}
+
+#ifdef __linux__
+// What fcntl() becomes in programs built with _FILE_OFFSET_BITS=64
+INTERPOSED int fcntl64(int fd, int cmd, ...) {
+    TRACE_START();
+    va_list ap;
+    va_start(ap, cmd);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+    return TRACE_END(TRACE_FCNTL, fd, fcntl_override(SYSTEM_FCNTL64, fd, cmd, arg));
+}
+#endif
+
+INTERPOSED int close(int fd) {
+    TRACE_START();
+    close_impl_t close_impl = system_function(SYSTEM_CLOSE);
+    int res = close_impl(fd);
+    if (tm_interactive_input_is_active()) {
+        stdin_fd_tracker_did_close(fd);
+        stdin_readiness_did_close(fd);
+    }
+    return TRACE_END(TRACE_CLOSE, fd, res);
+}
+
+int system_close(int fd) {
+    close_impl_t close_impl = system_function(SYSTEM_CLOSE);
+    return close_impl(fd);
+}
+
+int system_select(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
+    select_impl_t select_impl = system_function(SYSTEM_SELECT);
     return select_impl(nfds, readfds, writefds, errorfds, timeout);
 }
 
-int select_override(char * system_symbol, int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
-    int result;
-    
-    if (readfds == NULL) {
-        result = system_select(system_symbol, nfds, readfds, writefds, errorfds, timeout);
+int select_override(int which, int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
+    select_impl_t select_impl = system_function(which);
+
+    if (readfds == NULL || !tm_interactive_input_is_active() || stdin_fd_tracker_count_stdins_in_fdset(nfds, readfds) == 0)
+        return select_impl(nfds, readfds, writefds, errorfds, timeout);
+
+    // Wait on the readiness descriptor alongside the caller's, keeping their timeout
+    fd_set orig_readfds = *readfds;
+    int readiness_fd = stdin_readiness_fd();
+    bool watch_readiness = readiness_fd < FD_SETSIZE;
+    struct timeval t = { };
+
+    if (watch_readiness) {
+        FD_SET(readiness_fd, readfds);
+    } else if (stdin_readiness_is_signalled()) {
+        timeout = &t;
+    }
+
+    int result = select_impl(watch_readiness && readiness_fd >= nfds ? readiness_fd + 1 : nfds, readfds, writefds, errorfds, timeout);
+    if (result == -1) return result;
+
+    bool ready;
+    if (watch_readiness) {
+        ready = FD_ISSET(readiness_fd, readfds);
+        if (ready) --result;
+        FD_CLR(readiness_fd, readfds);
     } else {
-        fd_set orig_readfds; FD_ZERO(&orig_readfds); FD_COPY(readfds, &orig_readfds);
-        struct timeval t = { };
-        
-        if (stdin_fd_tracker_count_stdins_in_fdset(nfds, readfds) > 0)
-            timeout = &t;
-        
-        result = system_select(system_symbol, nfds, readfds, writefds, errorfds, timeout);
-        if (result != -1) result += stdin_fd_tracker_augment_select_result(nfds, &orig_readfds, readfds);
+        ready = stdin_readiness_is_signalled();
+    }
+
+    if (ready) {
+        int added = stdin_fd_tracker_augment_select_result(nfds, &orig_readfds, readfds);
+        if (added > 0) stdin_readiness_did_report();
+        result += added;
     }
 
     return result;
 }
 
-int select(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
-    return select_override("select", nfds, readfds, writefds, errorfds, timeout);
+INTERPOSED int select(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
+    TRACE_START();
+    return TRACE_END(TRACE_SELECT, nfds, select_override(SYSTEM_SELECT, nfds, readfds, writefds, errorfds, timeout));
+}
+
+#ifdef __APPLE__
+INTERPOSED int select_darwinextsn(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
+    TRACE_START();
+    return TRACE_END(TRACE_SELECT, nfds, select_override(SYSTEM_SELECT_DARWINEXTSN, nfds, readfds, writefds, errorfds, timeout));
+}
+
+INTERPOSED int select_darwinextsn_nocancel(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
+    TRACE_START();
+    return TRACE_END(TRACE_SELECT, nfds, select_override(SYSTEM_SELECT_DARWINEXTSN_NOCANCEL, nfds, readfds, writefds, errorfds, timeout));
 }
 
-int select_darwinextsn(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
-    return select_override("select$DARWIN_EXTSN", nfds, readfds, writefds, errorfds, timeout);
+INTERPOSED int select_nocancel_unix2003(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
+    TRACE_START();
+    return TRACE_END(TRACE_SELECT, nfds, select_override(SYSTEM_SELECT_NOCANCEL_UNIX2003, nfds, readfds, writefds, errorfds, timeout));
 }
 
-int select_darwinextsn_nocancel(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
-    return select_override("select$DARWIN_EXTSN$NOCANCEL", nfds, readfds, writefds, errorfds, timeout);
+INTERPOSED int select_unix2003(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
+    TRACE_START();
+    return TRACE_END(TRACE_SELECT, nfds, select_override(SYSTEM_SELECT_UNIX2003, nfds, readfds, writefds, errorfds, timeout));
+}
+#endif
+
+static int call_poll(int which, struct pollfd *fds, nfds_t nfds, int timeout, const struct timespec *timeout_ts, const sigset_t *sigmask) {
+#ifdef __linux__
+    if (which == SYSTEM_PPOLL) {
+        ppoll_impl_t ppoll_impl = system_function(SYSTEM_PPOLL);
+        return ppoll_impl(fds, nfds, timeout_ts, sigmask);
+    }
+#endif
+    poll_impl_t poll_impl = system_function(which);
+    return poll_impl(fds, nfds, timeout);
+}
+
+/*
+    poll() and ppoll() get the same treatment as select(): the readiness
+    descriptor is appended to a copy of the caller's entries.
+*/
+
+int poll_override(int which, struct pollfd *fds, nfds_t nfds, int timeout, const struct timespec *timeout_ts, const sigset_t *sigmask) {
+    if (!tm_interactive_input_is_active() || stdin_fd_tracker_count_stdins_in_pollfds(fds, nfds) == 0)
+        return call_poll(which, fds, nfds, timeout, timeout_ts, sigmask);
+
+    struct pollfd small[16];
+    struct pollfd* all = (nfds < sizeof(small) / sizeof(small[0])) ? small : malloc((nfds + 1) * sizeof(struct pollfd));
+    if (all == NULL) die("failed to allocate pollfds");
+
+    memcpy(all, fds, nfds * sizeof(struct pollfd));
+    all[nfds].fd = stdin_readiness_fd();
+    all[nfds].events = POLLIN;
+    all[nfds].revents = 0;
+
+    int result = call_poll(which, all, nfds + 1, timeout, timeout_ts, sigmask);
+    if (result != -1) {
+        nfds_t i;
+        for (i = 0; i < nfds; ++i) fds[i].revents = all[i].revents;
+
+        if (all[nfds].revents != 0) --result;
+        if (all[nfds].revents & POLLIN) {
+            int added = stdin_fd_tracker_augment_poll_result(fds, nfds);
+            if (added > 0) stdin_readiness_did_report();
+            result += added;
+        }
+    }
+
+    if (all != small) free(all);
+    return result;
+}
+
+INTERPOSED int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    TRACE_START();
+    return TRACE_END(TRACE_POLL, (int)nfds, poll_override(SYSTEM_POLL, fds, nfds, timeout, NULL, NULL));
+}
+
+#ifdef __linux__
+// What poll() becomes in programs built with _FORTIFY_SOURCE
+INTERPOSED int __poll_chk(struct pollfd *fds, nfds_t nfds, int timeout, size_t fds_size) {
+    TRACE_START();
+    if (fds_size / sizeof(struct pollfd) < nfds) abort();
+    return TRACE_END(TRACE_POLL, (int)nfds, poll_override(SYSTEM_POLL, fds, nfds, timeout, NULL, NULL));
+}
+
+INTERPOSED int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout, const sigset_t *sigmask) {
+    TRACE_START();
+    return TRACE_END(TRACE_PPOLL, (int)nfds, poll_override(SYSTEM_PPOLL, fds, nfds, -1, timeout, sigmask));
+}
+
+INTERPOSED int __ppoll_chk(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout, const sigset_t *sigmask, size_t fds_size) {
+    TRACE_START();
+    if (fds_size / sizeof(struct pollfd) < nfds) abort();
+    return TRACE_END(TRACE_PPOLL, (int)nfds, poll_override(SYSTEM_PPOLL, fds, nfds, -1, timeout, sigmask));
+}
+
+/*
+    For epoll we watch the interest list being built. An instance waiting
+    on a stdin also gets the readiness descriptor, tagged so we can take
+    its events out again and put in the ones the kernel would report for
+    stdin.
+*/
+
+static char readiness_tag;
+
+INTERPOSED int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    TRACE_START();
+    epoll_ctl_impl_t epoll_ctl_impl = system_function(SYSTEM_EPOLL_CTL);
+    int res = epoll_ctl_impl(epfd, op, fd, event);
+    if (res == 0 && tm_interactive_input_is_active()) {
+        int unneeded_readiness_fd = stdin_fd_tracker_did_epoll_ctl(epfd, op, fd, event);
+        if (unneeded_readiness_fd != -1) epoll_ctl_impl(epfd, EPOLL_CTL_DEL, unneeded_readiness_fd, NULL);
+    }
+    return TRACE_END(TRACE_EPOLL_CTL, fd, res);
+}
+
+static bool epoll_watches_readiness(int epfd, int readiness_fd) {
+    if (stdin_fd_tracker_epoll_watches_readiness(epfd, readiness_fd)) return true;
+
+    epoll_ctl_impl_t epoll_ctl_impl = system_function(SYSTEM_EPOLL_CTL);
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &readiness_tag };
+    if (epoll_ctl_impl(epfd, EPOLL_CTL_ADD, readiness_fd, &event) == -1 && errno != EEXIST) return false;
+
+    stdin_fd_tracker_did_add_readiness_to_epoll(epfd, readiness_fd);
+    return true;
+}
+
+int epoll_pwait_override(int epfd, struct epoll_event *events, int maxevents, int timeout, const sigset_t *sigmask, bool with_sigmask) {
+    bool watches_stdin = tm_interactive_input_is_active() && stdin_fd_tracker_count_stdins_in_epoll(epfd) > 0;
+    bool watch_readiness = watches_stdin && epoll_watches_readiness(epfd, stdin_readiness_fd());
+    if (watches_stdin && !watch_readiness && stdin_readiness_is_signalled()) timeout = 0;
+
+    int result;
+    if (with_sigmask) {
+        epoll_pwait_impl_t epoll_pwait_impl = system_function(SYSTEM_EPOLL_PWAIT);
+        result = epoll_pwait_impl(epfd, events, maxevents, timeout, sigmask);
+    } else {
+        epoll_wait_impl_t epoll_wait_impl = system_function(SYSTEM_EPOLL_WAIT);
+        result = epoll_wait_impl(epfd, events, maxevents, timeout);
+    }
+    if (!watches_stdin || result == -1) return result;
+
+    bool ready;
+    if (watch_readiness) {
+        ready = false;
+        int i, kept = 0;
+        for (i = 0; i < result; ++i) {
+            if (events[i].data.ptr == &readiness_tag) ready = true;
+            else events[kept++] = events[i];
+        }
+        result = kept;
+    } else {
+        ready = stdin_readiness_is_signalled();
+    }
+
+    if (ready) {
+        int count = stdin_fd_tracker_augment_epoll_result(epfd, events, result, maxevents);
+        if (count > result) stdin_readiness_did_report();
+        result = count;
+    }
+    return result;
 }
 
-int select_nocancel_unix2003(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
-    return select_override("select$NOCANCEL$UNIX2003", nfds, readfds, writefds, errorfds, timeout);
+INTERPOSED int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    TRACE_START();
+    return TRACE_END(TRACE_EPOLL_WAIT, epfd, epoll_pwait_override(epfd, events, maxevents, timeout, NULL, false));
 }
 
-int select_unix2003(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout) {
-    return select_override("select$UNIX2003", nfds, readfds, writefds, errorfds, timeout);
+INTERPOSED int epoll_pwait(int epfd, struct epoll_event *events, int maxevents, int timeout, const sigset_t *sigmask) {
+    TRACE_START();
+    return TRACE_END(TRACE_EPOLL_PWAIT, epfd, epoll_pwait_override(epfd, events, maxevents, timeout, sigmask, true));
 }
+#endif
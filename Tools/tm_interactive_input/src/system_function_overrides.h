@@ -3,22 +3,35 @@
 
 #include <sys/types.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 
-ssize_t system_read(char*, int, void *, size_t);
+// The functions we replace are the only symbols the library exports
+#define INTERPOSED __attribute__((visibility("default")))
+
+// Calls the implementation we replaced, looked up once at load time
+ssize_t system_read(int, void *, size_t);
+ssize_t system_readv(int, const struct iovec *, int);
+ssize_t system_write(int, const void *, size_t);
+int system_close(int);
+int system_select(int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout);
+
+#ifdef __APPLE__
 ssize_t read(int, void *, size_t) __asm("_read");
 ssize_t read_unix2003(int, void *, size_t) __asm("_read$UNIX2003");
 ssize_t read_nocancel_unix2003(int, void *, size_t) __asm("_read$NOCANCEL$UNIX2003");
 
-ssize_t system_write(char*, int, const void *, size_t);
+ssize_t readv(int, const struct iovec *, int);
+
 ssize_t write(int, const void*, size_t) __asm("_write");
 ssize_t write_unix2003(int, const void*, size_t) __asm("_write$UNIX2003");
 ssize_t write_nocancel_unix2003(int, const void*, size_t) __asm("_write$NOCANCEL$UNIX2003");
 
 int dup(int);
+int dup2(int, int);
 
-int close(int);
+int fcntl(int, int, ...);
 
-int system_select(char * symbol, int nfds, fd_set * __restrict readfds, fd_set * __restrict writefds, fd_set * __restrict errorfds, struct timeval * __restrict timeout);
+int close(int);
 
 #if MAC_OS_X_VERSION_MIN_REQUIRED < MAC_OS_X_VERSION_10_5
 int select(int, fd_set * __restrict, fd_set * __restrict, fd_set * __restrict, struct timeval * __restrict) __asm("_select");
@@ -29,5 +42,6 @@ int select_darwinextsn(int, fd_set * __restrict, fd_set * __restrict, fd_set * _
 int select_darwinextsn_nocancel(int, fd_set * __restrict, fd_set * __restrict, fd_set * __restrict, struct timeval * __restrict) __asm("_select$DARWIN_EXTSN$NOCANCEL");
 int select_nocancel_unix2003(int, fd_set * __restrict, fd_set * __restrict, fd_set * __restrict, struct timeval * __restrict) __asm("_select$NOCANCEL$UNIX2003");
 int select_unix2003(int, fd_set * __restrict, fd_set * __restrict, fd_set * __restrict, struct timeval * __restrict) __asm("_select$UNIX2003");
+#endif
 
-#endif /* _SYSTEM_FUNCTION_OVERRIDES_H_ */
\ No newline at end of file
+#endif /* _SYSTEM_FUNCTION_OVERRIDES_H_ */
@@ -5,10 +5,15 @@
 #include <fcntl.h>
 #include <stdlib.h>
 
+// TM_PID is read once; -2 means not yet
+static int tm_pid = -2;
+
 int get_tm_pid() {
-    char* value = getenv("TM_PID");
-    if (value == NULL) return -1;
-    return atoi(value);
+    if (tm_pid == -2) {
+        char* value = getenv("TM_PID");
+        tm_pid = (value == NULL) ? -1 : atoi(value);
+    }
+    return tm_pid;
 }
 
 bool fd_is_owned_by_tm(int fd) {
@@ -19,4 +24,4 @@ bool fd_is_owned_by_tm(int fd) {
     int fd_pid = fcntl(fd, F_GETOWN);
     D("fd_pid = %d, tm_pid = %d\n", fd_pid, tm_pid);
     return (abs(fd_pid) == tm_pid);
-}
\ No newline at end of file
+}
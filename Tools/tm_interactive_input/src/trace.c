@@ -0,0 +1,258 @@
+#include "trace.h"
+
+#ifndef NDEBUG
+
+#include "system_function_overrides.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+// Names written to the file, in the order of the TRACE_* events
+static char const* trace_event_names[TRACE_EVENT_COUNT] = {
+    "message",
+    "message continued",
+    "read",
+    "readv",
+    "write",
+    "writev",
+    "send",
+    "sendto",
+    "fflush",
+    "dup",
+    "dup2",
+    "dup3",
+    "fcntl",
+    "close",
+    "select",
+    "poll",
+    "ppoll",
+    "epoll_ctl",
+    "epoll_wait",
+    "epoll_pwait",
+    "dialog",
+};
+
+/*
+    Only its thread writes to a ring, claiming a slot by counting it in
+    +written+, so a signal handler tracing on that thread takes the next
+    one. Rings are never freed: they're pushed on a list the flush walks
+    without locking, and a new thread takes over the ring of one that
+    ended. A flush while a thread is tracing may catch a record half
+    written, or overwritten by one lapping it.
+*/
+typedef struct trace_ring {
+    struct trace_ring* next_ring;
+    uint64_t thread;
+    uint64_t written;
+    int in_use;
+    trace_record_t records[TRACE_RING_CAPACITY];
+} trace_ring_t;
+
+static trace_ring_t* rings = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+// Worked out ahead of time, as a signal handler shouldn't snprintf()
+static char trace_path[64];
+
+static uint64_t current_thread_id() {
+#ifdef __linux__
+    return syscall(SYS_gettid);
+#else
+    return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
+
+static void release_ring(void* ring) {
+    __atomic_store_n(&((trace_ring_t*)ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_ring_key() {
+    pthread_key_create(&ring_key, release_ring);
+}
+
+static trace_ring_t* claim_ring() {
+    trace_ring_t* ring;
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next_ring) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&ring->in_use, &unused, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (ring == NULL) {
+        ring = mmap(NULL, sizeof(trace_ring_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (ring == MAP_FAILED) return NULL;
+        ring->in_use = 1;
+        ring->next_ring = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next_ring, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+    ring->thread = current_thread_id();
+    __atomic_store_n(&ring->written, 0, __ATOMIC_RELEASE);
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+static trace_record_t* claim_record() {
+    pthread_once(&ring_key_once, create_ring_key);
+    trace_ring_t* ring = pthread_getspecific(ring_key);
+    if (ring == NULL && (ring = claim_ring()) == NULL) return NULL;
+
+    uint64_t slot = __atomic_fetch_add(&ring->written, 1, __ATOMIC_ACQ_REL);
+    return &ring->records[slot & (TRACE_RING_CAPACITY - 1)];
+}
+
+uint64_t trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_call(int event, int fd, uint64_t start, int64_t result) {
+    int saved_errno = errno;
+    trace_record_t* record = claim_record();
+    if (record != NULL) {
+        record->time = start;
+        record->duration = trace_now() - start;
+        record->result = result;
+        record->fd = fd;
+        record->event = event;
+        record->length = 0;
+    }
+    errno = saved_errno;
+}
+
+// A message takes as many records as its text needs
+void trace_message(char const* function, char const* format, ...) {
+    int saved_errno = errno;
+    char text[256];
+    int length = snprintf(text, sizeof(text), "%s(): ", function);
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(text + length, sizeof(text) - length, format, ap);
+    va_end(ap);
+    length = strlen(text);
+
+    uint64_t now = trace_now();
+    int offset = 0;
+    do {
+        trace_record_t* record = claim_record();
+        if (record == NULL) break;
+        int chunk = length - offset < TRACE_TEXT_SIZE ? length - offset : TRACE_TEXT_SIZE;
+        record->time = now;
+        record->duration = 0;
+        record->result = 0;
+        record->fd = -1;
+        record->event = offset == 0 ? TRACE_MESSAGE : TRACE_MESSAGE_CONTINUED;
+        record->length = chunk;
+        memcpy(record->text, text + offset, chunk);
+        offset += chunk;
+    } while (offset < length);
+    errno = saved_errno;
+}
+
+static bool write_all(int fd, void const* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = system_write(fd, bytes, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes = (char const*)bytes + written;
+        length -= written;
+    }
+    return true;
+}
+
+// Only calls what's safe in a signal handler
+void trace_flush() {
+    int saved_errno = errno;
+    int fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        errno = saved_errno;
+        return;
+    }
+
+    trace_file_header_t header = { TRACE_MAGIC, sizeof(trace_record_t), TRACE_EVENT_COUNT };
+    bool ok = write_all(fd, &header, sizeof(header));
+    int i;
+    for (i = 0; ok && i < TRACE_EVENT_COUNT; ++i)
+        ok = write_all(fd, trace_event_names[i], strlen(trace_event_names[i]) + 1);
+
+    trace_ring_t* ring;
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ok && ring != NULL; ring = ring->next_ring) {
+        uint64_t written = __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE);
+        if (written == 0) continue;
+
+        uint64_t count = written < TRACE_RING_CAPACITY ? written : TRACE_RING_CAPACITY;
+        uint64_t oldest = (written - count) & (TRACE_RING_CAPACITY - 1);
+        uint64_t first_part = count < TRACE_RING_CAPACITY - oldest ? count : TRACE_RING_CAPACITY - oldest;
+
+        trace_thread_header_t thread_header = { ring->thread, count };
+        ok = write_all(fd, &thread_header, sizeof(thread_header))
+            && write_all(fd, &ring->records[oldest], first_part * sizeof(trace_record_t))
+            && write_all(fd, &ring->records[0], (count - first_part) * sizeof(trace_record_t));
+    }
+
+    system_close(fd);
+    errno = saved_errno;
+}
+
+static void flush_on_signal(int signal) {
+    trace_flush();
+}
+
+static void set_trace_path() {
+    snprintf(trace_path, sizeof(trace_path), "/tmp/tm_interactive_input.%d.trace", (int)getpid());
+}
+
+// A forked child traces to a file of its own, from where it began
+static void start_child_trace() {
+    set_trace_path();
+    trace_ring_t* own_ring = pthread_getspecific(ring_key);
+    trace_ring_t* ring;
+    for (ring = rings; ring != NULL; ring = ring->next_ring) {
+        ring->written = 0;
+        if (ring != own_ring) ring->in_use = 0;
+    }
+    if (own_ring != NULL) own_ring->thread = current_thread_id();
+}
+
+__attribute__((constructor))
+static void start_trace() {
+    set_trace_path();
+    pthread_once(&ring_key_once, create_ring_key);
+    pthread_atfork(NULL, NULL, start_child_trace);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = flush_on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+// Processes that never traced anything, like most a shell starts, leave no file
+__attribute__((destructor))
+static void finish_trace() {
+    trace_ring_t* ring;
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next_ring) {
+        if (__atomic_load_n(&ring->written, __ATOMIC_ACQUIRE) > 0) {
+            trace_flush();
+            return;
+        }
+    }
+}
+
+#endif
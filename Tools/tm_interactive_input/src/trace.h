@@ -0,0 +1,83 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+/*
+    Debug builds record every interposed call, and every D() message, in a
+    ring of the most recent TRACE_RING_CAPACITY records per thread. Nothing
+    is written out until the process exits or gets SIGUSR1, when all rings
+    go to /tmp/tm_interactive_input.<pid>.trace. trace/decode_trace.c
+    turns that into latency histograms or a log.
+
+    The file starts with a trace_file_header_t, then event_count event names
+    (each ending in \0), then for each thread a trace_thread_header_t and
+    its records, oldest first.
+*/
+
+#define TRACE_RING_CAPACITY 8192 // records, a power of two
+#define TRACE_TEXT_SIZE 32
+
+enum {
+    TRACE_MESSAGE,
+    TRACE_MESSAGE_CONTINUED, // the next TRACE_TEXT_SIZE bytes of a message
+    TRACE_READ,
+    TRACE_READV,
+    TRACE_WRITE,
+    TRACE_WRITEV,
+    TRACE_SEND,
+    TRACE_SENDTO,
+    TRACE_FFLUSH,
+    TRACE_DUP,
+    TRACE_DUP2,
+    TRACE_DUP3,
+    TRACE_FCNTL,
+    TRACE_CLOSE,
+    TRACE_SELECT,
+    TRACE_POLL,
+    TRACE_PPOLL,
+    TRACE_EPOLL_CTL,
+    TRACE_EPOLL_WAIT,
+    TRACE_EPOLL_PWAIT,
+    TRACE_DIALOG, // bringing up a dialog and waiting for the answer
+    TRACE_EVENT_COUNT
+};
+
+typedef struct {
+    uint64_t time;     // ns on the monotonic clock when the call began
+    uint64_t duration; // ns
+    int64_t result;
+    int32_t fd;        // or, for select() and poll(), how many
+    uint16_t event;
+    uint16_t length;   // of text, for messages
+    char text[TRACE_TEXT_SIZE];
+} trace_record_t;
+
+#define TRACE_MAGIC "TMTRACE1"
+
+typedef struct {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t event_count;
+} trace_file_header_t;
+
+typedef struct {
+    uint64_t thread;
+    uint64_t count;
+} trace_thread_header_t;
+
+#ifndef NDEBUG
+uint64_t trace_now();
+void trace_call(int event, int fd, uint64_t start, int64_t result);
+void trace_message(char const* function, char const* format, ...) __attribute__((format(printf, 2, 3)));
+void trace_flush();
+
+// Wrap an interposed function's body: TRACE_START() first, then return TRACE_END(...)
+#define TRACE_START() uint64_t trace_start = trace_now()
+#define TRACE_END(event, fd, result) ({ __typeof__(result) trace_result = (result); trace_call(event, fd, trace_start, trace_result); trace_result; })
+#else
+#define TRACE_START()
+#define TRACE_END(event, fd, result) (result)
+#endif
+
+#endif /* _TRACE_H_ */
@@ -0,0 +1,71 @@
+#!/usr/bin/env ruby
+
+# Stands in for an input broker (see src/broker.h) when testing outside
+# TextMate: listens on the socket given as the first argument and answers
+# every dialog the way dialog-stub.sh would, going by the TM_DIALOG_STUB_*
+# variables of the process asking. The lines of the file given as the
+# second argument are answered first, all sent with the first request.
+
+require 'socket'
+
+SOCKET_PATH, ANSWERS_PATH = ARGV
+abort "usage: #{$0} socket [answers]" if SOCKET_PATH.nil?
+
+$answers = ANSWERS_PATH ? File.readlines(ANSWERS_PATH, chomp: true) : []
+$answers_lock = Mutex.new
+
+# The environment the asking process started with, as tm_dialog would inherit it
+def environment_of(pid)
+  File.read("/proc/#{pid}/environ").split("\0").map { |entry| entry.split('=', 2) }.to_h
+rescue SystemCallError
+  ENV.to_h
+end
+
+def escape(text)
+  text.gsub('&', '&amp;').gsub('<', '&lt;')
+end
+
+def output_plist(answer)
+  result = answer.nil? ? '' : "\t<key>result</key>\n\t<dict>\n" +
+    "\t\t<key>returnButton</key>\n\t\t<string>Send</string>\n" +
+    "\t\t<key>returnArgument</key>\n\t\t<string>#{escape(answer)}</string>\n\t</dict>\n"
+  <<~PLIST
+    <?xml version="1.0" encoding="UTF-8"?>
+    <!DOCTYPE plist PUBLIC "-//Apple//DTD PLIST 1.0//EN" "http://www.apple.com/DTDs/PropertyList-1.0.dtd">
+    <plist version="1.0">
+    <dict>
+    #{result}</dict>
+    </plist>
+  PLIST
+end
+
+# Every answer to hand, or else the one dialog-stub.sh would give
+def answers_for(pid, nib, parameters)
+  env = environment_of(pid)
+  File.open(env['TM_DIALOG_STUB_LOG'], 'a') { |log| log.puts '-m', nib, parameters } if env['TM_DIALOG_STUB_LOG']
+  sleep env['TM_DIALOG_STUB_DELAY'].to_f if env['TM_DIALOG_STUB_DELAY']
+
+  batch = $answers_lock.synchronize { $answers.slice!(0..-1) }
+  return batch unless batch.empty?
+  return [nil] if env['TM_DIALOG_STUB_EOF']
+  return [File.read(env['TM_DIALOG_STUB_ANSWER_FILE'])] if env['TM_DIALOG_STUB_ANSWER_FILE']
+  [env.fetch('TM_DIALOG_STUB_ANSWER', 'stub answer')]
+end
+
+def serve(client)
+  while header = client.gets
+    _, pid, nib, length = header.split
+    parameters = client.read(length.to_i)
+    answers = answers_for(pid, nib, parameters).map { |answer| output_plist(answer) }
+    client.write("answers #{answers.size}\n", *answers.map { |plist| "#{plist.bytesize}\n#{plist}" })
+  end
+rescue SystemCallError
+ensure
+  client.close
+end
+
+File.unlink(SOCKET_PATH) if File.socket?(SOCKET_PATH)
+server = UNIXServer.new(SOCKET_PATH)
+at_exit { File.unlink(SOCKET_PATH) rescue nil }
+trap('TERM') { exit }
+loop { Thread.new(server.accept) { |client| serve(client) } }
@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+
+# Stands in for tm_dialog when testing outside TextMate. Answers every
+# request with $TM_DIALOG_STUB_ANSWER (default "stub answer"), or the
+# contents of $TM_DIALOG_STUB_ANSWER_FILE if that is set, or as if Send
+# EOF was clicked when TM_DIALOG_STUB_EOF is set. The parameters it
+# was sent are appended to $TM_DIALOG_STUB_LOG if that is set, and the
+# user takes $TM_DIALOG_STUB_DELAY seconds to answer.
+
+PARAMETERS="$(cat)"
+[ -n "$TM_DIALOG_STUB_LOG" ] && printf '%s\n' "$@" "$PARAMETERS" >> "$TM_DIALOG_STUB_LOG"
+[ -n "$TM_DIALOG_STUB_DELAY" ] && sleep "$TM_DIALOG_STUB_DELAY"
+
+ANSWER="${TM_DIALOG_STUB_ANSWER-stub answer}"
+ANSWER="${ANSWER//&/&amp;}"
+ANSWER="${ANSWER//</&lt;}"
+
+# Send EOF closes the dialog without a result; Send returns the text
+cat <<PLIST
+<?xml version="1.0" encoding="UTF-8"?>
+<!DOCTYPE plist PUBLIC "-//Apple//DTD PLIST 1.0//EN" "http://www.apple.com/DTDs/PropertyList-1.0.dtd">
+<plist version="1.0">
+<dict>
+PLIST
+if [ -z "$TM_DIALOG_STUB_EOF" ]
+then
+    printf '\t<key>result</key>\n\t<dict>\n\t\t<key>returnButton</key>\n\t\t<string>Send</string>\n\t\t<key>returnArgument</key>\n\t\t<string>'
+    if [ -n "$TM_DIALOG_STUB_ANSWER_FILE" ]
+    then
+        sed -e 's/&/\&amp;/g' -e 's/</\&lt;/g' "$TM_DIALOG_STUB_ANSWER_FILE"
+    else
+        printf '%s' "$ANSWER"
+    fi
+    printf '</string>\n\t</dict>\n'
+fi
+cat <<PLIST
+</dict>
+</plist>
+PLIST
@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+
+# With an input broker, answers it has to hand arrive in one batch for the
+# dialogs that follow, and a forked child asks for its own rather than
+# reusing its parent's.
+
+. "$(dirname "$0")/setup.sh"
+BROKER_DIR="$(mktemp -d)"
+trap 'kill $broker; rm -rf "$BROKER_DIR"' EXIT
+printf '%s\n' first second third > "$BROKER_DIR/answers"
+ruby "$(dirname "$0")/broker-stub.rb" "$BROKER_DIR/socket" "$BROKER_DIR/answers" & broker=$!
+while [ ! -S "$BROKER_DIR/socket" ]; do sleep 0.05; done
+
+TM_INTERACTIVE_INPUT_BROKER="$BROKER_DIR/socket" TM_DIALOG_STUB_LOG="$BROKER_DIR/log" \
+TM_INTERACTIVE_INPUT=AUTO "$(command -v python || command -v python3)" -c "import os
+answers = [os.read(0, 100).decode().strip()]
+r, w = os.pipe()
+pid = os.fork()
+if pid == 0:
+    os.write(w, os.read(0, 100))
+    os._exit(0)
+os.waitpid(pid, 0)
+answers += [os.read(0, 100).decode().strip() for i in range(2)]
+print('%s, child: %s, ' % (' '.join(answers), os.read(r, 100).decode().strip()), end='')"
+echo "$(grep -c '^-m$' "$BROKER_DIR/log") requests"
@@ -0,0 +1,12 @@
+#!/usr/bin/env bash
+
+# Copies of stdin made with dup2(), dup3() and fcntl(F_DUPFD_CLOEXEC) read
+# through the dialog; a copy replaced by another file no longer does.
+
+. "$(dirname "$0")/setup.sh"
+TM_INTERACTIVE_INPUT=AUTO "$(command -v python || command -v python3)" -c "import fcntl, os, sys
+copies = [os.dup2(0, 7), os.dup2(0, 8, inheritable=False), fcntl.fcntl(0, fcntl.F_DUPFD_CLOEXEC, 10)]
+for fd in copies:
+    sys.stdout.write(os.read(fd, 100).decode())
+os.dup2(os.open(os.devnull, os.O_RDONLY), 7)
+print('replaced: %r' % os.read(7, 100))"
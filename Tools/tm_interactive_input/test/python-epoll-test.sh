@@ -0,0 +1,10 @@
+#!/usr/bin/env bash
+
+# Waits for stdin with epoll_wait() before reading, like asyncio does on Linux.
+
+. "$(dirname "$0")/setup.sh"
+TM_INTERACTIVE_INPUT=AUTO "$(command -v python || command -v python3)" -c "import select, sys
+e = select.epoll()
+e.register(sys.stdin, select.EPOLLIN)
+e.poll()
+sys.stdout.write(sys.stdin.readline())"
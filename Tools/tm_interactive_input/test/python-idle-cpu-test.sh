@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+
+# After the user sends EOF, a REPL that keeps waiting on stdin (and would
+# on sockets too) should sleep through its timeouts rather than bring up
+# the dialog over and over.
+
+. "$(dirname "$0")/setup.sh"
+TM_DIALOG_STUB_EOF=1 TM_INTERACTIVE_INPUT=AUTO "$(command -v python || command -v python3)" -c "import os, resource, selectors, sys, time
+sel = selectors.DefaultSelector()
+sel.register(sys.stdin, selectors.EVENT_READ)
+sys.stdout.write('> ')
+sys.stdout.flush()
+
+eofs, deadline = 0, time.monotonic() + 2
+while time.monotonic() < deadline:
+    if sel.select(timeout=0.5) and os.read(0, 4096) == b'':
+        eofs += 1
+
+usage = [resource.getrusage(who) for who in (resource.RUSAGE_SELF, resource.RUSAGE_CHILDREN)]
+cpu = sum(u.ru_utime + u.ru_stime for u in usage)
+print()
+print('idle' if eofs == 1 and cpu < 0.5 else 'busy: %d dialogs, %.2fs of CPU' % (eofs, cpu))"
@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+
+# Waits for stdin with poll() before reading, like event loops built on the
+# select module do.
+
+. "$(dirname "$0")/setup.sh"
+TM_INTERACTIVE_INPUT=AUTO "$(command -v python || command -v python3)" -c "import select, sys
+p = select.poll()
+p.register(sys.stdin, select.POLLIN)
+p.poll()
+sys.stdout.write(sys.stdin.readline())"
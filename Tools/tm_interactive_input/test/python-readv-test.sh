@@ -0,0 +1,10 @@
+#!/usr/bin/env bash
+
+# readv() scatters one answer over several buffers: the first is filled as
+# read() would, the rest from what the dialog left.
+
+. "$(dirname "$0")/setup.sh"
+TM_INTERACTIVE_INPUT=AUTO "$(command -v python || command -v python3)" -c "import os
+buffers = [bytearray(4), bytearray(3), bytearray(100)]
+count = os.readv(0, buffers)
+print(count, [bytes(b).rstrip(b'\0') for b in buffers])"
@@ -1,4 +1,4 @@
 #!/usr/bin/env bash
 
 . "$(dirname "$0")/setup.sh"
-TM_INTERACTIVE_INPUT=AUTO python -c "import sys ; sys.stdout.write(sys.stdin.readline())"
\ No newline at end of file
+TM_INTERACTIVE_INPUT=AUTO "$(command -v python || command -v python3)" -c "import sys ; sys.stdout.write(sys.stdin.readline())"
\ No newline at end of file
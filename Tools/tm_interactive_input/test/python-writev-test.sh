@@ -0,0 +1,9 @@
+#!/usr/bin/env bash
+
+# A prompt written in pieces with writev() is still the dialog's prompt, so
+# this one asks for a password and echoes stars.
+
+. "$(dirname "$0")/setup.sh"
+TM_INTERACTIVE_INPUT='AUTO|ECHO' "$(command -v python || command -v python3)" -c "import os
+os.writev(1, [b'Enter ', b'Pass', b'word: '])
+os.read(0, 100)"
@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+
+# An event loop REPL: IO.select, then a non blocking read. While the dialog
+# is up it should be idle, not spinning on EAGAIN.
+
+. "$(dirname "$0")/setup.sh"
+TM_DIALOG_STUB_DELAY=2 TM_INTERACTIVE_INPUT=AUTO ruby -e '
+def cpu; Process.clock_gettime(Process::CLOCK_PROCESS_CPUTIME_ID); end
+def now; Process.clock_gettime(Process::CLOCK_MONOTONIC); end
+
+print "> "
+STDOUT.flush
+
+line, deadline = nil, now + 5
+while line.nil? && now < deadline
+    next unless IO.select([STDIN], nil, nil, 1)
+    begin
+        line = STDIN.read_nonblock(4096)
+    rescue IO::WaitReadable
+    end
+end
+
+puts line
+puts cpu < 0.5 ? "idle" : "busy: #{cpu.round(2)}s of CPU"
+'
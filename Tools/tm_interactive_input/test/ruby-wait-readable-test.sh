@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+
+# IO#wait_readable waits with ppoll() on Linux.
+
+. "$(dirname "$0")/setup.sh"
+TM_INTERACTIVE_INPUT=AUTO ruby -rio/wait -e "
+    print 'Enter Something: '
+    STDOUT.flush
+    STDIN.wait_readable
+    puts gets
+"
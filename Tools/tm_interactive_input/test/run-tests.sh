@@ -0,0 +1,67 @@
+#!/usr/bin/env bash
+
+# Runs the interpreter tests without anyone at the keyboard: stdin is a pipe
+# nobody writes to, as it is for commands run from TextMate, and the stub
+# answers for the dialog. A test that blocks instead of asking fails. With
+# BROKER=1 a stand-in input broker answers instead of a dialog per read.
+
+cd "$(dirname "$0")"
+
+TIMEOUT=${TIMEOUT:-10}
+failures=0
+
+if [ -n "$BROKER" ]
+then
+    BROKER_DIR="$(mktemp -d)"
+    ruby broker-stub.rb "$BROKER_DIR/socket" & broker=$!
+    trap 'kill $broker; rm -rf "$BROKER_DIR"' EXIT
+    while [ ! -S "$BROKER_DIR/socket" ]; do sleep 0.05; done
+    export TM_INTERACTIVE_INPUT_BROKER="$BROKER_DIR/socket"
+fi
+
+expect() { # test, interpreter, expected output
+    if ! command -v "$2" >/dev/null
+    then
+        echo "skip  $1 (no $2)"
+        return
+    fi
+
+    output=$(
+        exec < <(sleep $((TIMEOUT + 1)))
+        writer=$!
+        timeout "$TIMEOUT" "./$1" 2>&1
+        status=$?
+        kill $writer
+        exit $status
+    )
+    status=$?
+
+    if [ $status -eq 0 ] && [[ "$output" == *"$3"* ]]
+    then
+        echo "ok    $1"
+    else
+        echo "FAIL  $1 (exit $status)"
+        echo "$output" | sed 's/^/      /'
+        failures=$((failures + 1))
+    fi
+}
+
+PYTHON=$(command -v python || command -v python3)
+
+expect bash-test.sh               bash     "Enter Password: ***********"
+expect ruby-test.sh               ruby     "Enter Something: stub answer"
+expect ruby-nonblock-test.sh      ruby     "non blocking read done"
+expect ruby-wait-readable-test.sh ruby     "Enter Something: stub answer"
+expect python-test.sh             "$PYTHON" "stub answer"
+expect python-poll-test.sh        "$PYTHON" "stub answer"
+expect python-epoll-test.sh       "$PYTHON" "stub answer"
+expect python-dup-test.sh         "$PYTHON" "replaced: b''"
+expect python-writev-test.sh      "$PYTHON" "Enter Password: ***********"
+expect python-broker-test.sh      ruby     "first second third, child: stub answer, 2 requests"
+expect python-readv-test.sh       "$PYTHON" "12 [b'stub', b' an', b'swer\n']"
+expect ruby-idle-cpu-test.sh      ruby     "idle"
+expect python-idle-cpu-test.sh    "$PYTHON" "idle"
+expect php-test.sh                php      "stub answer"
+expect groovy-test.sh             groovy   "stub answer"
+
+[ $failures -eq 0 ]
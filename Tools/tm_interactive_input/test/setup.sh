@@ -1,4 +1,9 @@
-TM_INTERACTIVE_INPUT_DYLIB="$(dirname "$0")/../build/tm_interactive_input.dylib"
+if [ "$(uname)" = Linux ]
+then
+    TM_INTERACTIVE_INPUT_DYLIB="$(dirname "$0")/../build/tm_interactive_input.so"
+else
+    TM_INTERACTIVE_INPUT_DYLIB="$(dirname "$0")/../build/tm_interactive_input.dylib"
+fi
 
 if [ ! -f "$TM_INTERACTIVE_INPUT_DYLIB" ]
 then
@@ -6,5 +11,19 @@ then
     exit 1  
 fi
 
-export DYLD_INSERT_LIBRARIES="$TM_INTERACTIVE_INPUT_DYLIB${DYLD_INSERT_LIBRARIES:+:$DYLD_INSERT_LIBRARIES}"
-export DYLD_FORCE_FLAT_NAMESPACE=1
\ No newline at end of file
+if [ "$(uname)" = Linux ]
+then
+    export LD_PRELOAD="$(cd "$(dirname "$TM_INTERACTIVE_INPUT_DYLIB")" && pwd)/tm_interactive_input.so${LD_PRELOAD:+:$LD_PRELOAD}"
+
+    # Outside TextMate, pretend to be it: our stdin counts as TextMate's,
+    # and a stub stands in for tm_dialog
+    if [ -z "$TM_PID" ]
+    then
+        export TM_PID=$$
+        perl -MFcntl -e 'fcntl(STDIN, F_SETOWN, 0 + $ENV{TM_PID}) or die "F_SETOWN: $!\n"'
+    fi
+    export DIALOG="${DIALOG:-$(cd "$(dirname "$0")" && pwd)/dialog-stub.sh}"
+else
+    export DYLD_INSERT_LIBRARIES="$TM_INTERACTIVE_INPUT_DYLIB${DYLD_INSERT_LIBRARIES:+:$DYLD_INSERT_LIBRARIES}"
+    export DYLD_FORCE_FLAT_NAMESPACE=1
+fi
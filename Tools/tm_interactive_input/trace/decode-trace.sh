@@ -0,0 +1,17 @@
+#!/usr/bin/env bash
+
+# Builds decode_trace and runs it on the given traces, or on every trace
+# in /tmp; pass -l first for the log rather than histograms. Traces come
+# from debug builds (NDEBUG= ../build.sh) when a process exits or gets
+# SIGUSR1.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+DECODER="$SCRIPT_DIR/../build/decode_trace"
+
+mkdir -p "$SCRIPT_DIR/../build"
+${CC:-gcc} -O2 -Wall -o "$DECODER" "$SCRIPT_DIR/decode_trace.c" || exit 1
+
+if [ $# -eq 0 ] || [ $# -eq 1 -a "$1" = -l ]; then
+  set -- "$@" /tmp/tm_interactive_input.*.trace
+fi
+"$DECODER" "$@"
@@ -0,0 +1,231 @@
+/*
+    Reads the traces a debug build of tm_interactive_input leaves in
+    /tmp/tm_interactive_input.<pid>.trace (see src/trace.h) and prints, for
+    every kind of call, how many there were and a histogram of how long
+    they took. With -l it prints every record instead, all threads merged
+    in the order they happened, with the D() messages in between.
+
+    usage: decode_trace [-l] trace...
+*/
+
+#include "../src/trace.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_EVENTS 256
+#define BUCKETS 64 // a bucket per power of two nanoseconds
+
+typedef struct {
+    trace_record_t record;
+    uint64_t thread;
+    size_t order;
+} entry_t;
+
+static char const* event_names[MAX_EVENTS];
+static uint32_t event_count;
+
+static entry_t* entries;
+static size_t entry_count, entry_capacity;
+
+static char* read_file(char const* path, size_t* length) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) return NULL;
+
+    size_t capacity = 1 << 16;
+    char* bytes = malloc(capacity);
+    *length = 0;
+    size_t got;
+    while (bytes != NULL && (got = fread(bytes + *length, 1, capacity - *length, f)) > 0) {
+        *length += got;
+        if (*length == capacity) bytes = realloc(bytes, capacity *= 2);
+    }
+    fclose(f);
+    return bytes;
+}
+
+static void add_entry(char const* record, uint64_t thread) {
+    if (entry_count == entry_capacity) {
+        entry_capacity = entry_capacity ? entry_capacity * 2 : 4096;
+        entries = realloc(entries, entry_capacity * sizeof(entry_t));
+        if (entries == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    // Records follow names of any length, so they may not be aligned
+    memcpy(&entries[entry_count].record, record, sizeof(trace_record_t));
+    entries[entry_count].thread = thread;
+    entries[entry_count].order = entry_count;
+    ++entry_count;
+}
+
+// The file is kept in memory, as the event names point into it
+static bool load_trace(char const* path) {
+    size_t length;
+    char* bytes = read_file(path, &length);
+    if (bytes == NULL) {
+        perror(path);
+        return false;
+    }
+
+    trace_file_header_t const* header = (trace_file_header_t const*)bytes;
+    if (length < sizeof(*header) || memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s: not a trace\n", path);
+        return false;
+    }
+    if (header->record_size != sizeof(trace_record_t) || header->event_count > MAX_EVENTS) {
+        fprintf(stderr, "%s: written by a different version\n", path);
+        return false;
+    }
+
+    // Traces of the same version name their events alike
+    char const* at = bytes + sizeof(*header);
+    char const* end = bytes + length;
+    uint32_t i;
+    for (i = 0; i < header->event_count; ++i) {
+        char const* name_end = memchr(at, '\0', end - at);
+        if (name_end == NULL) {
+            fprintf(stderr, "%s: truncated\n", path);
+            return false;
+        }
+        event_names[i] = at;
+        at = name_end + 1;
+    }
+    event_count = header->event_count;
+
+    while (end - at >= (ptrdiff_t)sizeof(trace_thread_header_t)) {
+        trace_thread_header_t thread_header;
+        memcpy(&thread_header, at, sizeof(thread_header));
+        at += sizeof(thread_header);
+
+        uint64_t r;
+        for (r = 0; r < thread_header.count && end - at >= (ptrdiff_t)sizeof(trace_record_t); ++r, at += sizeof(trace_record_t))
+            add_entry(at, thread_header.thread);
+    }
+    return true;
+}
+
+static char const* format_duration(uint64_t ns, char* text, size_t size) {
+    if (ns < 1000) snprintf(text, size, "%llu ns", (unsigned long long)ns);
+    else if (ns < 1000000) snprintf(text, size, "%.3g us", ns / 1e3);
+    else if (ns < 1000000000) snprintf(text, size, "%.3g ms", ns / 1e6);
+    else snprintf(text, size, "%.3g s", ns / 1e9);
+    return text;
+}
+
+static int compare_durations(void const* a, void const* b) {
+    uint64_t x = *(uint64_t const*)a, y = *(uint64_t const*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int bucket_of(uint64_t ns) {
+    int bucket = 0;
+    while (ns > 1) {
+        ns >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+static void print_histograms() {
+    uint64_t* durations = malloc(entry_count * sizeof(uint64_t));
+    if (durations == NULL && entry_count > 0) return;
+
+    uint32_t event;
+    for (event = 0; event < event_count; ++event) {
+        if (event == TRACE_MESSAGE || event == TRACE_MESSAGE_CONTINUED) continue;
+
+        size_t count = 0, i;
+        for (i = 0; i < entry_count; ++i) {
+            if (entries[i].record.event == event)
+                durations[count++] = entries[i].record.duration;
+        }
+        if (count == 0) continue;
+
+        qsort(durations, count, sizeof(uint64_t), compare_durations);
+        char p50[16], p99[16], max[16];
+        printf("%s: %zu calls, median %s, 99%% %s, max %s\n", event_names[event], count,
+            format_duration(durations[count / 2], p50, sizeof(p50)),
+            format_duration(durations[count * 99 / 100], p99, sizeof(p99)),
+            format_duration(durations[count - 1], max, sizeof(max)));
+
+        size_t buckets[BUCKETS] = { 0 }, largest = 0;
+        for (i = 0; i < count; ++i) {
+            int b = bucket_of(durations[i]);
+            if (++buckets[b] > largest) largest = buckets[b];
+        }
+
+        int b;
+        for (b = bucket_of(durations[0]); b <= bucket_of(durations[count - 1]); ++b) {
+            char from[16];
+            int bar = (int)((buckets[b] * 50 + largest - 1) / largest);
+            printf("  >= %9s %9zu %.*s\n", format_duration(1ULL << b, from, sizeof(from)), buckets[b], bar,
+                "##################################################");
+        }
+        printf("\n");
+    }
+    free(durations);
+}
+
+static int compare_entries(void const* a, void const* b) {
+    entry_t const* x = a;
+    entry_t const* y = b;
+    if (x->record.time != y->record.time) return x->record.time < y->record.time ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void print_log() {
+    qsort(entries, entry_count, sizeof(entry_t), compare_entries);
+    uint64_t start = entry_count ? entries[0].record.time : 0;
+
+    size_t i;
+    for (i = 0; i < entry_count; ++i) {
+        trace_record_t const* r = &entries[i].record;
+        if (r->event == TRACE_MESSAGE_CONTINUED || r->event >= event_count) continue;
+
+        printf("%12.3f us %6llu ", (r->time - start) / 1e3, (unsigned long long)entries[i].thread);
+        if (r->event == TRACE_MESSAGE) {
+            // The rest of the message is in the records after it from the same thread
+            printf("%.*s", r->length, r->text);
+            char last = r->length ? r->text[r->length - 1] : '\0';
+            size_t j;
+            for (j = i + 1; j < entry_count && entries[j].record.time == r->time; ++j) {
+                trace_record_t const* part = &entries[j].record;
+                if (entries[j].thread != entries[i].thread) continue;
+                if (part->event != TRACE_MESSAGE_CONTINUED) break;
+                printf("%.*s", part->length, part->text);
+                if (part->length) last = part->text[part->length - 1];
+            }
+            if (last != '\n') printf("\n");
+        } else {
+            char took[16];
+            printf("%s(%d) = %lld in %s\n", event_names[r->event], r->fd, (long long)r->result, format_duration(r->duration, took, sizeof(took)));
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    bool log = false;
+    int i = 1;
+    if (i < argc && strcmp(argv[i], "-l") == 0) {
+        log = true;
+        ++i;
+    }
+    if (i == argc) {
+        fprintf(stderr, "usage: %s [-l] trace...\n", argv[0]);
+        return 1;
+    }
+
+    for (; i < argc; ++i) {
+        if (!load_trace(argv[i])) return 1;
+    }
+
+    if (log) print_log();
+    else print_histograms();
+    return 0;
+}